@@ -0,0 +1,122 @@
+//
+//  ESHTTPBenchmark.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Minimal HTTP/1.1 server on 127.0.0.1 for benchmarking the networking stack without an outside service.
+ *
+ * Every request (any method, any path) gets the same configured response. Connections are kept alive
+ * and each one is served on its own serial queue. Configure the server before starting it.
+ */
+
+@interface ESHTTPBenchmarkServer : NSObject
+
+/**
+ * Length of a successful response body. Default is 4KB
+ */
+@property (assign, readwrite) NSUInteger payloadLength;
+/**
+ * If YES the body is a JSON array of small objects of about payloadLength bytes, otherwise it's opaque bytes. Default is NO
+ */
+@property (assign, readwrite) BOOL JSONPayload;
+/**
+ * If non zero the body is sent with chunked transfer encoding in chunks of this length, otherwise with a Content-Length. Default is 0
+ */
+@property (assign, readwrite) NSUInteger chunkLength;
+/**
+ * Delay before each response is written. Default is 0
+ */
+@property (assign, readwrite) NSTimeInterval latency;
+/**
+ * Fraction (0.0 - 1.0) of requests answered with a 500. Default is 0
+ */
+@property (assign, readwrite) double errorRate;
+/**
+ * Fraction (0.0 - 1.0) of requests answered by closing the connection without a response. Default is 0
+ */
+@property (assign, readwrite) double dropRate;
+
+/**
+ * Binds to an ephemeral port on the loopback interface and starts accepting connections
+ */
+- (BOOL)start:(NSError **)error;
+/**
+ * Stops accepting connections and closes the open ones
+ */
+- (void)stop;
+
+/**
+ * 0 until started
+ */
+@property (assign, readonly) uint16_t port;
+/**
+ * http://127.0.0.1:port/, nil until started
+ */
+@property (copy, readonly) NSURL *baseURL;
+/**
+ * Requests received since the server was started
+ */
+@property (assign, readonly) NSUInteger requestCount;
+
+@end
+
+/**
+ * Pushes a batch of ESHTTPOperations (or ESJSONOperations) at a server and reports their aggregated metrics.
+ *
+ * The operations run through a private ESHTTPOperationScheduler and report to a private 
+ * ESHTTPOperationMetricsSink, which is installed as [ESHTTPOperation metricsSink] for the duration of 
+ * the run, so only run one benchmark at a time and keep other operations out of the way. Responses 
+ * are never cached.
+ *
+ * The summary is ESHTTPOperationMetricsSink's summaryForHost: for the run: operations per second, 
+ * p50 and p99 of every phase, failures and peak resident size. Comparing the summaries of the same 
+ * workload before and after a change makes a regression check for networking performance.
+ */
+
+@interface ESHTTPBenchmark : NSObject
+
+- (id)initWithServer:(ESHTTPBenchmarkServer *)server; // designated initializer
+
+@property (strong, readonly) ESHTTPBenchmarkServer *server;
+/**
+ * Default is 1000
+ */
+@property (assign, readwrite) NSUInteger operationCount;
+/**
+ * Default is 6
+ */
+@property (assign, readwrite) NSUInteger maximumConcurrentOperationCount;
+/**
+ * If YES runs ESJSONOperations, the server should have JSONPayload set. Default is NO
+ */
+@property (assign, readwrite) BOOL usesJSONOperations;
+/**
+ * YES between runWithCompletion: and its completion
+ */
+@property (assign, readonly, getter=isRunning) BOOL running;
+
+/**
+ * Starts the server if it isn't running and starts operationCount operations. Must be called on the main thread.
+ *
+ * @param completion Called on the main queue once every operation has finished, with the run's summary (nil if the server couldn't be started)
+ */
+- (void)runWithCompletion:(void (^)(NSDictionary *summary))completion;
+
+@end
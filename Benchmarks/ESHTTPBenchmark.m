@@ -0,0 +1,537 @@
+//
+//  ESHTTPBenchmark.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESHTTPBenchmark.h"
+#import "ESHTTPOperation.h"
+#import "ESJSONOperation.h"
+#import "ESHTTPOperationMetrics.h"
+#import "ESHTTPOperationScheduler.h"
+#import <libkern/OSAtomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define READ_BUFFER_LENGTH (16 * 1024)
+// Request headers larger than this close the connection
+#define MAXIMUM_REQUEST_LENGTH (64 * 1024)
+
+static BOOL WriteAll(int fd, const void *bytes, size_t length)
+{
+	const uint8_t *cursor = (const uint8_t *)bytes;
+	while (length > 0)
+	{
+		ssize_t written = write(fd, cursor, length);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return NO;
+		}
+		cursor += written;
+		length -= (size_t)written;
+	}
+	return YES;
+}
+
+static NSData * NewPayload(NSUInteger length, BOOL JSON)
+{
+	NSMutableData *payload = [[NSMutableData alloc] initWithCapacity:length + 64];
+	if (!JSON)
+	{
+		[payload setLength:length];
+		memset([payload mutableBytes], 'x', length);
+		return payload;
+	}
+	[payload appendBytes:"[" length:1];
+	for (NSUInteger i = 0; ([payload length] + 1) < length; i++)
+	{
+		char object[96];
+		int objectLength = snprintf(object, sizeof(object), "%s{\"id\":%lu,\"name\":\"item %lu\",\"value\":%lu.5,\"flag\":%s}", (i > 0) ? "," : "", (unsigned long)i, (unsigned long)i, (unsigned long)(i * 7), (i % 2) ? "true" : "false");
+		[payload appendBytes:object length:(NSUInteger)objectLength];
+	}
+	[payload appendBytes:"]" length:1];
+	return payload;
+}
+
+@class ESHTTPBenchmarkConnection;
+
+@interface ESHTTPBenchmarkServer ()
+@property (assign, readwrite) uint16_t port;
+@property (copy, readwrite) NSURL *baseURL;
+@property (strong, readonly) NSData *payload;
+- (void)acceptConnections;
+- (void)connectionDidClose:(ESHTTPBenchmarkConnection *)connection;
+- (void)didReceiveRequest;
+@end
+
+#pragma mark - ESHTTPBenchmarkConnection
+
+@interface ESHTTPBenchmarkConnection : NSObject
+- (id)initWithSocket:(int)fd server:(ESHTTPBenchmarkServer *)server;
+- (void)open;
+- (void)close;
+- (void)readAvailableBytes;
+- (void)handleNextRequest;
+- (BOOL)writeResponse;
+@end
+
+@implementation ESHTTPBenchmarkConnection
+{
+	int _fd;
+	__weak ESHTTPBenchmarkServer *_server; // The server closes its connections when it goes away
+	dispatch_queue_t _queue;
+	dispatch_source_t _readSource;
+	NSMutableData *_buffer;
+	BOOL _responding;
+	BOOL _closesAfterResponse;
+	BOOL _closed;
+}
+
+- (id)initWithSocket:(int)fd server:(ESHTTPBenchmarkServer *)server
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_fd = fd;
+		_server = server;
+		_queue = dispatch_queue_create("com.everythingsolution.httpbenchmarkconnection", 0);
+		_buffer = [NSMutableData new];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	dispatch_release(_queue);
+}
+
+- (void)open
+{
+	int yes = 1;
+	setsockopt(_fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+	_readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)_fd, 0, _queue);
+	// The handlers keep the connection alive until the source is cancelled
+	dispatch_source_set_event_handler(_readSource, ^{
+		[self readAvailableBytes];
+	});
+	int fd = _fd;
+	dispatch_source_t readSource = _readSource;
+	dispatch_source_set_cancel_handler(_readSource, ^{
+		close(fd);
+		dispatch_release(readSource);
+		[self->_server connectionDidClose:self];
+	});
+	dispatch_resume(_readSource);
+}
+
+- (void)close
+{
+	dispatch_async(_queue, ^{
+		if (_closed)
+			return;
+		_closed = YES;
+		dispatch_source_cancel(_readSource);
+	});
+}
+
+- (void)readAvailableBytes
+{
+	// The socket is blocking, but the source says there's something to read
+	uint8_t buffer[READ_BUFFER_LENGTH];
+	ssize_t length = read(_fd, buffer, sizeof(buffer));
+	if (length <= 0)
+	{
+		if ((length < 0) && (errno == EINTR))
+			return;
+		[self close];
+		return;
+	}
+	[_buffer appendBytes:buffer length:(NSUInteger)length];
+	[self handleNextRequest];
+}
+
+- (void)handleNextRequest
+{
+	if (_responding || _closed)
+		return;
+	NSRange headerEnd = [_buffer rangeOfData:[NSData dataWithBytes:"\r\n\r\n" length:4] options:0 range:NSMakeRange(0, [_buffer length])];
+	if (headerEnd.location == NSNotFound)
+	{
+		if ([_buffer length] > MAXIMUM_REQUEST_LENGTH)
+			[self close];
+		return;
+	}
+	NSString *header = [[NSString alloc] initWithBytes:[_buffer bytes] length:headerEnd.location encoding:NSISOLatin1StringEncoding];
+	// Request bodies are read and ignored
+	NSUInteger contentLength = 0;
+	_closesAfterResponse = NO;
+	for (NSString *line in [header componentsSeparatedByString:@"\r\n"])
+	{
+		NSRange colon = [line rangeOfString:@":"];
+		if (colon.location == NSNotFound)
+			continue;
+		NSString *name = [[line substringToIndex:colon.location] lowercaseString];
+		NSString *value = [[line substringFromIndex:colon.location + 1] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+		if ([name isEqualToString:@"content-length"])
+			contentLength = (NSUInteger)[value longLongValue];
+		else if ([name isEqualToString:@"connection"] && ([value caseInsensitiveCompare:@"close"] == NSOrderedSame))
+			_closesAfterResponse = YES;
+	}
+	NSUInteger requestLength = NSMaxRange(headerEnd) + contentLength;
+	if ([_buffer length] < requestLength)
+		return;
+	[_buffer replaceBytesInRange:NSMakeRange(0, requestLength) withBytes:NULL length:0];
+	[_server didReceiveRequest];
+	// One response at a time, pipelined requests wait in the buffer
+	_responding = YES;
+	dispatch_block_t respond = ^{
+		self->_responding = NO;
+		if (self->_closed)
+			return;
+		if (![self writeResponse] || self->_closesAfterResponse)
+			[self close];
+		else
+			[self handleNextRequest];
+	};
+	NSTimeInterval latency = _server.latency;
+	if (latency > 0)
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(latency * NSEC_PER_SEC)), _queue, respond);
+	else
+		respond();
+}
+
+- (BOOL)writeResponse
+// Returns NO if the connection should be closed
+{
+	ESHTTPBenchmarkServer *server = _server;
+	if (server == nil)
+		return NO;
+	double roll = (double)arc4random_uniform(1000000) / 1000000.0;
+	if (roll < server.dropRate)
+		return NO;
+	if (roll < (server.dropRate + server.errorRate))
+	{
+		static const char errorResponse[] = "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\nContent-Length: 14\r\n\r\nInjected error";
+		return WriteAll(_fd, errorResponse, sizeof(errorResponse) - 1);
+	}
+	NSData *payload = server.payload;
+	const char *contentType = server.JSONPayload ? "application/json" : "application/octet-stream";
+	NSUInteger chunkLength = server.chunkLength;
+	char header[256];
+	int headerLength;
+	if (chunkLength == 0)
+		headerLength = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %lu\r\nCache-Control: no-store\r\n\r\n", contentType, (unsigned long)[payload length]);
+	else
+		headerLength = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\nCache-Control: no-store\r\n\r\n", contentType);
+	if (!WriteAll(_fd, header, (size_t)headerLength))
+		return NO;
+	if (chunkLength == 0)
+		return WriteAll(_fd, [payload bytes], [payload length]);
+	const uint8_t *bytes = (const uint8_t *)[payload bytes];
+	NSUInteger remaining = [payload length];
+	while (remaining > 0)
+	{
+		NSUInteger length = MIN(remaining, chunkLength);
+		char chunkHeader[24];
+		int chunkHeaderLength = snprintf(chunkHeader, sizeof(chunkHeader), "%lx\r\n", (unsigned long)length);
+		if (!WriteAll(_fd, chunkHeader, (size_t)chunkHeaderLength) || !WriteAll(_fd, bytes, length) || !WriteAll(_fd, "\r\n", 2))
+			return NO;
+		bytes += length;
+		remaining -= length;
+	}
+	return WriteAll(_fd, "0\r\n\r\n", 5);
+}
+
+@end
+
+#pragma mark - ESHTTPBenchmarkServer
+
+@implementation ESHTTPBenchmarkServer
+{
+	dispatch_queue_t _queue;
+	dispatch_source_t _acceptSource;
+	int _listenSocket;
+	NSMutableSet *_connections;
+	volatile int32_t _requestCount;
+}
+@synthesize payloadLength=_payloadLength;
+@synthesize JSONPayload=_JSONPayload;
+@synthesize chunkLength=_chunkLength;
+@synthesize latency=_latency;
+@synthesize errorRate=_errorRate;
+@synthesize dropRate=_dropRate;
+@synthesize port=_port;
+@synthesize baseURL=_baseURL;
+@synthesize payload=_payload;
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_payloadLength = 4 * 1024;
+		_listenSocket = -1;
+		_queue = dispatch_queue_create("com.everythingsolution.httpbenchmarkserver", 0);
+		_connections = [NSMutableSet new];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[self stop];
+	dispatch_release(_queue);
+}
+
+- (BOOL)start:(NSError **)error
+{
+	NSParameterAssert(_listenSocket == -1);
+	_payload = NewPayload(self.payloadLength, self.JSONPayload);
+	int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_len = sizeof(address);
+	address.sin_family = AF_INET;
+	address.sin_port = 0;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addressLength = sizeof(address);
+	int yes = 1;
+	if ((fd < 0) || 
+		(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) != 0) || 
+		(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) || 
+		(listen(fd, 128) != 0) || 
+		(getsockname(fd, (struct sockaddr *)&address, &addressLength) != 0) || 
+		(fcntl(fd, F_SETFL, O_NONBLOCK) != 0))
+	{
+		if (error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+		if (fd >= 0)
+			close(fd);
+		return NO;
+	}
+	_listenSocket = fd;
+	_requestCount = 0;
+	self.port = ntohs(address.sin_port);
+	self.baseURL = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%u/", self.port]];
+	_acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)fd, 0, _queue);
+	__unsafe_unretained ESHTTPBenchmarkServer *server = self;
+	dispatch_source_set_event_handler(_acceptSource, ^{
+		[server acceptConnections];
+	});
+	dispatch_source_set_cancel_handler(_acceptSource, ^{
+		close(fd);
+	});
+	dispatch_resume(_acceptSource);
+	return YES;
+}
+
+- (void)stop
+{
+	if (_listenSocket == -1)
+		return;
+	dispatch_source_t acceptSource = _acceptSource;
+	_acceptSource = NULL;
+	__block NSArray *connections = nil;
+	dispatch_sync(_queue, ^{
+		_listenSocket = -1;
+		dispatch_source_cancel(acceptSource);
+		dispatch_release(acceptSource);
+		connections = [_connections allObjects];
+		[_connections removeAllObjects];
+	});
+	[connections makeObjectsPerformSelector:@selector(close)];
+	self.port = 0;
+	self.baseURL = nil;
+}
+
+- (void)acceptConnections
+// Called on _queue
+{
+	for (;;)
+	{
+		int fd = accept(_listenSocket, NULL, NULL);
+		if (fd < 0)
+			return;
+		// Accepted sockets inherit O_NONBLOCK on some systems, connections use blocking writes
+		fcntl(fd, F_SETFL, 0);
+		ESHTTPBenchmarkConnection *connection = [[ESHTTPBenchmarkConnection alloc] initWithSocket:fd server:self];
+		[_connections addObject:connection];
+		[connection open];
+	}
+}
+
+- (void)connectionDidClose:(ESHTTPBenchmarkConnection *)connection
+{
+	dispatch_async(_queue, ^{
+		[_connections removeObject:connection];
+	});
+}
+
+- (void)didReceiveRequest
+{
+	OSAtomicIncrement32Barrier(&_requestCount);
+}
+
+- (NSUInteger)requestCount
+{
+	return (NSUInteger)_requestCount;
+}
+
+@end
+
+#pragma mark - ESHTTPBenchmark
+
+@interface ESHTTPBenchmark ()
+@property (assign, readwrite, getter=isRunning) BOOL running;
+- (ESHTTPOperation *)newOperationWithIndex:(NSUInteger)index;
+- (void)operationDidFinish;
+- (void)finishWhenMetricsAreReported;
+@end
+
+@implementation ESHTTPBenchmark
+{
+	ESHTTPOperationScheduler *_scheduler;
+	ESHTTPOperationMetricsSink *_sink;
+	ESHTTPOperationMetricsSink *_previousSink;
+	NSUInteger _remainingOperationCount;
+	void (^_completion)(NSDictionary *summary);
+}
+@synthesize server=_server;
+@synthesize operationCount=_operationCount;
+@synthesize maximumConcurrentOperationCount=_maximumConcurrentOperationCount;
+@synthesize usesJSONOperations=_usesJSONOperations;
+@synthesize running=_running;
+
+- (id)init
+{
+	return [self initWithServer:[ESHTTPBenchmarkServer new]];
+}
+
+- (id)initWithServer:(ESHTTPBenchmarkServer *)server
+{
+	NSParameterAssert(server != nil);
+	self = [super init];
+	if (self != nil)
+	{
+		_server = server;
+		_operationCount = 1000;
+		_maximumConcurrentOperationCount = 6;
+	}
+	return self;
+}
+
+- (ESHTTPOperation *)newOperationWithIndex:(NSUInteger)index
+{
+	NSURL *url = [[NSURL URLWithString:[NSString stringWithFormat:@"benchmark/%lu", (unsigned long)index] relativeToURL:self.server.baseURL] absoluteURL];
+	NSURLRequest *request = [NSURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:30.0];
+	ESHTTPOperation *op;
+	if (self.usesJSONOperations)
+	{
+		op = [ESJSONOperation newJSONOperationWithRequest:request 
+												  success:^(ESJSONOperation *jsonOp, id JSON) {
+													  [self operationDidFinish];
+												  } 
+												  failure:^(ESJSONOperation *jsonOp) {
+													  [self operationDidFinish];
+												  }];
+	}
+	else
+	{
+		op = [ESHTTPOperation newHTTPOperationWithRequest:request 
+													 work:^id<NSObject>(ESHTTPOperation *httpOp, NSError *__autoreleasing *error) {
+														 // Touch the body so the work phase isn't empty
+														 return [NSNumber numberWithUnsignedInteger:[httpOp.responseBody length]];
+													 } 
+											   completion:^(ESHTTPOperation *httpOp) {
+												   dispatch_async(dispatch_get_main_queue(), ^{
+													   [self operationDidFinish];
+												   });
+											   }];
+	}
+	op.cache = nil;
+	return op;
+}
+
+- (void)runWithCompletion:(void (^)(NSDictionary *summary))completion
+{
+	NSParameterAssert([NSThread isMainThread]);
+	NSParameterAssert(!self.running);
+	if ((self.server.baseURL == nil) && ![self.server start:NULL])
+	{
+		if (completion)
+			completion(nil);
+		return;
+	}
+	self.running = YES;
+	_completion = [completion copy];
+	_remainingOperationCount = self.operationCount;
+	_scheduler = [ESHTTPOperationScheduler new];
+	_scheduler.maximumConcurrentOperationCount = self.maximumConcurrentOperationCount;
+	_scheduler.maximumConcurrentOperationCountPerHost = self.maximumConcurrentOperationCount;
+	_sink = [ESHTTPOperationMetricsSink new];
+	_previousSink = [ESHTTPOperation metricsSink];
+	[ESHTTPOperation setMetricsSink:_sink];
+	if (_remainingOperationCount == 0)
+	{
+		[self finishWhenMetricsAreReported];
+		return;
+	}
+	NSMutableArray *ops = [[NSMutableArray alloc] initWithCapacity:self.operationCount];
+	for (NSUInteger i = 0; i < self.operationCount; i++)
+		[ops addObject:[self newOperationWithIndex:i]];
+	[_scheduler addOperations:ops];
+}
+
+- (void)operationDidFinish
+{
+	NSParameterAssert([NSThread isMainThread]);
+	if (--_remainingOperationCount == 0)
+		[self finishWhenMetricsAreReported];
+}
+
+- (void)finishWhenMetricsAreReported
+{
+	// Operations report to the sink just after their completion blocks
+	if ([_sink operationCountForHost:nil] < self.operationCount)
+	{
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_MSEC), dispatch_get_main_queue(), ^{
+			[self finishWhenMetricsAreReported];
+		});
+		return;
+	}
+	[ESHTTPOperation setMetricsSink:_previousSink];
+	NSDictionary *summary = [_sink summaryForHost:nil];
+	void (^completion)(NSDictionary *summary) = _completion;
+	_completion = nil;
+	_previousSink = nil;
+	_scheduler = nil;
+	_sink = nil;
+	self.running = NO;
+	if (completion)
+		completion(summary);
+}
+
+@end
@@ -0,0 +1,55 @@
+//
+//  ESPropertyAccessBenchmark.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Keys for the dictionary returned by -run
+ */
+extern NSString *const kESPropertyAccessBenchmarkIMPAccessesPerSecondKey; // NSNumber, GetScalarPropertyValue() and SetScalarPropertyValue() with cached IMPs
+extern NSString *const kESPropertyAccessBenchmarkInvocationAccessesPerSecondKey; // NSNumber, GetPrimitivePropertyValue() and SetPrimitivePropertyValue()
+
+/**
+ * Measures how fast scalar properties can be copied from one object to another, 
+ * through the cached IMP accessors the object mapping uses and through the 
+ * NSInvocation based ones it used before.
+ *
+ * The objects have an int, long long, double, float, BOOL and unsigned short 
+ * property, an access is one get and one set. The IMP variant includes the 
+ * NSNumber boxing it does in between. The variants alternate over several 
+ * rounds to even out warm up and thermal effects.
+ */
+
+@interface ESPropertyAccessBenchmark : NSObject
+
+/**
+ * Objects copied per round. Default is 10000
+ */
+@property (assign, readwrite) NSUInteger objectCount;
+/**
+ * Rounds per variant, the best round is reported. Default is 5
+ */
+@property (assign, readwrite) NSUInteger roundCount;
+
+/**
+ * Runs every round on the calling thread
+ */
+- (NSDictionary *)run;
+
+@end
@@ -0,0 +1,170 @@
+//
+//  ESPropertyAccessBenchmark.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESPropertyAccessBenchmark.h"
+#import "ESObjectMapFunctions.h"
+#import "NSObject+PropertyDictionary.h"
+#import <objc/runtime.h>
+#include <mach/mach_time.h>
+
+NSString *const kESPropertyAccessBenchmarkIMPAccessesPerSecondKey = @"IMPAccessesPerSecond";
+NSString *const kESPropertyAccessBenchmarkInvocationAccessesPerSecondKey = @"invocationAccessesPerSecond";
+
+static NSTimeInterval SecondsSince(uint64_t start)
+{
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	return ((double)(mach_absolute_time() - start) * ((double)timebase.numer / (double)timebase.denom)) / 1e9;
+}
+
+/**
+ * One property of every scalar width the accessors handle
+ */
+@interface ESScalarBenchmarkObject : NSObject
+@property (nonatomic) int intValue;
+@property (nonatomic) long long longLongValue;
+@property (nonatomic) double doubleValue;
+@property (nonatomic) float floatValue;
+@property (nonatomic) BOOL boolValue;
+@property (nonatomic) unsigned short unsignedShortValue;
+@end
+
+@implementation ESScalarBenchmarkObject
+@synthesize intValue=_intValue;
+@synthesize longLongValue=_longLongValue;
+@synthesize doubleValue=_doubleValue;
+@synthesize floatValue=_floatValue;
+@synthesize boolValue=_boolValue;
+@synthesize unsignedShortValue=_unsignedShortValue;
+@end
+
+// What a mapping plan keeps for each scalar property
+typedef struct {
+	SEL getter;
+	IMP getterIMP;
+	SEL setter;
+	IMP setterIMP;
+	PropertyStorageType storageType;
+} ESScalarAccessor;
+
+@interface ESPropertyAccessBenchmark ()
+- (double)accessesPerSecondWithObjects:(NSArray *)objects accessors:(const ESScalarAccessor *)accessors count:(NSUInteger)count invocations:(BOOL)invocations;
+@end
+
+@implementation ESPropertyAccessBenchmark
+@synthesize objectCount=_objectCount;
+@synthesize roundCount=_roundCount;
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_objectCount = 10000;
+		_roundCount = 5;
+	}
+	return self;
+}
+
+- (double)accessesPerSecondWithObjects:(NSArray *)objects accessors:(const ESScalarAccessor *)accessors count:(NSUInteger)count invocations:(BOOL)invocations
+{
+	ESScalarBenchmarkObject *destination = [ESScalarBenchmarkObject new];
+	uint64_t start = mach_absolute_time();
+	for (ESScalarBenchmarkObject *object in objects)
+	{
+		@autoreleasepool {
+			for (NSUInteger i = 0; i < count; i++)
+			{
+				const ESScalarAccessor *accessor = &accessors[i];
+				if (invocations)
+				{
+					// Big enough for any scalar
+					long long value;
+					GetPrimitivePropertyValue(object, accessor->getter, &value);
+					SetPrimitivePropertyValue(destination, accessor->setter, &value);
+				}
+				else
+				{
+					NSNumber *value = GetScalarPropertyValue(object, accessor->getter, accessor->getterIMP, accessor->storageType);
+					SetScalarPropertyValue(destination, accessor->setter, accessor->setterIMP, accessor->storageType, value);
+				}
+			}
+		}
+	}
+	NSTimeInterval elapsed = SecondsSince(start);
+	return (elapsed > 0) ? ((double)([objects count] * count) / elapsed) : 0;
+}
+
+- (NSDictionary *)run
+{
+	Class objectClass = [ESScalarBenchmarkObject class];
+	NSDictionary *propertyDictionary = [objectClass propertyDictionary];
+	ESScalarAccessor *accessors = (ESScalarAccessor *)calloc(MAX([propertyDictionary count], 1), sizeof(ESScalarAccessor));
+	NSUInteger count = 0;
+	for (ESDeclaredPropertyAttributes *attributes in [propertyDictionary allValues])
+	{
+		if ((attributes.storageType == IDType) || (attributes.storageType == ObjectType) || (attributes.storageType == UnsupportedType))
+			continue;
+		ESScalarAccessor *accessor = &accessors[count++];
+		accessor->getter = attributes.getter;
+		accessor->getterIMP = class_getMethodImplementation(objectClass, attributes.getter);
+		accessor->setter = attributes.setter;
+		accessor->setterIMP = class_getMethodImplementation(objectClass, attributes.setter);
+		accessor->storageType = attributes.storageType;
+	}
+	NSMutableArray *objects = [[NSMutableArray alloc] initWithCapacity:self.objectCount];
+	for (NSUInteger i = 0; i < self.objectCount; i++)
+	{
+		ESScalarBenchmarkObject *object = [ESScalarBenchmarkObject new];
+		object.intValue = (int)i;
+		object.longLongValue = (long long)i << 32;
+		object.doubleValue = (double)i / 3.0;
+		object.floatValue = (float)i / 7.0f;
+		object.boolValue = (i % 2);
+		object.unsignedShortValue = (unsigned short)i;
+		[objects addObject:object];
+	}
+	double imp = 0;
+	double invocation = 0;
+	for (NSUInteger round = 0; round < self.roundCount; round++)
+	{
+		// Alternate which goes first so neither always gets the warmer caches
+		if (round % 2)
+		{
+			invocation = MAX(invocation, [self accessesPerSecondWithObjects:objects accessors:accessors count:count invocations:YES]);
+			imp = MAX(imp, [self accessesPerSecondWithObjects:objects accessors:accessors count:count invocations:NO]);
+		}
+		else
+		{
+			imp = MAX(imp, [self accessesPerSecondWithObjects:objects accessors:accessors count:count invocations:NO]);
+			invocation = MAX(invocation, [self accessesPerSecondWithObjects:objects accessors:accessors count:count invocations:YES]);
+		}
+	}
+	free(accessors);
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+			[NSNumber numberWithDouble:imp], kESPropertyAccessBenchmarkIMPAccessesPerSecondKey,
+			[NSNumber numberWithDouble:invocation], kESPropertyAccessBenchmarkInvocationAccessesPerSecondKey,
+			nil];
+}
+
+@end
@@ -0,0 +1,64 @@
+//
+//  ESRunLoopOperationBenchmark.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Keys for the dictionary returned by -run
+ */
+extern NSString *const kESRunLoopOperationBenchmarkLockFreeOperationsPerSecondKey; // NSNumber, ESRunLoopOperation as it is
+extern NSString *const kESRunLoopOperationBenchmarkLockingOperationsPerSecondKey; // NSNumber, the same operation with its state behind an NSRecursiveLock
+
+/**
+ * Measures how fast an NSOperationQueue gets through ESRunLoopOperations that finish as soon as they start.
+ *
+ * The queue polls isExecuting and isFinished constantly, so with nothing else to do the throughput is 
+ * dominated by the cost of state reads and transitions. Each run is done twice, once with ESRunLoopOperation's 
+ * compare and swap state and once with a subclass that keeps the state behind an NSRecursiveLock the way 
+ * ESRunLoopOperation used to, and the variants alternate over several rounds to even out warm up and 
+ * thermal effects.
+ */
+
+@interface ESRunLoopOperationBenchmark : NSObject
+
+/**
+ * Operations per round. Default is 10000
+ */
+@property (assign, readwrite) NSUInteger operationCount;
+/**
+ * Rounds per variant, the best round is reported. Default is 5
+ */
+@property (assign, readwrite) NSUInteger roundCount;
+/**
+ * Default is NSOperationQueueDefaultMaxConcurrentOperationCount
+ */
+@property (assign, readwrite) NSInteger maximumConcurrentOperationCount;
+/**
+ * Run loop threads the operations are spread over. Default is 2
+ */
+@property (assign, readwrite) NSUInteger runLoopThreadCount;
+
+/**
+ * Runs every round and blocks until they're done. Don't call on one of the benchmark's run loop threads.
+ *
+ * The run loop threads are created on the first run and kept for later ones.
+ */
+- (NSDictionary *)run;
+
+@end
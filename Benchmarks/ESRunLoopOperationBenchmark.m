@@ -0,0 +1,185 @@
+//
+//  ESRunLoopOperationBenchmark.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESRunLoopOperationBenchmark.h"
+#import "ESRunLoopOperation.h"
+#import "ESRunLoopThreadPool.h"
+#include <mach/mach_time.h>
+
+NSString *const kESRunLoopOperationBenchmarkLockFreeOperationsPerSecondKey = @"lockFreeOperationsPerSecond";
+NSString *const kESRunLoopOperationBenchmarkLockingOperationsPerSecondKey = @"lockingOperationsPerSecond";
+
+static NSTimeInterval SecondsSince(uint64_t start)
+{
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	return ((double)(mach_absolute_time() - start) * ((double)timebase.numer / (double)timebase.denom)) / 1e9;
+}
+
+// ESRunLoopOperation keeps setState: in its class extension
+@interface ESRunLoopOperation (ESRunLoopOperationBenchmark)
+- (void)setState:(ESOperationState)state;
+@end
+
+/**
+ * Does nothing, finishes as soon as it's started
+ */
+@interface ESEmptyRunLoopOperation : ESRunLoopOperation
+@end
+
+@implementation ESEmptyRunLoopOperation
+
+- (void)operationDidStart
+{
+	[super operationDidStart];
+	[self finishWithError:nil];
+}
+
+@end
+
+/**
+ * ESEmptyRunLoopOperation with ESRunLoopOperation's original locked state, for comparison
+ */
+@interface ESLockingRunLoopOperation : ESEmptyRunLoopOperation
+@end
+
+@implementation ESLockingRunLoopOperation
+{
+	NSRecursiveLock *_lock;
+	ESOperationState _lockedState;
+}
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_lock = [[NSRecursiveLock alloc] init];
+	}
+	return self;
+}
+
+- (ESOperationState)state
+{
+	ESOperationState state;
+	[_lock lock];
+	state = _lockedState;
+	[_lock unlock];
+	return state;
+}
+
+- (void)setState:(ESOperationState)newState
+{
+	ESOperationState oldState;
+	[_lock lock];
+	NSAssert((newState > _lockedState), @"Invalid state transition from %d to %d", _lockedState, newState);
+	if ((newState == kESOperationStateExecuting) || (_lockedState == kESOperationStateExecuting))
+		[self willChangeValueForKey:@"isExecuting"];
+	if (newState == kESOperationStateFinished)
+		[self willChangeValueForKey:@"isFinished"];
+	oldState = _lockedState;
+	_lockedState = newState;
+	if (newState == kESOperationStateFinished)
+		[self didChangeValueForKey:@"isFinished"];
+	if ((newState == kESOperationStateExecuting) || (oldState == kESOperationStateExecuting))
+		[self didChangeValueForKey:@"isExecuting"];
+	[_lock unlock];
+}
+
+@end
+
+@interface ESRunLoopOperationBenchmark ()
+- (double)operationsPerSecondWithClass:(Class)operationClass pool:(ESRunLoopThreadPool *)pool;
+@end
+
+@implementation ESRunLoopOperationBenchmark
+{
+	// Pool threads run forever, so every run shares one pool
+	ESRunLoopThreadPool *_pool;
+}
+@synthesize operationCount=_operationCount;
+@synthesize roundCount=_roundCount;
+@synthesize maximumConcurrentOperationCount=_maximumConcurrentOperationCount;
+@synthesize runLoopThreadCount=_runLoopThreadCount;
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_operationCount = 10000;
+		_roundCount = 5;
+		_maximumConcurrentOperationCount = NSOperationQueueDefaultMaxConcurrentOperationCount;
+		_runLoopThreadCount = 2;
+	}
+	return self;
+}
+
+- (double)operationsPerSecondWithClass:(Class)operationClass pool:(ESRunLoopThreadPool *)pool
+{
+	NSMutableArray *ops = [[NSMutableArray alloc] initWithCapacity:self.operationCount];
+	for (NSUInteger i = 0; i < self.operationCount; i++)
+	{
+		ESRunLoopOperation *op = [operationClass new];
+		op.runLoopThread = [pool threadForHost:nil];
+		[ops addObject:op];
+	}
+	NSOperationQueue *queue = [NSOperationQueue new];
+	queue.maxConcurrentOperationCount = self.maximumConcurrentOperationCount;
+	uint64_t start = mach_absolute_time();
+	[queue addOperations:ops waitUntilFinished:YES];
+	NSTimeInterval elapsed = SecondsSince(start);
+	return (elapsed > 0) ? ((double)self.operationCount / elapsed) : 0;
+}
+
+- (NSDictionary *)run
+{
+	if ((_pool == nil) || (_pool.threadCount != MAX(self.runLoopThreadCount, (NSUInteger)1)))
+		_pool = [[ESRunLoopThreadPool alloc] initWithName:@"RunLoopOperationBenchmark" threadCount:MAX(self.runLoopThreadCount, (NSUInteger)1) threadPriority:0.5];
+	ESRunLoopThreadPool *pool = _pool;
+	NSParameterAssert(![pool containsThread:[NSThread currentThread]]);
+	double lockFree = 0;
+	double locking = 0;
+	for (NSUInteger round = 0; round < self.roundCount; round++)
+	{
+		@autoreleasepool {
+			// Alternate which goes first so neither always gets the warmer caches
+			if (round % 2)
+			{
+				locking = MAX(locking, [self operationsPerSecondWithClass:[ESLockingRunLoopOperation class] pool:pool]);
+				lockFree = MAX(lockFree, [self operationsPerSecondWithClass:[ESEmptyRunLoopOperation class] pool:pool]);
+			}
+			else
+			{
+				lockFree = MAX(lockFree, [self operationsPerSecondWithClass:[ESEmptyRunLoopOperation class] pool:pool]);
+				locking = MAX(locking, [self operationsPerSecondWithClass:[ESLockingRunLoopOperation class] pool:pool]);
+			}
+		}
+	}
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+			[NSNumber numberWithDouble:lockFree], kESRunLoopOperationBenchmarkLockFreeOperationsPerSecondKey,
+			[NSNumber numberWithDouble:locking], kESRunLoopOperationBenchmarkLockingOperationsPerSecondKey,
+			nil];
+}
+
+@end
@@ -0,0 +1,98 @@
+//
+//  ESDownloadOperation.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "ESHTTPOperation.h"
+
+/**
+ * `ESDownloadOperation` is an `ESHTTPOperation` that writes a response to a file and can pick up where an earlier attempt left off.
+ * 
+ * The body is written to partialURL (destinationURL with a .part extension) and progress is recorded next to it in 
+ * a small property list, along with the response's validator (a strong ETag or Last-Modified). An operation for the same 
+ * destination asks for the rest with `Range` and `If-Range`, if the file changed on the server in the meantime the server 
+ * answers with the whole file and the download starts over. Once complete the file is moved to destinationURL, replacing 
+ * whatever is there.
+ * 
+ * With maximumSegmentCount above 1, a large file from a server that supports byte ranges is split into that many ranges 
+ * that are downloaded concurrently and written at their offsets into a file preallocated to the full length.
+ * 
+ * Retries (see retryPolicy) resume the same way, so with a retry policy a failure part way through only costs the bytes 
+ * in flight. Responses aren't cached, coalesced, hedged or decompressed. Error bodies go to responseBody as usual.
+ * 
+ * downloadProgress reports the bytes on disk out of the full length, including what earlier attempts wrote.
+ * 
+ * @see ESHTTPOperation
+ */
+
+@interface ESDownloadOperation : ESHTTPOperation
+
+///--------------------------
+/// @name Creating Operations
+///--------------------------
+
++ (id)newDownloadOperationWithRequest:(NSURLRequest *)request 
+					   destinationURL:(NSURL *)destinationURL 
+						   completion:(ESHTTPOperationCompletionBlock)completion;
+- (id)initWithRequest:(NSURLRequest *)request 
+	   destinationURL:(NSURL *)destinationURL 
+		   completion:(ESHTTPOperationCompletionBlock)completion; // designated initializer
+
+/**
+ * Throws away any partial download for destinationURL, call when it isn't going to be resumed
+ */
++ (void)removePartialDownloadForDestinationURL:(NSURL *)destinationURL;
+
+///--------------------------
+/// @name Configure before queueing
+///--------------------------
+
+/**
+ * File URL the completed download is moved to
+ */
+@property (copy, readonly) NSURL *destinationURL;
+/**
+ * File URL the download is written to until it completes
+ */
+@property (copy, readonly) NSURL *partialURL;
+/**
+ * Number of ranges downloaded at once from servers that support byte ranges
+ * 
+ * Default is 1
+ */
+@property (assign, readwrite) NSUInteger maximumSegmentCount;
+/**
+ * Smallest range worth its own connection, files are only split if every range would be at least this long
+ * 
+ * Default is 4MB
+ */
+@property (assign, readwrite) unsigned long long minimumSegmentLength;
+
+///--------------------------
+/// @name Progress
+///--------------------------
+
+/**
+ * Length of the complete file, -1 if unknown. Only updated on the run loop thread.
+ */
+@property (assign, readonly) long long expectedLength;
+/**
+ * Bytes written to partialURL so far, including what earlier attempts and operations wrote. Only updated on the run loop thread.
+ */
+@property (assign, readonly) unsigned long long receivedLength;
+
+@end
@@ -0,0 +1,729 @@
+//
+//  ESDownloadOperation.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESDownloadOperation.h"
+#import "ESHTTPHeaderFields.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Bytes written between saves of the progress file
+#define STATE_SAVE_INTERVAL (1024 * 1024)
+
+static NSString *const kStateURLKey = @"URL";
+static NSString *const kStateValidatorKey = @"validator";
+static NSString *const kStateLengthKey = @"length";
+static NSString *const kStateSegmentsKey = @"segments";
+static NSString *const kSegmentStartKey = @"start";
+static NSString *const kSegmentEndKey = @"end";
+static NSString *const kSegmentWrittenKey = @"written";
+
+static NSURL * PartialURLForDestinationURL(NSURL *destinationURL)
+{
+	return [destinationURL URLByAppendingPathExtension:@"part"];
+}
+
+static NSURL * StateURLForDestinationURL(NSURL *destinationURL)
+{
+	return [PartialURLForDestinationURL(destinationURL) URLByAppendingPathExtension:@"plist"];
+}
+
+static NSString * ValidatorForResponse(NSHTTPURLResponse *response)
+// If-Range only works with strong validators
+{
+	NSDictionary *headerFields = [response allHeaderFields];
+	NSString *entityTag = HTTPHeaderValue(headerFields, @"ETag");
+	if ((entityTag != nil) && ![entityTag hasPrefix:@"W/"])
+		return entityTag;
+	return HTTPHeaderValue(headerFields, @"Last-Modified");
+}
+
+static BOOL ParseContentRange(NSString *contentRange, unsigned long long *first, unsigned long long *last, long long *length)
+// bytes first-last/length, length may be *
+{
+	if (contentRange == nil)
+		return NO;
+	NSScanner *scanner = [NSScanner scannerWithString:contentRange];
+	long long firstValue, lastValue;
+	if (![scanner scanString:@"bytes" intoString:NULL] || 
+		![scanner scanLongLong:&firstValue] || 
+		![scanner scanString:@"-" intoString:NULL] || 
+		![scanner scanLongLong:&lastValue] || 
+		![scanner scanString:@"/" intoString:NULL])
+		return NO;
+	if ((firstValue < 0) || (lastValue < firstValue))
+		return NO;
+	long long lengthValue = -1;
+	if (![scanner scanString:@"*" intoString:NULL] && ![scanner scanLongLong:&lengthValue])
+		return NO;
+	*first = (unsigned long long)firstValue;
+	*last = (unsigned long long)lastValue;
+	*length = lengthValue;
+	return YES;
+}
+
+/**
+ * Byte range of the file and how much of it is on disk
+ */
+@interface ESDownloadSegment : NSObject
+@property (assign, nonatomic) unsigned long long start;
+@property (assign, nonatomic) long long end; // exclusive, -1 if unknown
+@property (assign, nonatomic) unsigned long long written;
+@property (strong, nonatomic) NSURLConnection *connection; // nil for the segment on the operation's own connection
+@property (assign, readonly) unsigned long long offset;
+@property (assign, readonly, getter=isComplete) BOOL complete;
+- (id)initWithPropertyList:(NSDictionary *)propertyList;
+- (NSDictionary *)propertyList;
+@end
+
+@implementation ESDownloadSegment
+@synthesize start=_start;
+@synthesize end=_end;
+@synthesize written=_written;
+@synthesize connection=_connection;
+
+- (id)initWithPropertyList:(NSDictionary *)propertyList
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_start = [[propertyList objectForKey:kSegmentStartKey] unsignedLongLongValue];
+		_end = [[propertyList objectForKey:kSegmentEndKey] longLongValue];
+		_written = [[propertyList objectForKey:kSegmentWrittenKey] unsignedLongLongValue];
+	}
+	return self;
+}
+
+- (NSDictionary *)propertyList
+{
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+			[NSNumber numberWithUnsignedLongLong:self.start], kSegmentStartKey, 
+			[NSNumber numberWithLongLong:self.end], kSegmentEndKey, 
+			[NSNumber numberWithUnsignedLongLong:self.written], kSegmentWrittenKey, nil];
+}
+
+- (unsigned long long)offset
+{
+	return self.start + self.written;
+}
+
+- (BOOL)isComplete
+{
+	return (self.end >= 0) && (self.offset >= (unsigned long long)self.end);
+}
+
+- (NSString *)rangeHeaderValue
+{
+	if (self.end < 0)
+		return [NSString stringWithFormat:@"bytes=%llu-", self.offset];
+	return [NSString stringWithFormat:@"bytes=%llu-%lld", self.offset, self.end - 1];
+}
+
+@end
+
+@interface ESDownloadOperation ()
+@property (copy, readwrite) NSURL *destinationURL;
+@property (copy, readwrite) NSURL *partialURL;
+@property (copy, nonatomic) NSString *validator;
+@property (strong, nonatomic) NSMutableArray *segments;
+@property (strong, nonatomic) ESDownloadSegment *primarySegment;
+- (BOOL)openPartialFile:(NSError **)error;
+- (void)closePartialFile;
+- (void)loadState;
+- (void)saveState;
+- (void)resetWithLength:(long long)length;
+- (void)cancelSegmentConnections;
+- (void)discardPartialDownload;
+- (NSError *)fileErrorWithErrno:(int)errorNumber;
+- (BOOL)writeData:(NSData *)data toSegment:(ESDownloadSegment *)segment;
+- (void)splitPrimarySegment;
+- (void)startSegmentConnections;
+- (ESDownloadSegment *)segmentForConnection:(NSURLConnection *)connection;
+- (void)segmentDidFailWithError:(NSError *)error;
+- (void)finishIfComplete;
+@end
+
+@implementation ESDownloadOperation
+{
+	int _fileDescriptor;
+	unsigned long long _unsavedLength;
+	BOOL _primaryFinished;
+}
+@synthesize destinationURL=_destinationURL;
+@synthesize partialURL=_partialURL;
+@synthesize maximumSegmentCount=_maximumSegmentCount;
+@synthesize minimumSegmentLength=_minimumSegmentLength;
+@synthesize expectedLength=_expectedLength;
+@synthesize receivedLength=_receivedLength;
+@synthesize validator=_validator;
+@synthesize segments=_segments;
+@synthesize primarySegment=_primarySegment;
+
++ (id)newDownloadOperationWithRequest:(NSURLRequest *)request 
+					   destinationURL:(NSURL *)destinationURL 
+						   completion:(ESHTTPOperationCompletionBlock)completion
+{
+	return [[[self class] alloc] initWithRequest:request destinationURL:destinationURL completion:completion];
+}
+
+- (id)initWithRequest:(NSURLRequest *)request 
+	   destinationURL:(NSURL *)destinationURL 
+		   completion:(ESHTTPOperationCompletionBlock)completion
+{
+	NSParameterAssert([destinationURL isFileURL]);
+	self = [super initWithRequest:request work:nil completion:completion];
+	if (self != nil)
+	{
+		_destinationURL = [destinationURL copy];
+		_partialURL = [PartialURLForDestinationURL(destinationURL) copy];
+		_maximumSegmentCount = 1;
+		_minimumSegmentLength = 4 * 1024 * 1024;
+		_expectedLength = -1;
+		_fileDescriptor = -1;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[self closePartialFile];
+}
+
++ (void)removePartialDownloadForDestinationURL:(NSURL *)destinationURL
+{
+	NSFileManager *fileManager = [NSFileManager new];
+	[fileManager removeItemAtURL:StateURLForDestinationURL(destinationURL) error:NULL];
+	[fileManager removeItemAtURL:PartialURLForDestinationURL(destinationURL) error:NULL];
+}
+
+#pragma mark - Configuration ESHTTPOperation doesn't get a say in
+
+- (BOOL)decompressesResponseBody
+{
+	// Ranges are offsets into the encoded body
+	return NO;
+}
+
+- (BOOL)hedgesRequests
+{
+	// Two connections would write the same bytes
+	return NO;
+}
+
+- (ESHTTPCache *)cache
+{
+	return nil;
+}
+
+- (BOOL)isCoalescable
+{
+	return NO;
+}
+
+#pragma mark - Partial file and state
+
+- (NSError *)fileErrorWithErrno:(int)errorNumber
+{
+	NSDictionary *userInfo = 
+	[[NSDictionary alloc] initWithObjectsAndKeys:
+	 [NSError errorWithDomain:NSPOSIXErrorDomain code:errorNumber userInfo:nil], @"underlyingError",
+	 NSLocalizedString(@"Could not write download to disk", nil), NSLocalizedDescriptionKey,
+	 nil];
+	return [NSError errorWithDomain:kESHTTPOperationErrorDomain code:kESHTTPOperationErrorOnDownloadFile userInfo:userInfo];
+}
+
+- (BOOL)openPartialFile:(NSError **)error
+{
+	if (_fileDescriptor != -1)
+		return YES;
+	_fileDescriptor = open([[self.partialURL path] fileSystemRepresentation], O_RDWR | O_CREAT, 0600);
+	if (_fileDescriptor == -1)
+	{
+		if (error)
+			*error = [self fileErrorWithErrno:errno];
+		return NO;
+	}
+	return YES;
+}
+
+- (void)closePartialFile
+{
+	if (_fileDescriptor != -1)
+	{
+		close(_fileDescriptor);
+		_fileDescriptor = -1;
+	}
+}
+
+- (void)loadState
+// Picks up the segments left by an earlier operation, if they still match the file on disk
+{
+	self.segments = nil;
+	self.validator = nil;
+	_expectedLength = -1;
+	_receivedLength = 0;
+	NSDictionary *state = [NSDictionary dictionaryWithContentsOfURL:StateURLForDestinationURL(self.destinationURL)];
+	NSString *validator = [state objectForKey:kStateValidatorKey];
+	NSArray *segmentPropertyLists = [state objectForKey:kStateSegmentsKey];
+	if (![[state objectForKey:kStateURLKey] isEqual:[self.URL absoluteString]] || (validator == nil) || ([segmentPropertyLists count] == 0))
+		return;
+	NSDictionary *attributes = [[NSFileManager new] attributesOfItemAtPath:[self.partialURL path] error:NULL];
+	if (attributes == nil)
+		return;
+	NSMutableArray *segments = [NSMutableArray arrayWithCapacity:[segmentPropertyLists count]];
+	unsigned long long receivedLength = 0;
+	BOOL complete = YES;
+	for (NSDictionary *segmentPropertyList in segmentPropertyLists)
+	{
+		ESDownloadSegment *segment = [[ESDownloadSegment alloc] initWithPropertyList:segmentPropertyList];
+		// Never trust progress past the end of the file
+		if (segment.offset > [attributes fileSize])
+			return;
+		complete = complete && [segment isComplete];
+		receivedLength += segment.written;
+		[segments addObject:segment];
+	}
+	// A download that completed but never got moved into place is simpler to fetch again
+	if (complete)
+		return;
+	self.segments = segments;
+	self.validator = validator;
+	_expectedLength = [[state objectForKey:kStateLengthKey] longLongValue];
+	_receivedLength = receivedLength;
+}
+
+- (void)saveState
+{
+	if (self.segments == nil)
+		return;
+	if (_fileDescriptor != -1)
+		fsync(_fileDescriptor);
+	_unsavedLength = 0;
+	NSMutableArray *segmentPropertyLists = [NSMutableArray arrayWithCapacity:[self.segments count]];
+	for (ESDownloadSegment *segment in self.segments)
+		[segmentPropertyLists addObject:[segment propertyList]];
+	NSDictionary *state = [NSDictionary dictionaryWithObjectsAndKeys:
+						   [self.URL absoluteString], kStateURLKey, 
+						   [NSNumber numberWithLongLong:self.expectedLength], kStateLengthKey, 
+						   segmentPropertyLists, kStateSegmentsKey, 
+						   self.validator, kStateValidatorKey, // last, it may be nil
+						   nil];
+	[state writeToURL:StateURLForDestinationURL(self.destinationURL) atomically:YES];
+}
+
+- (void)cancelSegmentConnections
+{
+	for (ESDownloadSegment *segment in self.segments)
+	{
+		[segment.connection cancel];
+		segment.connection = nil;
+	}
+}
+
+- (void)discardPartialDownload
+// What we have doesn't fit the file on the server anymore, the next operation starts over
+{
+	[self cancelSegmentConnections];
+	self.segments = nil;
+	self.primarySegment = nil;
+	[[self class] removePartialDownloadForDestinationURL:self.destinationURL];
+}
+
+- (void)resetWithLength:(long long)length
+// The server sent the whole file, throw away anything from before
+{
+	[self cancelSegmentConnections];
+	ESDownloadSegment *segment = [ESDownloadSegment new];
+	segment.start = 0;
+	segment.end = length;
+	self.segments = [NSMutableArray arrayWithObject:segment];
+	self.primarySegment = segment;
+	_expectedLength = length;
+	_receivedLength = 0;
+	if (_fileDescriptor != -1)
+	{
+		ftruncate(_fileDescriptor, 0);
+		// Reserve the whole file up front so segments can be written at their offsets
+		if (length > 0)
+			ftruncate(_fileDescriptor, (off_t)length);
+	}
+}
+
+- (BOOL)writeData:(NSData *)data toSegment:(ESDownloadSegment *)segment
+// Writes as much of data as belongs to segment, returns NO if the operation failed
+{
+	NSUInteger length = [data length];
+	// A connection that was left open ended after its segment was split only gets to fill its own range
+	if ((segment.end >= 0) && (segment.offset + length > (unsigned long long)segment.end))
+		length = (NSUInteger)((unsigned long long)segment.end - segment.offset);
+	const uint8_t *bytes = [data bytes];
+	NSUInteger written = 0;
+	while (written < length)
+	{
+		ssize_t result = pwrite(_fileDescriptor, bytes + written, length - written, (off_t)(segment.offset + written));
+		if (result < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			[self processRequest:[self fileErrorWithErrno:errno]];
+			return NO;
+		}
+		written += (NSUInteger)result;
+	}
+	segment.written += length;
+	_receivedLength += length;
+	_unsavedLength += length;
+	if (_unsavedLength >= STATE_SAVE_INTERVAL)
+		[self saveState];
+	if (self.downloadProgress)
+		self.downloadProgress((NSUInteger)self.receivedLength, (NSUInteger)self.expectedLength);
+	[self.group operation:self didReceiveBytes:self.receivedLength ofExpectedBytes:self.expectedLength];
+	return YES;
+}
+
+#pragma mark - Segments
+
+- (void)splitPrimarySegment
+// Divides what's left of the primary segment between up to maximumSegmentCount connections
+{
+	ESDownloadSegment *primarySegment = self.primarySegment;
+	if ((self.maximumSegmentCount < 2) || (self.validator == nil) || ([self.segments count] != 1) || (primarySegment.end < 0))
+		return;
+	unsigned long long remaining = (unsigned long long)primarySegment.end - primarySegment.offset;
+	unsigned long long count = MIN((unsigned long long)self.maximumSegmentCount, remaining / MAX(self.minimumSegmentLength, 1ULL));
+	if (count < 2)
+		return;
+	unsigned long long segmentLength = remaining / count;
+	unsigned long long start = primarySegment.offset + segmentLength;
+	long long end = primarySegment.end;
+	primarySegment.end = (long long)start;
+	for (unsigned long long i = 1; i < count; i++)
+	{
+		ESDownloadSegment *segment = [ESDownloadSegment new];
+		segment.start = start;
+		segment.end = (i == count - 1) ? end : (long long)(start + segmentLength);
+		[self.segments addObject:segment];
+		start += segmentLength;
+	}
+}
+
+- (void)startSegmentConnections
+// Starts connections for segments that need one, up to maximumSegmentCount including the operation's own
+{
+	NSUInteger active = ((self.connection != nil) && !_primaryFinished) ? 1 : 0;
+	for (ESDownloadSegment *segment in self.segments)
+	{
+		if (segment.connection != nil)
+			active++;
+	}
+	for (ESDownloadSegment *segment in self.segments)
+	{
+		if (active >= MAX(self.maximumSegmentCount, (NSUInteger)1))
+			break;
+		if ((segment == self.primarySegment) || (segment.connection != nil) || [segment isComplete])
+			continue;
+		NSMutableURLRequest *request = [self.request mutableCopy];
+		[request setValue:@"identity" forHTTPHeaderField:@"Accept-Encoding"];
+		[request setValue:[segment rangeHeaderValue] forHTTPHeaderField:@"Range"];
+		[request setValue:self.validator forHTTPHeaderField:@"If-Range"];
+		segment.connection = [self newConnectionWithRequest:request];
+		[segment.connection start];
+		active++;
+	}
+}
+
+- (ESDownloadSegment *)segmentForConnection:(NSURLConnection *)connection
+{
+	if ((connection == nil) || (connection == self.connection))
+		return nil;
+	for (ESDownloadSegment *segment in self.segments)
+	{
+		if (segment.connection == connection)
+			return segment;
+	}
+	return nil;
+}
+
+- (void)segmentDidFailWithError:(NSError *)error
+// Any failure restarts every connection (from where it got to) if the retry policy allows
+{
+	if (![self retryAfterError:error response:nil])
+		[self processRequest:error];
+}
+
+- (void)finishIfComplete
+{
+	if (!_primaryFinished)
+		return;
+	for (ESDownloadSegment *segment in self.segments)
+	{
+		if (![segment isComplete])
+			return;
+	}
+	[self closePartialFile];
+	NSFileManager *fileManager = [NSFileManager new];
+	[fileManager removeItemAtURL:self.destinationURL error:NULL];
+	NSError *error = nil;
+	if (![fileManager moveItemAtURL:self.partialURL toURL:self.destinationURL error:&error])
+	{
+		[self processRequest:error];
+		return;
+	}
+	[fileManager removeItemAtURL:StateURLForDestinationURL(self.destinationURL) error:NULL];
+	self.segments = nil;
+	[super connectionDidFinishLoading:self.connection];
+}
+
+#pragma mark - ESHTTPOperation
+
+- (void)operationDidStart
+{
+	NSParameterAssert(self.destinationURL != nil);
+	[self loadState];
+	NSError *error = nil;
+	if (![self openPartialFile:&error])
+	{
+		[self.metrics recordEvent:ESHTTPOperationEventDidStart];
+		[self processRequest:error];
+		return;
+	}
+	[super operationDidStart];
+}
+
+- (NSURLRequest *)requestForAttempt:(NSURLRequest *)request
+{
+	request = [super requestForAttempt:request];
+	NSMutableURLRequest *rangeRequest = [request mutableCopy];
+	[rangeRequest setValue:@"identity" forHTTPHeaderField:@"Accept-Encoding"];
+	self.primarySegment = nil;
+	_primaryFinished = NO;
+	for (ESDownloadSegment *segment in self.segments)
+	{
+		if (![segment isComplete])
+		{
+			self.primarySegment = segment;
+			break;
+		}
+	}
+	if (self.primarySegment != nil)
+	{
+		[rangeRequest setValue:[self.primarySegment rangeHeaderValue] forHTTPHeaderField:@"Range"];
+		[rangeRequest setValue:self.validator forHTTPHeaderField:@"If-Range"];
+	}
+	else
+	{
+		// Asking for everything as a range shows whether the server supports them
+		[rangeRequest setValue:@"bytes=0-" forHTTPHeaderField:@"Range"];
+		[rangeRequest setValue:nil forHTTPHeaderField:@"If-Range"];
+	}
+	return rangeRequest;
+}
+
+- (BOOL)canRetry
+{
+	// Everything received so far is on disk, the next attempt asks for the rest
+	return YES;
+}
+
+- (void)prepareForRetry
+{
+	[super prepareForRetry];
+	[self cancelSegmentConnections];
+	[self saveState];
+}
+
+- (void)operationWillFinish
+{
+	[super operationWillFinish];
+	[self cancelSegmentConnections];
+	// Whatever made it to disk is there for the next operation
+	[self saveState];
+	[self closePartialFile];
+}
+
+#pragma mark - NSURLConnection Delegate
+
+- (NSURLRequest *)connection:(NSURLConnection *)connection willSendRequest:(NSURLRequest *)request redirectResponse:(NSURLResponse *)response
+{
+	if ([self segmentForConnection:connection] != nil)
+		return request;
+	return [super connection:connection willSendRequest:request redirectResponse:response];
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
+	ESDownloadSegment *segment = [self segmentForConnection:connection];
+	if (segment != nil)
+	{
+		unsigned long long first, last;
+		long long length;
+		// Anything but the exact range means the file changed since the first response
+		if (([httpResponse statusCode] != 206) || 
+			!ParseContentRange(HTTPHeaderValue([httpResponse allHeaderFields], @"Content-Range"), &first, &last, &length) || 
+			(first != segment.offset))
+		{
+			[self discardPartialDownload];
+			[self processRequest:[NSError errorWithDomain:kESHTTPOperationErrorDomain code:kESHTTPOperationErrorBadRange userInfo:nil]];
+			return;
+		}
+		return;
+	}
+	[super connection:connection didReceiveResponse:response];
+	if ((self.state != kESOperationStateExecuting) || (self.connection != connection))
+		return;
+	NSInteger statusCode = [httpResponse statusCode];
+	if (statusCode == 416)
+	{
+		[self discardPartialDownload];
+		return;
+	}
+	if (!self.isStatusCodeAcceptable)
+		return;
+	if (statusCode == 206)
+	{
+		unsigned long long first, last;
+		long long length;
+		unsigned long long expectedFirst = (self.primarySegment != nil) ? self.primarySegment.offset : 0;
+		if (!ParseContentRange(HTTPHeaderValue([httpResponse allHeaderFields], @"Content-Range"), &first, &last, &length) || (first != expectedFirst))
+		{
+			[self.connection cancel];
+			[self processRequest:[NSError errorWithDomain:kESHTTPOperationErrorDomain code:kESHTTPOperationErrorBadRange userInfo:nil]];
+			return;
+		}
+		if (self.segments == nil)
+		{
+			[self resetWithLength:length];
+			self.validator = ValidatorForResponse(httpResponse);
+		}
+	}
+	else
+	{
+		// The whole file, either the server doesn't do ranges or the validator no longer matches
+		[self resetWithLength:[httpResponse expectedContentLength]];
+		self.validator = ValidatorForResponse(httpResponse);
+		if (![[HTTPHeaderValue([httpResponse allHeaderFields], @"Accept-Ranges") lowercaseString] isEqualToString:@"bytes"])
+			self.validator = nil;
+	}
+	[self splitPrimarySegment];
+	[self saveState];
+	[self startSegmentConnections];
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data
+{
+	ESDownloadSegment *segment = [self segmentForConnection:connection];
+	if (segment == nil)
+	{
+		[super connection:connection didReceiveData:data];
+		return;
+	}
+	NSParameterAssert(self.isActualRunLoopThread);
+	[self.metrics addReceivedByteCount:[data length]];
+	if (![self writeData:data toSegment:segment])
+		return;
+	if ([segment isComplete])
+	{
+		[segment.connection cancel];
+		segment.connection = nil;
+		[self startSegmentConnections];
+		[self finishIfComplete];
+	}
+}
+
+- (void)processReceivedData:(NSData *)data
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	// Error bodies go wherever ESHTTPOperation puts them
+	if (!self.isStatusCodeAcceptable || (self.primarySegment == nil))
+	{
+		[super processReceivedData:data];
+		return;
+	}
+	self.firstData = NO;
+	if (![self writeData:data toSegment:self.primarySegment])
+		return;
+	if ([self.primarySegment isComplete] && !_primaryFinished)
+	{
+		// Its range was split off to other connections, the rest of what it's sending isn't needed
+		[self.connection cancel];
+		_primaryFinished = YES;
+		[self startSegmentConnections];
+		[self finishIfComplete];
+	}
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection *)connection
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	ESDownloadSegment *segment = [self segmentForConnection:connection];
+	if (segment != nil)
+	{
+		segment.connection = nil;
+		if (![segment isComplete])
+		{
+			[self segmentDidFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil]];
+			return;
+		}
+		[self startSegmentConnections];
+		[self finishIfComplete];
+		return;
+	}
+	if (!self.isStatusCodeAcceptable || (self.primarySegment == nil))
+	{
+		[super connectionDidFinishLoading:connection];
+		return;
+	}
+	ESDownloadSegment *primarySegment = self.primarySegment;
+	if (primarySegment.end < 0)
+	{
+		// Length wasn't known until now
+		primarySegment.end = (long long)primarySegment.offset;
+		_expectedLength = primarySegment.end;
+	}
+	if (![primarySegment isComplete])
+	{
+		if (![self retryAfterError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil] response:nil])
+			[self processRequest:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil]];
+		return;
+	}
+	_primaryFinished = YES;
+	[self startSegmentConnections];
+	[self finishIfComplete];
+}
+
+- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error
+{
+	ESDownloadSegment *segment = [self segmentForConnection:connection];
+	if (segment == nil)
+	{
+		[super connection:connection didFailWithError:error];
+		return;
+	}
+	NSParameterAssert(self.isActualRunLoopThread);
+	segment.connection = nil;
+	[self segmentDidFailWithError:error];
+}
+
+@end
@@ -0,0 +1,114 @@
+//
+//  ESHTTPCache.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Response previously stored in an ESHTTPCache
+ */
+
+@interface ESHTTPCachedResponse : NSObject
+
+@property (strong, readonly) NSHTTPURLResponse *response;
+@property (strong, readonly) NSData *data;
+/**
+ * ETag header of the stored response, used for If-None-Match
+ */
+@property (copy, readonly) NSString *entityTag;
+/**
+ * Last-Modified header of the stored response, used for If-Modified-Since
+ */
+@property (copy, readonly) NSString *lastModified;
+/**
+ * Date after which the response must be revalidated, derived from Cache-Control max-age or Expires
+ */
+@property (strong, readonly) NSDate *expirationDate;
+/**
+ * YES if the response can be used without revalidating it with the server
+ */
+@property (assign, readonly, getter=isFresh) BOOL fresh;
+/**
+ * YES if the response has a validator that can be used for a conditional request
+ */
+@property (assign, readonly, getter=isRevalidatable) BOOL revalidatable;
+
+@end
+
+/**
+ * Bounded, persistent on disk cache of HTTP responses with support for conditional revalidation.
+ *
+ * Responses are keyed by request method and URL, and are only used for requests with the same values for the headers
+ * named in the response's Vary header. Requests with an Authorization header aren't cached. Freshness comes from the Cache-Control (max-age, no-cache, no-store)
+ * and Expires headers. When the cache grows beyond maximumDiskSize the least recently used responses are removed.
+ *
+ * In addition to response bodies, the cache can hold on to the result of processing a body (see ESHTTPOperation's
+ * processedResponse) in memory, so that a response that is revalidated with a 304 doesn't have to be processed again.
+ *
+ * All methods are thread safe.
+ */
+
+@interface ESHTTPCache : NSObject
+
+/**
+ * Cache stored in the application's Caches directory with a maximumDiskSize of 20MB
+ */
++ (id)sharedCache;
+
+- (id)initWithDirectoryURL:(NSURL *)directoryURL maximumDiskSize:(NSUInteger)maximumDiskSize; // designated initializer
+
+@property (strong, readonly) NSURL *directoryURL;
+@property (assign, readwrite) NSUInteger maximumDiskSize;
+
+/**
+ * Returns YES for requests whose responses the cache is willing to store (GET requests without Cache-Control: no-store or Authorization)
+ */
++ (BOOL)isCacheableRequest:(NSURLRequest *)request;
+
+///-----------------------
+/// @name Cached responses
+///-----------------------
+
+- (ESHTTPCachedResponse *)cachedResponseForRequest:(NSURLRequest *)request;
+/**
+ * Stores response and data for request if the response allows it
+ *
+ * Replacing a stored response discards its processed response
+ */
+- (void)storeResponse:(NSHTTPURLResponse *)response data:(NSData *)data forRequest:(NSURLRequest *)request;
+/**
+ * Same as storeResponse:data:forRequest: for a body held as an array of NSData segments (see -[ESHTTPOperation responseBodySegments]), which are written out without being concatenated
+ */
+- (void)storeResponse:(NSHTTPURLResponse *)response segments:(NSArray *)segments forRequest:(NSURLRequest *)request;
+/**
+ * Merges the headers of a 304 (Not Modified) response into cachedResponse, stores the result and returns it
+ */
+- (ESHTTPCachedResponse *)cachedResponse:(ESHTTPCachedResponse *)cachedResponse revalidatedWithResponse:(NSHTTPURLResponse *)response forRequest:(NSURLRequest *)request;
+- (void)removeCachedResponseForRequest:(NSURLRequest *)request;
+- (void)removeAllCachedResponses;
+
+///--------------------------
+/// @name Processed responses
+///--------------------------
+
+// Processed responses are only kept in memory and only for requests that have a stored response
+
+- (id)processedResponseForRequest:(NSURLRequest *)request;
+- (void)setProcessedResponse:(id)processedResponse forRequest:(NSURLRequest *)request;
+
+@end
@@ -0,0 +1,551 @@
+//
+//  ESHTTPCache.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESHTTPCache.h"
+#import "ESHTTPHeaderFields.h"
+#import <CommonCrypto/CommonDigest.h>
+#include <stdio.h>
+#include <unistd.h>
+
+//
+//	References
+//	http://www.w3.org/Protocols/rfc2616/rfc2616-sec13.html
+//	http://www.w3.org/Protocols/rfc2616/rfc2616-sec14.html#sec14.9
+//
+
+static NSString *const kMetadataURLKey = @"URL";
+static NSString *const kMetadataStatusCodeKey = @"statusCode";
+static NSString *const kMetadataHeaderFieldsKey = @"headerFields";
+static NSString *const kMetadataExpirationDateKey = @"expirationDate";
+static NSString *const kMetadataVaryingHeaderValuesKey = @"varyingHeaderValues";
+
+static NSDictionary * CacheControlDirectives(NSString *cacheControl)
+// no-cache, max-age=60 -> { no-cache : "", max-age : "60" }
+{
+	NSMutableDictionary *directives = [NSMutableDictionary new];
+	for (NSString *component in [cacheControl componentsSeparatedByString:@","])
+	{
+		NSString *directive = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+		if ([directive length] == 0)
+			continue;
+		NSRange equals = [directive rangeOfString:@"="];
+		if (equals.location == NSNotFound)
+			[directives setObject:@"" forKey:[directive lowercaseString]];
+		else
+		{
+			NSString *name = [[directive substringToIndex:equals.location] lowercaseString];
+			NSString *value = [directive substringFromIndex:equals.location + 1];
+			value = [value stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"\" "]];
+			[directives setObject:value forKey:name];
+		}
+	}
+	return directives;
+}
+
+static NSDate * DateFromHTTPDateString(NSString *string)
+{
+	static NSDateFormatter *dateFormatter = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		dateFormatter = [NSDateFormatter new];
+		[dateFormatter setLocale:[[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"]];
+		[dateFormatter setTimeZone:[NSTimeZone timeZoneWithAbbreviation:@"GMT"]];
+		[dateFormatter setDateFormat:@"EEE',' dd MMM yyyy HH':'mm':'ss 'GMT'"];
+	});
+	if (string == nil)
+		return nil;
+	// NSDateFormatter isn't thread safe on older systems
+	@synchronized (dateFormatter)
+	{
+		return [dateFormatter dateFromString:string];
+	}
+}
+
+static BOOL ExpirationDateForHeaderFields(NSDictionary *headerFields, NSDate **expirationDate)
+// Returns NO if the response must not be stored
+{
+	NSDictionary *directives = CacheControlDirectives(HTTPHeaderValue(headerFields, @"Cache-Control"));
+	if ([directives objectForKey:@"no-store"] != nil)
+		return NO;
+	if ([HTTPHeaderValue(headerFields, @"Vary") isEqualToString:@"*"])
+		return NO;
+	NSDate *date = nil;
+	if ([directives objectForKey:@"no-cache"] != nil)
+		date = [NSDate distantPast];
+	else if ([directives objectForKey:@"max-age"] != nil)
+	{
+		NSTimeInterval maxAge = [[directives objectForKey:@"max-age"] doubleValue];
+		NSTimeInterval age = [HTTPHeaderValue(headerFields, @"Age") doubleValue];
+		date = [NSDate dateWithTimeIntervalSinceNow:MAX(maxAge - age, 0)];
+	}
+	else
+	{
+		// Unparseable Expires values mean already expired
+		NSString *expires = HTTPHeaderValue(headerFields, @"Expires");
+		if (expires != nil)
+		{
+			date = DateFromHTTPDateString(expires);
+			if (date == nil)
+				date = [NSDate distantPast];
+		}
+	}
+	if (date == nil)
+		date = [NSDate distantPast];
+	if (expirationDate)
+		*expirationDate = date;
+	return YES;
+}
+
+static NSArray * VaryingHeaderNames(NSDictionary *headerFields)
+// Vary: Accept-Encoding, accept -> [ accept-encoding, accept ]
+{
+	NSMutableArray *names = [NSMutableArray new];
+	for (NSString *component in [HTTPHeaderValue(headerFields, @"Vary") componentsSeparatedByString:@","])
+	{
+		NSString *name = [[component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]] lowercaseString];
+		if (([name length] > 0) && ![names containsObject:name])
+			[names addObject:name];
+	}
+	return names;
+}
+
+static NSDictionary * VaryingHeaderValues(NSArray *names, NSURLRequest *request)
+// Values of request's headers named by a response's Vary header, empty strings for missing headers
+{
+	NSMutableDictionary *values = [NSMutableDictionary new];
+	for (NSString *name in names)
+	{
+		NSString *value = [request valueForHTTPHeaderField:name];
+		[values setObject:((value != nil) ? value : @"") forKey:name];
+	}
+	return values;
+}
+
+static NSString * CacheKeyForRequest(NSURLRequest *request)
+{
+	NSString *method = [request HTTPMethod];
+	if (method == nil)
+		method = @"GET";
+	NSString *string = [NSString stringWithFormat:@"%@ %@", [method uppercaseString], [[request URL] absoluteString]];
+	const char *cString = [string UTF8String];
+	unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+	CC_SHA1(cString, (CC_LONG)strlen(cString), digest);
+	NSMutableString *key = [[NSMutableString alloc] initWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+	for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++)
+		[key appendFormat:@"%02x", digest[i]];
+	return key;
+}
+
+static BOOL WriteSegmentsToURL(NSArray *segments, NSURL *url)
+// Like -[NSData writeToURL:atomically:], without concatenating the segments first
+{
+	NSString *path = [url path];
+	NSString *temporaryPath = [path stringByAppendingPathExtension:@"tmp"];
+	FILE *file = fopen([temporaryPath fileSystemRepresentation], "wb");
+	if (file == NULL)
+		return NO;
+	BOOL written = YES;
+	for (NSData *segment in segments)
+	{
+		if (fwrite([segment bytes], 1, [segment length], file) != [segment length])
+		{
+			written = NO;
+			break;
+		}
+	}
+	if (fclose(file) != 0)
+		written = NO;
+	if (written)
+		written = (rename([temporaryPath fileSystemRepresentation], [path fileSystemRepresentation]) == 0);
+	if (!written)
+		unlink([temporaryPath fileSystemRepresentation]);
+	return written;
+}
+
+#pragma mark - ESHTTPCachedResponse
+
+@interface ESHTTPCachedResponse ()
+- (id)initWithResponse:(NSHTTPURLResponse *)response data:(NSData *)data expirationDate:(NSDate *)expirationDate;
+@end
+
+@implementation ESHTTPCachedResponse
+@synthesize response=_response;
+@synthesize data=_data;
+@synthesize entityTag=_entityTag;
+@synthesize lastModified=_lastModified;
+@synthesize expirationDate=_expirationDate;
+
+- (id)initWithResponse:(NSHTTPURLResponse *)response data:(NSData *)data expirationDate:(NSDate *)expirationDate
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_response = response;
+		_data = data;
+		_expirationDate = expirationDate;
+		NSDictionary *headerFields = [response allHeaderFields];
+		_entityTag = [HTTPHeaderValue(headerFields, @"ETag") copy];
+		_lastModified = [HTTPHeaderValue(headerFields, @"Last-Modified") copy];
+	}
+	return self;
+}
+
+- (BOOL)isFresh
+{
+	return ([self.expirationDate timeIntervalSinceNow] > 0);
+}
+
+- (BOOL)isRevalidatable
+{
+	return ((self.entityTag != nil) || (self.lastModified != nil));
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<%@ : %p>\n{\n\tURL: %@\n\tETag: %@\n\tLast-Modified: %@\n\tExpires: %@\n\tLength: %lu\n}", NSStringFromClass([self class]), self, [self.response URL], self.entityTag, self.lastModified, self.expirationDate, (unsigned long)[self.data length]];
+}
+
+@end
+
+#pragma mark - ESHTTPProcessedResponse
+
+// Processed response along with the request header values it was made for
+@interface ESHTTPProcessedResponse : NSObject
+@property (strong, nonatomic) id processedResponse;
+@property (strong, nonatomic) NSDictionary *varyingHeaderValues;
+@end
+
+@implementation ESHTTPProcessedResponse
+@synthesize processedResponse=_processedResponse;
+@synthesize varyingHeaderValues=_varyingHeaderValues;
+@end
+
+#pragma mark - ESHTTPCache
+
+@interface ESHTTPCache ()
+- (NSURL *)metadataURLForKey:(NSString *)key;
+- (NSURL *)bodyURLForKey:(NSString *)key;
+- (void)writeMetadataForResponse:(NSHTTPURLResponse *)response request:(NSURLRequest *)request expirationDate:(NSDate *)expirationDate key:(NSString *)key;
+- (void)trimToMaximumDiskSize;
+@end
+
+@implementation ESHTTPCache
+{
+	dispatch_queue_t _ioQueue;
+	NSCache *_processedResponses;
+	NSCache *_varyingHeaderNames; // Key -> Vary header names of the stored response
+}
+@synthesize directoryURL=_directoryURL;
+@synthesize maximumDiskSize=_maximumDiskSize;
+
++ (id)sharedCache
+{
+	static id sharedCache = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		NSURL *cachesURL = [[[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask] lastObject];
+		sharedCache = [[[self class] alloc] initWithDirectoryURL:[cachesURL URLByAppendingPathComponent:@"com.everythingsolution.httpcache"]
+												 maximumDiskSize:20 * 1024 * 1024];
+	});
+	return sharedCache;
+}
+
+- (id)initWithDirectoryURL:(NSURL *)directoryURL maximumDiskSize:(NSUInteger)maximumDiskSize
+{
+	NSParameterAssert(directoryURL != nil);
+	self = [super init];
+	if (directoryURL == nil)
+		self = nil;
+	if (self != nil)
+	{
+		_directoryURL = [directoryURL copy];
+		_maximumDiskSize = maximumDiskSize;
+		_ioQueue = dispatch_queue_create("com.everythingsolution.httpcache", 0);
+		_processedResponses = [NSCache new];
+		_varyingHeaderNames = [NSCache new];
+		[[NSFileManager defaultManager] createDirectoryAtURL:_directoryURL
+								 withIntermediateDirectories:YES
+												  attributes:nil
+													   error:nil];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	dispatch_release(_ioQueue);
+}
+
++ (BOOL)isCacheableRequest:(NSURLRequest *)request
+{
+	NSString *method = [request HTTPMethod];
+	if ((method != nil) && ![[method uppercaseString] isEqualToString:@"GET"])
+		return NO;
+	// Responses to authorized requests are for one user, the cache is shared by everyone
+	if ([request valueForHTTPHeaderField:@"Authorization"] != nil)
+		return NO;
+	NSDictionary *directives = CacheControlDirectives([request valueForHTTPHeaderField:@"Cache-Control"]);
+	return ([directives objectForKey:@"no-store"] == nil);
+}
+
+#pragma mark - Files
+
+- (NSURL *)metadataURLForKey:(NSString *)key
+{
+	return [self.directoryURL URLByAppendingPathComponent:[key stringByAppendingPathExtension:@"plist"]];
+}
+
+- (NSURL *)bodyURLForKey:(NSString *)key
+{
+	return [self.directoryURL URLByAppendingPathComponent:[key stringByAppendingPathExtension:@"body"]];
+}
+
+- (void)writeMetadataForResponse:(NSHTTPURLResponse *)response request:(NSURLRequest *)request expirationDate:(NSDate *)expirationDate key:(NSString *)key
+// Must be called on _ioQueue
+{
+	NSDictionary *headerFields = [response allHeaderFields];
+	NSDictionary *metadata =
+	[[NSDictionary alloc] initWithObjectsAndKeys:
+	 [[response URL] absoluteString], kMetadataURLKey,
+	 [NSNumber numberWithInteger:[response statusCode]], kMetadataStatusCodeKey,
+	 headerFields, kMetadataHeaderFieldsKey,
+	 expirationDate, kMetadataExpirationDateKey,
+	 VaryingHeaderValues(VaryingHeaderNames(headerFields), request), kMetadataVaryingHeaderValuesKey,
+	 nil];
+	[metadata writeToURL:[self metadataURLForKey:key] atomically:YES];
+}
+
+- (void)trimToMaximumDiskSize
+// Must be called on _ioQueue
+{
+	NSFileManager *fileManager = [NSFileManager defaultManager];
+	NSArray *keys = [NSArray arrayWithObjects:NSURLFileSizeKey, NSURLContentModificationDateKey, nil];
+	NSArray *fileURLs = [fileManager contentsOfDirectoryAtURL:self.directoryURL includingPropertiesForKeys:keys options:NSDirectoryEnumerationSkipsHiddenFiles error:nil];
+	// Entries are a metadata file and a body file sharing a key
+	NSMutableDictionary *entrySizes = [NSMutableDictionary new];
+	NSMutableDictionary *entryDates = [NSMutableDictionary new];
+	unsigned long long totalSize = 0;
+	for (NSURL *fileURL in fileURLs)
+	{
+		NSString *key = [[fileURL lastPathComponent] stringByDeletingPathExtension];
+		NSNumber *fileSize = nil;
+		NSDate *modificationDate = nil;
+		[fileURL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:nil];
+		[fileURL getResourceValue:&modificationDate forKey:NSURLContentModificationDateKey error:nil];
+		unsigned long long entrySize = [[entrySizes objectForKey:key] unsignedLongLongValue] + [fileSize unsignedLongLongValue];
+		[entrySizes setObject:[NSNumber numberWithUnsignedLongLong:entrySize] forKey:key];
+		NSDate *entryDate = [entryDates objectForKey:key];
+		if (modificationDate != nil && (entryDate == nil || [modificationDate compare:entryDate] == NSOrderedDescending))
+			[entryDates setObject:modificationDate forKey:key];
+		totalSize += [fileSize unsignedLongLongValue];
+	}
+	if (totalSize <= self.maximumDiskSize)
+		return;
+	NSArray *leastRecentlyUsed = [[entrySizes allKeys] sortedArrayUsingComparator:^NSComparisonResult(id key1, id key2) {
+		NSDate *date1 = [entryDates objectForKey:key1];
+		NSDate *date2 = [entryDates objectForKey:key2];
+		if (date1 == nil)
+			return NSOrderedAscending;
+		if (date2 == nil)
+			return NSOrderedDescending;
+		return [date1 compare:date2];
+	}];
+	for (NSString *key in leastRecentlyUsed)
+	{
+		if (totalSize <= self.maximumDiskSize)
+			break;
+		[fileManager removeItemAtURL:[self metadataURLForKey:key] error:nil];
+		[fileManager removeItemAtURL:[self bodyURLForKey:key] error:nil];
+		[_processedResponses removeObjectForKey:key];
+		[_varyingHeaderNames removeObjectForKey:key];
+		totalSize -= [[entrySizes objectForKey:key] unsignedLongLongValue];
+	}
+}
+
+#pragma mark - Cached responses
+
+- (ESHTTPCachedResponse *)cachedResponseForRequest:(NSURLRequest *)request
+{
+	if (![[self class] isCacheableRequest:request])
+		return nil;
+	NSString *key = CacheKeyForRequest(request);
+	__block NSDictionary *metadata = nil;
+	__block NSData *data = nil;
+	dispatch_sync(_ioQueue, ^{
+		metadata = [[NSDictionary alloc] initWithContentsOfURL:[self metadataURLForKey:key]];
+		if (metadata != nil)
+			data = [[NSData alloc] initWithContentsOfURL:[self bodyURLForKey:key] options:NSDataReadingMappedIfSafe error:nil];
+	});
+	if (metadata == nil || data == nil)
+		return nil;
+	// Stored for a request with different values for the headers the response varies on. 
+	// Entries from before Vary was recorded can't be checked, so they're treated as misses.
+	NSDictionary *varyingHeaderValues = [metadata objectForKey:kMetadataVaryingHeaderValuesKey];
+	if ((varyingHeaderValues == nil) || ![varyingHeaderValues isEqualToDictionary:VaryingHeaderValues([varyingHeaderValues allKeys], request)])
+		return nil;
+	[_varyingHeaderNames setObject:[varyingHeaderValues allKeys] forKey:key];
+	NSURL *url = [NSURL URLWithString:[metadata objectForKey:kMetadataURLKey]];
+	if (url == nil)
+		return nil;
+	NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:url
+															  statusCode:[[metadata objectForKey:kMetadataStatusCodeKey] integerValue]
+															 HTTPVersion:@"HTTP/1.1"
+															headerFields:[metadata objectForKey:kMetadataHeaderFieldsKey]];
+	// Touch the entry so that trimming is least recently used rather than least recently stored
+	dispatch_async(_ioQueue, ^{
+		NSDictionary *attributes = [NSDictionary dictionaryWithObject:[NSDate date] forKey:NSFileModificationDate];
+		[[NSFileManager defaultManager] setAttributes:attributes ofItemAtPath:[[self bodyURLForKey:key] path] error:nil];
+	});
+	return [[ESHTTPCachedResponse alloc] initWithResponse:response data:data expirationDate:[metadata objectForKey:kMetadataExpirationDateKey]];
+}
+
+- (void)storeResponse:(NSHTTPURLResponse *)response data:(NSData *)data forRequest:(NSURLRequest *)request
+{
+	if (data == nil)
+		return;
+	[self storeResponse:response segments:[NSArray arrayWithObject:data] forRequest:request];
+}
+
+- (void)storeResponse:(NSHTTPURLResponse *)response segments:(NSArray *)segments forRequest:(NSURLRequest *)request
+{
+	if ((response == nil) || (segments == nil) || ![[self class] isCacheableRequest:request])
+		return;
+	// Whatever happens, a new response supersedes anything stored for this request
+	NSString *key = CacheKeyForRequest(request);
+	[_processedResponses removeObjectForKey:key];
+	[_varyingHeaderNames removeObjectForKey:key];
+	NSDate *expirationDate = nil;
+	BOOL storable = NO;
+	// Only bother with complete responses
+	if (([response statusCode] == 200) && ExpirationDateForHeaderFields([response allHeaderFields], &expirationDate))
+	{
+		ESHTTPCachedResponse *cachedResponse = [[ESHTTPCachedResponse alloc] initWithResponse:response data:nil expirationDate:expirationDate];
+		// If it can't be reused and can't be revalidated, there's no point
+		storable = ([cachedResponse isFresh] || [cachedResponse isRevalidatable]);
+	}
+	if (!storable)
+	{
+		[self removeCachedResponseForRequest:request];
+		return;
+	}
+	[_varyingHeaderNames setObject:VaryingHeaderNames([response allHeaderFields]) forKey:key];
+	dispatch_async(_ioQueue, ^{
+		// Body first so that a metadata file never points at a missing or stale body
+		[[NSFileManager defaultManager] removeItemAtURL:[self metadataURLForKey:key] error:nil];
+		if (WriteSegmentsToURL(segments, [self bodyURLForKey:key]))
+			[self writeMetadataForResponse:response request:request expirationDate:expirationDate key:key];
+		[self trimToMaximumDiskSize];
+	});
+}
+
+- (ESHTTPCachedResponse *)cachedResponse:(ESHTTPCachedResponse *)cachedResponse revalidatedWithResponse:(NSHTTPURLResponse *)response forRequest:(NSURLRequest *)request
+{
+	NSParameterAssert(cachedResponse != nil);
+	NSParameterAssert([response statusCode] == 304);
+	// Headers in a 304 replace the stored ones
+	NSMutableDictionary *headerFields = [[cachedResponse.response allHeaderFields] mutableCopy];
+	[[response allHeaderFields] enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+		for (NSString *existingKey in [headerFields allKeys])
+		{
+			if ([existingKey caseInsensitiveCompare:key] == NSOrderedSame)
+				[headerFields removeObjectForKey:existingKey];
+		}
+		[headerFields setObject:obj forKey:key];
+	}];
+	// Content-Length, etc. in a 304 describe the empty 304 body, not the stored one
+	[headerFields setObject:[NSString stringWithFormat:@"%lu", (unsigned long)[cachedResponse.data length]] forKey:@"Content-Length"];
+	NSHTTPURLResponse *mergedResponse = [[NSHTTPURLResponse alloc] initWithURL:[cachedResponse.response URL]
+																	statusCode:[cachedResponse.response statusCode]
+																   HTTPVersion:@"HTTP/1.1"
+																  headerFields:headerFields];
+	NSDate *expirationDate = nil;
+	if (!ExpirationDateForHeaderFields(headerFields, &expirationDate))
+	{
+		[self removeCachedResponseForRequest:request];
+		expirationDate = [NSDate distantPast];
+	}
+	else
+	{
+		NSString *key = CacheKeyForRequest(request);
+		[_varyingHeaderNames setObject:VaryingHeaderNames(headerFields) forKey:key];
+		dispatch_async(_ioQueue, ^{
+			if ([[NSFileManager defaultManager] fileExistsAtPath:[[self bodyURLForKey:key] path]])
+				[self writeMetadataForResponse:mergedResponse request:request expirationDate:expirationDate key:key];
+		});
+	}
+	return [[ESHTTPCachedResponse alloc] initWithResponse:mergedResponse data:cachedResponse.data expirationDate:expirationDate];
+}
+
+- (void)removeCachedResponseForRequest:(NSURLRequest *)request
+{
+	NSString *key = CacheKeyForRequest(request);
+	[_processedResponses removeObjectForKey:key];
+	[_varyingHeaderNames removeObjectForKey:key];
+	dispatch_async(_ioQueue, ^{
+		[[NSFileManager defaultManager] removeItemAtURL:[self metadataURLForKey:key] error:nil];
+		[[NSFileManager defaultManager] removeItemAtURL:[self bodyURLForKey:key] error:nil];
+	});
+}
+
+- (void)removeAllCachedResponses
+{
+	[_processedResponses removeAllObjects];
+	[_varyingHeaderNames removeAllObjects];
+	dispatch_async(_ioQueue, ^{
+		NSFileManager *fileManager = [NSFileManager defaultManager];
+		for (NSURL *fileURL in [fileManager contentsOfDirectoryAtURL:self.directoryURL includingPropertiesForKeys:nil options:0 error:nil])
+			[fileManager removeItemAtURL:fileURL error:nil];
+	});
+}
+
+#pragma mark - Processed responses
+
+- (id)processedResponseForRequest:(NSURLRequest *)request
+{
+	if (![[self class] isCacheableRequest:request])
+		return nil;
+	ESHTTPProcessedResponse *entry = [_processedResponses objectForKey:CacheKeyForRequest(request)];
+	if ((entry == nil) || ![entry.varyingHeaderValues isEqualToDictionary:VaryingHeaderValues([entry.varyingHeaderValues allKeys], request)])
+		return nil;
+	return entry.processedResponse;
+}
+
+- (void)setProcessedResponse:(id)processedResponse forRequest:(NSURLRequest *)request
+{
+	if (![[self class] isCacheableRequest:request])
+		return;
+	NSString *key = CacheKeyForRequest(request);
+	// Without the stored response's Vary header there's no telling which requests can share it
+	NSArray *varyingHeaderNames = [_varyingHeaderNames objectForKey:key];
+	if ((processedResponse == nil) || (varyingHeaderNames == nil))
+	{
+		[_processedResponses removeObjectForKey:key];
+		return;
+	}
+	ESHTTPProcessedResponse *entry = [ESHTTPProcessedResponse new];
+	entry.processedResponse = processedResponse;
+	entry.varyingHeaderValues = VaryingHeaderValues(varyingHeaderNames, request);
+	[_processedResponses setObject:entry forKey:key];
+}
+
+@end
@@ -0,0 +1,27 @@
+//
+//  ESHTTPHeaderFields.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Value of the header field called name in headerFields (from -[NSHTTPURLResponse allHeaderFields], etc.), ignoring case.
+ *
+ * Header names are case insensitive and servers, proxies and NSHTTPURLResponse don't agree on their case, so don't count on an exact match.
+ */
+NSString * HTTPHeaderValue(NSDictionary *headerFields, NSString *name);
@@ -0,0 +1,37 @@
+//
+//  ESHTTPHeaderFields.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESHTTPHeaderFields.h"
+
+NSString * HTTPHeaderValue(NSDictionary *headerFields, NSString *name)
+{
+	NSString *value = [headerFields objectForKey:name];
+	if (value != nil)
+		return value;
+	for (NSString *key in headerFields)
+	{
+		if ([key caseInsensitiveCompare:name] == NSOrderedSame)
+			return [headerFields objectForKey:key];
+	}
+	return nil;
+}
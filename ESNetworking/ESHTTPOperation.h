@@ -1,8 +1,18 @@
 #import "ESRunLoopOperation.h"
 #import "ESNetworkError.h"
 #import "NSMutableURLRequest+ESNetworking.h"
+#import "ESRunLoopThreadPool.h"
+#import "ESHTTPCache.h"
+#import "ESResponseAccumulator.h"
+#import "ESHTTPOperationMetrics.h"
+#import "ESResponseDecompressor.h"
+#import "ESHTTPRetryPolicy.h"
+#import "ESMultipartFormData.h"
+#import "ESProcessingQueue.h"
+#import "ESHTTPOperationGroup.h"
 
-// Shared concurrent dispatch queue for work block processing
+// Shared concurrent dispatch queue, unbounded. Nothing in ESNetworking uses it 
+// anymore, work blocks and JSON elements go through [ESProcessingQueue sharedQueue].
 DISPATCH_EXPORT DISPATCH_WARN_RESULT 
 dispatch_queue_t 
 dispatch_get_processing_queue(void);
@@ -34,7 +44,7 @@ typedef void (^ESHTTPOperationDownloadBlock)(NSUInteger totalBytesRead, NSUInteg
 	typedef void (^ESHTTPOperationCompletionBlock)(ESHTTPOperation *op);
  
  @param urlRequest The request object to be loaded asynchronously during execution of the operation
- @param work ESHTTPOperationWorkBlock that will be dispatched on shared processing queue
+ @param work ESHTTPOperationWorkBlock that will be run by [ESProcessingQueue sharedQueue] at the operation's queuePriority
  @param completion ESHTTPOperationCompletionBlock that will be dispatched on main queue
  
  @return A new HTTP request operation
@@ -49,13 +59,48 @@ typedef void (^ESHTTPOperationDownloadBlock)(NSUInteger totalBytesRead, NSUInteg
 	typedef void (^ESHTTPOperationCompletionBlock)(ESHTTPOperation *op);
  
  @param urlRequest The request object to be loaded asynchronously during execution of the operation
- @param work ESHTTPOperationWorkBlock that will be dispatched on shared processing queue
+ @param work ESHTTPOperationWorkBlock that will be run by [ESProcessingQueue sharedQueue] at the operation's queuePriority
  @param completion ESHTTPOperationCompletionBlock that will be dispatched on main queue
  
  @return An initialized HTTP request operation
  */
 - (id)initWithRequest:(NSURLRequest *)request work:(ESHTTPOperationWorkBlock)work completion:(ESHTTPOperationCompletionBlock)completion; // designated initializer
 
+///-------------------------
+/// @name Network threads
+///-------------------------
+
+/**
+ Pool of run loop threads that operations without an explicit runLoopThread are scheduled on.
+ 
+ Each operation is assigned a thread from the pool when it is started, either the least loaded thread or, if usesHostAffinity is set on the pool, a thread chosen by the request's host. The pool's threadStatistics can be used to check if the pool is saturated.
+ 
+ @see setNetworkRunLoopThreadCount:
+ */
++ (ESRunLoopThreadPool *)networkRunLoopThreadPool;
+/**
+ Sets the number of threads in networkRunLoopThreadPool.
+ 
+ Must be called before the first operation is started. Later calls assert, and are ignored in release builds.
+ 
+ Default is 1.
+ */
++ (void)setNetworkRunLoopThreadCount:(NSUInteger)threadCount;
+
+///-------------------------
+/// @name Metrics
+///-------------------------
+
+/**
+ Sink every finished operation's metrics are added to.
+ 
+ Operations that share a load through coalescesIdenticalRequests aren't added, the load is reported once by the operation that performed it.
+ 
+ Default is [ESHTTPOperationMetricsSink sharedSink], set to nil to stop aggregating.
+ */
++ (ESHTTPOperationMetricsSink *)metricsSink;
++ (void)setMetricsSink:(ESHTTPOperationMetricsSink *)metricsSink;
+
 ///-------------------------
 /// @name Configured at init
 ///-------------------------
@@ -91,12 +136,19 @@ typedef void (^ESHTTPOperationDownloadBlock)(NSUInteger totalBytesRead, NSUInteg
  */
 @property (copy, readonly) ESHTTPOperationCompletionBlock completion;
 @property (assign, readonly) NSInteger operationID;
+/**
+ * Timestamps of the operation's transitions (start, response, first data, work, completion, etc.)
+ * 
+ * Complete once the completion block is called.
+ */
+@property (strong, readonly) ESHTTPOperationMetrics *metrics;
 
 ///-----------------------------------------
 /// @name Configure before queuing operation
 ///-----------------------------------------
 
 // runLoopThread and runLoopModes inherited from ESRunLoopOperation
+// If runLoopThread is nil when the operation starts, it is set to a thread from networkRunLoopThreadPool
 /**
  * Acceptable status codes returned by NSHTTPURLResponse
  * 
@@ -145,6 +197,73 @@ typedef void (^ESHTTPOperationDownloadBlock)(NSUInteger totalBytesRead, NSUInteg
  * @see acceptableContentTypes
  */
 @property (assign, readwrite) BOOL cancelOnContentTypeError; // default is NO
+/**
+ * Cache used to store responses and to revalidate stored responses with If-None-Match/If-Modified-Since.
+ * 
+ * Fresh responses are served without touching the network and a 304 (Not Modified) response is answered 
+ * with the stored body without downloading it again.
+ * 
+ * Only responses accumulated in responseBody (not written to outputStream) are stored.
+ * 
+ * Default is nil, implying responses are only cached by NSURLCache
+ * 
+ * @see reusesCachedProcessedResponse
+ */
+@property (strong, readwrite) ESHTTPCache *cache;
+/**
+ * If YES, when a response comes from cache the processedResponse remembered for it is reused and the work block is skipped.
+ * 
+ * Only set this if the work block has no side effects other than producing its result.
+ * 
+ * Default is NO
+ * 
+ * @see cache
+ */
+@property (assign, readwrite) BOOL reusesCachedProcessedResponse;
+/**
+ * If YES, this operation shares its network load and work block run with any identical operation that is already in flight.
+ * 
+ * Every operation sharing a load still runs its own completion block and ends up with its own copy of lastResponse, 
+ * responseBody and processedResponse (processedResponse is the same object for all of them). Cancelling one of them 
+ * doesn't affect the others.
+ * 
+ * Ignored for requests that can't be shared, see ESRequestCoalescer.
+ * 
+ * Default is NO
+ * 
+ * @see ESRequestCoalescer
+ */
+@property (assign, readwrite) BOOL coalescesIdenticalRequests;
+/**
+ * Policy used to retry attempts that fail with a transient connection error or a retryable status code.
+ * 
+ * Retries are scheduled on the operation's run loop thread, the operation stays executing in between. 
+ * An attempt whose body has already been written to outputStream (or streamed to an element block) 
+ * isn't retried.
+ * 
+ * Default is nil, implying the first failure finishes the operation
+ * 
+ * @see ESHTTPRetryPolicy
+ */
+@property (copy, readwrite) ESHTTPRetryPolicy *retryPolicy;
+/**
+ * If YES, a GET or HEAD request that hasn't received a response after hedgingDelay is sent a second time 
+ * and whichever connection responds first is used, the other one is cancelled.
+ * 
+ * Default is NO
+ * 
+ * @see hedgingDelay
+ */
+@property (assign, readwrite) BOOL hedgesRequests;
+/**
+ * Time to wait for a response before hedging.
+ * 
+ * Default is 0, implying the 95th percentile time to first byte for the request's host as recorded 
+ * by the metrics sink. No hedge is sent until the sink has enough samples for the host.
+ * 
+ * @see hedgesRequests
+ */
+@property (assign, readwrite) NSTimeInterval hedgingDelay;
 
 ///--------------------------------------
 /// @name Configure before receiving data
@@ -166,7 +285,9 @@ typedef void (^ESHTTPOperationDownloadBlock)(NSUInteger totalBytesRead, NSUInteg
  */
 @property (strong, readwrite) NSOutputStream *outputStream;
 /**
- * Used for hinting capacity on data accumulator used by connection.
+ * Size assumed for responses that don't specify a Content-Length when checking them against maximumResponseSize.
+ *
+ * Nothing is reserved up front, the body is held as the chunks it arrives in (see responseBodySegments).
  *
  * This value is ignored if outputStream is set
  * 
@@ -178,9 +299,37 @@ typedef void (^ESHTTPOperationDownloadBlock)(NSUInteger totalBytesRead, NSUInteg
  * 
  * This value is ignored if outputStream is set
  * 
+ * When responseSpillThreshold is set, at most responseSpillThreshold bytes are held in memory 
+ * and this can be raised to however much you're willing to put in the temporary directory.
+ * 
  * Default is 4MB.
  */
 @property (assign, readwrite) NSUInteger maximumResponseSize;
+/**
+ * Size past which the response body is moved out of memory and into a temporary file.
+ * 
+ * A spilled responseBody is memory mapped from that file, so it doesn't count against the 
+ * application's dirty memory and isn't copied as it grows.
+ * 
+ * This value is ignored if outputStream is set
+ * 
+ * Default is 0, implying the response body is always held in memory
+ * 
+ * @see maximumResponseSize
+ */
+@property (assign, readwrite) NSUInteger responseSpillThreshold;
+/**
+ * If YES, a gzip or zlib compressed body is inflated as it arrives, before it reaches responseBody or outputStream.
+ * 
+ * Use this for bodies NSURLConnection doesn't decode itself, such as pre-compressed files served without 
+ * a Content-Encoding. The format is detected from the body, bodies that aren't compressed are left alone.
+ * 
+ * maximumResponseSize applies to the decompressed length, and when this is set it also applies to data 
+ * written to outputStream.
+ * 
+ * Default is NO
+ */
+@property (assign, readwrite) BOOL decompressesResponseBody;
 
 ///--------------------------
 /// @name Response validation
@@ -209,13 +358,31 @@ typedef void (^ESHTTPOperationDownloadBlock)(NSUInteger totalBytesRead, NSUInteg
  */
 @property (copy, readonly) NSHTTPURLResponse *lastResponse;
 /**
+ * Response body as one contiguous NSData.
  * 
+ * The body is received in chunks, the first call to this concatenates them (unless there's only one, 
+ * as is the case for spilled or cached bodies). Chunks are released as they're copied, so the body 
+ * isn't held in memory twice. Use responseBodySegments to avoid the copy altogether.
  */
 @property (strong, readonly) NSData *responseBody;
+/**
+ * Response body as an array of NSData segments, in order, without concatenating them.
+ * 
+ * Once responseBody has been accessed this is an array containing just responseBody.
+ */
+@property (strong, readonly) NSArray *responseBodySegments;
 /**
  * 
  */
 @property (strong, readonly) id processedResponse;
+/**
+ * Number of connections started for the request, including retries but not hedges
+ */
+@property (assign, readonly) NSUInteger attemptCount;
+/**
+ * YES if responseBody came from cache, either because the stored response was fresh or because the server responded with a 304
+ */
+@property (assign, readonly, getter=isResponseFromCache) BOOL responseFromCache;
 
 ///---------------
 /// @name Progress
@@ -229,6 +396,12 @@ typedef void (^ESHTTPOperationDownloadBlock)(NSUInteger totalBytesRead, NSUInteg
  * 
  */
 - (void)setDownloadProgressBlock:(ESHTTPOperationDownloadBlock)downloadProgress;
+/**
+ * Group the operation was added to, if any. Byte progress is reported to it alongside the progress blocks.
+ * 
+ * @see [ESHTTPOperationGroup addOperation:]
+ */
+@property (weak, readonly) ESHTTPOperationGroup *group;
 
 @end
 
@@ -243,7 +416,70 @@ typedef void (^ESHTTPOperationDownloadBlock)(NSUInteger totalBytesRead, NSUInteg
 
 @property (strong, readwrite) NSURLConnection* connection;
 @property (assign, readwrite) BOOL firstData;
-@property (strong, readwrite) NSMutableData* dataAccumulator;
+@property (strong, readwrite) ESResponseAccumulator* dataAccumulator;
+@property (strong, readwrite) ESResponseDecompressor* decompressor;
+@property (copy, nonatomic) ESHTTPOperationUploadBlock uploadProgress;
+@property (copy, nonatomic) ESHTTPOperationDownloadBlock downloadProgress;
+@property (weak, readwrite) ESHTTPOperationGroup *group;
+
+// Finishes the operation with error, or if error is nil runs the work block 
+// and then finishes.  Must be called on the actual run loop thread.
+
+- (void)processRequest:(NSError *)error;
+
+// Called with each chunk of the body once any compression has been undone. 
+// Subclasses that consume the body themselves override this rather than 
+// -connection:didReceiveData:.
+
+- (void)processReceivedData:(NSData *)data;
+
+// Passes anything still held by the decompressor to -processReceivedData:. 
+// Subclasses that override -connectionDidFinishLoading: and look at the body 
+// before calling super must call this first. Returns NO if the operation 
+// finished with an error.
+
+- (BOOL)finishDecompressing;
+
+// Creates a connection with self as its delegate, scheduled in this thread's 
+// run loop in the required run loop modes but not started. Subclasses that 
+// run connections of their own must handle every delegate callback for them 
+// rather than passing them to super.
+
+- (NSURLConnection *)newConnectionWithRequest:(NSURLRequest *)request;
+
+// Called on the run loop thread before each attempt (including retries) with 
+// the request about to be sent, returns the request to send instead. 
+// Default returns request.
+
+- (NSURLRequest *)requestForAttempt:(NSURLRequest *)request;
+
+// Return NO once the attempt in flight has done something that can't be 
+// repeated, like writing to outputStream. Subclasses must call super.
+
+- (BOOL)canRetry;
+
+// Called before another attempt is started to throw away whatever the failed 
+// attempt received. Subclasses must call super.
+
+- (void)prepareForRetry;
+
+// Return NO if the operation relies on per operation state (streamed parsing, 
+// side effects in callbacks, etc.) that a shared load can't provide.
+// Default is YES.
+
+- (BOOL)isCoalescable;
+
+// Checked after each chunk of data is handled. While it returns YES the 
+// connection is taken out of the run loop and checked again periodically. 
+// Default returns YES while [ESProcessingQueue sharedQueue] is backlogged. 
+// Subclasses with their own backlog should OR in super.
+
+- (BOOL)shouldPauseReceiving;
+
+// Finishes the operation with the result of a shared load started by 
+// ESRequestCoalescer. Must be called on the actual run loop thread.
+
+- (void)finishWithResultOfCoalescedOperation:(ESHTTPOperation *)op;
 
 @end
 
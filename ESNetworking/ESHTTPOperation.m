@@ -1,5 +1,7 @@
 #import "ESHTTPOperation.h"
+#import "ESRequestCoalescer.h"
 #import <libkern/OSAtomic.h>
+#include <math.h>
 
 static dispatch_queue_t _processingQueue;
 dispatch_queue_t dispatch_get_processing_queue(void)
@@ -13,12 +15,62 @@ dispatch_queue_t dispatch_get_processing_queue(void)
 
 NSString * kESHTTPOperationErrorDomain = @"ESHTTPOperationErrorDomain";
 
+// Samples needed before the metrics sink's percentiles are trusted for hedging
+#define MINIMUM_HEDGING_SAMPLES 20
+// How often a connection paused for backpressure checks whether it can carry on
+#define BACKPRESSURE_POLL_INTERVAL 0.05
+
+// NSURLConnection delegate messages come from a run loop source instead of a 
+// queued hop, this stands in as the delegate so the pool still counts them
+@interface ESHTTPConnectionDelegate : NSObject
+- (id)initWithOperation:(ESHTTPOperation *)operation;
+@end
+
+@implementation ESHTTPConnectionDelegate
+{
+	ESHTTPOperation *_operation;
+}
+
+- (id)initWithOperation:(ESHTTPOperation *)operation
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_operation = operation;
+	}
+	return self;
+}
+
+- (BOOL)respondsToSelector:(SEL)aSelector
+{
+	return [_operation respondsToSelector:aSelector];
+}
+
+- (id)forwardingTargetForSelector:(SEL)aSelector
+{
+	[[[_operation class] networkRunLoopThreadPool] unqueuedCallbackDidRunOnThread:[NSThread currentThread]];
+	return _operation;
+}
+
+@end
+
 @interface ESHTTPOperation ()
-+ (void)networkRunLoopThreadEntry;
-+ (NSThread *)networkRunLoopThread;
-@property (copy, nonatomic) ESHTTPOperationUploadBlock uploadProgress;
-@property (copy, nonatomic) ESHTTPOperationDownloadBlock downloadProgress;
-- (void)processRequest:(NSError *)error;
+- (void)finishWithErrorFromProcessingQueue:(NSError *)error;
+- (void)cancelOnRunLoopThreadFromCancel;
+@property (strong, nonatomic) ESHTTPCachedResponse *cachedResponse;
+- (void)processCachedResponse:(ESHTTPCachedResponse *)cachedResponse;
+@property (assign, nonatomic) BOOL coalesced;
+@property (copy, nonatomic) NSURLRequest *connectionRequest;
+@property (strong, nonatomic) NSURLConnection *hedgeConnection;
+@property (strong, nonatomic) NSTimer *hedgeTimer;
+@property (strong, nonatomic) NSTimer *retryTimer;
+@property (strong, nonatomic) NSTimer *backpressureTimer;
+- (void)startAttempt;
+- (BOOL)retryAfterError:(NSError *)error response:(NSHTTPURLResponse *)response;
+- (NSTimeInterval)effectiveHedgingDelay;
+- (NSTimer *)scheduledTimerWithTimeInterval:(NSTimeInterval)interval selector:(SEL)selector;
+- (void)pauseReceiving;
+- (void)resumeReceiving;
 @end
 
 @implementation ESHTTPOperation
@@ -27,6 +79,7 @@ NSString * kESHTTPOperationErrorDomain = @"ESHTTPOperationErrorDomain";
 @synthesize lastRequest=_lastRequest;
 @synthesize lastResponse=_lastResponse;
 @synthesize responseBody=_responseBody;
+@synthesize responseBodySegments=_responseBodySegments;
 @synthesize processedResponse=_processedResponse;
 @synthesize connection=_connection;
 @synthesize firstData=_firstData;
@@ -35,46 +88,77 @@ NSString * kESHTTPOperationErrorDomain = @"ESHTTPOperationErrorDomain";
 @synthesize acceptableContentTypes=_acceptableContentTypes;
 @synthesize outputStream=_outputStream;
 @synthesize maximumResponseSize=_maximumResponseSize;
+@synthesize responseSpillThreshold=_responseSpillThreshold;
+@synthesize decompressesResponseBody=_decompressesResponseBody;
+@synthesize decompressor=_decompressor;
 @synthesize completion=_completion;
 @synthesize work=_work;
 @synthesize uploadProgress=_uploadProgress;
 @synthesize downloadProgress=_downloadProgress;
+@synthesize group=_group;
 @synthesize operationID=_operationID;
+@synthesize metrics=_metrics;
 @synthesize cancelOnStatusCodeError=_cancelOnStatusCodeError;
 @synthesize cancelOnContentTypeError=_cancelOnContentTypeError;
+@synthesize cache=_cache;
+@synthesize reusesCachedProcessedResponse=_reusesCachedProcessedResponse;
+@synthesize responseFromCache=_responseFromCache;
+@synthesize cachedResponse=_cachedResponse;
+@synthesize coalescesIdenticalRequests=_coalescesIdenticalRequests;
+@synthesize coalesced=_coalesced;
+@synthesize retryPolicy=_retryPolicy;
+@synthesize hedgesRequests=_hedgesRequests;
+@synthesize hedgingDelay=_hedgingDelay;
+@synthesize attemptCount=_attemptCount;
+@synthesize connectionRequest=_connectionRequest;
+@synthesize hedgeConnection=_hedgeConnection;
+@synthesize hedgeTimer=_hedgeTimer;
+@synthesize retryTimer=_retryTimer;
+@synthesize backpressureTimer=_backpressureTimer;
 
-static NSThread *_networkRunLoopThread = nil;
+static NSUInteger _networkRunLoopThreadCount = 1;
+static ESRunLoopThreadPool *_networkRunLoopThreadPool = nil;
 
-+ (void)networkRunLoopThreadEntry
-// This thread runs all of our network operation run loop callbacks.
++ (ESRunLoopThreadPool *)networkRunLoopThreadPool
 {
-	NSAssert(([NSThread currentThread] == [[self class] networkRunLoopThread]), @"Entered networkRunLoopThreadEntry from invalid thread");	
-	@autoreleasepool {
-		// Schedule a timer in the distant future to keep the run loop from simply immediately exiting
-		[NSTimer scheduledTimerWithTimeInterval:3600*24*365*100 target:nil selector:nil userInfo:nil repeats:NO];
-		while (YES) 
-		{
-			@autoreleasepool {
-				CFRunLoopRunInMode(kCFRunLoopDefaultMode, 10, YES);
-			}
-		}
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		// We run all of our network callbacks on secondary threads to ensure that they don't
+		// contribute to main thread latency. Create and configure those threads.
+		_networkRunLoopThreadPool = [[ESRunLoopThreadPool alloc] initWithName:@"NetworkRunLoopThread" threadCount:_networkRunLoopThreadCount threadPriority:0.3];
+		NSParameterAssert(_networkRunLoopThreadPool != nil);
+	});
+	return _networkRunLoopThreadPool;
+}
+
++ (void)setNetworkRunLoopThreadCount:(NSUInteger)threadCount
+{
+	NSParameterAssert(threadCount > 0);
+	NSAssert(_networkRunLoopThreadPool == nil, @"Network run loop thread count set after the pool was created");
+	if (threadCount > 0)
+		_networkRunLoopThreadCount = threadCount;
+}
+
+static ESHTTPOperationMetricsSink *_metricsSink = nil;
+static BOOL _metricsSinkSet = NO;
+
++ (ESHTTPOperationMetricsSink *)metricsSink
+{
+	@synchronized ([ESHTTPOperation class])
+	{
+		if (!_metricsSinkSet)
+			return [ESHTTPOperationMetricsSink sharedSink];
+		return _metricsSink;
 	}
-	NSAssert(NO, @"Exited networkRunLoopThreadEntry prematurely");
 }
 
-+ (NSThread *)networkRunLoopThread
++ (void)setMetricsSink:(ESHTTPOperationMetricsSink *)metricsSink
 {
-	static dispatch_once_t onceToken;
-	dispatch_once(&onceToken, ^{
-		// We run all of our network callbacks on a secondary thread to ensure that they don't
-		// contribute to main thread latency. Create and configure that thread.
-		_networkRunLoopThread = [[NSThread alloc] initWithTarget:[self class] selector:@selector(networkRunLoopThreadEntry) object:nil];
-		NSParameterAssert(_networkRunLoopThread != nil);
-		[_networkRunLoopThread setThreadPriority:0.3];
-		[_networkRunLoopThread setName:@"NetworkRunLoopThread"];
-		[_networkRunLoopThread start];
-	});
-	return _networkRunLoopThread;
+	@synchronized ([ESHTTPOperation class])
+	{
+		_metricsSink = metricsSink;
+		_metricsSinkSet = YES;
+	}
 }
 
 static int32_t _globalOperationIDCounter = 10000;
@@ -111,6 +195,7 @@ static int32_t GetOperationID(void)
 		_maximumResponseSize = 4 * 1024 * 1024;
 		_firstData = YES;
 		_operationID = GetOperationID();
+		_metrics = [[ESHTTPOperationMetrics alloc] initWithOperationID:_operationID host:[[request URL] host]];
 	}
 	return self;
 }
@@ -122,6 +207,43 @@ static int32_t GetOperationID(void)
 
 #pragma mark - Start and finish overrides
 
+- (void)start
+{
+	// any thread
+	[self.metrics recordEvent:ESHTTPOperationEventStart];
+	ESRunLoopThreadPool *pool = [[self class] networkRunLoopThreadPool];
+	[pool operationDidBeginOnThread:self.actualRunLoopThread];
+	[pool callbackWasQueuedOnThread:self.actualRunLoopThread];
+	[super start];
+}
+
+- (void)startOnRunLoopThread
+{
+	[[[self class] networkRunLoopThreadPool] callbackDidRunOnThread:self.actualRunLoopThread];
+	[super startOnRunLoopThread];
+}
+
+- (void)cancel
+// Same as ESRunLoopOperation's, with the hop counted by the pool
+{
+	// any thread
+	if ([self markCancelled])
+	{
+		[[[self class] networkRunLoopThreadPool] callbackWasQueuedOnThread:self.actualRunLoopThread];
+		[self performSelector:@selector(cancelOnRunLoopThreadFromCancel) 
+					 onThread:self.actualRunLoopThread 
+				   withObject:nil 
+				waitUntilDone:YES 
+						modes:[self.actualRunLoopModes allObjects]];
+	}
+}
+
+- (void)cancelOnRunLoopThreadFromCancel
+{
+	[[[self class] networkRunLoopThreadPool] callbackDidRunOnThread:self.actualRunLoopThread];
+	[self cancelOnRunLoopThread];
+}
+
 - (void)operationDidStart
 // Called by QRunLoopOperation when the operation starts. This kicks of an
 // asynchronous NSURLConnection.
@@ -132,16 +254,212 @@ static int32_t GetOperationID(void)
 	NSParameterAssert(self.maximumResponseSize > 0);
 	NSParameterAssert(self.defaultResponseSize <= self.maximumResponseSize);
 	NSParameterAssert(self.request != nil);
-	// Create a connection that's scheduled in the required run loop modes.
+	[self.metrics recordEvent:ESHTTPOperationEventDidStart];
+	// Piggyback on an identical load if there is one (or become the first subscriber of a new one)
+	if (self.coalescesIdenticalRequests && [ESRequestCoalescer canCoalesceOperation:self])
+	{
+		self.coalesced = YES;
+		[[ESRequestCoalescer sharedCoalescer] addSubscriber:self];
+		return;
+	}
+	NSURLRequest *request = self.request;
+	// Check the cache, either skipping the network entirely or turning this into a conditional request
+	if (self.cache != nil)
+	{
+		ESHTTPCachedResponse *cachedResponse = [self.cache cachedResponseForRequest:request];
+		if ([cachedResponse isFresh])
+		{
+			[self processCachedResponse:cachedResponse];
+			return;
+		}
+		if ([cachedResponse isRevalidatable])
+		{
+			NSMutableURLRequest *conditionalRequest = [request mutableCopy];
+			if (cachedResponse.entityTag != nil)
+				[conditionalRequest setValue:cachedResponse.entityTag forHTTPHeaderField:@"If-None-Match"];
+			if (cachedResponse.lastModified != nil)
+				[conditionalRequest setValue:cachedResponse.lastModified forHTTPHeaderField:@"If-Modified-Since"];
+			// Make sure the 304 makes it to us rather than being answered by NSURLCache
+			[conditionalRequest setCachePolicy:NSURLRequestReloadIgnoringLocalCacheData];
+			request = conditionalRequest;
+			self.cachedResponse = cachedResponse;
+		}
+	}
+	self.connectionRequest = request;
+	[self startAttempt];
+}
+
+- (NSURLConnection *)newConnectionWithRequest:(NSURLRequest *)request
+// Create a connection that's scheduled in the required run loop modes.
+{
+	ESHTTPConnectionDelegate *delegate = [[ESHTTPConnectionDelegate alloc] initWithOperation:self];
+	NSURLConnection *connection = [[NSURLConnection alloc] initWithRequest:request delegate:delegate startImmediately:NO];
+	NSParameterAssert(connection != nil);
+	for (NSString * mode in self.actualRunLoopModes)
+	{
+		[connection scheduleInRunLoop:[NSRunLoop currentRunLoop] forMode:mode];
+	}
+	return connection;
+}
+
+- (NSTimer *)scheduledTimerWithTimeInterval:(NSTimeInterval)interval selector:(SEL)selector
+// Timer on this thread's run loop in the required run loop modes. The timer 
+// retains self, so it must be invalidated by the time the operation finishes.
+{
+	NSTimer *timer = [NSTimer timerWithTimeInterval:interval target:self selector:selector userInfo:nil repeats:NO];
+	for (NSString * mode in self.actualRunLoopModes)
+	{
+		[[NSRunLoop currentRunLoop] addTimer:timer forMode:mode];
+	}
+	return timer;
+}
+
+- (void)startAttempt
+{
+	NSParameterAssert(self.isActualRunLoopThread);
 	NSParameterAssert(self.connection == nil);
-	NSURLConnection *connection = [[NSURLConnection alloc] initWithRequest:self.request delegate:self startImmediately:NO];
-	self.connection = connection;
-	NSParameterAssert(self.connection != nil);
+	// The previous attempt read the body stream, retries need one that starts over
+	NSInputStream *bodyStream = [self.connectionRequest HTTPBodyStream];
+	if ((_attemptCount > 0) && [bodyStream conformsToProtocol:@protocol(NSCopying)])
+	{
+		NSMutableURLRequest *request = [self.connectionRequest mutableCopy];
+		[request setHTTPBodyStream:[bodyStream copy]];
+		self.connectionRequest = request;
+	}
+	self.connectionRequest = [self requestForAttempt:self.connectionRequest];
+	_attemptCount++;
+	self.connection = [self newConnectionWithRequest:self.connectionRequest];
+	[self.connection start];
+	if (self.hedgesRequests)
+	{
+		NSURLRequest *request = self.connectionRequest;
+		NSString *method = [[request HTTPMethod] uppercaseString];
+		BOOL idempotent = ((method == nil) || [method isEqualToString:@"GET"] || [method isEqualToString:@"HEAD"]) && ([request HTTPBody] == nil) && ([request HTTPBodyStream] == nil);
+		NSTimeInterval delay = idempotent ? [self effectiveHedgingDelay] : 0;
+		if (delay > 0)
+			self.hedgeTimer = [self scheduledTimerWithTimeInterval:delay selector:@selector(hedgeTimerDidFire:)];
+	}
+}
+
+- (NSURLRequest *)requestForAttempt:(NSURLRequest *)request
+{
+	return request;
+}
+
+- (NSTimeInterval)effectiveHedgingDelay
+{
+	if (self.hedgingDelay > 0)
+		return self.hedgingDelay;
+	ESHTTPOperationMetricsSink *sink = [[self class] metricsSink];
+	NSString *host = [self.URL host];
+	if ((sink == nil) || ([sink operationCountForHost:host] < MINIMUM_HEDGING_SAMPLES))
+		return 0;
+	NSTimeInterval delay = [sink percentile:0.95 forPhase:ESHTTPOperationPhaseTimeToFirstByte host:host];
+	if (isinf(delay))
+		return 0;
+	return delay;
+}
+
+- (void)hedgeTimerDidFire:(NSTimer *)timer
+// Still no response, race a second connection against the first
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	self.hedgeTimer = nil;
+	if ((self.state != kESOperationStateExecuting) || (self.connection == nil) || (self.hedgeConnection != nil))
+		return;
+	self.hedgeConnection = [self newConnectionWithRequest:self.connectionRequest];
+	[self.hedgeConnection start];
+}
+
+#pragma mark - Backpressure
+
+- (BOOL)shouldPauseReceiving
+{
+	return [[ESProcessingQueue sharedQueue] isBacklogged];
+}
+
+- (void)pauseReceiving
+// Takes the connections out of the run loop so no more data is read from 
+// them, the socket buffers fill and TCP flow control slows the server down.
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	NSParameterAssert(self.backpressureTimer == nil);
+	for (NSString * mode in self.actualRunLoopModes)
+	{
+		[self.connection unscheduleFromRunLoop:[NSRunLoop currentRunLoop] forMode:mode];
+		[self.hedgeConnection unscheduleFromRunLoop:[NSRunLoop currentRunLoop] forMode:mode];
+	}
+	self.backpressureTimer = [self scheduledTimerWithTimeInterval:BACKPRESSURE_POLL_INTERVAL selector:@selector(backpressureTimerDidFire:)];
+}
+
+- (void)resumeReceiving
+{
+	NSParameterAssert(self.isActualRunLoopThread);
 	for (NSString * mode in self.actualRunLoopModes)
 	{
 		[self.connection scheduleInRunLoop:[NSRunLoop currentRunLoop] forMode:mode];
+		[self.hedgeConnection scheduleInRunLoop:[NSRunLoop currentRunLoop] forMode:mode];
 	}
-	[self.connection start];
+}
+
+- (void)backpressureTimerDidFire:(NSTimer *)timer
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	self.backpressureTimer = nil;
+	if (self.state != kESOperationStateExecuting)
+		return;
+	if ([self shouldPauseReceiving])
+		self.backpressureTimer = [self scheduledTimerWithTimeInterval:BACKPRESSURE_POLL_INTERVAL selector:@selector(backpressureTimerDidFire:)];
+	else
+		[self resumeReceiving];
+}
+
+- (BOOL)canRetry
+{
+	// Anything already written to outputStream can't be taken back
+	return self.firstData || (self.dataAccumulator != nil);
+}
+
+- (void)prepareForRetry
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	self.dataAccumulator = nil;
+	self.decompressor = nil;
+	self.firstData = YES;
+	self.lastResponse = nil;
+}
+
+- (BOOL)retryAfterError:(NSError *)error response:(NSHTTPURLResponse *)response
+// Schedules another attempt if the retry policy allows it. Returns NO if the 
+// failure should finish the operation.
+{
+	ESHTTPRetryPolicy *retryPolicy = self.retryPolicy;
+	if ((retryPolicy == nil) || 
+		![self canRetry] || 
+		![retryPolicy canRetryRequest:self.connectionRequest] || 
+		![retryPolicy shouldRetryAttempt:self.attemptCount error:error response:response])
+		return NO;
+	NSTimeInterval delay = [retryPolicy delayAfterAttempt:self.attemptCount response:response];
+	[self.connection cancel];
+	self.connection = nil;
+	[self.hedgeConnection cancel];
+	self.hedgeConnection = nil;
+	[self.hedgeTimer invalidate];
+	self.hedgeTimer = nil;
+	[self.backpressureTimer invalidate];
+	self.backpressureTimer = nil;
+	[self prepareForRetry];
+	self.retryTimer = [self scheduledTimerWithTimeInterval:delay selector:@selector(retryTimerDidFire:)];
+	return YES;
+}
+
+- (void)retryTimerDidFire:(NSTimer *)timer
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	self.retryTimer = nil;
+	if (self.state != kESOperationStateExecuting)
+		return;
+	[self startAttempt];
 }
 
 - (void)operationWillFinish
@@ -150,8 +468,25 @@ static int32_t GetOperationID(void)
 {
 	NSParameterAssert(self.isActualRunLoopThread);
 	NSParameterAssert(self.state == kESOperationStateExecuting);
+	[[[self class] networkRunLoopThreadPool] operationDidEndOnThread:self.actualRunLoopThread];
+	if (self.coalesced)
+	{
+		self.coalesced = NO;
+		[[ESRequestCoalescer sharedCoalescer] removeSubscriber:self];
+	}
 	[self.connection cancel];
 	self.connection = nil;
+	[self.hedgeConnection cancel];
+	self.hedgeConnection = nil;
+	[self.hedgeTimer invalidate];
+	self.hedgeTimer = nil;
+	[self.retryTimer invalidate];
+	self.retryTimer = nil;
+	[self.backpressureTimer invalidate];
+	self.backpressureTimer = nil;
+	// Don't hang on to a partial body (or its temporary file) after failing part way through
+	self.dataAccumulator = nil;
+	self.decompressor = nil;
 	// If we have an output stream, close it at this point.	 We might never
 	// have actually opened this stream but, AFAICT, closing an unopened stream
 	// doesn't hurt.
@@ -165,28 +500,109 @@ static int32_t GetOperationID(void)
 		[self finishWithError:error];
 	else if (self.work)
 	{
-		dispatch_async(dispatch_get_processing_queue(), ^{
+		[[ESProcessingQueue sharedQueue] enqueueBlock:^{
 			NSError *error = nil;
 			id result;
+			[self.metrics recordEvent:ESHTTPOperationEventWorkStart];
 			result = self.work(self, &error);
+			[self.metrics recordEvent:ESHTTPOperationEventWorkEnd];
 			if (!error && result)
+			{
 				_processedResponse = result;
+				if (self.reusesCachedProcessedResponse)
+					[self.cache setProcessedResponse:result forRequest:self.request];
+			}
 			if (self.state == kESOperationStateExecuting)
-				[self performSelector:@selector(finishWithError:) 
+			{
+				// Pending until the completion block has seen it
+				[[ESProcessingQueue sharedQueue] resultWasProduced];
+				[[[self class] networkRunLoopThreadPool] callbackWasQueuedOnThread:self.actualRunLoopThread];
+				[self performSelector:@selector(finishWithErrorFromProcessingQueue:) 
 							 onThread:self.actualRunLoopThread 
 						   withObject:error 
 						waitUntilDone:NO];
-		});
+			}
+		} priority:[self queuePriority]];
 	}
 	else
 		[self finishWithError:nil];
 }
 
+- (void)processCachedResponse:(ESHTTPCachedResponse *)cachedResponse
+// Completes the operation with a response from cache instead of the network
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	NSParameterAssert(cachedResponse != nil);
+	self.cachedResponse = nil;
+	self.lastResponse = cachedResponse.response;
+	_responseBody = cachedResponse.data;
+	_responseFromCache = YES;
+	self.metrics.responseFromCache = YES;
+	id processedResponse = nil;
+	if (self.reusesCachedProcessedResponse)
+		processedResponse = [self.cache processedResponseForRequest:self.request];
+	if (processedResponse != nil)
+	{
+		_processedResponse = processedResponse;
+		[self finishWithError:nil];
+	}
+	else
+		[self processRequest:nil];
+}
+
+- (BOOL)isCoalescable
+{
+	return YES;
+}
+
+- (void)finishWithResultOfCoalescedOperation:(ESHTTPOperation *)op
+// Completes the operation with the result of a shared load
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	NSParameterAssert(op.isFinished);
+	// Cancelled while the result was on its way
+	if (self.state != kESOperationStateExecuting)
+		return;
+	self.lastRequest = op.lastRequest;
+	self.lastResponse = op.lastResponse;
+	@synchronized (op)
+	{
+		// Share whichever form the body is in so it's concatenated at most once per subscriber
+		_responseBody = op->_responseBody;
+		_responseBodySegments = [op->_responseBodySegments copy];
+	}
+	_processedResponse = op.processedResponse;
+	_responseFromCache = op.isResponseFromCache;
+	// The shared operation has no group, each subscriber accounts for the load in its own
+	[self.group operation:self didReceiveBytes:op.metrics.receivedByteCount ofExpectedBytes:[op.lastResponse expectedContentLength]];
+	[self finishWithError:op.error];
+}
+
+- (void)finishWithErrorFromProcessingQueue:(NSError *)error
+{
+	[[[self class] networkRunLoopThreadPool] callbackDidRunOnThread:self.actualRunLoopThread];
+	[self finishWithError:error];
+	[[ESProcessingQueue sharedQueue] resultWasConsumed];
+}
+
 - (void)finishWithError:(NSError *)error
 {
+	// A coalesced load is reported once, by the shared operation that performed it
+	BOOL coalesced = self.coalesced;
 	[super finishWithError:error];
+	ESHTTPOperationMetrics *metrics = self.metrics;
+	BOOL report = ![metrics hasEvent:ESHTTPOperationEventCompletion];
+	[metrics recordEvent:ESHTTPOperationEventCompletion];
+	if (report)
+		metrics.failed = (self.error != nil);
 	if (self.completion)
 		self.completion(self);
+	if (report)
+	{
+		if (!coalesced)
+			[[[self class] metricsSink] addMetrics:metrics];
+		[self.group operationDidFinish:self];
+	}
 }
 
 #pragma mark - NSURLConnection Delegate
@@ -195,9 +611,11 @@ static int32_t GetOperationID(void)
 // See comment in header.
 {
 	NSParameterAssert(self.isActualRunLoopThread);
-	NSParameterAssert(connection == self.connection);
-#pragma unused(connection)
+	NSParameterAssert((connection == self.connection) || (connection == self.hedgeConnection));
 	NSParameterAssert( (response == nil) || [response isKindOfClass:[NSHTTPURLResponse class]] );
+	// The hedge only gets to report redirects once it has won
+	if (connection == self.hedgeConnection)
+		return request;
 	self.lastRequest = request;
 	self.lastResponse = (NSHTTPURLResponse *)response;
 	return request;
@@ -207,11 +625,34 @@ static int32_t GetOperationID(void)
 // See comment in header.
 {
 	NSParameterAssert(self.isActualRunLoopThread);
-	NSParameterAssert(connection == self.connection);
-#pragma unused(connection)
+	NSParameterAssert((connection == self.connection) || (connection == self.hedgeConnection));
 	NSParameterAssert([response isKindOfClass:[NSHTTPURLResponse class]]);
+	// First response wins the race, if there was one
+	[self.hedgeTimer invalidate];
+	self.hedgeTimer = nil;
+	if (connection == self.hedgeConnection)
+	{
+		[self.connection cancel];
+		self.connection = connection;
+	}
+	else
+		[self.hedgeConnection cancel];
+	self.hedgeConnection = nil;
+	[self.metrics recordEvent:ESHTTPOperationEventResponse];
 	self.lastResponse = (NSHTTPURLResponse *)response;
-	if (self.cancelOnStatusCodeError && !self.isStatusCodeAcceptable)
+	if ((self.cachedResponse != nil) && ([self.lastResponse statusCode] == 304))
+	{
+		// Not Modified, the stored body is still good so don't wait for the (empty) body
+		ESHTTPCachedResponse *cachedResponse = [self.cache cachedResponse:self.cachedResponse revalidatedWithResponse:self.lastResponse forRequest:self.request];
+		[self.connection cancel];
+		self.connection = nil;
+		[self processCachedResponse:cachedResponse];
+	}
+	else if ([self retryAfterError:nil response:self.lastResponse])
+	{
+		// Don't bother downloading the error body
+	}
+	else if (self.cancelOnStatusCodeError && !self.isStatusCodeAcceptable)
 	{
 		NSDictionary *userInfo = 
 		[[NSDictionary alloc] initWithObjectsAndKeys:
@@ -237,10 +678,58 @@ static int32_t GetOperationID(void)
 - (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data
 // See comment in header.
 {
-	BOOL success;
 	NSParameterAssert(self.isActualRunLoopThread);
 	NSParameterAssert(connection == self.connection);
 #pragma unused(connection)
+	NSParameterAssert(data != nil);
+	[self.metrics recordEvent:ESHTTPOperationEventFirstData];
+	[self.metrics addReceivedByteCount:[data length]];
+	if (self.decompressesResponseBody)
+	{
+		if (self.decompressor == nil)
+		{
+			self.decompressor = [ESResponseDecompressor new];
+			// Limit what comes out, not what goes in
+			self.decompressor.maximumOutputLength = self.maximumResponseSize;
+		}
+		NSError *error = nil;
+		data = [self.decompressor decompressData:data error:&error];
+		if (data == nil)
+		{
+			[self processRequest:error];
+			return;
+		}
+		if ([data length] == 0)
+			return;
+	}
+	[self processReceivedData:data];
+	if ((self.state == kESOperationStateExecuting) && (self.backpressureTimer == nil) && [self shouldPauseReceiving])
+		[self pauseReceiving];
+}
+
+- (BOOL)finishDecompressing
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	ESResponseDecompressor *decompressor = self.decompressor;
+	if (decompressor == nil)
+		return YES;
+	self.decompressor = nil;
+	NSError *error = nil;
+	NSData *data = [decompressor finish:&error];
+	if (data == nil)
+	{
+		[self processRequest:error];
+		return NO;
+	}
+	if ([data length] > 0)
+		[self processReceivedData:data];
+	return (self.state == kESOperationStateExecuting);
+}
+
+- (void)processReceivedData:(NSData *)data
+{
+	BOOL success;
+	NSParameterAssert(self.isActualRunLoopThread);
 	NSParameterAssert(data != nil);
 	// If we don't yet have a destination for the data, calculate one.	Note that, even
 	// if there is an output stream, we don't use it for error responses.
@@ -256,7 +745,7 @@ static int32_t GetOperationID(void)
 			if (length == NSURLResponseUnknownLength)
 				length = self.defaultResponseSize;
 			if (length <= (long long)self.maximumResponseSize)
-				self.dataAccumulator = [NSMutableData dataWithCapacity:(NSUInteger)length];
+				self.dataAccumulator = [[ESResponseAccumulator alloc] initWithSpillThreshold:self.responseSpillThreshold];
 			else
 			{
 				[self processRequest:[NSError errorWithDomain:kESHTTPOperationErrorDomain code:kESHTTPOperationErrorResponseTooLarge userInfo:nil]];
@@ -277,12 +766,21 @@ static int32_t GetOperationID(void)
 	// Write the data to its destination.
 	if (success)
 	{
+		[self.group operation:self didReceiveBytes:self.metrics.receivedByteCount ofExpectedBytes:[self.lastResponse expectedContentLength]];
 		if (self.dataAccumulator != nil)
 		{
 			if (self.downloadProgress)
-				self.downloadProgress([self.dataAccumulator length] + [data length], (NSUInteger)[self.lastResponse expectedContentLength]);
+			{
+				// expectedContentLength is the encoded length
+				NSUInteger totalBytesRead = self.decompressesResponseBody ? (NSUInteger)self.metrics.receivedByteCount : [self.dataAccumulator length] + [data length];
+				self.downloadProgress(totalBytesRead, (NSUInteger)[self.lastResponse expectedContentLength]);
+			}
 			if (([self.dataAccumulator length] + [data length]) <= self.maximumResponseSize)
-				[self.dataAccumulator appendData:data];
+			{
+				NSError *error = nil;
+				if (![self.dataAccumulator appendData:data error:&error])
+					[self processRequest:error];
+			}
 			else
 				[self processRequest:[NSError errorWithDomain:kESHTTPOperationErrorDomain code:kESHTTPOperationErrorResponseTooLarge userInfo:nil]];
 		}
@@ -330,13 +828,27 @@ static int32_t GetOperationID(void)
 	NSParameterAssert(connection == self.connection);
 #pragma unused(connection)
 	NSParameterAssert(self.lastResponse != nil);
-	// Swap the data accumulator over to the response data so that we don't trigger a copy.
-	NSParameterAssert(_responseBody == nil);
-	_responseBody = _dataAccumulator;
-	_dataAccumulator = nil;
+	[self.metrics recordEvent:ESHTTPOperationEventFinishLoading];
+	if (![self finishDecompressing])
+		return;
+	// Keep the received chunks as they are, responseBody only concatenates them if it's asked for.
+	NSParameterAssert((_responseBody == nil) && (_responseBodySegments == nil));
+	// Responses written to outputStream or consumed by a subclass never make it here
+	BOOL accumulated = (_dataAccumulator != nil);
+	if (accumulated)
+	{
+		NSError *error = nil;
+		_responseBodySegments = [_dataAccumulator finish:&error];
+		_dataAccumulator = nil;
+		if (_responseBodySegments == nil)
+		{
+			[self processRequest:error];
+			return;
+		}
+	}
 	// Because we fill out _dataAccumulator lazily, an empty body will leave _dataAccumulator
 	// set to nil.	That's not what our clients expect, so we fix it here.
-	if (_responseBody == nil)
+	else
 	{
 		_responseBody = [[NSData alloc] init];
 		NSParameterAssert(_responseBody != nil);
@@ -359,16 +871,29 @@ static int32_t GetOperationID(void)
 		[self processRequest:[NSError errorWithDomain:kESHTTPOperationErrorDomain code:kESHTTPOperationErrorBadContentType userInfo:userInfo]];
 	}
 	else
+	{
+		if ((self.cache != nil) && accumulated)
+			[self.cache storeResponse:self.lastResponse segments:self.responseBodySegments forRequest:self.request];
 		[self processRequest:nil];
+	}
 }
 
 - (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error
 // See comment in header.
 {
 	NSParameterAssert(self.isActualRunLoopThread);
-	NSParameterAssert(connection == self.connection);
-#pragma unused(connection)
+	NSParameterAssert((connection == self.connection) || (connection == self.hedgeConnection));
 	NSParameterAssert(error != nil);
+	if (self.hedgeConnection != nil)
+	{
+		// One of the racing connections failed, let the other one carry on
+		if (connection == self.connection)
+			self.connection = self.hedgeConnection;
+		self.hedgeConnection = nil;
+		return;
+	}
+	if ([self retryAfterError:error response:nil])
+		return;
 	[self processRequest:error];
 }
 
@@ -379,6 +904,19 @@ totalBytesExpectedToWrite:(NSInteger)totalBytesExpectedToWrite
 {
     if (self.uploadProgress)
         self.uploadProgress(totalBytesWritten, totalBytesExpectedToWrite);
+    [self.group operation:self didSendBytes:(unsigned long long)totalBytesWritten ofExpectedBytes:totalBytesExpectedToWrite];
+}
+
+- (NSInputStream *)connection:(NSURLConnection *)connection needNewBodyStream:(NSURLRequest *)request
+// Sent when a redirect or authentication challenge means the body has to be 
+// sent again. Only streams that can be copied (like ESMultipartFormData's) 
+// can start over, anything else fails the load.
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	NSInputStream *bodyStream = [request HTTPBodyStream];
+	if ([bodyStream conformsToProtocol:@protocol(NSCopying)])
+		return [bodyStream copy];
+	return nil;
 }
 
 - (NSCachedURLResponse *)connection:(NSURLConnection *)connection 
@@ -403,15 +941,51 @@ totalBytesExpectedToWrite:(NSInteger)totalBytesExpectedToWrite
 
 - (NSThread *)actualRunLoopThread
 // Returns the effective run loop thread, that is, the one set by the user 
-// or, if that's not set, the network thread.
+// or, if that's not set, a thread from the network pool.
 {
     NSThread *result;
     result = self.runLoopThread;
     if (result == nil)
-        result = [[self class] networkRunLoopThread];
+    {
+        // Pin the pool thread the first time it's asked for so that every 
+        // callback for this operation lands on the same thread.
+        @synchronized (self)
+        {
+            if (self.runLoopThread == nil)
+                self.runLoopThread = [[[self class] networkRunLoopThreadPool] threadForHost:[self.URL host]];
+            result = self.runLoopThread;
+        }
+    }
     return result;
 }
 
+- (NSData *)responseBody
+{
+	@synchronized (self)
+	{
+		if ((_responseBody == nil) && (_responseBodySegments != nil))
+		{
+			// Don't keep two copies of the body around, not even while concatenating
+			NSMutableArray *segments = [_responseBodySegments mutableCopy];
+			_responseBodySegments = nil;
+			_responseBody = [ESResponseAccumulator dataByConsumingSegments:segments];
+		}
+		return _responseBody;
+	}
+}
+
+- (NSArray *)responseBodySegments
+{
+	@synchronized (self)
+	{
+		if (_responseBodySegments != nil)
+			return _responseBodySegments;
+		if (_responseBody != nil)
+			return [NSArray arrayWithObject:_responseBody];
+		return nil;
+	}
+}
+
 - (NSString *)description
 {
 	return [NSString stringWithFormat:@"<%@ : %p>\n{\n\tRequest: %@\n\tResponse: %@\n\tID: %d\n\tError: %@\n}", NSStringFromClass([self class]), self, self.request, self.lastResponse, self.operationID, self.error];
@@ -602,6 +1176,33 @@ totalBytesExpectedToWrite:(NSInteger)totalBytesExpectedToWrite
 	}
 }
 
++ (BOOL)automaticallyNotifiesObserversOfResponseSpillThreshold
+{
+	return NO;
+}
+
+- (NSUInteger)responseSpillThreshold
+{
+	return _responseSpillThreshold;
+}
+
+- (void)setResponseSpillThreshold:(NSUInteger)newValue
+{
+	if (self.dataAccumulator != nil)
+	{
+		NSParameterAssert(NO);
+	}
+	else
+	{
+		if (newValue != _responseSpillThreshold)
+		{
+			[self willChangeValueForKey:@"responseSpillThreshold"];
+			_responseSpillThreshold = newValue;
+			[self didChangeValueForKey:@"responseSpillThreshold"];
+		}
+	}
+}
+
 - (NSURL *)URL
 {
 	return [self.request URL];
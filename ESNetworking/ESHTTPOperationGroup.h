@@ -0,0 +1,85 @@
+//
+//  ESHTTPOperationGroup.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class ESHTTPOperation;
+@class ESHTTPOperationGroup;
+typedef void (^ESHTTPOperationGroupProgressBlock)(ESHTTPOperationGroup *group);
+
+/**
+ * Collects ESHTTPOperations that belong together (the requests made by one screen, say) so they can be 
+ * cancelled together and their byte progress followed as a whole.
+ *
+ * The group holds on to operations until they finish. Operations that finish stay in the progress totals 
+ * until -resetProgress.
+ *
+ * All methods are thread safe.
+ */
+
+@interface ESHTTPOperationGroup : NSObject
+
+/**
+ * Cancels operations with one trip to each run loop thread they're running on, rather than one per operation. 
+ * Unlike -[NSOperation cancel] this doesn't wait for the cancellations to happen.
+ */
++ (void)cancelOperations:(NSArray *)operations;
+
+/**
+ * Adds op to the group, must be called before op is queued
+ */
+- (void)addOperation:(ESHTTPOperation *)op;
+/**
+ * Operations that haven't finished yet
+ */
+- (NSArray *)operations;
+- (NSUInteger)operationCount;
+/**
+ * Cancels every operation that hasn't finished
+ *
+ * @see cancelOperations:
+ */
+- (void)cancelAllOperations;
+
+///-----------------
+/// @name Progress
+///-----------------
+
+// Totals across operations, an operation that doesn't know its expected length counts 
+// what it has transferred so far as expected until it finishes.
+
+@property (assign, readonly) unsigned long long bytesSent;
+@property (assign, readonly) unsigned long long bytesExpectedToSend;
+@property (assign, readonly) unsigned long long bytesReceived;
+@property (assign, readonly) unsigned long long bytesExpectedToReceive;
+
+/**
+ * Called whenever the totals change, on the run loop thread of the operation that changed them
+ */
+@property (copy, readwrite) ESHTTPOperationGroupProgressBlock progress;
+
+- (void)resetProgress;
+
+// Called by ESHTTPOperation on its run loop thread
+
+- (void)operation:(ESHTTPOperation *)op didSendBytes:(unsigned long long)bytes ofExpectedBytes:(long long)expectedBytes;
+- (void)operation:(ESHTTPOperation *)op didReceiveBytes:(unsigned long long)bytes ofExpectedBytes:(long long)expectedBytes;
+- (void)operationDidFinish:(ESHTTPOperation *)op;
+
+@end
@@ -0,0 +1,245 @@
+//
+//  ESHTTPOperationGroup.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESHTTPOperationGroup.h"
+#import "ESHTTPOperation.h"
+#import <libkern/OSAtomic.h>
+
+/**
+ * Last reported progress of one operation
+ */
+@interface ESHTTPOperationGroupProgress : NSObject
+{
+@public
+	unsigned long long _sent;
+	unsigned long long _expectedToSend;
+	unsigned long long _received;
+	unsigned long long _expectedToReceive;
+}
+@end
+
+@implementation ESHTTPOperationGroupProgress
+@end
+
+@interface ESHTTPOperationGroup ()
++ (void)cancelOperationsOnCurrentThread:(NSArray *)operations;
+- (void)updateProgressForOperation:(ESHTTPOperation *)op withBlock:(void (^)(ESHTTPOperationGroupProgress *progress))block;
+@end
+
+@implementation ESHTTPOperationGroup
+{
+	OSSpinLock _lock;
+	NSMutableArray *_operations;
+	NSMutableDictionary *_progressByOperationID;
+	unsigned long long _bytesSent;
+	unsigned long long _bytesExpectedToSend;
+	unsigned long long _bytesReceived;
+	unsigned long long _bytesExpectedToReceive;
+}
+@synthesize progress=_progress;
+
++ (void)cancelOperations:(NSArray *)operations
+{
+	// Operations that haven't started pick up isCancelled in -startOnRunLoopThread, 
+	// only executing ones need a trip to their thread
+	NSMutableArray *threads = [NSMutableArray array];
+	NSMutableArray *operationsByThread = [NSMutableArray array];
+	NSMutableArray *modesByThread = [NSMutableArray array];
+	for (ESHTTPOperation *op in operations)
+	{
+		if (![op markCancelled] || (op.state != kESOperationStateExecuting))
+			continue;
+		NSThread *thread = op.actualRunLoopThread;
+		NSUInteger index = [threads indexOfObjectIdenticalTo:thread];
+		if (index == NSNotFound)
+		{
+			index = [threads count];
+			[threads addObject:thread];
+			[operationsByThread addObject:[NSMutableArray array]];
+			[modesByThread addObject:[NSMutableSet set]];
+		}
+		[[operationsByThread objectAtIndex:index] addObject:op];
+		[[modesByThread objectAtIndex:index] unionSet:op.actualRunLoopModes];
+	}
+	[threads enumerateObjectsUsingBlock:^(NSThread *thread, NSUInteger idx, BOOL *stop) {
+		[[ESHTTPOperation networkRunLoopThreadPool] callbackWasQueuedOnThread:thread];
+		[self performSelector:@selector(cancelOperationsOnCurrentThread:) 
+					 onThread:thread 
+				   withObject:[operationsByThread objectAtIndex:idx] 
+				waitUntilDone:NO 
+						modes:[[modesByThread objectAtIndex:idx] allObjects]];
+	}];
+}
+
++ (void)cancelOperationsOnCurrentThread:(NSArray *)operations
+{
+	[[ESHTTPOperation networkRunLoopThreadPool] callbackDidRunOnThread:[NSThread currentThread]];
+	for (ESHTTPOperation *op in operations)
+		[op cancelOnRunLoopThread];
+}
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_lock = OS_SPINLOCK_INIT;
+		_operations = [NSMutableArray new];
+		_progressByOperationID = [NSMutableDictionary new];
+	}
+	return self;
+}
+
+- (void)addOperation:(ESHTTPOperation *)op
+{
+	NSParameterAssert(op != nil);
+	NSParameterAssert(op.group == nil);
+	NSParameterAssert(op.state == kESOperationStateInited);
+	op.group = self;
+	OSSpinLockLock(&_lock);
+	[_operations addObject:op];
+	OSSpinLockUnlock(&_lock);
+}
+
+- (NSArray *)operations
+{
+	OSSpinLockLock(&_lock);
+	NSArray *operations = [_operations copy];
+	OSSpinLockUnlock(&_lock);
+	return operations;
+}
+
+- (NSUInteger)operationCount
+{
+	OSSpinLockLock(&_lock);
+	NSUInteger count = [_operations count];
+	OSSpinLockUnlock(&_lock);
+	return count;
+}
+
+- (void)cancelAllOperations
+{
+	[[self class] cancelOperations:[self operations]];
+}
+
+#pragma mark - Progress
+
+- (unsigned long long)bytesSent
+{
+	OSSpinLockLock(&_lock);
+	unsigned long long bytes = _bytesSent;
+	OSSpinLockUnlock(&_lock);
+	return bytes;
+}
+
+- (unsigned long long)bytesExpectedToSend
+{
+	OSSpinLockLock(&_lock);
+	unsigned long long bytes = _bytesExpectedToSend;
+	OSSpinLockUnlock(&_lock);
+	return bytes;
+}
+
+- (unsigned long long)bytesReceived
+{
+	OSSpinLockLock(&_lock);
+	unsigned long long bytes = _bytesReceived;
+	OSSpinLockUnlock(&_lock);
+	return bytes;
+}
+
+- (unsigned long long)bytesExpectedToReceive
+{
+	OSSpinLockLock(&_lock);
+	unsigned long long bytes = _bytesExpectedToReceive;
+	OSSpinLockUnlock(&_lock);
+	return bytes;
+}
+
+- (void)resetProgress
+{
+	OSSpinLockLock(&_lock);
+	[_progressByOperationID removeAllObjects];
+	_bytesSent = 0;
+	_bytesExpectedToSend = 0;
+	_bytesReceived = 0;
+	_bytesExpectedToReceive = 0;
+	OSSpinLockUnlock(&_lock);
+}
+
+- (void)updateProgressForOperation:(ESHTTPOperation *)op withBlock:(void (^)(ESHTTPOperationGroupProgress *progress))block
+// Swaps the operation's previous numbers in the totals for the ones block sets
+{
+	NSNumber *operationID = [NSNumber numberWithInteger:op.operationID];
+	ESHTTPOperationGroupProgress *newProgress = [ESHTTPOperationGroupProgress new];
+	OSSpinLockLock(&_lock);
+	ESHTTPOperationGroupProgress *progress = [_progressByOperationID objectForKey:operationID];
+	if (progress == nil)
+	{
+		progress = newProgress;
+		[_progressByOperationID setObject:progress forKey:operationID];
+	}
+	_bytesSent -= progress->_sent;
+	_bytesExpectedToSend -= progress->_expectedToSend;
+	_bytesReceived -= progress->_received;
+	_bytesExpectedToReceive -= progress->_expectedToReceive;
+	block(progress);
+	_bytesSent += progress->_sent;
+	_bytesExpectedToSend += progress->_expectedToSend;
+	_bytesReceived += progress->_received;
+	_bytesExpectedToReceive += progress->_expectedToReceive;
+	ESHTTPOperationGroupProgressBlock progressBlock = _progress;
+	OSSpinLockUnlock(&_lock);
+	if (progressBlock)
+		progressBlock(self);
+}
+
+- (void)operation:(ESHTTPOperation *)op didSendBytes:(unsigned long long)bytes ofExpectedBytes:(long long)expectedBytes
+{
+	[self updateProgressForOperation:op withBlock:^(ESHTTPOperationGroupProgress *progress) {
+		progress->_sent = bytes;
+		progress->_expectedToSend = (expectedBytes < 0) ? bytes : MAX((unsigned long long)expectedBytes, bytes);
+	}];
+}
+
+- (void)operation:(ESHTTPOperation *)op didReceiveBytes:(unsigned long long)bytes ofExpectedBytes:(long long)expectedBytes
+{
+	[self updateProgressForOperation:op withBlock:^(ESHTTPOperationGroupProgress *progress) {
+		progress->_received = bytes;
+		progress->_expectedToReceive = (expectedBytes < 0) ? bytes : MAX((unsigned long long)expectedBytes, bytes);
+	}];
+}
+
+- (void)operationDidFinish:(ESHTTPOperation *)op
+{
+	OSSpinLockLock(&_lock);
+	[_operations removeObjectIdenticalTo:op];
+	OSSpinLockUnlock(&_lock);
+	// Whatever didn't arrive isn't going to, don't leave the totals waiting for it
+	[self updateProgressForOperation:op withBlock:^(ESHTTPOperationGroupProgress *progress) {
+		progress->_expectedToSend = progress->_sent;
+		progress->_expectedToReceive = progress->_received;
+	}];
+}
+
+@end
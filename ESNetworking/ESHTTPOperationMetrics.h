@@ -0,0 +1,176 @@
+//
+//  ESHTTPOperationMetrics.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Transitions timestamped over the life of an ESHTTPOperation, in the order they normally happen
+ */
+typedef enum {
+	ESHTTPOperationEventCreated,		// -init
+	ESHTTPOperationEventStart,			// -start, called by the queue or scheduler
+	ESHTTPOperationEventDidStart,		// -operationDidStart, on the run loop thread
+	ESHTTPOperationEventResponse,		// -connection:didReceiveResponse:
+	ESHTTPOperationEventFirstData,		// first -connection:didReceiveData:
+	ESHTTPOperationEventFinishLoading,	// -connectionDidFinishLoading:
+	ESHTTPOperationEventWorkStart,		// work block called on the processing queue
+	ESHTTPOperationEventWorkEnd,		// work block returned
+	ESHTTPOperationEventCompletion,		// operation finished, about to call the completion block
+	ESHTTPOperationEventCount
+} ESHTTPOperationEvent;
+
+/**
+ * Intervals between events
+ */
+typedef enum {
+	ESHTTPOperationPhaseQueued,				// Created -> Start
+	ESHTTPOperationPhaseThreadWait,			// Start -> DidStart, waiting on the network thread
+	ESHTTPOperationPhaseTimeToFirstByte,	// DidStart -> Response
+	ESHTTPOperationPhaseTransfer,			// Response -> FinishLoading, body transfer
+	ESHTTPOperationPhaseWorkWait,			// last network event -> WorkStart, waiting on the processing queue
+	ESHTTPOperationPhaseWork,				// WorkStart -> WorkEnd
+	ESHTTPOperationPhaseCompletionHop,		// WorkEnd (or last network event) -> Completion, back to the network thread
+	ESHTTPOperationPhaseTotal,				// Start -> Completion
+	ESHTTPOperationPhaseCount
+} ESHTTPOperationPhase;
+
+/**
+ * Monotonic (mach_absolute_time) timestamps of an operation's transitions.
+ *
+ * Each event is only recorded the first time it happens. Events are recorded on whatever thread the
+ * transition happens on, read the metrics once the operation has finished.
+ */
+
+@interface ESHTTPOperationMetrics : NSObject
+
+- (id)initWithOperationID:(NSInteger)operationID host:(NSString *)host; // designated initializer
+
+@property (assign, readonly) NSInteger operationID;
+@property (copy, readonly) NSString *host;
+@property (assign, readwrite) BOOL responseFromCache;
+/**
+ * YES if the operation finished with an error (including cancellation)
+ */
+@property (assign, readwrite) BOOL failed;
+@property (assign, readonly) unsigned long long receivedByteCount;
+
+- (void)recordEvent:(ESHTTPOperationEvent)event;
+- (void)addReceivedByteCount:(NSUInteger)byteCount;
+
+/**
+ * YES if event has been recorded
+ */
+- (BOOL)hasEvent:(ESHTTPOperationEvent)event;
+/**
+ * Seconds between the creation of the operation and event, negative if event hasn't been recorded
+ */
+- (NSTimeInterval)timeOfEvent:(ESHTTPOperationEvent)event;
+/**
+ * Duration of phase in seconds, negative if the operation didn't go through it
+ * (a fresh cached response has no network phases, an operation without a work block has no work phases, etc.)
+ */
+- (NSTimeInterval)intervalForPhase:(ESHTTPOperationPhase)phase;
+
++ (NSString *)nameForPhase:(ESHTTPOperationPhase)phase;
+
+@end
+
+/**
+ * Keys for the dictionary returned by -summaryForHost:
+ */
+extern NSString *const kESHTTPOperationMetricsOperationCountKey; // NSNumber, operations reported
+extern NSString *const kESHTTPOperationMetricsFailedOperationCountKey; // NSNumber, operations that finished with an error
+extern NSString *const kESHTTPOperationMetricsReceivedByteCountKey; // NSNumber, bytes received over the network
+extern NSString *const kESHTTPOperationMetricsOperationsPerSecondKey; // NSNumber, operations completed per second between the first start and the last completion
+extern NSString *const kESHTTPOperationMetricsPhasesKey; // NSDictionary, phase name -> NSDictionary with the percentile keys below
+extern NSString *const kESHTTPOperationMetricsMedianKey; // NSNumber, seconds
+extern NSString *const kESHTTPOperationMetricsP99Key; // NSNumber, seconds
+extern NSString *const kESHTTPOperationMetricsPeakResidentSizeKey; // NSNumber, bytes, for the whole process
+
+/**
+ * Aggregates ESHTTPOperationMetrics into per host histograms of each phase.
+ *
+ * Histograms have logarithmic buckets, bucket 0 counts intervals under a millisecond and each
+ * following bucket doubles the upper bound (1ms, 2ms, 4ms, ...). The last bucket counts everything
+ * past the second to last bound.
+ *
+ * All methods are thread safe.
+ */
+
+@interface ESHTTPOperationMetricsSink : NSObject
+
+/**
+ * Sink ESHTTPOperation reports to by default
+ *
+ * @see [ESHTTPOperation setMetricsSink:]
+ */
++ (id)sharedSink;
+
+/**
+ * Upper bound of each histogram bucket in seconds
+ */
++ (NSArray *)histogramBucketUpperBounds;
+
+- (void)addMetrics:(ESHTTPOperationMetrics *)metrics;
+- (void)reset;
+
+/**
+ * Hosts that have reported metrics
+ */
+- (NSArray *)hosts;
+
+// For all of these, a nil host aggregates every host
+
+/**
+ * Number of operations reported
+ */
+- (NSUInteger)operationCountForHost:(NSString *)host;
+/**
+ * Array of NSNumber counts, one for each bucket in histogramBucketUpperBounds
+ */
+- (NSArray *)histogramForPhase:(ESHTTPOperationPhase)phase host:(NSString *)host;
+/**
+ * Given percentile (0.0 - 1.0), interpolated within the bucket containing it. Negative if there are no samples, infinite if it falls in the last bucket
+ */
+- (NSTimeInterval)percentile:(double)percentile forPhase:(ESHTTPOperationPhase)phase host:(NSString *)host;
+
+///-----------------
+/// @name Summaries
+///-----------------
+
+/**
+ * Throughput, median and 99th percentile of every phase and peak memory, for comparing runs of the
+ * same workload before and after a change. -reset the sink before a run, throughput is measured from
+ * the first operation's start to the last operation's completion.
+ *
+ * Phases without samples are left out.
+ *
+ * @see ESHTTPBenchmark
+ */
+- (NSDictionary *)summaryForHost:(NSString *)host;
+/**
+ * summaryForHost: as one line per value, suitable for logging
+ */
+- (NSString *)formattedSummaryForHost:(NSString *)host;
+/**
+ * Largest resident size of the process so far, in bytes
+ */
++ (unsigned long long)peakResidentSize;
+
+@end
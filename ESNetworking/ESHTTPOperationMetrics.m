@@ -0,0 +1,495 @@
+//
+//  ESHTTPOperationMetrics.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESHTTPOperationMetrics.h"
+#include <mach/mach_time.h>
+#include <math.h>
+#include <sys/resource.h>
+
+#define HISTOGRAM_BUCKET_COUNT 22
+
+NSString *const kESHTTPOperationMetricsOperationCountKey = @"operationCount";
+NSString *const kESHTTPOperationMetricsFailedOperationCountKey = @"failedOperationCount";
+NSString *const kESHTTPOperationMetricsReceivedByteCountKey = @"receivedByteCount";
+NSString *const kESHTTPOperationMetricsOperationsPerSecondKey = @"operationsPerSecond";
+NSString *const kESHTTPOperationMetricsPhasesKey = @"phases";
+NSString *const kESHTTPOperationMetricsMedianKey = @"p50";
+NSString *const kESHTTPOperationMetricsP99Key = @"p99";
+NSString *const kESHTTPOperationMetricsPeakResidentSizeKey = @"peakResidentSize";
+
+static double SecondsPerMachTimeUnit(void)
+{
+	static double secondsPerUnit;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		mach_timebase_info_data_t timebase;
+		mach_timebase_info(&timebase);
+		secondsPerUnit = ((double)timebase.numer / (double)timebase.denom) / 1e9;
+	});
+	return secondsPerUnit;
+}
+
+static NSUInteger HistogramBucketForInterval(NSTimeInterval interval)
+{
+	double milliseconds = interval * 1000.0;
+	if (milliseconds < 1.0)
+		return 0;
+	NSUInteger bucket = (NSUInteger)floor(log2(milliseconds)) + 1;
+	if (bucket >= HISTOGRAM_BUCKET_COUNT)
+		bucket = HISTOGRAM_BUCKET_COUNT - 1;
+	return bucket;
+}
+
+static NSTimeInterval HistogramBucketUpperBound(NSUInteger bucket)
+{
+	if (bucket == HISTOGRAM_BUCKET_COUNT - 1)
+		return INFINITY;
+	return ldexp(1.0, (int)bucket) / 1000.0;
+}
+
+static NSTimeInterval HistogramBucketLowerBound(NSUInteger bucket)
+{
+	if (bucket == 0)
+		return 0.0;
+	return HistogramBucketUpperBound(bucket - 1);
+}
+
+@interface ESHTTPOperationMetrics ()
+- (NSTimeInterval)intervalFromEvent:(ESHTTPOperationEvent)from toEvent:(ESHTTPOperationEvent)to;
+- (ESHTTPOperationEvent)lastNetworkEvent;
+- (uint64_t)machTimeOfEvent:(ESHTTPOperationEvent)event;
+@end
+
+@implementation ESHTTPOperationMetrics
+{
+	uint64_t _timestamps[ESHTTPOperationEventCount];
+}
+@synthesize operationID=_operationID;
+@synthesize host=_host;
+@synthesize responseFromCache=_responseFromCache;
+@synthesize failed=_failed;
+@synthesize receivedByteCount=_receivedByteCount;
+
+- (id)initWithOperationID:(NSInteger)operationID host:(NSString *)host
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_operationID = operationID;
+		_host = [host copy];
+		[self recordEvent:ESHTTPOperationEventCreated];
+	}
+	return self;
+}
+
+- (id)init
+{
+	return [self initWithOperationID:0 host:nil];
+}
+
+- (void)recordEvent:(ESHTTPOperationEvent)event
+{
+	NSParameterAssert(event < ESHTTPOperationEventCount);
+	if (_timestamps[event] == 0)
+		_timestamps[event] = mach_absolute_time();
+}
+
+- (void)addReceivedByteCount:(NSUInteger)byteCount
+{
+	_receivedByteCount += byteCount;
+}
+
+- (BOOL)hasEvent:(ESHTTPOperationEvent)event
+{
+	NSParameterAssert(event < ESHTTPOperationEventCount);
+	return (_timestamps[event] != 0);
+}
+
+- (uint64_t)machTimeOfEvent:(ESHTTPOperationEvent)event
+// 0 if event hasn't been recorded
+{
+	NSParameterAssert(event < ESHTTPOperationEventCount);
+	return _timestamps[event];
+}
+
+- (NSTimeInterval)intervalFromEvent:(ESHTTPOperationEvent)from toEvent:(ESHTTPOperationEvent)to
+{
+	if ((_timestamps[from] == 0) || (_timestamps[to] == 0) || (_timestamps[to] < _timestamps[from]))
+		return -1.0;
+	return (double)(_timestamps[to] - _timestamps[from]) * SecondsPerMachTimeUnit();
+}
+
+- (NSTimeInterval)timeOfEvent:(ESHTTPOperationEvent)event
+{
+	return [self intervalFromEvent:ESHTTPOperationEventCreated toEvent:event];
+}
+
+- (ESHTTPOperationEvent)lastNetworkEvent
+// The last thing that happened before the response was handed off for processing
+{
+	if (_timestamps[ESHTTPOperationEventFinishLoading] != 0)
+		return ESHTTPOperationEventFinishLoading;
+	if (_timestamps[ESHTTPOperationEventResponse] != 0)
+		return ESHTTPOperationEventResponse;
+	return ESHTTPOperationEventDidStart;
+}
+
+- (NSTimeInterval)intervalForPhase:(ESHTTPOperationPhase)phase
+{
+	switch (phase) {
+		case ESHTTPOperationPhaseQueued:
+			return [self intervalFromEvent:ESHTTPOperationEventCreated toEvent:ESHTTPOperationEventStart];
+		case ESHTTPOperationPhaseThreadWait:
+			return [self intervalFromEvent:ESHTTPOperationEventStart toEvent:ESHTTPOperationEventDidStart];
+		case ESHTTPOperationPhaseTimeToFirstByte:
+			return [self intervalFromEvent:ESHTTPOperationEventDidStart toEvent:ESHTTPOperationEventResponse];
+		case ESHTTPOperationPhaseTransfer:
+			return [self intervalFromEvent:ESHTTPOperationEventResponse toEvent:ESHTTPOperationEventFinishLoading];
+		case ESHTTPOperationPhaseWorkWait:
+			return [self intervalFromEvent:[self lastNetworkEvent] toEvent:ESHTTPOperationEventWorkStart];
+		case ESHTTPOperationPhaseWork:
+			return [self intervalFromEvent:ESHTTPOperationEventWorkStart toEvent:ESHTTPOperationEventWorkEnd];
+		case ESHTTPOperationPhaseCompletionHop:
+			if (_timestamps[ESHTTPOperationEventWorkEnd] != 0)
+				return [self intervalFromEvent:ESHTTPOperationEventWorkEnd toEvent:ESHTTPOperationEventCompletion];
+			return [self intervalFromEvent:[self lastNetworkEvent] toEvent:ESHTTPOperationEventCompletion];
+		case ESHTTPOperationPhaseTotal:
+			return [self intervalFromEvent:ESHTTPOperationEventStart toEvent:ESHTTPOperationEventCompletion];
+		default:
+			break;
+	}
+	return -1.0;
+}
+
++ (NSString *)nameForPhase:(ESHTTPOperationPhase)phase
+{
+	switch (phase) {
+		case ESHTTPOperationPhaseQueued:
+			return @"queued";
+		case ESHTTPOperationPhaseThreadWait:
+			return @"threadWait";
+		case ESHTTPOperationPhaseTimeToFirstByte:
+			return @"timeToFirstByte";
+		case ESHTTPOperationPhaseTransfer:
+			return @"transfer";
+		case ESHTTPOperationPhaseWorkWait:
+			return @"workWait";
+		case ESHTTPOperationPhaseWork:
+			return @"work";
+		case ESHTTPOperationPhaseCompletionHop:
+			return @"completionHop";
+		case ESHTTPOperationPhaseTotal:
+			return @"total";
+		default:
+			break;
+	}
+	return nil;
+}
+
+- (NSString *)description
+{
+	NSMutableString *description = [NSMutableString stringWithFormat:@"<%@ : %p>\n{\n\tID: %d\n\tHost: %@\n\tBytes: %llu\n\tFrom Cache: %d\n\tFailed: %d", NSStringFromClass([self class]), self, self.operationID, self.host, self.receivedByteCount, self.responseFromCache, self.failed];
+	for (NSUInteger phase = 0; phase < ESHTTPOperationPhaseCount; phase++)
+	{
+		NSTimeInterval interval = [self intervalForPhase:(ESHTTPOperationPhase)phase];
+		if (interval >= 0)
+			[description appendFormat:@"\n\t%@: %.2fms", [[self class] nameForPhase:(ESHTTPOperationPhase)phase], interval * 1000.0];
+	}
+	[description appendString:@"\n}"];
+	return description;
+}
+
+@end
+
+@interface ESHTTPOperationHistogramSet : NSObject
+{
+@public
+	NSUInteger _operationCount;
+	NSUInteger _failedOperationCount;
+	unsigned long long _receivedByteCount;
+	uint64_t _firstStart;
+	uint64_t _lastCompletion;
+	uint32_t _counts[ESHTTPOperationPhaseCount][HISTOGRAM_BUCKET_COUNT];
+}
+@end
+
+@implementation ESHTTPOperationHistogramSet
+@end
+
+@interface ESHTTPOperationMetricsSink ()
+- (ESHTTPOperationHistogramSet *)histogramSetForHost:(NSString *)host;
+- (NSTimeInterval)percentile:(double)percentile forPhase:(ESHTTPOperationPhase)phase histograms:(ESHTTPOperationHistogramSet *)histograms;
+@end
+
+@implementation ESHTTPOperationMetricsSink
+{
+	dispatch_queue_t _queue;
+	NSMutableDictionary *_histogramsByHost;
+	ESHTTPOperationHistogramSet *_allHosts;
+}
+
++ (id)sharedSink
+{
+	static id sharedSink = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedSink = [[self class] new];
+	});
+	return sharedSink;
+}
+
++ (NSArray *)histogramBucketUpperBounds
+{
+	NSMutableArray *bounds = [NSMutableArray arrayWithCapacity:HISTOGRAM_BUCKET_COUNT];
+	for (NSUInteger bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT; bucket++)
+		[bounds addObject:[NSNumber numberWithDouble:HistogramBucketUpperBound(bucket)]];
+	return bounds;
+}
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_queue = dispatch_queue_create("com.everythingsolution.httpoperationmetrics", 0);
+		_histogramsByHost = [NSMutableDictionary new];
+		_allHosts = [ESHTTPOperationHistogramSet new];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	dispatch_release(_queue);
+}
+
+- (ESHTTPOperationHistogramSet *)histogramSetForHost:(NSString *)host
+// Call on _queue
+{
+	if (host == nil)
+		return _allHosts;
+	return [_histogramsByHost objectForKey:host];
+}
+
+- (void)addMetrics:(ESHTTPOperationMetrics *)metrics
+{
+	NSParameterAssert(metrics != nil);
+	// Work out the intervals on the calling thread, the queue only does the counting.
+	// Blocks can't capture arrays, but they can capture a struct that holds one.
+	struct { NSUInteger index[ESHTTPOperationPhaseCount]; } buckets;
+	for (NSUInteger phase = 0; phase < ESHTTPOperationPhaseCount; phase++)
+	{
+		NSTimeInterval interval = [metrics intervalForPhase:(ESHTTPOperationPhase)phase];
+		buckets.index[phase] = (interval < 0) ? NSNotFound : HistogramBucketForInterval(interval);
+	}
+	NSString *host = metrics.host;
+	if (host == nil)
+		host = @"";
+	BOOL failed = metrics.failed;
+	unsigned long long receivedByteCount = metrics.receivedByteCount;
+	uint64_t start = [metrics machTimeOfEvent:ESHTTPOperationEventStart];
+	uint64_t completion = [metrics machTimeOfEvent:ESHTTPOperationEventCompletion];
+	void (^addTotals)(ESHTTPOperationHistogramSet *) = ^(ESHTTPOperationHistogramSet *histograms) {
+		histograms->_operationCount++;
+		if (failed)
+			histograms->_failedOperationCount++;
+		histograms->_receivedByteCount += receivedByteCount;
+		if ((start != 0) && ((histograms->_firstStart == 0) || (start < histograms->_firstStart)))
+			histograms->_firstStart = start;
+		if (completion > histograms->_lastCompletion)
+			histograms->_lastCompletion = completion;
+	};
+	dispatch_async(_queue, ^{
+		ESHTTPOperationHistogramSet *hostHistograms = [_histogramsByHost objectForKey:host];
+		if (hostHistograms == nil)
+		{
+			hostHistograms = [ESHTTPOperationHistogramSet new];
+			[_histogramsByHost setObject:hostHistograms forKey:host];
+		}
+		addTotals(hostHistograms);
+		addTotals(_allHosts);
+		for (NSUInteger phase = 0; phase < ESHTTPOperationPhaseCount; phase++)
+		{
+			if (buckets.index[phase] == NSNotFound)
+				continue;
+			hostHistograms->_counts[phase][buckets.index[phase]]++;
+			_allHosts->_counts[phase][buckets.index[phase]]++;
+		}
+	});
+}
+
+- (void)reset
+{
+	dispatch_async(_queue, ^{
+		[_histogramsByHost removeAllObjects];
+		_allHosts = [ESHTTPOperationHistogramSet new];
+	});
+}
+
+- (NSArray *)hosts
+{
+	__block NSArray *hosts;
+	dispatch_sync(_queue, ^{
+		hosts = [_histogramsByHost allKeys];
+	});
+	return hosts;
+}
+
+- (NSUInteger)operationCountForHost:(NSString *)host
+{
+	__block NSUInteger count = 0;
+	dispatch_sync(_queue, ^{
+		ESHTTPOperationHistogramSet *histograms = [self histogramSetForHost:host];
+		if (histograms != nil)
+			count = histograms->_operationCount;
+	});
+	return count;
+}
+
+- (NSArray *)histogramForPhase:(ESHTTPOperationPhase)phase host:(NSString *)host
+{
+	NSParameterAssert(phase < ESHTTPOperationPhaseCount);
+	NSMutableArray *histogram = [NSMutableArray arrayWithCapacity:HISTOGRAM_BUCKET_COUNT];
+	dispatch_sync(_queue, ^{
+		ESHTTPOperationHistogramSet *histograms = [self histogramSetForHost:host];
+		for (NSUInteger bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT; bucket++)
+			[histogram addObject:[NSNumber numberWithUnsignedInt:(histograms != nil) ? histograms->_counts[phase][bucket] : 0]];
+	});
+	return histogram;
+}
+
+- (NSTimeInterval)percentile:(double)percentile forPhase:(ESHTTPOperationPhase)phase histograms:(ESHTTPOperationHistogramSet *)histograms
+// Call on _queue
+{
+	if (histograms == nil)
+		return -1.0;
+	unsigned long long total = 0;
+	for (NSUInteger bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT; bucket++)
+		total += histograms->_counts[phase][bucket];
+	if (total == 0)
+		return -1.0;
+	unsigned long long target = (unsigned long long)ceil(percentile * (double)total);
+	if (target == 0)
+		target = 1;
+	unsigned long long cumulative = 0;
+	for (NSUInteger bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT; bucket++)
+	{
+		unsigned long long count = histograms->_counts[phase][bucket];
+		if (cumulative + count >= target)
+		{
+			// Buckets double in width, so the upper bound alone can be off by 2x.
+			// Assume the samples are spread evenly through the bucket instead.
+			NSTimeInterval upperBound = HistogramBucketUpperBound(bucket);
+			if (isinf(upperBound))
+				return upperBound;
+			NSTimeInterval lowerBound = HistogramBucketLowerBound(bucket);
+			return lowerBound + ((upperBound - lowerBound) * ((double)(target - cumulative) / (double)count));
+		}
+		cumulative += count;
+	}
+	return -1.0;
+}
+
+- (NSTimeInterval)percentile:(double)percentile forPhase:(ESHTTPOperationPhase)phase host:(NSString *)host
+{
+	NSParameterAssert(phase < ESHTTPOperationPhaseCount);
+	NSParameterAssert(percentile >= 0.0 && percentile <= 1.0);
+	__block NSTimeInterval result = -1.0;
+	dispatch_sync(_queue, ^{
+		result = [self percentile:percentile forPhase:phase histograms:[self histogramSetForHost:host]];
+	});
+	return result;
+}
+
+#pragma mark - Summaries
+
++ (unsigned long long)peakResidentSize
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	// Bytes on Darwin
+	return (unsigned long long)usage.ru_maxrss;
+}
+
+- (NSDictionary *)summaryForHost:(NSString *)host
+{
+	NSMutableDictionary *summary = [NSMutableDictionary dictionary];
+	dispatch_sync(_queue, ^{
+		ESHTTPOperationHistogramSet *histograms = [self histogramSetForHost:host];
+		if (histograms == nil)
+			return;
+		[summary setObject:[NSNumber numberWithUnsignedInteger:histograms->_operationCount] forKey:kESHTTPOperationMetricsOperationCountKey];
+		[summary setObject:[NSNumber numberWithUnsignedInteger:histograms->_failedOperationCount] forKey:kESHTTPOperationMetricsFailedOperationCountKey];
+		[summary setObject:[NSNumber numberWithUnsignedLongLong:histograms->_receivedByteCount] forKey:kESHTTPOperationMetricsReceivedByteCountKey];
+		if ((histograms->_firstStart != 0) && (histograms->_lastCompletion > histograms->_firstStart))
+		{
+			double elapsed = (double)(histograms->_lastCompletion - histograms->_firstStart) * SecondsPerMachTimeUnit();
+			[summary setObject:[NSNumber numberWithDouble:(double)histograms->_operationCount / elapsed] forKey:kESHTTPOperationMetricsOperationsPerSecondKey];
+		}
+		NSMutableDictionary *phases = [NSMutableDictionary dictionary];
+		for (NSUInteger phase = 0; phase < ESHTTPOperationPhaseCount; phase++)
+		{
+			NSTimeInterval median = [self percentile:0.5 forPhase:(ESHTTPOperationPhase)phase histograms:histograms];
+			if (median < 0)
+				continue;
+			NSTimeInterval p99 = [self percentile:0.99 forPhase:(ESHTTPOperationPhase)phase histograms:histograms];
+			NSDictionary *percentiles = [NSDictionary dictionaryWithObjectsAndKeys:
+										 [NSNumber numberWithDouble:median], kESHTTPOperationMetricsMedianKey, 
+										 [NSNumber numberWithDouble:p99], kESHTTPOperationMetricsP99Key, nil];
+			[phases setObject:percentiles forKey:[ESHTTPOperationMetrics nameForPhase:(ESHTTPOperationPhase)phase]];
+		}
+		[summary setObject:phases forKey:kESHTTPOperationMetricsPhasesKey];
+	});
+	[summary setObject:[NSNumber numberWithUnsignedLongLong:[[self class] peakResidentSize]] forKey:kESHTTPOperationMetricsPeakResidentSizeKey];
+	return summary;
+}
+
+- (NSString *)formattedSummaryForHost:(NSString *)host
+{
+	NSDictionary *summary = [self summaryForHost:host];
+	NSMutableString *formatted = [NSMutableString stringWithFormat:@"%@: %@ operations, %@ failed, %@ bytes", 
+								  (host != nil) ? host : @"all hosts", 
+								  [summary objectForKey:kESHTTPOperationMetricsOperationCountKey], 
+								  [summary objectForKey:kESHTTPOperationMetricsFailedOperationCountKey], 
+								  [summary objectForKey:kESHTTPOperationMetricsReceivedByteCountKey]];
+	NSNumber *operationsPerSecond = [summary objectForKey:kESHTTPOperationMetricsOperationsPerSecondKey];
+	if (operationsPerSecond != nil)
+		[formatted appendFormat:@"\n\t%.1f ops/sec", [operationsPerSecond doubleValue]];
+	NSDictionary *phases = [summary objectForKey:kESHTTPOperationMetricsPhasesKey];
+	for (NSUInteger phase = 0; phase < ESHTTPOperationPhaseCount; phase++)
+	{
+		NSDictionary *percentiles = [phases objectForKey:[ESHTTPOperationMetrics nameForPhase:(ESHTTPOperationPhase)phase]];
+		if (percentiles == nil)
+			continue;
+		// The last bucket is unbounded, p99 prints as inf if anything landed there
+		[formatted appendFormat:@"\n\t%@: p50 <= %.0fms, p99 <= %.0fms", 
+		 [ESHTTPOperationMetrics nameForPhase:(ESHTTPOperationPhase)phase], 
+		 [[percentiles objectForKey:kESHTTPOperationMetricsMedianKey] doubleValue] * 1000.0, 
+		 [[percentiles objectForKey:kESHTTPOperationMetricsP99Key] doubleValue] * 1000.0];
+	}
+	[formatted appendFormat:@"\n\tpeak resident size: %.1fMB", [[summary objectForKey:kESHTTPOperationMetricsPeakResidentSizeKey] doubleValue] / (1024.0 * 1024.0)];
+	return formatted;
+}
+
+@end
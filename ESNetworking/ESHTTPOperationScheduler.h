@@ -0,0 +1,107 @@
+//
+//  ESHTTPOperationScheduler.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class ESHTTPOperation;
+
+/**
+ * Keys for the dictionary returned by -statistics
+ */
+extern NSString *const kESHTTPOperationSchedulerPendingOperationsKey; // NSNumber, operations waiting to be started
+extern NSString *const kESHTTPOperationSchedulerRunningOperationsKey; // NSNumber, operations started that haven't finished
+extern NSString *const kESHTTPOperationSchedulerPendingByPriorityKey; // NSDictionary, NSNumber (NSOperationQueuePriority) -> NSNumber pending operations
+extern NSString *const kESHTTPOperationSchedulerHostsKey; // NSDictionary, host -> NSDictionary with the pending and running keys above
+extern NSString *const kESHTTPOperationSchedulerOldestPendingIntervalKey; // NSNumber, seconds the longest waiting operation has been pending
+
+/**
+ * Starts ESHTTPOperations by priority while limiting how many run at once, overall and per host.
+ *
+ * Use it instead of an NSOperationQueue so a burst of low priority loads (image prefetching, etc.) can't
+ * hold up the requests the user is waiting on:
+ *
+ * - Operations are started in order of queuePriority, first in first out within a priority.
+ * - No more than maximumConcurrentOperationCountPerHost operations talk to a host at once, 
+ *   and hosts with operations of the same priority take turns.
+ * - For every agingInterval an operation has been waiting it's treated as one priority class 
+ *   higher, so low priority operations are delayed but never starved.
+ *
+ * Dependencies are honored, operations are only started once they are ready. Cancelled operations 
+ * are started right away so that they finish and run their completion blocks.
+ *
+ * Scheduling decisions are logged with each operation's operationID when ES_HTTP_SCHEDULER_TRACE is defined.
+ *
+ * All methods are thread safe.
+ */
+
+@interface ESHTTPOperationScheduler : NSObject
+
++ (id)sharedScheduler;
+
+///-----------------
+/// @name Limits
+///-----------------
+
+/**
+ * Default is 6
+ */
+@property (assign, readwrite) NSUInteger maximumConcurrentOperationCount;
+/**
+ * Default is 4
+ */
+@property (assign, readwrite) NSUInteger maximumConcurrentOperationCountPerHost;
+/**
+ * Time an operation waits before being promoted to the next priority class, 0 disables aging
+ *
+ * Default is 2 seconds
+ */
+@property (assign, readwrite) NSTimeInterval agingInterval;
+/**
+ * While suspended no operations are started
+ */
+@property (assign, readwrite, getter=isSuspended) BOOL suspended;
+
+///-----------------
+/// @name Operations
+///-----------------
+
+/**
+ * Schedules op, which must not have been started or added to an NSOperationQueue
+ */
+- (void)addOperation:(ESHTTPOperation *)op;
+- (void)addOperations:(NSArray *)ops;
+/**
+ * Cancels every pending and running operation
+ */
+- (void)cancelAllOperations;
+
+///-----------------
+/// @name Metrics
+///-----------------
+
+@property (assign, readonly) NSUInteger pendingOperationCount;
+@property (assign, readonly) NSUInteger runningOperationCount;
+/**
+ * Snapshot of queue depths
+ *
+ * @see kESHTTPOperationSchedulerPendingOperationsKey
+ */
+- (NSDictionary *)statistics;
+
+@end
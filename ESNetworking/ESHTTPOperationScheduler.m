@@ -0,0 +1,441 @@
+//
+//  ESHTTPOperationScheduler.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESHTTPOperationScheduler.h"
+#import "ESHTTPOperation.h"
+
+#ifndef SchedulerLog
+#if ES_HTTP_SCHEDULER_TRACE
+#define SchedulerLog(fmt, ...) NSLog((@"ESHTTPOperationScheduler: " fmt), ##__VA_ARGS__)
+#else
+#define SchedulerLog(fmt, ...) 
+#endif
+#endif
+
+NSString *const kESHTTPOperationSchedulerPendingOperationsKey = @"pendingOperations";
+NSString *const kESHTTPOperationSchedulerRunningOperationsKey = @"runningOperations";
+NSString *const kESHTTPOperationSchedulerPendingByPriorityKey = @"pendingByPriority";
+NSString *const kESHTTPOperationSchedulerHostsKey = @"hosts";
+NSString *const kESHTTPOperationSchedulerOldestPendingIntervalKey = @"oldestPendingInterval";
+
+static void * ESHTTPOperationSchedulerPendingContext = &ESHTTPOperationSchedulerPendingContext;
+static void * ESHTTPOperationSchedulerRunningContext = &ESHTTPOperationSchedulerRunningContext;
+
+// NSOperationQueuePriority values are spaced 4 apart
+#define PRIORITY_CLASS_STEP 4.0
+
+static NSString * HostForOperation(ESHTTPOperation *op)
+{
+	NSString *host = [[op.URL host] lowercaseString];
+	if (host == nil)
+		host = @"";
+	return host;
+}
+
+@interface ESScheduledOperation : NSObject
+@property (strong, nonatomic) ESHTTPOperation *operation;
+@property (copy, nonatomic) NSString *host;
+@property (assign, nonatomic) CFAbsoluteTime enqueueTime;
+@end
+
+@implementation ESScheduledOperation
+@synthesize operation=_operation;
+@synthesize host=_host;
+@synthesize enqueueTime=_enqueueTime;
+@end
+
+@interface ESHTTPOperationScheduler ()
+- (void)scheduleOperations;
+- (ESScheduledOperation *)nextOperation:(CFAbsoluteTime)now;
+- (double)effectivePriorityOfOperation:(ESScheduledOperation *)scheduledOperation now:(CFAbsoluteTime)now;
+- (void)startScheduledOperation:(ESScheduledOperation *)scheduledOperation now:(CFAbsoluteTime)now;
+- (void)operationDidFinish:(ESHTTPOperation *)op;
+@end
+
+@implementation ESHTTPOperationScheduler
+{
+	dispatch_queue_t _queue;
+	// host -> NSMutableArray of ESScheduledOperation, in the order they were added
+	NSMutableDictionary *_pendingByHost;
+	// hosts with pending operations, in round robin order
+	NSMutableArray *_hosts;
+	NSUInteger _nextHostIndex;
+	NSUInteger _pendingCount;
+	// ESScheduledOperations that have been started and haven't finished
+	NSMutableArray *_running;
+	NSCountedSet *_runningByHost;
+	NSUInteger _maximumConcurrentOperationCount;
+	NSUInteger _maximumConcurrentOperationCountPerHost;
+	NSTimeInterval _agingInterval;
+	BOOL _suspended;
+}
+
++ (id)sharedScheduler
+{
+	static id sharedScheduler = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedScheduler = [[self class] new];
+	});
+	return sharedScheduler;
+}
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_queue = dispatch_queue_create("com.everythingsolution.httpoperationscheduler", 0);
+		_pendingByHost = [NSMutableDictionary new];
+		_hosts = [NSMutableArray new];
+		_running = [NSMutableArray new];
+		_runningByHost = [NSCountedSet new];
+		_maximumConcurrentOperationCount = 6;
+		_maximumConcurrentOperationCountPerHost = 4;
+		_agingInterval = 2.0;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	dispatch_release(_queue);
+}
+
+#pragma mark - Limits
+
+- (NSUInteger)maximumConcurrentOperationCount
+{
+	__block NSUInteger count;
+	dispatch_sync(_queue, ^{
+		count = _maximumConcurrentOperationCount;
+	});
+	return count;
+}
+
+- (void)setMaximumConcurrentOperationCount:(NSUInteger)maximumConcurrentOperationCount
+{
+	NSParameterAssert(maximumConcurrentOperationCount > 0);
+	dispatch_async(_queue, ^{
+		_maximumConcurrentOperationCount = maximumConcurrentOperationCount;
+		[self scheduleOperations];
+	});
+}
+
+- (NSUInteger)maximumConcurrentOperationCountPerHost
+{
+	__block NSUInteger count;
+	dispatch_sync(_queue, ^{
+		count = _maximumConcurrentOperationCountPerHost;
+	});
+	return count;
+}
+
+- (void)setMaximumConcurrentOperationCountPerHost:(NSUInteger)maximumConcurrentOperationCountPerHost
+{
+	NSParameterAssert(maximumConcurrentOperationCountPerHost > 0);
+	dispatch_async(_queue, ^{
+		_maximumConcurrentOperationCountPerHost = maximumConcurrentOperationCountPerHost;
+		[self scheduleOperations];
+	});
+}
+
+- (NSTimeInterval)agingInterval
+{
+	__block NSTimeInterval interval;
+	dispatch_sync(_queue, ^{
+		interval = _agingInterval;
+	});
+	return interval;
+}
+
+- (void)setAgingInterval:(NSTimeInterval)agingInterval
+{
+	dispatch_async(_queue, ^{
+		_agingInterval = agingInterval;
+	});
+}
+
+- (BOOL)isSuspended
+{
+	__block BOOL suspended;
+	dispatch_sync(_queue, ^{
+		suspended = _suspended;
+	});
+	return suspended;
+}
+
+- (void)setSuspended:(BOOL)suspended
+{
+	dispatch_async(_queue, ^{
+		_suspended = suspended;
+		[self scheduleOperations];
+	});
+}
+
+#pragma mark - Operations
+
+- (void)addOperation:(ESHTTPOperation *)op
+{
+	NSParameterAssert(op != nil);
+	NSParameterAssert(op.state == kESOperationStateInited);
+	ESScheduledOperation *scheduledOperation = [ESScheduledOperation new];
+	scheduledOperation.operation = op;
+	scheduledOperation.host = HostForOperation(op);
+	scheduledOperation.enqueueTime = CFAbsoluteTimeGetCurrent();
+	// Dependencies finishing and cancellation both need a scheduling pass
+	[op addObserver:self forKeyPath:@"isReady" options:0 context:ESHTTPOperationSchedulerPendingContext];
+	[op addObserver:self forKeyPath:@"isCancelled" options:0 context:ESHTTPOperationSchedulerPendingContext];
+	dispatch_async(_queue, ^{
+		NSString *host = scheduledOperation.host;
+		NSMutableArray *pending = [_pendingByHost objectForKey:host];
+		if (pending == nil)
+		{
+			pending = [NSMutableArray new];
+			[_pendingByHost setObject:pending forKey:host];
+			[_hosts addObject:host];
+		}
+		[pending addObject:scheduledOperation];
+		_pendingCount++;
+		SchedulerLog(@"Added %d (%@) with priority %d", op.operationID, host, [op queuePriority]);
+		[self scheduleOperations];
+	});
+}
+
+- (void)addOperations:(NSArray *)ops
+{
+	for (ESHTTPOperation *op in ops)
+		[self addOperation:op];
+}
+
+- (void)cancelAllOperations
+{
+	NSMutableArray *ops = [NSMutableArray new];
+	dispatch_sync(_queue, ^{
+		for (NSArray *pending in [_pendingByHost allValues])
+			for (ESScheduledOperation *scheduledOperation in pending)
+				[ops addObject:scheduledOperation.operation];
+		for (ESScheduledOperation *scheduledOperation in _running)
+			[ops addObject:scheduledOperation.operation];
+	});
+	// One trip per network thread rather than a blocking -cancel per operation
+	[ESHTTPOperationGroup cancelOperations:ops];
+}
+
+#pragma mark - Scheduling
+
+- (double)effectivePriorityOfOperation:(ESScheduledOperation *)scheduledOperation now:(CFAbsoluteTime)now
+{
+	double priority = [scheduledOperation.operation queuePriority];
+	if (_agingInterval > 0)
+	{
+		priority += floor((now - scheduledOperation.enqueueTime) / _agingInterval) * PRIORITY_CLASS_STEP;
+		if (priority > NSOperationQueuePriorityVeryHigh)
+			priority = NSOperationQueuePriorityVeryHigh;
+	}
+	return priority;
+}
+
+- (ESScheduledOperation *)nextOperation:(CFAbsoluteTime)now
+// Highest effective priority ready operation on a host that isn't at its limit.
+// Hosts are visited starting after the last one served and ties go to the first 
+// candidate found, which gives round robin between hosts and FIFO within a host.
+{
+	ESScheduledOperation *next = nil;
+	double nextPriority = 0;
+	NSUInteger nextHostIndex = 0;
+	NSUInteger hostCount = [_hosts count];
+	for (NSUInteger i = 0; i < hostCount; i++)
+	{
+		NSUInteger hostIndex = (_nextHostIndex + i) % hostCount;
+		NSString *host = [_hosts objectAtIndex:hostIndex];
+		if ([_runningByHost countForObject:host] >= _maximumConcurrentOperationCountPerHost)
+			continue;
+		for (ESScheduledOperation *scheduledOperation in [_pendingByHost objectForKey:host])
+		{
+			if (![scheduledOperation.operation isReady])
+				continue;
+			double priority = [self effectivePriorityOfOperation:scheduledOperation now:now];
+			if ((next == nil) || (priority > nextPriority))
+			{
+				next = scheduledOperation;
+				nextPriority = priority;
+				nextHostIndex = hostIndex;
+			}
+		}
+	}
+	if (next != nil)
+		_nextHostIndex = nextHostIndex + 1;
+	return next;
+}
+
+- (void)startScheduledOperation:(ESScheduledOperation *)scheduledOperation now:(CFAbsoluteTime)now
+{
+	ESHTTPOperation *op = scheduledOperation.operation;
+	NSString *host = scheduledOperation.host;
+	NSMutableArray *pending = [_pendingByHost objectForKey:host];
+	[pending removeObjectIdenticalTo:scheduledOperation];
+	_pendingCount--;
+	if ([pending count] == 0)
+	{
+		[_pendingByHost removeObjectForKey:host];
+		NSUInteger hostIndex = [_hosts indexOfObject:host];
+		[_hosts removeObjectAtIndex:hostIndex];
+		if (_nextHostIndex > hostIndex)
+			_nextHostIndex--;
+	}
+	[op removeObserver:self forKeyPath:@"isReady" context:ESHTTPOperationSchedulerPendingContext];
+	[op removeObserver:self forKeyPath:@"isCancelled" context:ESHTTPOperationSchedulerPendingContext];
+	[_running addObject:scheduledOperation];
+	[_runningByHost addObject:host];
+	[op addObserver:self forKeyPath:@"isFinished" options:0 context:ESHTTPOperationSchedulerRunningContext];
+	SchedulerLog(@"Starting %d (%@) after %.3fs, %d running", op.operationID, host, now - scheduledOperation.enqueueTime, [_running count]);
+	[op start];
+}
+
+- (void)scheduleOperations
+{
+	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+	// Cancelled operations only need to be started to finish, don't make them wait for a slot
+	NSMutableArray *cancelled = nil;
+	for (NSArray *pending in [_pendingByHost allValues])
+	{
+		for (ESScheduledOperation *scheduledOperation in pending)
+		{
+			if ([scheduledOperation.operation isCancelled] && [scheduledOperation.operation isReady])
+			{
+				if (cancelled == nil)
+					cancelled = [NSMutableArray new];
+				[cancelled addObject:scheduledOperation];
+			}
+		}
+	}
+	for (ESScheduledOperation *scheduledOperation in cancelled)
+		[self startScheduledOperation:scheduledOperation now:now];
+	if (_suspended)
+		return;
+	while ([_running count] < _maximumConcurrentOperationCount)
+	{
+		ESScheduledOperation *next = [self nextOperation:now];
+		if (next == nil)
+			break;
+		[self startScheduledOperation:next now:now];
+	}
+}
+
+- (void)operationDidFinish:(ESHTTPOperation *)op
+{
+	NSUInteger index = [_running indexOfObjectPassingTest:^BOOL(ESScheduledOperation *scheduledOperation, NSUInteger idx, BOOL *stop) {
+		return (scheduledOperation.operation == op);
+	}];
+	if (index == NSNotFound)
+		return;
+	NSString *host = [[_running objectAtIndex:index] host];
+	[_running removeObjectAtIndex:index];
+	[_runningByHost removeObject:host];
+	SchedulerLog(@"Finished %d (%@), %d running, %d pending", op.operationID, host, [_running count], _pendingCount);
+	[self scheduleOperations];
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context
+{
+	if (context == ESHTTPOperationSchedulerRunningContext)
+	{
+		ESHTTPOperation *op = object;
+		if (![op isFinished])
+			return;
+		[op removeObserver:self forKeyPath:@"isFinished" context:ESHTTPOperationSchedulerRunningContext];
+		dispatch_async(_queue, ^{
+			[self operationDidFinish:op];
+		});
+	}
+	else if (context == ESHTTPOperationSchedulerPendingContext)
+	{
+		dispatch_async(_queue, ^{
+			[self scheduleOperations];
+		});
+	}
+	else
+		[super observeValueForKeyPath:keyPath ofObject:object change:change context:context];
+}
+
+#pragma mark - Metrics
+
+- (NSUInteger)pendingOperationCount
+{
+	__block NSUInteger count;
+	dispatch_sync(_queue, ^{
+		count = _pendingCount;
+	});
+	return count;
+}
+
+- (NSUInteger)runningOperationCount
+{
+	__block NSUInteger count;
+	dispatch_sync(_queue, ^{
+		count = [_running count];
+	});
+	return count;
+}
+
+- (NSDictionary *)statistics
+{
+	__block NSDictionary *statistics = nil;
+	dispatch_sync(_queue, ^{
+		CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+		CFAbsoluteTime oldest = now;
+		NSCountedSet *pendingByPriority = [NSCountedSet new];
+		NSMutableDictionary *hosts = [NSMutableDictionary new];
+		NSMutableSet *allHosts = [NSMutableSet setWithArray:_hosts];
+		[allHosts addObjectsFromArray:[_runningByHost allObjects]];
+		for (NSString *host in allHosts)
+		{
+			NSArray *pending = [_pendingByHost objectForKey:host];
+			for (ESScheduledOperation *scheduledOperation in pending)
+			{
+				[pendingByPriority addObject:[NSNumber numberWithInteger:[scheduledOperation.operation queuePriority]]];
+				if (scheduledOperation.enqueueTime < oldest)
+					oldest = scheduledOperation.enqueueTime;
+			}
+			[hosts setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+							  [NSNumber numberWithUnsignedInteger:[pending count]], kESHTTPOperationSchedulerPendingOperationsKey,
+							  [NSNumber numberWithUnsignedInteger:[_runningByHost countForObject:host]], kESHTTPOperationSchedulerRunningOperationsKey,
+							  nil]
+					  forKey:host];
+		}
+		NSMutableDictionary *priorities = [NSMutableDictionary new];
+		for (NSNumber *priority in pendingByPriority)
+			[priorities setObject:[NSNumber numberWithUnsignedInteger:[pendingByPriority countForObject:priority]] forKey:priority];
+		statistics = [NSDictionary dictionaryWithObjectsAndKeys:
+					  [NSNumber numberWithUnsignedInteger:_pendingCount], kESHTTPOperationSchedulerPendingOperationsKey,
+					  [NSNumber numberWithUnsignedInteger:[_running count]], kESHTTPOperationSchedulerRunningOperationsKey,
+					  priorities, kESHTTPOperationSchedulerPendingByPriorityKey,
+					  hosts, kESHTTPOperationSchedulerHostsKey,
+					  [NSNumber numberWithDouble:now - oldest], kESHTTPOperationSchedulerOldestPendingIntervalKey,
+					  nil];
+	});
+	return statistics;
+}
+
+@end
@@ -0,0 +1,87 @@
+//
+//  ESHTTPRetryPolicy.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Describes when and how often an ESHTTPOperation retries a failed attempt.
+ *
+ * Attempts are retried after connection errors that are likely to be transient (timeouts, dropped
+ * connections, DNS failures) and after responses with a status code in retryableStatusCodes.
+ * The delay before attempt n is initialDelay * multiplier^(n-2), capped at maximumDelay, with
+ * up to jitter of it randomized away so that clients that failed together don't retry together.
+ * A Retry-After header (in seconds) is honored if it asks for a longer delay.
+ *
+ * Only idempotent requests (GET, HEAD, PUT, DELETE, OPTIONS) whose body can be sent again are retried
+ * unless retriesNonIdempotentRequests is set.
+ */
+
+@interface ESHTTPRetryPolicy : NSObject <NSCopying>
+
+/**
+ * 3 attempts, 0.5 second initial delay doubling up to 30 seconds, 50% jitter,
+ * retrying 408, 429, 500, 502, 503 and 504.
+ */
++ (id)defaultPolicy;
+
+/**
+ * Total attempts including the first one. Default is 3
+ */
+@property (assign, readwrite) NSUInteger maximumAttempts;
+/**
+ * Delay before the first retry. Default is 0.5 seconds
+ */
+@property (assign, readwrite) NSTimeInterval initialDelay;
+/**
+ * Default is 2.0
+ */
+@property (assign, readwrite) double multiplier;
+/**
+ * Default is 30 seconds
+ */
+@property (assign, readwrite) NSTimeInterval maximumDelay;
+/**
+ * Fraction (0.0 - 1.0) of each delay that is randomized. Default is 0.5
+ */
+@property (assign, readwrite) double jitter;
+/**
+ * Status codes that cause a retry
+ */
+@property (copy, readwrite) NSIndexSet *retryableStatusCodes;
+/**
+ * Default is NO
+ */
+@property (assign, readwrite) BOOL retriesNonIdempotentRequests;
+
+/**
+ * Returns YES if request can safely be sent again. Requests with a body stream can only be retried if the stream conforms to NSCopying.
+ */
+- (BOOL)canRetryRequest:(NSURLRequest *)request;
+/**
+ * Returns YES if an attempt that failed with error or got response should be retried.
+ * 
+ * @param attempt Number of attempts made so far, starting at 1
+ */
+- (BOOL)shouldRetryAttempt:(NSUInteger)attempt error:(NSError *)error response:(NSHTTPURLResponse *)response;
+/**
+ * Delay before the attempt after attempt
+ */
+- (NSTimeInterval)delayAfterAttempt:(NSUInteger)attempt response:(NSHTTPURLResponse *)response;
+
+@end
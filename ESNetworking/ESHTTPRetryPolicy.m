@@ -0,0 +1,142 @@
+//
+//  ESHTTPRetryPolicy.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESHTTPRetryPolicy.h"
+#import "ESHTTPHeaderFields.h"
+#include <math.h>
+#include <stdlib.h>
+
+@implementation ESHTTPRetryPolicy
+@synthesize maximumAttempts=_maximumAttempts;
+@synthesize initialDelay=_initialDelay;
+@synthesize multiplier=_multiplier;
+@synthesize maximumDelay=_maximumDelay;
+@synthesize jitter=_jitter;
+@synthesize retryableStatusCodes=_retryableStatusCodes;
+@synthesize retriesNonIdempotentRequests=_retriesNonIdempotentRequests;
+
++ (id)defaultPolicy
+{
+	return [[self class] new];
+}
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_maximumAttempts = 3;
+		_initialDelay = 0.5;
+		_multiplier = 2.0;
+		_maximumDelay = 30.0;
+		_jitter = 0.5;
+		NSMutableIndexSet *statusCodes = [NSMutableIndexSet new];
+		[statusCodes addIndex:408];
+		[statusCodes addIndex:429];
+		[statusCodes addIndex:500];
+		[statusCodes addIndexesInRange:NSMakeRange(502, 3)];
+		_retryableStatusCodes = [statusCodes copy];
+	}
+	return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+	ESHTTPRetryPolicy *policy = [[[self class] allocWithZone:zone] init];
+	policy.maximumAttempts = self.maximumAttempts;
+	policy.initialDelay = self.initialDelay;
+	policy.multiplier = self.multiplier;
+	policy.maximumDelay = self.maximumDelay;
+	policy.jitter = self.jitter;
+	policy.retryableStatusCodes = self.retryableStatusCodes;
+	policy.retriesNonIdempotentRequests = self.retriesNonIdempotentRequests;
+	return policy;
+}
+
+- (BOOL)canRetryRequest:(NSURLRequest *)request
+{
+	// A body stream has been consumed by the first attempt, unless it can be copied to start over
+	NSInputStream *bodyStream = [request HTTPBodyStream];
+	if ((bodyStream != nil) && ![bodyStream conformsToProtocol:@protocol(NSCopying)])
+		return NO;
+	if (self.retriesNonIdempotentRequests)
+		return YES;
+	NSString *method = [[request HTTPMethod] uppercaseString];
+	if (method == nil)
+		return YES;
+	static NSSet *idempotentMethods = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		idempotentMethods = [[NSSet alloc] initWithObjects:@"GET", @"HEAD", @"PUT", @"DELETE", @"OPTIONS", nil];
+	});
+	return [idempotentMethods containsObject:method];
+}
+
+- (BOOL)shouldRetryAttempt:(NSUInteger)attempt error:(NSError *)error response:(NSHTTPURLResponse *)response
+{
+	if (attempt >= self.maximumAttempts)
+		return NO;
+	if (error != nil)
+	{
+		if (![[error domain] isEqualToString:NSURLErrorDomain])
+			return NO;
+		switch ([error code]) {
+			case NSURLErrorTimedOut:
+			case NSURLErrorCannotFindHost:
+			case NSURLErrorCannotConnectToHost:
+			case NSURLErrorNetworkConnectionLost:
+			case NSURLErrorDNSLookupFailed:
+			case NSURLErrorNotConnectedToInternet:
+				return YES;
+			default:
+				return NO;
+		}
+	}
+	if (response != nil)
+	{
+		NSInteger statusCode = [response statusCode];
+		return (statusCode >= 0) && [self.retryableStatusCodes containsIndex:(NSUInteger)statusCode];
+	}
+	return NO;
+}
+
+- (NSTimeInterval)delayAfterAttempt:(NSUInteger)attempt response:(NSHTTPURLResponse *)response
+{
+	NSParameterAssert(attempt > 0);
+	NSTimeInterval delay = self.initialDelay * pow(self.multiplier, (double)(attempt - 1));
+	if (delay > self.maximumDelay)
+		delay = self.maximumDelay;
+	double jitter = MIN(MAX(self.jitter, 0.0), 1.0);
+	delay -= delay * jitter * ((double)arc4random() / (double)UINT32_MAX);
+	// Retry-After can also be an HTTP date, only the delta seconds form is supported
+	NSString *retryAfter = HTTPHeaderValue([response allHeaderFields], @"Retry-After");
+	if (retryAfter != nil)
+	{
+		NSTimeInterval requestedDelay = [retryAfter doubleValue];
+		if (requestedDelay > delay)
+			delay = MIN(requestedDelay, self.maximumDelay);
+	}
+	return delay;
+}
+
+@end
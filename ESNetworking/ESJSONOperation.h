@@ -3,6 +3,7 @@
 @class ESJSONOperation;
 typedef void (^ESJSONOperationSuccessBlock)(ESJSONOperation *op, id JSON);
 typedef void (^ESJSONOperationFailureBlock)(ESJSONOperation *op);
+typedef void (^ESJSONOperationElementBlock)(ESJSONOperation *op, id element, NSUInteger index);
 
 /**
  `ESJSONOperation` is an `NSOperation` that wraps the callback from `ESHTTPOperation` to determine the success or failure of a request based on its status code and response content type, and parse the response body into a JSON object.
@@ -55,6 +56,47 @@ typedef void (^ESJSONOperationFailureBlock)(ESJSONOperation *op);
 						  success:(ESJSONOperationSuccessBlock)success
 						  failure:(ESJSONOperationFailureBlock)failure;
 
+/**
+ Creates and returns an `ESJSONOperation` object that parses the response incrementally while it downloads.
+ 
+	typedef void (^ESJSONOperationElementBlock)(ESJSONOperation *op, id element, NSUInteger index);
+ 
+ If the response is a top level JSON array, each element is parsed as soon as it has been received and passed to element, so the first objects are available before the response completes and neither the full response body nor the full object tree are ever held in memory. Elements are delivered in order, through [ESProcessingQueue sharedQueue] like work blocks. In this case success is called with a nil JSON object once every element has been delivered.
+ 
+ If the response is any other JSON value it is parsed as a whole and passed to success as usual.
+ 
+ maximumResponseSize limits the size of a single element rather than the whole response.
+ 
+ @param urlRequest The request object to be loaded asynchronously during execution of the operation
+ @param element A block object to be executed for each element of a top level array. It has no return value and takes the operation, the parsed element and the element's index.
+ @param success A block object to be executed when the JSON request operation finishes successfully.
+ @param failure A block object to be executed when the JSON request operation finishes unsuccessfully, including when an element fails to parse.
+ 
+ @see operationWithRequest:success:failure:
+ 
+ @return A new JSON request operation
+ */
++ (id)newJSONOperationWithRequest:(NSURLRequest *)urlRequest 
+						  element:(ESJSONOperationElementBlock)element
+						  success:(ESJSONOperationSuccessBlock)success
+						  failure:(ESJSONOperationFailureBlock)failure;
+
+/**
+ Block that receives the elements of a top level array as they are parsed, nil unless the operation was created with newJSONOperationWithRequest:element:success:failure:
+ */
+@property (copy, readonly) ESJSONOperationElementBlock element;
+
+/**
+ If YES, success and failure blocks are delivered through [ESMainQueueBatcher sharedBatcher] so that operations finishing together are reported to the main thread in a single callout instead of one callout each.
+ 
+ Set the shared batcher's window to widen the batches.
+ 
+ Default is NO
+ 
+ @see ESMainQueueBatcher
+ */
+@property (assign, readwrite) BOOL batchesMainQueueDelivery;
+
 ///----------------------------------
 /// @name Getting Default HTTP Values
 ///----------------------------------
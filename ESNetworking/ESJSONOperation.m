@@ -18,8 +18,65 @@
 //	
 
 #import "ESJSONOperation.h"
+#import "ESJSONStreamParser.h"
+#import "ESMainQueueBatcher.h"
+#import <libkern/OSAtomic.h>
+
+// Elements parsed off the wire but not yet through the element block before 
+// the connection is paused
+#define MAXIMUM_PENDING_ELEMENTS 64
+
+static void DeliverOnMainQueue(ESJSONOperation *op, dispatch_block_t block)
+{
+	// Counts toward the processing queue's backlog until the main queue gets to it
+	ESProcessingQueue *processingQueue = [ESProcessingQueue sharedQueue];
+	[processingQueue resultWasProduced];
+	dispatch_block_t deliveryBlock = ^{
+		block();
+		[processingQueue resultWasConsumed];
+	};
+	if (op.batchesMainQueueDelivery)
+		[[ESMainQueueBatcher sharedBatcher] enqueueBlock:deliveryBlock];
+	else
+		dispatch_async(dispatch_get_main_queue(), deliveryBlock);
+}
+
+@interface ESJSONOperation ()
+@property (copy, readwrite) ESJSONOperationElementBlock element;
+@property (strong, readwrite) ESJSONStreamParser *streamParser;
+@property (strong, readwrite) NSError *elementError;
+- (void)startStreamParser;
+- (void)enqueueElementData:(NSData *)elementData index:(NSUInteger)index;
+- (void)deliverPendingElements;
+- (NSError *)errorFromStreamParserError:(NSError *)error;
+@end
 
 @implementation ESJSONOperation
+{
+	// Element data waiting to be parsed and delivered, alternating NSData and NSNumber index
+	NSMutableArray *_pendingElements;
+	OSSpinLock _pendingElementsLock;
+	BOOL _deliveryScheduled;
+	// Held while elements are being delivered, keeps them in order
+	NSLock *_deliveryLock;
+	volatile int32_t _pendingElementCount;
+}
+@synthesize element=_element;
+@synthesize streamParser=_streamParser;
+@synthesize elementError=_elementError;
+@synthesize batchesMainQueueDelivery=_batchesMainQueueDelivery;
+
+- (id)initWithRequest:(NSURLRequest *)request work:(ESHTTPOperationWorkBlock)work completion:(ESHTTPOperationCompletionBlock)completion
+{
+	self = [super initWithRequest:request work:work completion:completion];
+	if (self != nil)
+	{
+		_pendingElements = [NSMutableArray new];
+		_pendingElementsLock = OS_SPINLOCK_INIT;
+		_deliveryLock = [NSLock new];
+	}
+	return self;
+}
 
 + (id)newJSONOperationWithRequest:(NSURLRequest *)urlRequest				   
 						  success:(ESJSONOperationSuccessBlock)success
@@ -40,7 +97,28 @@
 												 *error = op.error;
 											 return nil;
 										 }
-										 NSData *data = op.responseBody;
+										 ESJSONOperation *jsonOp = (ESJSONOperation *)op;
+										 NSData *data = nil;
+										 ESJSONStreamParser *streamParser = jsonOp.streamParser;
+										 // NSJSONSerialization needs contiguous bytes, responseBody gets them without
+										 // holding the body twice (and without copying a spilled one at all)
+										 if (streamParser == nil)
+											 data = op.responseBody;
+										 else
+										 {
+											 // Deliver whatever is still pending here rather than wait for a 
+											 // slot on the processing queue, which this block may be holding up
+											 [jsonOp deliverPendingElements];
+											 if (jsonOp.elementError)
+											 {
+												 if (error)
+													 *error = jsonOp.elementError;
+												 return nil;
+											 }
+											 if ([streamParser isTopLevelArray])
+												 return nil;
+											 data = streamParser.documentData;
+										 }
 										 if ([data length] == 0) 
 										 {
 											 return nil;
@@ -54,6 +132,14 @@
 												 *error = jsonError;
 											 return nil;
 										 }
+										 // Bodies that weren't streamed (from cache, for example) still go to the element block
+										 if ((jsonOp.element != nil) && [json isKindOfClass:[NSArray class]])
+										 {
+											 [(NSArray *)json enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
+												 jsonOp.element(jsonOp, obj, idx);
+											 }];
+											 return nil;
+										 }
 										 return json;
 									 }
 							   completion:^(ESHTTPOperation *op) {
@@ -63,7 +149,7 @@
 								   {
 									   if (failure) 
 									   {
-										   dispatch_async(dispatch_get_main_queue(), ^{
+										   DeliverOnMainQueue(jsonOp, ^{
 											   failure(jsonOp);
 										   });
 									   }
@@ -72,7 +158,7 @@
 								   {
 									   if (success)
 									   {
-										   dispatch_async(dispatch_get_main_queue(), ^{
+										   DeliverOnMainQueue(jsonOp, ^{
 											   success(jsonOp, op.processedResponse);
 										   });
 									   }
@@ -81,6 +167,179 @@
 	return op;
 }
 
++ (id)newJSONOperationWithRequest:(NSURLRequest *)urlRequest 
+						  element:(ESJSONOperationElementBlock)element
+						  success:(ESJSONOperationSuccessBlock)success
+						  failure:(ESJSONOperationFailureBlock)failure
+{
+	ESJSONOperation *op = [self newJSONOperationWithRequest:urlRequest success:success failure:failure];
+	op.element = element;
+	return op;
+}
+
+#pragma mark - Incremental parsing
+
+- (void)startStreamParser
+// Called on the run loop thread when the first chunk of an acceptable 
+// response arrives.
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	NSParameterAssert(self.streamParser == nil);
+	// The parser's block retains self, the cycle is broken in -operationWillFinish
+	ESJSONStreamParser *streamParser = 
+	[[ESJSONStreamParser alloc] initWithElementBlock:^(NSData *elementData, NSUInteger index) {
+		[self enqueueElementData:elementData index:index];
+	}];
+	streamParser.maximumBufferLength = self.maximumResponseSize;
+	self.streamParser = streamParser;
+}
+
+- (void)enqueueElementData:(NSData *)elementData index:(NSUInteger)index
+// Elements go through the processing queue like work blocks do, one delivery 
+// block at a time per operation. While any are waiting the operation counts 
+// as one pending result toward the processing queue's backlog.
+{
+	OSAtomicIncrement32Barrier(&_pendingElementCount);
+	OSSpinLockLock(&_pendingElementsLock);
+	[_pendingElements addObject:elementData];
+	[_pendingElements addObject:[NSNumber numberWithUnsignedInteger:index]];
+	BOOL schedule = !_deliveryScheduled;
+	_deliveryScheduled = YES;
+	OSSpinLockUnlock(&_pendingElementsLock);
+	if (schedule)
+	{
+		[[ESProcessingQueue sharedQueue] resultWasProduced];
+		[[ESProcessingQueue sharedQueue] enqueueBlock:^{
+			[self deliverPendingElements];
+		} priority:[self queuePriority]];
+	}
+}
+
+- (void)deliverPendingElements
+// Any thread. Parses and delivers elements until none are left.
+{
+	ESJSONOperationElementBlock element = self.element;
+	[_deliveryLock lock];
+	while (YES)
+	{
+		NSData *elementData = nil;
+		NSUInteger index = 0;
+		BOOL drained = NO;
+		OSSpinLockLock(&_pendingElementsLock);
+		if ([_pendingElements count] > 0)
+		{
+			elementData = [_pendingElements objectAtIndex:0];
+			index = [[_pendingElements objectAtIndex:1] unsignedIntegerValue];
+			[_pendingElements removeObjectsInRange:NSMakeRange(0, 2)];
+		}
+		else if (_deliveryScheduled)
+		{
+			_deliveryScheduled = NO;
+			drained = YES;
+		}
+		OSSpinLockUnlock(&_pendingElementsLock);
+		if (elementData == nil)
+		{
+			if (drained)
+				[[ESProcessingQueue sharedQueue] resultWasConsumed];
+			break;
+		}
+		@autoreleasepool {
+			if ((self.elementError == nil) && ![self isCancelled])
+			{
+				NSError *jsonError = nil;
+				id json = [NSJSONSerialization JSONObjectWithData:elementData options:NSJSONReadingAllowFragments error:&jsonError];
+				if (json == nil)
+					self.elementError = jsonError;
+				else
+					element(self, json, index);
+			}
+		}
+		OSAtomicDecrement32Barrier(&_pendingElementCount);
+	}
+	[_deliveryLock unlock];
+}
+
+- (NSError *)errorFromStreamParserError:(NSError *)error
+{
+	if ([error code] == kESJSONStreamParserErrorBufferTooLarge)
+	{
+		NSDictionary *userInfo = [[NSDictionary alloc] initWithObjectsAndKeys:error, @"underlyingError", nil];
+		return [NSError errorWithDomain:kESHTTPOperationErrorDomain code:kESHTTPOperationErrorResponseTooLarge userInfo:userInfo];
+	}
+	return error;
+}
+
+- (void)operationWillFinish
+{
+	[super operationWillFinish];
+	self.streamParser = nil;
+}
+
+- (BOOL)canRetry
+{
+	// Elements that have been delivered can't be taken back
+	if (self.streamParser != nil)
+		return ([self.streamParser elementCount] == 0);
+	return [super canRetry];
+}
+
+- (void)prepareForRetry
+{
+	[super prepareForRetry];
+	self.streamParser = nil;
+}
+
+- (BOOL)shouldPauseReceiving
+{
+	// A slow element block holds the rest of the array back on the wire instead of in memory
+	return (_pendingElementCount >= MAXIMUM_PENDING_ELEMENTS) || [super shouldPauseReceiving];
+}
+
+- (BOOL)isCoalescable
+{
+	// Elements are delivered while the load is in flight, which a shared load can't do per subscriber
+	return (self.element == nil) && [super isCoalescable];
+}
+
+#pragma mark - NSURLConnection Delegate
+
+- (void)processReceivedData:(NSData *)data
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	// Error bodies and output streams are left to ESHTTPOperation
+	if ((self.element != nil) && self.firstData && (self.outputStream == nil) && self.isStatusCodeAcceptable)
+	{
+		[self startStreamParser];
+		self.firstData = NO;
+	}
+	if (self.streamParser == nil)
+	{
+		[super processReceivedData:data];
+		return;
+	}
+	if (self.downloadProgress)
+		self.downloadProgress((NSUInteger)self.metrics.receivedByteCount, (NSUInteger)[self.lastResponse expectedContentLength]);
+	[self.group operation:self didReceiveBytes:self.metrics.receivedByteCount ofExpectedBytes:[self.lastResponse expectedContentLength]];
+	NSError *error = nil;
+	if (![self.streamParser appendData:data error:&error])
+		[self processRequest:[self errorFromStreamParserError:error]];
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection *)connection
+{
+	NSParameterAssert(self.isActualRunLoopThread);
+	if (![self finishDecompressing])
+		return;
+	NSError *error = nil;
+	if ((self.streamParser != nil) && ![self.streamParser finish:&error])
+	{
+		[self processRequest:[self errorFromStreamParserError:error]];
+		return;
+	}
+	[super connectionDidFinishLoading:connection];
+}
+
 + (NSSet *)defaultAcceptableContentTypes 
 {
 	return [NSSet setWithObjects:
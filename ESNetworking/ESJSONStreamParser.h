@@ -0,0 +1,82 @@
+//
+//  ESJSONStreamParser.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+extern NSString *const kESJSONStreamParserErrorDomain;
+
+enum {
+	kESJSONStreamParserErrorUnexpectedCharacter	=	-1,
+	kESJSONStreamParserErrorUnexpectedEnd		=	-2,
+	kESJSONStreamParserErrorBufferTooLarge		=	-3
+};
+
+typedef void (^ESJSONStreamParserElementBlock)(NSData *elementData, NSUInteger index);
+
+/**
+ * Splits a JSON document into its top level array elements as bytes arrive.
+ *
+ * The parser only tracks structure (nesting, strings and escapes), it doesn't validate
+ * or build the elements themselves. Each complete element is handed to elementBlock
+ * as a standalone JSON text that can be passed to NSJSONSerialization with
+ * NSJSONReadingAllowFragments. Only the element currently being received is buffered.
+ *
+ * If the top level value isn't an array, the whole document is buffered and made
+ * available through documentData once -finish: succeeds.
+ *
+ * Not thread safe, feed a parser from one thread at a time.
+ */
+
+@interface ESJSONStreamParser : NSObject
+
+- (id)initWithElementBlock:(ESJSONStreamParserElementBlock)elementBlock; // designated initializer
+
+/**
+ * Upper bound on bytes buffered for a single element (or the whole document if it isn't an array)
+ *
+ * Default is NSUIntegerMax
+ */
+@property (assign, readwrite) NSUInteger maximumBufferLength;
+/**
+ * YES once the parser has seen that the top level value is an array
+ */
+@property (assign, readonly, getter=isTopLevelArray) BOOL topLevelArray;
+/**
+ * Number of elements passed to elementBlock so far
+ */
+@property (assign, readonly) NSUInteger elementCount;
+/**
+ * Full document if the top level value isn't an array, valid after -finish:
+ */
+@property (strong, readonly) NSData *documentData;
+
+/**
+ * Scans data, calling elementBlock for every element completed by it
+ *
+ * @return NO if data can't be part of a valid document, error describes why. Once this returns NO the parser should be discarded.
+ */
+- (BOOL)appendData:(NSData *)data error:(NSError **)error;
+/**
+ * Call once all data has been appended.
+ *
+ * @return NO if the document is incomplete
+ */
+- (BOOL)finish:(NSError **)error;
+
+@end
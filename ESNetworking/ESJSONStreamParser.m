@@ -0,0 +1,288 @@
+//
+//  ESJSONStreamParser.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESJSONStreamParser.h"
+
+NSString *const kESJSONStreamParserErrorDomain = @"ESJSONStreamParserErrorDomain";
+
+typedef enum {
+	ESJSONStreamScanStart, // nothing but whitespace so far
+	ESJSONStreamScanDocument, // top level isn't an array, buffering everything
+	ESJSONStreamScanBetweenElements, // inside the top level array, outside any element
+	ESJSONStreamScanElement, // inside a top level element
+	ESJSONStreamScanEnd // past the closing bracket of the top level array
+} ESJSONStreamScanState;
+
+static inline BOOL IsJSONWhitespace(uint8_t c)
+{
+	return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+@interface ESJSONStreamParser ()
+@property (copy, nonatomic) ESJSONStreamParserElementBlock elementBlock;
+- (BOOL)appendBytes:(const uint8_t *)bytes length:(NSUInteger)length error:(NSError **)error;
+- (void)emitElement;
+- (NSError *)errorWithCode:(NSInteger)code description:(NSString *)description;
+@end
+
+@implementation ESJSONStreamParser
+{
+	ESJSONStreamScanState _scanState;
+	NSMutableData *_buffer;
+	unsigned long long _offset; // bytes consumed, for error reporting
+	NSUInteger _depth;
+	BOOL _inString;
+	BOOL _escaped;
+	BOOL _bareScalar; // element is a number or literal, which only ends at a delimiter
+	BOOL _expectingValue; // just saw '[' or ','
+	BOOL _sawComma;
+	BOOL _skippedBOM;
+}
+@synthesize elementBlock=_elementBlock;
+@synthesize maximumBufferLength=_maximumBufferLength;
+@synthesize topLevelArray=_topLevelArray;
+@synthesize elementCount=_elementCount;
+@synthesize documentData=_documentData;
+
+- (id)initWithElementBlock:(ESJSONStreamParserElementBlock)elementBlock
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_elementBlock = [elementBlock copy];
+		_maximumBufferLength = NSUIntegerMax;
+		_buffer = [NSMutableData new];
+		_scanState = ESJSONStreamScanStart;
+	}
+	return self;
+}
+
+- (id)init
+{
+	return [self initWithElementBlock:nil];
+}
+
+- (NSError *)errorWithCode:(NSInteger)code description:(NSString *)description
+{
+	NSDictionary *userInfo =
+	[[NSDictionary alloc] initWithObjectsAndKeys:
+	 [[NSString alloc] initWithFormat:@"%@ at byte %llu", description, _offset], NSLocalizedDescriptionKey,
+	 nil];
+	return [NSError errorWithDomain:kESJSONStreamParserErrorDomain code:code userInfo:userInfo];
+}
+
+- (void)emitElement
+{
+	NSData *element = [_buffer copy];
+	[_buffer setLength:0];
+	NSUInteger index = _elementCount;
+	_elementCount++;
+	if (self.elementBlock)
+		self.elementBlock(element, index);
+}
+
+- (BOOL)appendData:(NSData *)data error:(NSError **)error
+{
+	return [self appendBytes:(const uint8_t *)[data bytes] length:[data length] error:error];
+}
+
+- (BOOL)appendBytes:(const uint8_t *)bytes length:(NSUInteger)length error:(NSError **)error
+{
+	NSError *scanError = nil;
+	NSUInteger i = 0;
+	// Start of the run of bytes in this chunk that belongs to the element being scanned
+	NSUInteger elementStart = 0;
+	while (i < length && scanError == nil)
+	{
+		uint8_t c = bytes[i];
+		switch (_scanState) {
+			case ESJSONStreamScanStart:
+				if (!_skippedBOM && _offset == 0 && length - i >= 3 && c == 0xEF && bytes[i+1] == 0xBB && bytes[i+2] == 0xBF)
+				{
+					_skippedBOM = YES;
+					i += 3;
+					_offset += 3;
+					continue;
+				}
+				if (IsJSONWhitespace(c))
+					break;
+				if (c == '[')
+				{
+					_topLevelArray = YES;
+					_expectingValue = YES;
+					_sawComma = NO;
+					_scanState = ESJSONStreamScanBetweenElements;
+				}
+				else
+				{
+					// Not an array, just hang on to everything
+					_scanState = ESJSONStreamScanDocument;
+					elementStart = i;
+					continue;
+				}
+				break;
+			case ESJSONStreamScanDocument:
+				// Swallow the rest of the chunk in one go
+				[_buffer appendBytes:&bytes[i] length:length - i];
+				_offset += length - i;
+				i = length;
+				if ([_buffer length] > self.maximumBufferLength)
+					scanError = [self errorWithCode:kESJSONStreamParserErrorBufferTooLarge description:@"Document exceeds maximum buffer length"];
+				continue;
+			case ESJSONStreamScanBetweenElements:
+				if (IsJSONWhitespace(c))
+					break;
+				if (c == ',')
+				{
+					if (_expectingValue)
+						scanError = [self errorWithCode:kESJSONStreamParserErrorUnexpectedCharacter description:@"Unexpected ','"];
+					_expectingValue = YES;
+					_sawComma = YES;
+				}
+				else if (c == ']')
+				{
+					if (_expectingValue && _sawComma)
+						scanError = [self errorWithCode:kESJSONStreamParserErrorUnexpectedCharacter description:@"Unexpected ']' after ','"];
+					_scanState = ESJSONStreamScanEnd;
+				}
+				else if (!_expectingValue)
+					scanError = [self errorWithCode:kESJSONStreamParserErrorUnexpectedCharacter description:@"Expected ',' or ']'"];
+				else
+				{
+					_scanState = ESJSONStreamScanElement;
+					_expectingValue = NO;
+					_inString = NO;
+					_escaped = NO;
+					_bareScalar = NO;
+					_depth = 0;
+					elementStart = i;
+					if (c == '{' || c == '[')
+						_depth = 1;
+					else if (c == '"')
+						_inString = YES;
+					else
+						_bareScalar = YES;
+				}
+				break;
+			case ESJSONStreamScanElement:
+			{
+				BOOL complete = NO;
+				BOOL includeByte = YES;
+				// The first byte of the element was classified on the way in from BetweenElements
+				if (_inString)
+				{
+					if (_escaped)
+						_escaped = NO;
+					else if (c == '\\')
+						_escaped = YES;
+					else if (c == '"')
+					{
+						_inString = NO;
+						complete = (_depth == 0);
+					}
+				}
+				else if (_bareScalar)
+				{
+					if (IsJSONWhitespace(c) || c == ',' || c == ']')
+					{
+						complete = YES;
+						includeByte = NO;
+					}
+				}
+				else if (c == '"')
+					_inString = YES;
+				else if (c == '{' || c == '[')
+					_depth++;
+				else if (c == '}' || c == ']')
+				{
+					_depth--;
+					complete = (_depth == 0);
+				}
+				if (complete)
+				{
+					NSUInteger end = includeByte ? i + 1 : i;
+					[_buffer appendBytes:&bytes[elementStart] length:end - elementStart];
+					_scanState = ESJSONStreamScanBetweenElements;
+					_sawComma = NO;
+					if ([_buffer length] > self.maximumBufferLength)
+						scanError = [self errorWithCode:kESJSONStreamParserErrorBufferTooLarge description:@"Element exceeds maximum buffer length"];
+					else
+						[self emitElement];
+					if (!includeByte)
+					{
+						// The delimiter belongs to the array, scan it again in that state
+						continue;
+					}
+				}
+				break;
+			}
+			case ESJSONStreamScanEnd:
+				if (!IsJSONWhitespace(c))
+					scanError = [self errorWithCode:kESJSONStreamParserErrorUnexpectedCharacter description:@"Unexpected data after top level array"];
+				break;
+		}
+		i++;
+		_offset++;
+	}
+	// Carry a partially received element over to the next chunk
+	if (scanError == nil && _scanState == ESJSONStreamScanElement)
+	{
+		[_buffer appendBytes:&bytes[elementStart] length:length - elementStart];
+		if ([_buffer length] > self.maximumBufferLength)
+			scanError = [self errorWithCode:kESJSONStreamParserErrorBufferTooLarge description:@"Element exceeds maximum buffer length"];
+	}
+	if (scanError != nil)
+	{
+		if (error)
+			*error = scanError;
+		return NO;
+	}
+	return YES;
+}
+
+- (BOOL)finish:(NSError **)error
+{
+	NSError *finishError = nil;
+	switch (_scanState) {
+		case ESJSONStreamScanStart:
+		case ESJSONStreamScanDocument:
+			_documentData = [_buffer copy];
+			[_buffer setLength:0];
+			break;
+		case ESJSONStreamScanEnd:
+			break;
+		case ESJSONStreamScanBetweenElements:
+		case ESJSONStreamScanElement:
+			finishError = [self errorWithCode:kESJSONStreamParserErrorUnexpectedEnd description:@"Unexpected end of top level array"];
+			break;
+	}
+	if (finishError != nil)
+	{
+		if (error)
+			*error = finishError;
+		return NO;
+	}
+	return YES;
+}
+
+@end
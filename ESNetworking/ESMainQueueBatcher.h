@@ -0,0 +1,45 @@
+//
+//  ESMainQueueBatcher.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Collects blocks bound for the main queue and runs them together in a single main queue callout.
+ *
+ * With a window of 0 every block enqueued before the main queue gets around to the pending
+ * callout runs in it, so a burst of completions finishing in the same run loop turn costs the
+ * main thread one wakeup instead of one each. A longer window trades latency for bigger batches.
+ *
+ * Blocks run in the order they were enqueued. All methods are thread safe.
+ */
+
+@interface ESMainQueueBatcher : NSObject
+
++ (id)sharedBatcher;
+
+/**
+ * Time a batch stays open after its first block is enqueued
+ *
+ * Default is 0, implying the next main queue callout
+ */
+@property (assign, readwrite) NSTimeInterval window;
+
+- (void)enqueueBlock:(dispatch_block_t)block;
+
+@end
@@ -0,0 +1,119 @@
+//
+//  ESMainQueueBatcher.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESMainQueueBatcher.h"
+#import <libkern/OSAtomic.h>
+
+@interface ESMainQueueBatcher ()
+- (void)flush;
+@end
+
+@implementation ESMainQueueBatcher
+{
+	OSSpinLock _lock;
+	NSMutableArray *_blocks;
+	NSTimeInterval _window;
+}
+
++ (id)sharedBatcher
+{
+	static id sharedBatcher = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedBatcher = [[self class] new];
+	});
+	return sharedBatcher;
+}
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_lock = OS_SPINLOCK_INIT;
+	}
+	return self;
+}
+
+- (NSTimeInterval)window
+{
+	OSSpinLockLock(&_lock);
+	NSTimeInterval window = _window;
+	OSSpinLockUnlock(&_lock);
+	return window;
+}
+
+- (void)setWindow:(NSTimeInterval)window
+{
+	OSSpinLockLock(&_lock);
+	_window = window;
+	OSSpinLockUnlock(&_lock);
+}
+
+- (void)enqueueBlock:(dispatch_block_t)block
+{
+	NSParameterAssert(block != nil);
+	dispatch_block_t copiedBlock = [block copy];
+	// Allocate outside the lock
+	NSMutableArray *blocks = [[NSMutableArray alloc] initWithObjects:copiedBlock, nil];
+	BOOL scheduleFlush = NO;
+	NSTimeInterval window;
+	OSSpinLockLock(&_lock);
+	if (_blocks == nil)
+	{
+		// First block of a new batch
+		_blocks = blocks;
+		scheduleFlush = YES;
+	}
+	else
+		[_blocks addObject:copiedBlock];
+	window = _window;
+	OSSpinLockUnlock(&_lock);
+	if (!scheduleFlush)
+		return;
+	if (window > 0)
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(window * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+			[self flush];
+		});
+	else
+		dispatch_async(dispatch_get_main_queue(), ^{
+			[self flush];
+		});
+}
+
+- (void)flush
+{
+	NSParameterAssert([NSThread isMainThread]);
+	OSSpinLockLock(&_lock);
+	NSArray *blocks = _blocks;
+	_blocks = nil;
+	OSSpinLockUnlock(&_lock);
+	for (dispatch_block_t block in blocks)
+	{
+		@autoreleasepool {
+			block();
+		}
+	}
+}
+
+@end
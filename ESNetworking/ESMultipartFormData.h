@@ -0,0 +1,79 @@
+//
+//  ESMultipartFormData.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Builds a multipart/form-data request body out of strings, data and files without ever holding the whole body in memory.
+ *
+ * Parts are read one after the other from a stream returned by -newInputStream, files are read in chunks as the
+ * upload goes. The total length is known up front, so the body can be sent with a Content-Length rather than chunked
+ * (which also gives ESHTTPOperation's upload progress block a total to report against).
+ *
+ * Files must not change size between being appended and being sent. If one does, the stream fails rather than send more or less than Content-Length.
+ *
+ * @see [NSMutableURLRequest multipartRequestWithURL:formData:]
+ */
+
+@interface ESMultipartFormData : NSObject
+
+- (id)initWithBoundary:(NSString *)boundary; // designated initializer
+/**
+ * Uses a random boundary
+ */
+- (id)init;
+
+@property (copy, readonly) NSString *boundary;
+/**
+ * Value for the request's Content-Type header
+ */
+@property (copy, readonly) NSString *contentType;
+/**
+ * Length of the complete body in bytes
+ */
+@property (assign, readonly) unsigned long long contentLength;
+
+///-----------------
+/// @name Parts
+///-----------------
+
+- (void)appendPartWithName:(NSString *)name value:(NSString *)value;
+- (void)appendPartWithName:(NSString *)name data:(NSData *)data fileName:(NSString *)fileName contentType:(NSString *)contentType;
+/**
+ * Appends a part that is read from fileURL while the body is sent
+ *
+ * @param fileName If nil, the last path component of fileURL is used
+ * @param contentType If nil, application/octet-stream is used
+ * @return NO if the file's size couldn't be determined
+ */
+- (BOOL)appendPartWithName:(NSString *)name fileURL:(NSURL *)fileURL fileName:(NSString *)fileName contentType:(NSString *)contentType error:(NSError **)error;
+
+///-----------------
+/// @name Body
+///-----------------
+
+/**
+ * New, unopened stream that produces the body. The stream conforms to NSCopying, copies
+ * start over from the beginning (which is how ESHTTPOperation answers needNewBodyStream).
+ *
+ * Parts appended afterwards aren't included.
+ */
+- (NSInputStream *)newInputStream;
+
+@end
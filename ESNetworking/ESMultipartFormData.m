@@ -0,0 +1,351 @@
+//
+//  ESMultipartFormData.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESMultipartFormData.h"
+
+static NSString * QuotedHeaderParameter(NSString *value)
+// Same escaping browsers use for names and file names
+{
+	value = [value stringByReplacingOccurrencesOfString:@"\"" withString:@"%22"];
+	value = [value stringByReplacingOccurrencesOfString:@"\r" withString:@"%0D"];
+	value = [value stringByReplacingOccurrencesOfString:@"\n" withString:@"%0A"];
+	return value;
+}
+
+static NSError * FileChangedError(NSString *filePath)
+// The file isn't the length it was when it was appended, so Content-Length is now a lie
+{
+	return [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:[NSDictionary dictionaryWithObject:filePath forKey:NSFilePathErrorKey]];
+}
+
+/**
+ * Piece of the body, either in memory or read from a file
+ */
+@interface ESMultipartSegment : NSObject
+@property (strong, nonatomic) NSData *data;
+@property (copy, nonatomic) NSString *filePath;
+@property (assign, nonatomic) unsigned long long length;
+@end
+
+@implementation ESMultipartSegment
+@synthesize data=_data;
+@synthesize filePath=_filePath;
+@synthesize length=_length;
+
++ (id)segmentWithData:(NSData *)data
+{
+	ESMultipartSegment *segment = [[self class] new];
+	segment.data = data;
+	segment.length = [data length];
+	return segment;
+}
+
+@end
+
+/**
+ * NSInputStream that reads a list of segments one after the other.
+ *
+ * NSURLConnection schedules body streams with CFReadStream calls that end up in the private methods
+ * at the bottom. The stream always has bytes available, so there's nothing to actually schedule.
+ */
+@interface ESMultipartInputStream : NSInputStream <NSCopying>
+- (id)initWithSegments:(NSArray *)segments;
+@end
+
+@implementation ESMultipartInputStream
+{
+	NSArray *_segments;
+	NSUInteger _segmentIndex;
+	unsigned long long _segmentOffset;
+	NSInputStream *_fileStream;
+	NSStreamStatus _streamStatus;
+	NSError *_streamError;
+	__unsafe_unretained id<NSStreamDelegate> _delegate;
+}
+
+- (id)initWithSegments:(NSArray *)segments
+{
+	// NSInputStream's initializers belong to the class cluster and can hand back a different stream
+	self = [super init];
+	if (self != nil)
+	{
+		_segments = [segments copy];
+		_streamStatus = NSStreamStatusNotOpen;
+		_delegate = self;
+	}
+	return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+	return [[[self class] allocWithZone:zone] initWithSegments:_segments];
+}
+
+- (void)open
+{
+	if (_streamStatus != NSStreamStatusNotOpen)
+		return;
+	_streamStatus = NSStreamStatusOpen;
+}
+
+- (void)close
+{
+	[_fileStream close];
+	_fileStream = nil;
+	_streamStatus = NSStreamStatusClosed;
+}
+
+- (NSStreamStatus)streamStatus
+{
+	return _streamStatus;
+}
+
+- (NSError *)streamError
+{
+	return _streamError;
+}
+
+- (id<NSStreamDelegate>)delegate
+{
+	return _delegate;
+}
+
+- (void)setDelegate:(id<NSStreamDelegate>)delegate
+{
+	_delegate = (delegate != nil) ? delegate : self;
+}
+
+- (id)propertyForKey:(NSString *)key
+{
+	return nil;
+}
+
+- (BOOL)setProperty:(id)property forKey:(NSString *)key
+{
+	return NO;
+}
+
+- (void)scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode
+{
+	
+}
+
+- (void)removeFromRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode
+{
+	
+}
+
+- (BOOL)hasBytesAvailable
+{
+	return (_streamStatus == NSStreamStatusOpen);
+}
+
+- (BOOL)getBuffer:(uint8_t **)buffer length:(NSUInteger *)len
+{
+	return NO;
+}
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)length
+{
+	if (_streamStatus != NSStreamStatusOpen)
+		return (_streamStatus == NSStreamStatusAtEnd) ? 0 : -1;
+	NSUInteger totalRead = 0;
+	while ((totalRead < length) && (_segmentIndex < [_segments count]))
+	{
+		ESMultipartSegment *segment = [_segments objectAtIndex:_segmentIndex];
+		NSInteger bytesRead = 0;
+		if (segment.data != nil)
+		{
+			NSUInteger available = (NSUInteger)(segment.length - _segmentOffset);
+			NSUInteger count = MIN(available, length - totalRead);
+			[segment.data getBytes:buffer + totalRead range:NSMakeRange((NSUInteger)_segmentOffset, count)];
+			bytesRead = (NSInteger)count;
+		}
+		else
+		{
+			if (_fileStream == nil)
+			{
+				_fileStream = [[NSInputStream alloc] initWithFileAtPath:segment.filePath];
+				[_fileStream open];
+			}
+			// Never past the recorded length, anything more would run into the next part
+			NSUInteger available = (NSUInteger)MIN(segment.length - _segmentOffset, (unsigned long long)NSUIntegerMax);
+			bytesRead = [_fileStream read:buffer + totalRead maxLength:MIN(available, length - totalRead)];
+			if (bytesRead < 0)
+			{
+				_streamError = [_fileStream streamError];
+				_streamStatus = NSStreamStatusError;
+				return -1;
+			}
+			if ((bytesRead == 0) && (_segmentOffset < segment.length))
+			{
+				// File got shorter
+				_streamError = FileChangedError(segment.filePath);
+				_streamStatus = NSStreamStatusError;
+				return -1;
+			}
+			if (_segmentOffset + (unsigned long long)bytesRead >= segment.length)
+			{
+				// File got longer
+				uint8_t extra;
+				if ([_fileStream read:&extra maxLength:1] != 0)
+				{
+					_streamError = FileChangedError(segment.filePath);
+					_streamStatus = NSStreamStatusError;
+					return -1;
+				}
+			}
+		}
+		_segmentOffset += (unsigned long long)bytesRead;
+		totalRead += (NSUInteger)bytesRead;
+		if (_segmentOffset >= segment.length)
+		{
+			[_fileStream close];
+			_fileStream = nil;
+			_segmentIndex++;
+			_segmentOffset = 0;
+		}
+	}
+	if (_segmentIndex >= [_segments count])
+		_streamStatus = NSStreamStatusAtEnd;
+	return (NSInteger)totalRead;
+}
+
+#pragma mark - Undocumented CFReadStream bridged methods
+
+- (void)_scheduleInCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode
+{
+	
+}
+
+- (void)_unscheduleFromCFRunLoop:(CFRunLoopRef)aRunLoop forMode:(CFStringRef)aMode
+{
+	
+}
+
+- (BOOL)_setCFClientFlags:(CFOptionFlags)inFlags callback:(CFReadStreamClientCallBack)inCallback context:(CFStreamClientContext *)inContext
+{
+	return NO;
+}
+
+@end
+
+@interface ESMultipartFormData ()
+- (void)appendPartWithHeaders:(NSString *)headers bodySegment:(ESMultipartSegment *)bodySegment;
+@end
+
+@implementation ESMultipartFormData
+{
+	NSMutableArray *_segments;
+}
+@synthesize boundary=_boundary;
+@synthesize contentLength=_contentLength;
+
+- (id)initWithBoundary:(NSString *)boundary
+{
+	NSParameterAssert([boundary length] > 0);
+	self = [super init];
+	if (self != nil)
+	{
+		_boundary = [boundary copy];
+		_segments = [NSMutableArray new];
+		// Room for the closing boundary, which -newInputStream adds
+		_contentLength = [[[NSString stringWithFormat:@"--%@--\r\n", _boundary] dataUsingEncoding:NSUTF8StringEncoding] length];
+	}
+	return self;
+}
+
+- (id)init
+{
+	return [self initWithBoundary:[NSString stringWithFormat:@"ESBoundary%08X%08X%08X", arc4random(), arc4random(), arc4random()]];
+}
+
+- (NSString *)contentType
+{
+	return [NSString stringWithFormat:@"multipart/form-data; boundary=%@", self.boundary];
+}
+
+- (void)appendPartWithHeaders:(NSString *)headers bodySegment:(ESMultipartSegment *)bodySegment
+{
+	NSMutableString *prefix = [NSMutableString stringWithString:@"--"];
+	[prefix appendString:self.boundary];
+	[prefix appendString:@"\r\n"];
+	[prefix appendString:headers];
+	[prefix appendString:@"\r\n"];
+	ESMultipartSegment *prefixSegment = [ESMultipartSegment segmentWithData:[prefix dataUsingEncoding:NSUTF8StringEncoding]];
+	ESMultipartSegment *suffixSegment = [ESMultipartSegment segmentWithData:[NSData dataWithBytes:"\r\n" length:2]];
+	[_segments addObject:prefixSegment];
+	[_segments addObject:bodySegment];
+	[_segments addObject:suffixSegment];
+	_contentLength += prefixSegment.length + bodySegment.length + suffixSegment.length;
+}
+
+- (void)appendPartWithName:(NSString *)name value:(NSString *)value
+{
+	NSParameterAssert(name != nil);
+	NSString *headers = [NSString stringWithFormat:@"Content-Disposition: form-data; name=\"%@\"\r\n", QuotedHeaderParameter(name)];
+	NSData *data = [value dataUsingEncoding:NSUTF8StringEncoding];
+	[self appendPartWithHeaders:headers bodySegment:[ESMultipartSegment segmentWithData:(data != nil) ? data : [NSData data]]];
+}
+
+- (void)appendPartWithName:(NSString *)name data:(NSData *)data fileName:(NSString *)fileName contentType:(NSString *)contentType
+{
+	NSParameterAssert(name != nil);
+	NSParameterAssert(data != nil);
+	NSMutableString *headers = [NSMutableString stringWithFormat:@"Content-Disposition: form-data; name=\"%@\"", QuotedHeaderParameter(name)];
+	if (fileName != nil)
+		[headers appendFormat:@"; filename=\"%@\"", QuotedHeaderParameter(fileName)];
+	[headers appendString:@"\r\n"];
+	if (contentType != nil)
+		[headers appendFormat:@"Content-Type: %@\r\n", contentType];
+	[self appendPartWithHeaders:headers bodySegment:[ESMultipartSegment segmentWithData:[data copy]]];
+}
+
+- (BOOL)appendPartWithName:(NSString *)name fileURL:(NSURL *)fileURL fileName:(NSString *)fileName contentType:(NSString *)contentType error:(NSError **)error
+{
+	NSParameterAssert(name != nil);
+	NSParameterAssert([fileURL isFileURL]);
+	NSString *path = [fileURL path];
+	NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:error];
+	if (attributes == nil)
+		return NO;
+	if (fileName == nil)
+		fileName = [path lastPathComponent];
+	if (contentType == nil)
+		contentType = @"application/octet-stream";
+	NSString *headers = [NSString stringWithFormat:@"Content-Disposition: form-data; name=\"%@\"; filename=\"%@\"\r\nContent-Type: %@\r\n", QuotedHeaderParameter(name), QuotedHeaderParameter(fileName), contentType];
+	ESMultipartSegment *bodySegment = [ESMultipartSegment new];
+	bodySegment.filePath = path;
+	bodySegment.length = [attributes fileSize];
+	[self appendPartWithHeaders:headers bodySegment:bodySegment];
+	return YES;
+}
+
+- (NSInputStream *)newInputStream
+{
+	NSMutableArray *segments = [_segments mutableCopy];
+	[segments addObject:[ESMultipartSegment segmentWithData:[[NSString stringWithFormat:@"--%@--\r\n", self.boundary] dataUsingEncoding:NSUTF8StringEncoding]]];
+	return [[ESMultipartInputStream alloc] initWithSegments:segments];
+}
+
+@end
@@ -20,6 +20,10 @@ extern NSString * kESHTTPOperationErrorDomain;
 enum {
     kESHTTPOperationErrorResponseTooLarge	=	-1, 
     kESHTTPOperationErrorOnOutputStream		=	-2, 
+    kESHTTPOperationErrorOnSpillFile		=	-3, // userInfo dictionary contains the underlying POSIX error in @"underlyingError" key
+    kESHTTPOperationErrorBadCompressedData	=	-4, 
+    kESHTTPOperationErrorOnDownloadFile		=	-5, // userInfo dictionary contains the underlying POSIX error in @"underlyingError" key
+    kESHTTPOperationErrorBadRange			=	-6, // Content-Range of a partial response didn't match the range requested
 	kESHTTPOperationErrorBadStatusCode		=	NSURLErrorBadServerResponse, // userInfo dictionary contains error with statusCode in @"underlyingError" key
     kESHTTPOperationErrorBadContentType		=	NSURLErrorCannotDecodeContentData
 };
\ No newline at end of file
@@ -0,0 +1,75 @@
+//
+//  ESProcessingQueue.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Runs ESHTTPOperation work blocks with bounded concurrency, in order of the operations' priority.
+ *
+ * At most maximumConcurrentBlockCount blocks run at once, so a burst of finished downloads doesn't
+ * start a parse per download and have them all fight over the cores. Waiting blocks are kept in one
+ * FIFO lane per NSOperationQueuePriority and the highest non empty lane goes next. Blocks run on
+ * the global queue matching their lane's priority.
+ *
+ * The backlog is what operations check to apply backpressure, while it's at or above maximumBacklog
+ * they stop reading from their connections. It counts blocks that haven't run yet and results that
+ * have been produced but not consumed: JSON elements waiting for their element block and processed
+ * responses waiting for their completion block. A slow consumer holds data back on the wire instead
+ * of letting parsed results pile up in memory.
+ *
+ * All methods are thread safe.
+ */
+
+@interface ESProcessingQueue : NSObject
+
++ (id)sharedQueue;
+
+/**
+ * Default is the number of active processors
+ */
+@property (assign, readwrite) NSUInteger maximumConcurrentBlockCount;
+/**
+ * Backlog at which isBacklogged returns YES, 0 disables backpressure
+ *
+ * Default is 4 times the number of active processors
+ */
+@property (assign, readwrite) NSUInteger maximumBacklog;
+/**
+ * Blocks waiting to run plus pending results
+ */
+@property (assign, readonly) NSUInteger backlog;
+@property (assign, readonly, getter=isBacklogged) BOOL backlogged;
+
+- (void)enqueueBlock:(dispatch_block_t)block priority:(NSOperationQueuePriority)priority;
+
+///--------------------------
+/// @name Pending results
+///--------------------------
+
+// Producers call the first when a result is handed off toward its consumer and 
+// the second once the consumer is done with it, always in pairs.
+
+- (void)resultWasProduced;
+- (void)resultWasConsumed;
+/**
+ * Results produced and not yet consumed
+ */
+@property (assign, readonly) NSUInteger pendingResultCount;
+
+@end
@@ -0,0 +1,213 @@
+//
+//  ESProcessingQueue.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESProcessingQueue.h"
+#import <libkern/OSAtomic.h>
+
+// One lane per NSOperationQueuePriority, VeryLow to VeryHigh
+#define LANE_COUNT 5
+
+static NSUInteger LaneForPriority(NSOperationQueuePriority priority)
+{
+	if (priority <= NSOperationQueuePriorityVeryLow)
+		return 0;
+	if (priority >= NSOperationQueuePriorityVeryHigh)
+		return LANE_COUNT - 1;
+	// Priorities are 4 apart, round anything in between down
+	return (NSUInteger)((priority - NSOperationQueuePriorityVeryLow) / 4);
+}
+
+static dispatch_queue_t GlobalQueueForLane(NSUInteger lane)
+{
+	if (lane > LaneForPriority(NSOperationQueuePriorityNormal))
+		return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0);
+	if (lane < LaneForPriority(NSOperationQueuePriorityNormal))
+		return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0);
+	return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+}
+
+@interface ESProcessingQueue ()
+- (void)startWaitingBlocks;
+@end
+
+@implementation ESProcessingQueue
+{
+	OSSpinLock _lock;
+	NSMutableArray *_lanes[LANE_COUNT];
+	NSUInteger _waitingCount;
+	NSUInteger _runningCount;
+	NSUInteger _pendingResultCount;
+	NSUInteger _maximumConcurrentBlockCount;
+	NSUInteger _maximumBacklog;
+}
+
++ (id)sharedQueue
+{
+	static id sharedQueue = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedQueue = [[self class] new];
+	});
+	return sharedQueue;
+}
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_lock = OS_SPINLOCK_INIT;
+		for (NSUInteger lane = 0; lane < LANE_COUNT; lane++)
+			_lanes[lane] = [NSMutableArray new];
+		NSUInteger processorCount = MAX([[NSProcessInfo processInfo] activeProcessorCount], (NSUInteger)1);
+		_maximumConcurrentBlockCount = processorCount;
+		_maximumBacklog = processorCount * 4;
+	}
+	return self;
+}
+
+- (NSUInteger)maximumConcurrentBlockCount
+{
+	OSSpinLockLock(&_lock);
+	NSUInteger count = _maximumConcurrentBlockCount;
+	OSSpinLockUnlock(&_lock);
+	return count;
+}
+
+- (void)setMaximumConcurrentBlockCount:(NSUInteger)count
+{
+	NSParameterAssert(count > 0);
+	OSSpinLockLock(&_lock);
+	_maximumConcurrentBlockCount = MAX(count, (NSUInteger)1);
+	OSSpinLockUnlock(&_lock);
+	// Raising the limit can let waiting blocks go
+	[self startWaitingBlocks];
+}
+
+- (NSUInteger)maximumBacklog
+{
+	OSSpinLockLock(&_lock);
+	NSUInteger maximumBacklog = _maximumBacklog;
+	OSSpinLockUnlock(&_lock);
+	return maximumBacklog;
+}
+
+- (void)setMaximumBacklog:(NSUInteger)maximumBacklog
+{
+	OSSpinLockLock(&_lock);
+	_maximumBacklog = maximumBacklog;
+	OSSpinLockUnlock(&_lock);
+}
+
+- (NSUInteger)backlog
+{
+	OSSpinLockLock(&_lock);
+	NSUInteger backlog = _waitingCount + _pendingResultCount;
+	OSSpinLockUnlock(&_lock);
+	return backlog;
+}
+
+- (BOOL)isBacklogged
+{
+	OSSpinLockLock(&_lock);
+	BOOL backlogged = (_maximumBacklog > 0) && ((_waitingCount + _pendingResultCount) >= _maximumBacklog);
+	OSSpinLockUnlock(&_lock);
+	return backlogged;
+}
+
+- (void)resultWasProduced
+{
+	OSSpinLockLock(&_lock);
+	_pendingResultCount++;
+	OSSpinLockUnlock(&_lock);
+}
+
+- (void)resultWasConsumed
+{
+	OSSpinLockLock(&_lock);
+	BOOL balanced = (_pendingResultCount > 0);
+	if (balanced)
+		_pendingResultCount--;
+	OSSpinLockUnlock(&_lock);
+	NSAssert(balanced, @"Result consumed that wasn't produced");
+}
+
+- (NSUInteger)pendingResultCount
+{
+	OSSpinLockLock(&_lock);
+	NSUInteger count = _pendingResultCount;
+	OSSpinLockUnlock(&_lock);
+	return count;
+}
+
+- (void)enqueueBlock:(dispatch_block_t)block priority:(NSOperationQueuePriority)priority
+{
+	NSParameterAssert(block != nil);
+	dispatch_block_t copiedBlock = [block copy];
+	NSUInteger lane = LaneForPriority(priority);
+	OSSpinLockLock(&_lock);
+	[_lanes[lane] addObject:copiedBlock];
+	_waitingCount++;
+	OSSpinLockUnlock(&_lock);
+	[self startWaitingBlocks];
+}
+
+- (void)startWaitingBlocks
+{
+	while (YES)
+	{
+		dispatch_block_t block = nil;
+		NSUInteger lane = LANE_COUNT;
+		OSSpinLockLock(&_lock);
+		if ((_waitingCount > 0) && (_runningCount < _maximumConcurrentBlockCount))
+		{
+			while (lane > 0)
+			{
+				lane--;
+				NSMutableArray *waiting = _lanes[lane];
+				if ([waiting count] > 0)
+				{
+					block = [waiting objectAtIndex:0];
+					[waiting removeObjectAtIndex:0];
+					break;
+				}
+			}
+			_waitingCount--;
+			_runningCount++;
+		}
+		OSSpinLockUnlock(&_lock);
+		if (block == nil)
+			return;
+		dispatch_async(GlobalQueueForLane(lane), ^{
+			@autoreleasepool {
+				block();
+			}
+			OSSpinLockLock(&_lock);
+			_runningCount--;
+			OSSpinLockUnlock(&_lock);
+			[self startWaitingBlocks];
+		});
+	}
+}
+
+@end
@@ -0,0 +1,60 @@
+//
+//  ESRequestCoalescer.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class ESHTTPOperation;
+
+/**
+ * Shares one network load and work block run between identical in flight ESHTTPOperations.
+ *
+ * Operations that set coalescesIdenticalRequests subscribe here when they start. The first subscriber
+ * for a key causes a private operation to be started that performs the request and the work block,
+ * every subscriber (including the first) then finishes with a copy of that operation's result and runs
+ * its own completion block.
+ *
+ * Cancelling a subscriber only detaches it, the shared load is cancelled once it has no subscribers left.
+ *
+ * Operations are identical if they are the same class, have the same work block and their requests have
+ * the same method, URL and header fields. Only GET and HEAD requests without a body are coalesced.
+ * Operations in different ESHTTPOperationGroups can share a load.
+ *
+ * The shared operation reports the load to the metrics sink, subscribers don't.
+ */
+
+@interface ESRequestCoalescer : NSObject
+
++ (id)sharedCoalescer;
+
+/**
+ * Returns YES if op's request could be shared with other operations
+ */
++ (BOOL)canCoalesceOperation:(ESHTTPOperation *)op;
+
+/**
+ * Number of shared loads currently in flight
+ */
+@property (assign, readonly) NSUInteger activeRequestCount;
+
+// Called by ESHTTPOperation on the subscriber's run loop thread
+
+- (void)addSubscriber:(ESHTTPOperation *)op;
+- (void)removeSubscriber:(ESHTTPOperation *)op;
+
+@end
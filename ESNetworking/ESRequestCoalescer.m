@@ -0,0 +1,207 @@
+//
+//  ESRequestCoalescer.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESRequestCoalescer.h"
+#import "ESHTTPOperation.h"
+
+static NSString * CoalescingKeyForOperation(ESHTTPOperation *op)
+{
+	NSURLRequest *request = op.request;
+	NSString *method = [request HTTPMethod];
+	if (method == nil)
+		method = @"GET";
+	// Different work blocks produce different processed responses, so they can't share.
+	// Blocks that don't capture anything (like ESJSONOperation's) are the same object every time.
+	NSMutableString *key = [NSMutableString stringWithFormat:@"%@ %p %@ %@", NSStringFromClass([op class]), op.work, [method uppercaseString], [[request URL] absoluteString]];
+	NSDictionary *headerFields = [request allHTTPHeaderFields];
+	for (NSString *name in [[headerFields allKeys] sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)])
+		[key appendFormat:@"\n%@: %@", [name lowercaseString], [headerFields objectForKey:name]];
+	// Configuration that changes the outcome. The group doesn't, subscribers in
+	// different groups share a load and each reports to its own.
+	[key appendFormat:@"\n%@\n%@\n%lu\n%d", op.acceptableStatusCodes, op.acceptableContentTypes, (unsigned long)op.maximumResponseSize, op.decompressesResponseBody];
+	return key;
+}
+
+@interface ESCoalescedRequest : NSObject
+@property (strong, nonatomic) ESHTTPOperation *operation;
+@property (strong, nonatomic) NSMutableArray *subscribers;
+@end
+
+@implementation ESCoalescedRequest
+@synthesize operation=_operation;
+@synthesize subscribers=_subscribers;
+@end
+
+@interface ESRequestCoalescer ()
+- (ESHTTPOperation *)newSharedOperationForSubscriber:(ESHTTPOperation *)op key:(NSString *)key;
+- (void)sharedOperationDidFinish:(ESHTTPOperation *)sharedOperation key:(NSString *)key;
+@end
+
+@implementation ESRequestCoalescer
+{
+	NSMutableDictionary *_requests;
+	dispatch_queue_t _syncQueue;
+}
+
++ (id)sharedCoalescer
+{
+	static id sharedCoalescer = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedCoalescer = [[self class] new];
+	});
+	return sharedCoalescer;
+}
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_requests = [NSMutableDictionary new];
+		_syncQueue = dispatch_queue_create("com.everythingsolution.requestcoalescer", 0);
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	dispatch_release(_syncQueue);
+}
+
++ (BOOL)canCoalesceOperation:(ESHTTPOperation *)op
+{
+	NSURLRequest *request = op.request;
+	NSString *method = [[request HTTPMethod] uppercaseString];
+	if ((method != nil) && ![method isEqualToString:@"GET"] && ![method isEqualToString:@"HEAD"])
+		return NO;
+	if (([request HTTPBody] != nil) || ([request HTTPBodyStream] != nil))
+		return NO;
+	// Streams and progress blocks are per operation
+	if ((op.outputStream != nil) || (op.downloadProgress != nil) || (op.uploadProgress != nil))
+		return NO;
+	return [op isCoalescable];
+}
+
+- (NSUInteger)activeRequestCount
+{
+	__block NSUInteger count;
+	dispatch_sync(_syncQueue, ^{
+		count = [_requests count];
+	});
+	return count;
+}
+
+- (ESHTTPOperation *)newSharedOperationForSubscriber:(ESHTTPOperation *)op key:(NSString *)key
+{
+	ESHTTPOperation *sharedOperation =
+	[[[op class] alloc] initWithRequest:op.request
+								   work:op.work
+							 completion:^(ESHTTPOperation *sharedOp) {
+								 [self sharedOperationDidFinish:sharedOp key:key];
+							 }];
+	sharedOperation.runLoopModes = op.runLoopModes;
+	sharedOperation.acceptableStatusCodes = op.acceptableStatusCodes;
+	sharedOperation.acceptableContentTypes = op.acceptableContentTypes;
+	sharedOperation.cancelOnStatusCodeError = op.cancelOnStatusCodeError;
+	sharedOperation.cancelOnContentTypeError = op.cancelOnContentTypeError;
+	sharedOperation.cache = op.cache;
+	sharedOperation.reusesCachedProcessedResponse = op.reusesCachedProcessedResponse;
+	sharedOperation.defaultResponseSize = op.defaultResponseSize;
+	sharedOperation.maximumResponseSize = op.maximumResponseSize;
+	sharedOperation.responseSpillThreshold = op.responseSpillThreshold;
+	sharedOperation.decompressesResponseBody = op.decompressesResponseBody;
+	sharedOperation.retryPolicy = op.retryPolicy;
+	sharedOperation.hedgesRequests = op.hedgesRequests;
+	sharedOperation.hedgingDelay = op.hedgingDelay;
+	return sharedOperation;
+}
+
+- (void)addSubscriber:(ESHTTPOperation *)op
+{
+	NSParameterAssert(op.isActualRunLoopThread);
+	NSString *key = CoalescingKeyForOperation(op);
+	__block ESHTTPOperation *startOperation = nil;
+	dispatch_sync(_syncQueue, ^{
+		ESCoalescedRequest *coalescedRequest = [_requests objectForKey:key];
+		if (coalescedRequest == nil)
+		{
+			coalescedRequest = [ESCoalescedRequest new];
+			coalescedRequest.subscribers = [NSMutableArray new];
+			coalescedRequest.operation = [self newSharedOperationForSubscriber:op key:key];
+			[_requests setObject:coalescedRequest forKey:key];
+			startOperation = coalescedRequest.operation;
+		}
+		[coalescedRequest.subscribers addObject:op];
+	});
+	// Concurrent operations can be started directly, this just bounces to a network thread
+	[startOperation start];
+}
+
+- (void)removeSubscriber:(ESHTTPOperation *)op
+{
+	NSString *key = CoalescingKeyForOperation(op);
+	__block ESHTTPOperation *cancelOperation = nil;
+	dispatch_sync(_syncQueue, ^{
+		ESCoalescedRequest *coalescedRequest = [_requests objectForKey:key];
+		if (coalescedRequest == nil)
+			return;
+		[coalescedRequest.subscribers removeObjectIdenticalTo:op];
+		if ([coalescedRequest.subscribers count] == 0)
+		{
+			[_requests removeObjectForKey:key];
+			cancelOperation = coalescedRequest.operation;
+		}
+	});
+	// Nobody is waiting on it anymore. -cancel waits on the shared operation's
+	// thread, so don't do it from this one.
+	if (cancelOperation != nil)
+	{
+		dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+			[cancelOperation cancel];
+		});
+	}
+}
+
+- (void)sharedOperationDidFinish:(ESHTTPOperation *)sharedOperation key:(NSString *)key
+{
+	__block NSArray *subscribers = nil;
+	dispatch_sync(_syncQueue, ^{
+		ESCoalescedRequest *coalescedRequest = [_requests objectForKey:key];
+		// A newer shared operation may have taken this key after a cancellation
+		if (coalescedRequest.operation != sharedOperation)
+			return;
+		subscribers = [coalescedRequest.subscribers copy];
+		[_requests removeObjectForKey:key];
+	});
+	for (ESHTTPOperation *subscriber in subscribers)
+	{
+		[subscriber performSelector:@selector(finishWithResultOfCoalescedOperation:)
+						   onThread:subscriber.actualRunLoopThread
+						 withObject:sharedOperation
+					  waitUntilDone:NO
+							  modes:[subscriber.actualRunLoopModes allObjects]];
+	}
+}
+
+@end
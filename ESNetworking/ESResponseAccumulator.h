@@ -0,0 +1,76 @@
+//
+//  ESResponseAccumulator.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Accumulates a response body as the list of chunks it was received in, moving it to a temporary file once it grows past spillThreshold.
+ *
+ * Chunks are retained rather than copied into one growing buffer, so nothing is reserved up front and nothing is copied
+ * as the body grows. Callers that can consume non-contiguous data use the segments directly, everyone else flattens them
+ * once with +dataByConsumingSegments:.
+ *
+ * A spilled body is handed back as a single segment mapped from the temporary file, so large responses don't cost
+ * their size in dirty memory. The file is unlinked as soon as it's mapped (or when the accumulator is deallocated),
+ * nothing is left behind in the temporary directory.
+ *
+ * Errors are in kESHTTPOperationErrorDomain with code kESHTTPOperationErrorOnSpillFile.
+ *
+ * Not thread safe, feed an accumulator from one thread at a time.
+ */
+
+@interface ESResponseAccumulator : NSObject
+
+/**
+ * @param spillThreshold Number of bytes held in memory before spilling to disk, 0 never spills
+ */
+- (id)initWithSpillThreshold:(NSUInteger)spillThreshold; // designated initializer
+
+/**
+ * Concatenates segments into a single contiguous NSData. A single segment is returned as is.
+ */
++ (NSData *)dataWithSegments:(NSArray *)segments;
+/**
+ * Same as +dataWithSegments:, but removes each segment from segments as soon as it's copied. If nothing else holds on 
+ * to them, the segments are freed as the copy is made instead of the body being in memory twice.
+ */
++ (NSData *)dataByConsumingSegments:(NSMutableArray *)segments;
+
+@property (assign, readonly) NSUInteger spillThreshold;
+/**
+ * Bytes appended so far
+ */
+@property (assign, readonly) NSUInteger length;
+/**
+ * YES once the body has been moved to a temporary file
+ */
+@property (assign, readonly, getter=isSpilled) BOOL spilled;
+
+/**
+ * @return NO if the body couldn't be written to the temporary file. Once this returns NO the accumulator should be discarded.
+ */
+- (BOOL)appendData:(NSData *)data error:(NSError **)error;
+/**
+ * Call once all data has been appended, the accumulator can't be appended to afterwards.
+ *
+ * @return The accumulated body as an array of NSData segments in the order they were received, or nil if a spilled body couldn't be mapped
+ */
+- (NSArray *)finish:(NSError **)error;
+
+@end
@@ -0,0 +1,239 @@
+//
+//  ESResponseAccumulator.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESResponseAccumulator.h"
+#import "ESNetworkError.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+@interface ESResponseAccumulator ()
+- (BOOL)spill:(NSError **)error;
+- (BOOL)writeBytes:(const uint8_t *)bytes length:(NSUInteger)length error:(NSError **)error;
+- (void)removeFile;
+- (NSError *)errorWithUnderlyingError:(NSError *)underlyingError;
+@end
+
+@implementation ESResponseAccumulator
+{
+	NSMutableArray *_segments;
+	NSString *_filePath;
+	int _fileDescriptor;
+	BOOL _finished;
+}
+@synthesize spillThreshold=_spillThreshold;
+@synthesize length=_length;
+
+- (id)initWithSpillThreshold:(NSUInteger)spillThreshold
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_spillThreshold = spillThreshold;
+		_segments = [NSMutableArray new];
+		_fileDescriptor = -1;
+	}
+	return self;
+}
+
+- (id)init
+{
+	return [self initWithSpillThreshold:0];
+}
+
++ (NSData *)dataWithSegments:(NSArray *)segments
+{
+	NSUInteger count = [segments count];
+	if (count == 0)
+		return [NSData data];
+	if (count == 1)
+		return [segments objectAtIndex:0];
+	NSUInteger length = 0;
+	for (NSData *segment in segments)
+		length += [segment length];
+	NSMutableData *data = [[NSMutableData alloc] initWithLength:length];
+	uint8_t *bytes = [data mutableBytes];
+	for (NSData *segment in segments)
+	{
+		NSUInteger segmentLength = [segment length];
+		memcpy(bytes, [segment bytes], segmentLength);
+		bytes += segmentLength;
+	}
+	return data;
+}
+
++ (NSData *)dataByConsumingSegments:(NSMutableArray *)segments
+{
+	NSUInteger count = [segments count];
+	if (count <= 1)
+	{
+		NSData *data = [self dataWithSegments:segments];
+		[segments removeAllObjects];
+		return data;
+	}
+	NSUInteger length = 0;
+	for (NSData *segment in segments)
+		length += [segment length];
+	// A large zero filled buffer is only committed page by page as it's written, 
+	// so releasing each segment once it's copied keeps the peak near one body
+	NSMutableData *data = [[NSMutableData alloc] initWithLength:length];
+	uint8_t *bytes = [data mutableBytes];
+	while ([segments count] > 0)
+	{
+		@autoreleasepool {
+			NSData *segment = [segments objectAtIndex:0];
+			NSUInteger segmentLength = [segment length];
+			memcpy(bytes, [segment bytes], segmentLength);
+			bytes += segmentLength;
+			[segments removeObjectAtIndex:0];
+		}
+	}
+	return data;
+}
+
+- (void)dealloc
+{
+	[self removeFile];
+}
+
+- (BOOL)isSpilled
+{
+	return (_filePath != nil);
+}
+
+- (NSError *)errorWithUnderlyingError:(NSError *)underlyingError
+{
+	NSDictionary *userInfo = 
+	[[NSDictionary alloc] initWithObjectsAndKeys:
+	 underlyingError, @"underlyingError",
+	 NSLocalizedString(@"Could not buffer response body on disk", nil), NSLocalizedDescriptionKey,
+	 nil];
+	return [NSError errorWithDomain:kESHTTPOperationErrorDomain code:kESHTTPOperationErrorOnSpillFile userInfo:userInfo];
+}
+
+- (void)removeFile
+{
+	if (_fileDescriptor != -1)
+	{
+		close(_fileDescriptor);
+		_fileDescriptor = -1;
+	}
+	if (_filePath != nil)
+	{
+		unlink([_filePath fileSystemRepresentation]);
+		_filePath = nil;
+	}
+}
+
+- (BOOL)spill:(NSError **)error
+{
+	NSString *template = [NSTemporaryDirectory() stringByAppendingPathComponent:@"ESResponseAccumulator.XXXXXX"];
+	char *path = strdup([template fileSystemRepresentation]);
+	int fd = mkstemp(path);
+	if (fd == -1)
+	{
+		int mkstempErrno = errno;
+		free(path);
+		if (error)
+			*error = [self errorWithUnderlyingError:[NSError errorWithDomain:NSPOSIXErrorDomain code:mkstempErrno userInfo:nil]];
+		return NO;
+	}
+	_filePath = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:path length:strlen(path)];
+	free(path);
+	_fileDescriptor = fd;
+	for (NSData *segment in _segments)
+	{
+		if (![self writeBytes:[segment bytes] length:[segment length] error:error])
+			return NO;
+	}
+	_segments = nil;
+	return YES;
+}
+
+- (BOOL)writeBytes:(const uint8_t *)bytes length:(NSUInteger)length error:(NSError **)error
+{
+	NSParameterAssert(_fileDescriptor != -1);
+	while (length > 0)
+	{
+		ssize_t bytesWritten = write(_fileDescriptor, bytes, length);
+		if (bytesWritten < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (error)
+				*error = [self errorWithUnderlyingError:[NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil]];
+			return NO;
+		}
+		bytes += bytesWritten;
+		length -= (NSUInteger)bytesWritten;
+	}
+	return YES;
+}
+
+- (BOOL)appendData:(NSData *)data error:(NSError **)error
+{
+	NSParameterAssert(!_finished);
+	NSUInteger dataLength = [data length];
+	if ((_fileDescriptor == -1) && (_spillThreshold > 0) && (_length + dataLength > _spillThreshold))
+	{
+		if (![self spill:error])
+			return NO;
+	}
+	if (_fileDescriptor != -1)
+	{
+		if (![self writeBytes:[data bytes] length:dataLength error:error])
+			return NO;
+	}
+	else if (dataLength > 0)
+		[_segments addObject:[data copy]]; // NSURLConnection hands out immutable data, so this is just a retain
+	_length += dataLength;
+	return YES;
+}
+
+- (NSArray *)finish:(NSError **)error
+{
+	NSParameterAssert(!_finished);
+	_finished = YES;
+	if (_filePath == nil)
+	{
+		NSArray *segments = [_segments copy];
+		_segments = nil;
+		return segments;
+	}
+	close(_fileDescriptor);
+	_fileDescriptor = -1;
+	NSError *readError = nil;
+	NSData *data = [[NSData alloc] initWithContentsOfFile:_filePath options:NSDataReadingMappedAlways error:&readError];
+	// The mapping outlives the directory entry
+	[self removeFile];
+	if (data == nil)
+	{
+		if (error)
+			*error = [self errorWithUnderlyingError:readError];
+		return nil;
+	}
+	return [NSArray arrayWithObject:data];
+}
+
+@end
@@ -0,0 +1,68 @@
+//
+//  ESResponseDecompressor.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Inflates a gzip or zlib compressed body chunk by chunk as it arrives.
+ *
+ * The format is detected from the first bytes of the body. Bodies that don't start with a gzip or
+ * zlib header are passed through untouched, so a response NSURLConnection has already decoded
+ * (or one that was never compressed) is safe to feed through a decompressor. A zlib header is only
+ * two bytes and some text starts with bytes that look like one, so a body that fails to inflate
+ * before producing any output is passed through as well.
+ *
+ * Requires libz.
+ *
+ * Errors are in kESHTTPOperationErrorDomain, kESHTTPOperationErrorBadCompressedData for corrupt or
+ * truncated data and kESHTTPOperationErrorResponseTooLarge when maximumOutputLength is exceeded.
+ *
+ * Not thread safe, feed a decompressor from one thread at a time.
+ */
+
+@interface ESResponseDecompressor : NSObject
+
+/**
+ * Upper bound on the total decompressed length, checked as data is inflated so a small
+ * compressed body can't expand into an unbounded amount of memory.
+ *
+ * Default is NSUIntegerMax
+ */
+@property (assign, readwrite) NSUInteger maximumOutputLength;
+/**
+ * Decompressed bytes produced so far
+ */
+@property (assign, readonly) unsigned long long outputLength;
+/**
+ * YES once the body has been recognized as compressed
+ */
+@property (assign, readonly, getter=isDecompressing) BOOL decompressing;
+
+/**
+ * @return The data produced by this chunk, which may be empty, or nil on error. Once this returns nil the decompressor should be discarded.
+ */
+- (NSData *)decompressData:(NSData *)data error:(NSError **)error;
+/**
+ * Call once all data has been passed in.
+ *
+ * @return Any remaining data, which may be empty, or nil if the compressed stream was incomplete
+ */
+- (NSData *)finish:(NSError **)error;
+
+@end
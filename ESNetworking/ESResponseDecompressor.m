@@ -0,0 +1,237 @@
+//
+//  ESResponseDecompressor.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESResponseDecompressor.h"
+#import "ESNetworkError.h"
+#include <zlib.h>
+
+#define OUTPUT_CHUNK_LENGTH (32 * 1024)
+
+typedef enum {
+	ESResponseDecompressorDetecting, // haven't seen enough of the body to know what it is
+	ESResponseDecompressorInflating,
+	ESResponseDecompressorPassingThrough,
+	ESResponseDecompressorFinished
+} ESResponseDecompressorState;
+
+static BOOL IsGzipHeader(const uint8_t *bytes)
+{
+	return (bytes[0] == 0x1f && bytes[1] == 0x8b);
+}
+
+static BOOL IsZlibHeader(const uint8_t *bytes)
+{
+	// CM must be 8 (deflate), CMF/FLG must be a multiple of 31 (RFC 1950) and HTTP bodies 
+	// never use a preset dictionary. Plenty of text still matches, see inflateBytes:.
+	return ((bytes[0] & 0x0f) == 8) && ((bytes[0] >> 4) <= 7) && ((bytes[1] & 0x20) == 0) && ((((unsigned int)bytes[0] << 8) | bytes[1]) % 31 == 0);
+}
+
+@interface ESResponseDecompressor ()
+- (NSData *)inflateBytes:(const uint8_t *)bytes length:(NSUInteger)length error:(NSError **)error;
+- (NSData *)passThroughPendingInput;
+- (NSError *)errorWithCode:(NSInteger)code description:(NSString *)description;
+@end
+
+@implementation ESResponseDecompressor
+{
+	ESResponseDecompressorState _state;
+	z_stream _stream;
+	BOOL _streamInitialized;
+	BOOL _streamEnded; // the current gzip member (or zlib stream) is complete
+	NSMutableData *_header; // first bytes of the body while detecting
+	NSMutableData *_pendingInput; // everything inflated until the first output, in case it wasn't compressed after all
+}
+@synthesize maximumOutputLength=_maximumOutputLength;
+@synthesize outputLength=_outputLength;
+
+- (id)init
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_maximumOutputLength = NSUIntegerMax;
+		_state = ESResponseDecompressorDetecting;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if (_streamInitialized)
+		inflateEnd(&_stream);
+}
+
+- (BOOL)isDecompressing
+{
+	return _streamInitialized;
+}
+
+- (NSError *)errorWithCode:(NSInteger)code description:(NSString *)description
+{
+	NSDictionary *userInfo = 
+	[[NSDictionary alloc] initWithObjectsAndKeys:
+	 description, NSLocalizedDescriptionKey,
+	 nil];
+	return [NSError errorWithDomain:kESHTTPOperationErrorDomain code:code userInfo:userInfo];
+}
+
+- (NSData *)decompressData:(NSData *)data error:(NSError **)error
+{
+	NSParameterAssert(_state != ESResponseDecompressorFinished);
+	const uint8_t *bytes = [data bytes];
+	NSUInteger length = [data length];
+	if (_state == ESResponseDecompressorDetecting)
+	{
+		// Usually the whole header is in the first chunk, if it isn't hang on to what we have
+		NSData *header = data;
+		if ((_header != nil) || (length < 2))
+		{
+			if (_header == nil)
+				_header = [NSMutableData new];
+			[_header appendData:data];
+			if ([_header length] < 2)
+				return [NSData data];
+			header = _header;
+			_header = nil;
+		}
+		if (!IsGzipHeader([header bytes]) && !IsZlibHeader([header bytes]))
+		{
+			_state = ESResponseDecompressorPassingThrough;
+			_outputLength += [header length];
+			return header;
+		}
+		memset(&_stream, 0, sizeof(_stream));
+		// 32 added to the window bits detects gzip or zlib wrapping
+		if (inflateInit2(&_stream, 15 + 32) != Z_OK)
+		{
+			if (error)
+				*error = [self errorWithCode:kESHTTPOperationErrorBadCompressedData description:NSLocalizedString(@"Could not initialize decompression", nil)];
+			return nil;
+		}
+		_streamInitialized = YES;
+		_state = ESResponseDecompressorInflating;
+		_pendingInput = [NSMutableData new];
+		return [self inflateBytes:[header bytes] length:[header length] error:error];
+	}
+	if (_state == ESResponseDecompressorPassingThrough)
+	{
+		_outputLength += length;
+		return data;
+	}
+	return [self inflateBytes:bytes length:length error:error];
+}
+
+- (NSData *)passThroughPendingInput
+// A body that looked compressed but didn't inflate to anything is passed through as is
+{
+	NSData *pendingInput = _pendingInput;
+	_pendingInput = nil;
+	inflateEnd(&_stream);
+	_streamInitialized = NO;
+	_state = ESResponseDecompressorPassingThrough;
+	_outputLength += [pendingInput length];
+	return pendingInput;
+}
+
+- (NSData *)inflateBytes:(const uint8_t *)bytes length:(NSUInteger)length error:(NSError **)error
+{
+	if (_pendingInput != nil)
+		[_pendingInput appendBytes:bytes length:length];
+	NSMutableData *output = [NSMutableData data];
+	uint8_t buffer[OUTPUT_CHUNK_LENGTH];
+	_stream.next_in = (Bytef *)bytes;
+	_stream.avail_in = (uInt)length;
+	// Keep going while there's input, or while zlib filled the buffer and may have more output pending
+	BOOL more = (length > 0);
+	while (more)
+	{
+		if (_streamEnded)
+		{
+			if (_stream.avail_in == 0)
+				break;
+			// Concatenated gzip members are valid, start on the next one
+			if (inflateReset(&_stream) != Z_OK)
+				break;
+			_streamEnded = NO;
+		}
+		_stream.next_out = buffer;
+		_stream.avail_out = OUTPUT_CHUNK_LENGTH;
+		int status = inflate(&_stream, Z_NO_FLUSH);
+		if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+		{
+			if (_pendingInput != nil)
+				return [self passThroughPendingInput];
+			if (error)
+				*error = [self errorWithCode:kESHTTPOperationErrorBadCompressedData description:NSLocalizedString(@"Response body is not valid compressed data", nil)];
+			return nil;
+		}
+		NSUInteger produced = OUTPUT_CHUNK_LENGTH - _stream.avail_out;
+		if (_outputLength + produced > _maximumOutputLength)
+		{
+			if (error)
+				*error = [self errorWithCode:kESHTTPOperationErrorResponseTooLarge description:NSLocalizedString(@"Decompressed response body is too large", nil)];
+			return nil;
+		}
+		[output appendBytes:buffer length:produced];
+		_outputLength += produced;
+		// Really compressed, no need to keep the input around anymore
+		if (produced > 0)
+			_pendingInput = nil;
+		if (status == Z_STREAM_END)
+			_streamEnded = YES;
+		else if ((status == Z_BUF_ERROR) && (produced == 0))
+			break; // needs more input than this chunk has
+		more = (_stream.avail_in > 0) || (_stream.avail_out == 0);
+	}
+	return output;
+}
+
+- (NSData *)finish:(NSError **)error
+{
+	NSParameterAssert(_state != ESResponseDecompressorFinished);
+	ESResponseDecompressorState state = _state;
+	_state = ESResponseDecompressorFinished;
+	if (state == ESResponseDecompressorDetecting)
+	{
+		// Body too short to be compressed
+		NSData *header = (_header != nil) ? _header : [NSData data];
+		_header = nil;
+		_outputLength += [header length];
+		return header;
+	}
+	if ((state == ESResponseDecompressorInflating) && !_streamEnded && (_pendingInput != nil))
+	{
+		NSData *pendingInput = [self passThroughPendingInput];
+		_state = ESResponseDecompressorFinished;
+		return pendingInput;
+	}
+	if ((state == ESResponseDecompressorInflating) && !_streamEnded)
+	{
+		if (error)
+			*error = [self errorWithCode:kESHTTPOperationErrorBadCompressedData description:NSLocalizedString(@"Compressed response body is incomplete", nil)];
+		return nil;
+	}
+	return [NSData data];
+}
+
+@end
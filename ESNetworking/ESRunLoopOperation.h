@@ -69,6 +69,19 @@ typedef enum ESOperationState ESOperationState;
 
 - (void)setError:(NSError *)error;
 
+// -start and -cancel bounce to these on the actual run loop thread.  Subclasses 
+// that override them must call super.
+
+- (void)startOnRunLoopThread;
+- (void)cancelOnRunLoopThread;
+
+// The first half of -cancel: sets isCancelled without bouncing to the run loop 
+// thread and returns YES if -cancelOnRunLoopThread should still be run there. 
+// Lets callers cancelling many operations make one trip per thread (see 
+// ESHTTPOperationGroup) instead of one each.
+
+- (BOOL)markCancelled;
+
 @end
 
 /*
@@ -1,5 +1,5 @@
 #import "ESRunLoopOperation.h"
-//#import <libkern/OSAtomic.h>
+#import <libkern/OSAtomic.h>
 
 @interface ESRunLoopOperation ()
 // read/write versions of public properties
@@ -9,13 +9,13 @@
 
 @implementation ESRunLoopOperation
 {
-	NSRecursiveLock *lock;
+	// ESOperationState, changed only with compare and swap
+	volatile int32_t _state;
 }
 
 @synthesize runLoopThread=_runLoopThread;
 @synthesize runLoopModes=_runLoopModes;
 @synthesize error=_error;
-@synthesize state=_state;
 
 - (id)init
 {
@@ -25,7 +25,6 @@
 		NSAssert((_state == kESOperationStateInited), @"Operation initialized with invalid state: %d", _state);
 		if (_state != kESOperationStateInited)
 			self = nil;
-		lock = [[NSRecursiveLock alloc] init];
 	}
     return self;
 }
@@ -68,27 +67,26 @@
 
 - (ESOperationState)state
 {
-	ESOperationState state;
-	[lock lock];
-	state = _state;
-	[lock unlock];
-    return state;
+	// any thread
+	// An aligned 32 bit read can't tear, the barrier keeps whatever the 
+	// transition published from being read before the state itself.
+	ESOperationState state = (ESOperationState)_state;
+	OSMemoryBarrier();
+	return state;
 }
 
 - (void)setState:(ESOperationState)newState
 // Change the state of the operation, sending the appropriate KVO notifications.
 {
-    // any thread
-	
-	[lock lock];
+	// any thread
 	
-	ESOperationState oldState;
+	ESOperationState oldState = (ESOperationState)_state;
 	
 	// The following check is really important.  The state can only go forward, and there 
 	// should be no redundant changes to the state (that is, newState must never be 
 	// equal to _state).
 	
-	NSAssert((newState > _state), @"Invalid state transition from %d to %d");
+	NSAssert((newState > oldState), @"Invalid state transition from %d to %d", oldState, newState);
 	
 	// Transitions from executing to finished must be done on the run loop thread.
 	
@@ -98,18 +96,23 @@
 	// inited    + finished  -> isFinished
 	// executing + finished  -> isExecuting + isFinished
 	
-	oldState = _state;
 	if ((newState == kESOperationStateExecuting) || (oldState == kESOperationStateExecuting))
 		[self willChangeValueForKey:@"isExecuting"];
 	if (newState == kESOperationStateFinished)
 		[self willChangeValueForKey:@"isFinished"];
-	_state = newState;
+	
+	// Transitions never race each other: inited to executing only happens in -start, which 
+	// is only called once, and executing to finished only happens on the run loop thread 
+	// after that. Losing the swap means that was violated.
+	
+	BOOL swapped = OSAtomicCompareAndSwap32Barrier(oldState, newState, &_state);
+	NSAssert(swapped, @"State changed from %d during transition to %d", oldState, newState);
+#pragma unused(swapped)
+	
 	if (newState == kESOperationStateFinished)
 		[self didChangeValueForKey:@"isFinished"];
 	if ((newState == kESOperationStateExecuting) || (oldState == kESOperationStateExecuting))
 		[self didChangeValueForKey:@"isExecuting"];
-	
-	[lock unlock];
 }
 
 - (void)startOnRunLoopThread
@@ -217,7 +220,7 @@
 					modes:[self.actualRunLoopModes allObjects]];
 }
 
-- (void)cancel
+- (BOOL)markCancelled
 {
     BOOL runCancelOnRunLoopThread;
     BOOL oldValue;
@@ -242,7 +245,13 @@
 		
         runCancelOnRunLoopThread = !(oldValue && (self.state == kESOperationStateExecuting));
     }
-    if (runCancelOnRunLoopThread)
+    return runCancelOnRunLoopThread;
+}
+
+- (void)cancel
+{
+    // any thread
+    if ([self markCancelled])
         [self performSelector:@selector(cancelOnRunLoopThread) 
 					 onThread:self.actualRunLoopThread 
 				   withObject:nil 
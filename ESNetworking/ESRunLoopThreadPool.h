@@ -0,0 +1,92 @@
+//
+//  ESRunLoopThreadPool.h
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Keys for the dictionaries returned by -threadStatistics
+ */
+extern NSString *const kESRunLoopThreadPoolThreadNameKey; // NSString
+extern NSString *const kESRunLoopThreadPoolActiveOperationsKey; // NSNumber, operations currently assigned to the thread
+extern NSString *const kESRunLoopThreadPoolQueuedCallbacksKey; // NSNumber, callbacks performed onto the thread that haven't run yet
+extern NSString *const kESRunLoopThreadPoolCompletedCallbacksKey; // NSNumber, callbacks run on the thread since it was created, queued or not
+
+/**
+ * Fixed size pool of persistent threads that each spin a run loop, suitable for scheduling NSURLConnections and other run loop sources.
+ *
+ * Threads are created lazily on first use and run forever.
+ */
+
+@interface ESRunLoopThreadPool : NSObject
+
+/**
+ * @param name Prefix used to name the pool's threads
+ * @param threadCount Number of threads in the pool, must be greater than 0
+ * @param threadPriority Priority assigned to each thread (0.0 - 1.0)
+ */
+- (id)initWithName:(NSString *)name threadCount:(NSUInteger)threadCount threadPriority:(double)threadPriority; // designated initializer
+
+@property (copy, readonly) NSString *name;
+@property (assign, readonly) NSUInteger threadCount;
+@property (assign, readonly) double threadPriority;
+/**
+ * If YES, -threadForHost: always returns the same thread for a given host, otherwise it returns the least loaded thread
+ *
+ * Default is NO
+ */
+@property (assign, readwrite) BOOL usesHostAffinity;
+
+///--------------------------
+/// @name Assigning threads
+///--------------------------
+
+/**
+ * Thread that should be used for an operation talking to host. Does not change the load counters.
+ *
+ * @param host May be nil
+ */
+- (NSThread *)threadForHost:(NSString *)host;
+/**
+ * Returns YES if thread belongs to this pool
+ */
+- (BOOL)containsThread:(NSThread *)thread;
+
+///--------------------------
+/// @name Load accounting
+///--------------------------
+
+// All of these are safe to call from any thread and are no-ops for threads not in the pool
+
+- (void)operationDidBeginOnThread:(NSThread *)thread;
+- (void)operationDidEndOnThread:(NSThread *)thread;
+- (void)callbackWasQueuedOnThread:(NSThread *)thread;
+- (void)callbackDidRunOnThread:(NSThread *)thread;
+/**
+ * For callbacks that arrive through a run loop source without being queued, like NSURLConnection delegate messages
+ */
+- (void)unqueuedCallbackDidRunOnThread:(NSThread *)thread;
+
+/**
+ * Snapshot of the load counters, one dictionary per thread in pool order
+ *
+ * @see kESRunLoopThreadPoolThreadNameKey
+ */
+- (NSArray *)threadStatistics;
+
+@end
@@ -0,0 +1,239 @@
+//
+//  ESRunLoopThreadPool.m
+//
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#if !__has_feature(objc_arc)
+#error THIS FILE REQUIRES ARC
+#endif
+
+#import "ESRunLoopThreadPool.h"
+#import <libkern/OSAtomic.h>
+
+NSString *const kESRunLoopThreadPoolThreadNameKey = @"threadName";
+NSString *const kESRunLoopThreadPoolActiveOperationsKey = @"activeOperations";
+NSString *const kESRunLoopThreadPoolQueuedCallbacksKey = @"queuedCallbacks";
+NSString *const kESRunLoopThreadPoolCompletedCallbacksKey = @"completedCallbacks";
+
+@interface ESRunLoopThreadPool ()
+- (void)runLoopThreadEntry;
+- (void)startThreadsIfNeeded;
+- (NSInteger)indexOfThread:(NSThread *)thread;
+@end
+
+@implementation ESRunLoopThreadPool
+{
+	NSArray *_threads;
+	OSSpinLock _threadsSpinlock;
+	// One counter per thread, indexed in the same order as _threads
+	volatile int32_t *_activeOperations;
+	volatile int32_t *_queuedCallbacks;
+	volatile int32_t *_completedCallbacks;
+}
+@synthesize name=_name;
+@synthesize threadCount=_threadCount;
+@synthesize threadPriority=_threadPriority;
+@synthesize usesHostAffinity=_usesHostAffinity;
+
+- (id)initWithName:(NSString *)name threadCount:(NSUInteger)threadCount threadPriority:(double)threadPriority
+{
+	NSParameterAssert(threadCount > 0);
+	self = [super init];
+	if (threadCount == 0)
+		self = nil;
+	if (self != nil)
+	{
+		_name = [name copy];
+		_threadCount = threadCount;
+		_threadPriority = threadPriority;
+		_threadsSpinlock = OS_SPINLOCK_INIT;
+		_activeOperations = (volatile int32_t *)calloc(threadCount, sizeof(int32_t));
+		_queuedCallbacks = (volatile int32_t *)calloc(threadCount, sizeof(int32_t));
+		_completedCallbacks = (volatile int32_t *)calloc(threadCount, sizeof(int32_t));
+	}
+	return self;
+}
+
+- (id)init
+{
+	return [self initWithName:@"RunLoopThread" threadCount:1 threadPriority:0.5];
+}
+
+- (void)dealloc
+{
+	// Pool threads run forever and retain the pool, so in practice this only
+	// happens if the pool was never used.
+	free((void *)_activeOperations);
+	free((void *)_queuedCallbacks);
+	free((void *)_completedCallbacks);
+}
+
+#pragma mark - Threads
+
+- (void)runLoopThreadEntry
+// Each pool thread sits in here servicing its run loop.
+{
+	NSAssert([self containsThread:[NSThread currentThread]], @"Entered runLoopThreadEntry from invalid thread");
+	@autoreleasepool {
+		// Schedule a timer in the distant future to keep the run loop from simply immediately exiting
+		[NSTimer scheduledTimerWithTimeInterval:3600*24*365*100 target:nil selector:nil userInfo:nil repeats:NO];
+		while (YES)
+		{
+			@autoreleasepool {
+				CFRunLoopRunInMode(kCFRunLoopDefaultMode, 10, YES);
+			}
+		}
+	}
+	NSAssert(NO, @"Exited runLoopThreadEntry prematurely");
+}
+
+- (void)startThreadsIfNeeded
+{
+	OSSpinLockLock(&_threadsSpinlock);
+	if (_threads == nil)
+	{
+		NSMutableArray *threads = [[NSMutableArray alloc] initWithCapacity:self.threadCount];
+		for (NSUInteger i = 0; i < self.threadCount; i++)
+		{
+			NSThread *thread = [[NSThread alloc] initWithTarget:self selector:@selector(runLoopThreadEntry) object:nil];
+			NSParameterAssert(thread != nil);
+			[thread setThreadPriority:self.threadPriority];
+			if (self.threadCount == 1)
+				[thread setName:self.name];
+			else
+				[thread setName:[NSString stringWithFormat:@"%@-%lu", self.name, (unsigned long)i]];
+			[threads addObject:thread];
+		}
+		_threads = [threads copy];
+		// Publish _threads before starting so that runLoopThreadEntry can find itself
+		for (NSThread *thread in _threads)
+			[thread start];
+	}
+	OSSpinLockUnlock(&_threadsSpinlock);
+}
+
+- (NSInteger)indexOfThread:(NSThread *)thread
+{
+	NSArray *threads;
+	OSSpinLockLock(&_threadsSpinlock);
+	threads = _threads;
+	OSSpinLockUnlock(&_threadsSpinlock);
+	if (thread == nil || threads == nil)
+		return NSNotFound;
+	// Pools are small enough that a linear scan is cheaper than anything clever
+	return [threads indexOfObjectIdenticalTo:thread];
+}
+
+- (BOOL)containsThread:(NSThread *)thread
+{
+	return ([self indexOfThread:thread] != NSNotFound);
+}
+
+- (NSThread *)threadForHost:(NSString *)host
+{
+	[self startThreadsIfNeeded];
+	NSUInteger index = 0;
+	if (self.threadCount > 1)
+	{
+		if (self.usesHostAffinity && host != nil)
+			index = [[host lowercaseString] hash] % self.threadCount;
+		else
+		{
+			// Least loaded, ties go to the thread with the shortest callback backlog
+			int32_t bestOperations = INT32_MAX;
+			int32_t bestCallbacks = INT32_MAX;
+			for (NSUInteger i = 0; i < self.threadCount; i++)
+			{
+				int32_t operations = _activeOperations[i];
+				int32_t callbacks = _queuedCallbacks[i];
+				if ((operations < bestOperations) ||
+					((operations == bestOperations) && (callbacks < bestCallbacks)))
+				{
+					bestOperations = operations;
+					bestCallbacks = callbacks;
+					index = i;
+				}
+			}
+		}
+	}
+	return [_threads objectAtIndex:index];
+}
+
+#pragma mark - Load accounting
+
+- (void)operationDidBeginOnThread:(NSThread *)thread
+{
+	NSInteger index = [self indexOfThread:thread];
+	if (index != NSNotFound)
+		OSAtomicIncrement32Barrier(&_activeOperations[index]);
+}
+
+- (void)operationDidEndOnThread:(NSThread *)thread
+{
+	NSInteger index = [self indexOfThread:thread];
+	if (index != NSNotFound)
+		OSAtomicDecrement32Barrier(&_activeOperations[index]);
+}
+
+- (void)callbackWasQueuedOnThread:(NSThread *)thread
+{
+	NSInteger index = [self indexOfThread:thread];
+	if (index != NSNotFound)
+		OSAtomicIncrement32Barrier(&_queuedCallbacks[index]);
+}
+
+- (void)callbackDidRunOnThread:(NSThread *)thread
+{
+	NSInteger index = [self indexOfThread:thread];
+	if (index != NSNotFound)
+	{
+		OSAtomicDecrement32Barrier(&_queuedCallbacks[index]);
+		OSAtomicIncrement32Barrier(&_completedCallbacks[index]);
+	}
+}
+
+- (void)unqueuedCallbackDidRunOnThread:(NSThread *)thread
+{
+	NSInteger index = [self indexOfThread:thread];
+	if (index != NSNotFound)
+		OSAtomicIncrement32Barrier(&_completedCallbacks[index]);
+}
+
+- (NSArray *)threadStatistics
+{
+	[self startThreadsIfNeeded];
+	NSMutableArray *statistics = [[NSMutableArray alloc] initWithCapacity:self.threadCount];
+	for (NSUInteger i = 0; i < self.threadCount; i++)
+	{
+		NSDictionary *threadStatistics =
+		[[NSDictionary alloc] initWithObjectsAndKeys:
+		 [[_threads objectAtIndex:i] name], kESRunLoopThreadPoolThreadNameKey,
+		 [NSNumber numberWithInt:_activeOperations[i]], kESRunLoopThreadPoolActiveOperationsKey,
+		 [NSNumber numberWithInt:_queuedCallbacks[i]], kESRunLoopThreadPoolQueuedCallbacksKey,
+		 [NSNumber numberWithInt:_completedCallbacks[i]], kESRunLoopThreadPoolCompletedCallbacksKey,
+		 nil];
+		[statistics addObject:threadStatistics];
+	}
+	return statistics;
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<%@ : %p>\n{\n\tName: %@\n\tThreads: %@\n}", NSStringFromClass([self class]), self, self.name, [self threadStatistics]];
+}
+
+@end
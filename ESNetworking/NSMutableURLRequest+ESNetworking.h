@@ -19,10 +19,17 @@
 
 #import <Foundation/Foundation.h>
 
+@class ESMultipartFormData;
+
 @interface NSMutableURLRequest (ESNetworking)
 
 + (NSString *)urlEncodeString:(NSString *)string;
 + (NSData *)HTTPBodyWithDictionary:(NSDictionary *)body;
 + (NSMutableURLRequest *)postRequestWithURL:(NSURL *)url body:(NSDictionary *)body;
+/**
+ * POST request that streams formData as its body, with Content-Type and Content-Length set.
+ * Upload progress is reported to ESHTTPOperation's uploadProgress block against formData's contentLength.
+ */
++ (NSMutableURLRequest *)multipartRequestWithURL:(NSURL *)url formData:(ESMultipartFormData *)formData;
 
 @end
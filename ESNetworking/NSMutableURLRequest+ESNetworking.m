@@ -18,6 +18,7 @@
 //  
 
 #import "NSMutableURLRequest+ESNetworking.h"
+#import "ESMultipartFormData.h"
 
 @implementation NSMutableURLRequest (ESNetworking)
 
@@ -39,57 +40,19 @@
 + (NSData *)HTTPBodyWithDictionary:(NSDictionary *)body
 {
 	NSMutableString *buffer = [NSMutableString string];
-	NSArray *keys = [body allKeys];
-	NSString *value;
-	for (NSString *key in keys) 
+	for (NSString *key in body) 
 	{
-		value = [[self class] urlEncodeString:[body objectForKey:key]];
-		value = [NSString stringWithFormat:@"&%@=%@", key, value];
-		if (value)
-			[buffer appendString:value];
+		NSString *value = [body objectForKey:key];
+		if ([buffer length] > 0)
+			[buffer appendString:@"&"];
+		[buffer appendString:key];
+		[buffer appendString:@"="];
+		[buffer appendString:[[self class] urlEncodeString:value]];
 	}
-	if (buffer.length > 0)
-		[buffer deleteCharactersInRange:NSMakeRange(0, 1)];
-	NSData *postBody = [NSData dataWithBytes:[buffer UTF8String] length:[buffer length]];
-	return postBody;
+	// Length in bytes, not characters
+	return [buffer dataUsingEncoding:NSUTF8StringEncoding];
 }
 
-//+ (NSData *)multipartHTTPBodyWithDictionary:(NSDictionary *)body stringBoundary:(NSString *)stringBoundary
-//{	
-//	NSMutableData *postBody	= [NSMutableData data];
-//	NSArray *keys = [body allKeys];
-//	NSString *value;
-//	for (NSString *key in keys) 
-//	{
-//		value = [body objectForKey:key];
-//		if (value)
-//		{
-//			[postBody appendData:[[NSString stringWithFormat:@"--%@\r\n", stringBoundary] dataUsingEncoding:NSUTF8StringEncoding]];
-//			[postBody appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"%@\"\r\n\r\n", key] dataUsingEncoding:NSUTF8StringEncoding]];
-//			[postBody appendData:[[NSString stringWithString:value] dataUsingEncoding:NSUTF8StringEncoding]];
-//			[postBody appendData:[[NSString stringWithString:@"\r\n"] dataUsingEncoding:NSUTF8StringEncoding]];
-//		}
-//	}
-//	for (NSDictionary *dataDict in bodyDataArray)
-//	{
-//		NSString	*	fieldName	=	[dataDict objectForKey:@"fieldName"];
-//		NSString	*	fileName	=	[dataDict objectForKey:@"fileName"];
-//		NSString	*	contentType	=	[dataDict objectForKey:@"contentType"];
-//		NSData		*	data		=	[dataDict objectForKey:@"data"];
-//		if (fieldName && fileName && contentType && data && !cancelled)
-//		{
-//			[postBody appendData:[[NSString stringWithFormat:@"--%@\r\n",stringBoundary] dataUsingEncoding:NSUTF8StringEncoding]];
-//			[postBody appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"%@\"; filename=\"%@\"\r\n", fieldName, fileName] dataUsingEncoding:NSUTF8StringEncoding]];
-//			[postBody appendData:[[NSString stringWithFormat:@"Content-Type: %@\r\n\r\n", contentType] dataUsingEncoding:NSUTF8StringEncoding]];
-//			[postBody appendData:data];
-//			[postBody appendData:[[NSString stringWithString:@"\r\n"] dataUsingEncoding:NSUTF8StringEncoding]];
-//		}
-//	}
-//	[postBody appendData:[[NSString stringWithFormat:@"--%@--\r\n",stringBoundary] dataUsingEncoding:NSUTF8StringEncoding]];
-//	
-//	return (NSData *)postBody;
-//}
-
 + (NSMutableURLRequest *)postRequestWithURL:(NSURL *)url body:(NSDictionary *)body
 {
 	if (url == nil)
@@ -100,4 +63,17 @@
 	return request;
 }
 
++ (NSMutableURLRequest *)multipartRequestWithURL:(NSURL *)url formData:(ESMultipartFormData *)formData
+{
+	if (url == nil)
+		return nil;
+	NSParameterAssert(formData != nil);
+	NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
+	[request setHTTPMethod:@"POST"];
+	[request setValue:formData.contentType forHTTPHeaderField:@"Content-Type"];
+	[request setValue:[NSString stringWithFormat:@"%llu", formData.contentLength] forHTTPHeaderField:@"Content-Length"];
+	[request setHTTPBodyStream:[formData newInputStream]];
+	return request;
+}
+
 @end
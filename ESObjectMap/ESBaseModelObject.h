@@ -25,5 +25,17 @@
 
 + (id)newWithDictionary:(NSDictionary *)dictionary;
 - (id)initWithDictionary:(NSDictionary *)dictionary;
+/**
+ * Maps an array of dictionaries, in parallel when it's large enough and the class opts in with +mapsArraysConcurrently
+ * 
+ * @see ObjectsFromArray
+ */
++ (NSMutableArray *)objectsWithArray:(NSArray *)array;
+/**
+ * Override to return YES to have large arrays of this class, including ESArrayPropertyMap members, mapped in parallel chunks. Only do so if initWithDictionary: is safe to call from several threads at once.
+ * 
+ * @return NO
+ */
++ (BOOL)mapsArraysConcurrently;
 
 @end
@@ -43,11 +43,26 @@
 	return self;
 }
 
++ (NSMutableArray *)objectsWithArray:(NSArray *)array
+{
+	return ObjectsFromArray([self class], array);
+}
+
++ (BOOL)mapsArraysConcurrently
+{
+	return NO;
+}
+
 - (void)configureWithDictionary:(NSDictionary *)dictionary
 {
 	ConfigureObjectWithDictionary(self, dictionary);
 }
 
+- (NSSet *)updateWithDictionary:(NSDictionary *)dictionary
+{
+	return UpdateObjectWithDictionary(self, dictionary);
+}
+
 - (NSDictionary *)dictionaryRepresentation
 {
 	return GetDictionaryRepresentation(self);
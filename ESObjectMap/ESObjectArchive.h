@@ -0,0 +1,79 @@
+//
+//  ESObjectArchive.h
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import <Foundation/Foundation.h>
+
+extern NSString *const kESObjectArchiveErrorDomain;
+
+enum {
+	kESObjectArchiveErrorInvalidValue		=	-1,
+	kESObjectArchiveErrorTooDeep			=	-2,
+	kESObjectArchiveErrorCorrupt			=	-3,
+	kESObjectArchiveErrorUnsupportedVersion	=	-4
+};
+
+/**
+ * Compact, versioned binary archive of ESBaseModelObject graphs.
+ * 
+ * Model objects are written property by property from their ESObjectMappingPlan 
+ * (readonly properties are skipped), with scalars packed as varints or raw floats 
+ * straight from their getters. Every string (class names, property names and 
+ * values) is stored once in a string table and referred to by index. A model object 
+ * that's referenced more than once (or from inside itself) is written once, later 
+ * references point back to it, so shared instances come back shared.
+ * 
+ * Property values can be model objects, NSString, NSNumber, NSDate, NSURL, NSData, 
+ * NSNull, NSArray and NSDictionary (with string keys) of those, or anything else that 
+ * conforms to NSCoding, which is stored as a keyed archive.
+ * 
+ * Reading is lazy: arrays are restored as NSMutableArrays that only materialize 
+ * members (and strings) the first time they're accessed, straight out of the 
+ * archive's data, which can be memory mapped. Single nested objects and dictionaries 
+ * are materialized along with their parent. Properties that no longer exist, or whose 
+ * type changed, since the archive was written are skipped, as are objects whose 
+ * class no longer exists (they come back as nil, or NSNull inside arrays).
+ * 
+ * Lazy arrays can be read from multiple threads, shared objects are materialized one at 
+ * a time per archive. Archived data that turns out to be 
+ * corrupt while it's being materialized raises a "Corrupt Archive" exception.
+ */
+
+@interface ESObjectArchive : NSObject
+
+/**
+ * @return Archive of rootObject, or nil with error set if the graph contains something that can't be archived
+ */
++ (NSData *)archivedDataWithRootObject:(id)rootObject error:(NSError **)error;
+
+/**
+ * Memory maps the file at url when it's safe to
+ */
++ (id)newArchiveWithContentsOfURL:(NSURL *)url error:(NSError **)error;
+/**
+ * Only the header and string table are checked here, the rest of the data is read as it's accessed
+ */
+- (id)initWithData:(NSData *)data error:(NSError **)error;
+
+@property (strong, nonatomic, readonly) NSData *data;
+/**
+ * Materialized on first access
+ */
+@property (strong, nonatomic, readonly) id rootObject;
+
+@end
@@ -0,0 +1,1160 @@
+//
+//  ESObjectArchive.m
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import "ESObjectArchive.h"
+#import "ESObjectMappingPlan.h"
+#import "ESObjectMapFunctions.h"
+#import "ESBaseModelObject.h"
+#import <libkern/OSAtomic.h>
+#import <libkern/OSByteOrder.h>
+
+NSString *const kESObjectArchiveErrorDomain = @"ESObjectArchiveErrorDomain";
+
+// Deep enough for any real graph, catches cycles before the stack runs out
+#define MAXIMUM_DEPTH 512
+
+// "ESOA", version, 3 reserved bytes, then little endian uint32s: root value 
+// offset, string table offset and string count. Version 2 added shared objects, 
+// version 1 archives are still read.
+#define ARCHIVE_VERSION 2
+#define MINIMUM_ARCHIVE_VERSION 1
+#define HEADER_LENGTH 20
+static const uint8_t _magic[4] = { 'E', 'S', 'O', 'A' };
+
+// Every value starts with one of these. Varints are unsigned LEB128, signed 
+// integers are zigzag encoded first, fixed width values are little endian.
+enum {
+	kESArchiveTagNull		=	0,
+	kESArchiveTagFalse,
+	kESArchiveTagTrue,
+	kESArchiveTagInteger,		// varint
+	kESArchiveTagUnsigned,		// varint, only for values too large for long long
+	kESArchiveTagDouble,		// 8 bytes
+	kESArchiveTagFloat,			// 4 bytes
+	kESArchiveTagString,		// varint string index
+	kESArchiveTagData,			// varint length, bytes
+	kESArchiveTagDate,			// 8 byte double, seconds since the reference date
+	kESArchiveTagURL,			// varint string index
+	kESArchiveTagArray,			// uint32 offset of the end of the array, varint count, count uint32 member offsets, members
+	kESArchiveTagDictionary,	// varint count, count string index and value pairs
+	kESArchiveTagObject,		// varint class name index, uint16 count, count property name index and value pairs
+	kESArchiveTagCoded,			// varint length, NSKeyedArchiver data
+	kESArchiveTagSharedObject,	// Same as kESArchiveTagObject, for an object a later kESArchiveTagReference points back to
+	kESArchiveTagReference		// uint32 offset of an earlier kESArchiveTagSharedObject
+};
+
+static Class _stringClass;
+static Class _numberClass;
+static Class _decimalNumberClass;
+static Class _dateClass;
+static Class _URLClass;
+static Class _dataClass;
+static Class _dictionaryClass;
+static Class _arrayClass;
+static Class _baseModelObjectClass;
+
+#pragma mark - Writing
+
+typedef struct {
+	uint8_t *bytes;
+	size_t length;
+	size_t capacity;
+	CFMutableDictionaryRef stringIndexes; // String -> index, every string is written once
+	CFMutableArrayRef strings;
+	CFMutableDictionaryRef objectOffsets; // Model object (by identity) -> offset of its tag, every object is written once
+	NSUInteger depth;
+	NSInteger errorCode;
+	const char *errorReason;
+} ESArchiveWriter;
+
+static BOOL Fail(ESArchiveWriter *writer, NSInteger code, const char *reason)
+{
+	if (writer->errorCode == 0)
+	{
+		writer->errorCode = code;
+		writer->errorReason = reason;
+	}
+	return NO;
+}
+
+// Grows the buffer by length bytes and returns the offset of the new bytes, 
+// or -1 if the archive would be too large for its 32 bit offsets
+static ssize_t Extend(ESArchiveWriter *writer, size_t length)
+{
+	if ((writer->length + length) > UINT32_MAX)
+	{
+		Fail(writer, kESObjectArchiveErrorInvalidValue, "Archive would be larger than 4GB");
+		return -1;
+	}
+	if ((writer->length + length) > writer->capacity)
+	{
+		while ((writer->length + length) > writer->capacity)
+			writer->capacity *= 2;
+		writer->bytes = (uint8_t *)realloc(writer->bytes, writer->capacity);
+	}
+	size_t offset = writer->length;
+	writer->length += length;
+	return (ssize_t)offset;
+}
+
+static BOOL Append(ESArchiveWriter *writer, const void *bytes, size_t length)
+{
+	ssize_t offset = Extend(writer, length);
+	if (offset < 0)
+		return NO;
+	memcpy(writer->bytes + offset, bytes, length);
+	return YES;
+}
+
+static inline BOOL AppendByte(ESArchiveWriter *writer, uint8_t byte)
+{
+	if (writer->length < writer->capacity)
+	{
+		writer->bytes[writer->length++] = byte;
+		return YES;
+	}
+	return Append(writer, &byte, 1);
+}
+
+static BOOL AppendVarint(ESArchiveWriter *writer, uint64_t value)
+{
+	uint8_t buffer[10];
+	size_t length = 0;
+	while (value >= 0x80)
+	{
+		buffer[length++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buffer[length++] = (uint8_t)value;
+	return Append(writer, buffer, length);
+}
+
+static BOOL AppendUInt32(ESArchiveWriter *writer, uint32_t value)
+{
+	ssize_t offset = Extend(writer, 4);
+	if (offset < 0)
+		return NO;
+	OSWriteLittleInt32(writer->bytes, offset, value);
+	return YES;
+}
+
+static BOOL AppendDouble(ESArchiveWriter *writer, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	ssize_t offset = Extend(writer, 8);
+	if (offset < 0)
+		return NO;
+	OSWriteLittleInt64(writer->bytes, offset, bits);
+	return YES;
+}
+
+static BOOL AppendFloat(ESArchiveWriter *writer, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return AppendUInt32(writer, bits);
+}
+
+static BOOL AppendStringIndex(ESArchiveWriter *writer, NSString *string)
+{
+	const void *index = NULL;
+	if (!CFDictionaryGetValueIfPresent(writer->stringIndexes, (__bridge CFStringRef)string, &index))
+	{
+		// Mutable strings can't be keys
+		CFStringRef copy = CFStringCreateCopy(NULL, (__bridge CFStringRef)string);
+		index = (const void *)(uintptr_t)CFArrayGetCount(writer->strings);
+		CFArrayAppendValue(writer->strings, copy);
+		CFDictionarySetValue(writer->stringIndexes, copy, index);
+		CFRelease(copy);
+	}
+	return AppendVarint(writer, (uint64_t)(uintptr_t)index);
+}
+
+#pragma mark - Values
+
+static BOOL WriteInteger(ESArchiveWriter *writer, long long value)
+{
+	// Zigzag, so small negative numbers stay short
+	return AppendByte(writer, kESArchiveTagInteger) && AppendVarint(writer, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static BOOL WriteUnsignedInteger(ESArchiveWriter *writer, unsigned long long value)
+{
+	if (value <= LLONG_MAX)
+		return WriteInteger(writer, (long long)value);
+	return AppendByte(writer, kESArchiveTagUnsigned) && AppendVarint(writer, value);
+}
+
+static BOOL WriteDouble(ESArchiveWriter *writer, double value)
+{
+	return AppendByte(writer, kESArchiveTagDouble) && AppendDouble(writer, value);
+}
+
+static BOOL WriteFloat(ESArchiveWriter *writer, float value)
+{
+	return AppendByte(writer, kESArchiveTagFloat) && AppendFloat(writer, value);
+}
+
+static BOOL WriteBool(ESArchiveWriter *writer, BOOL value)
+{
+	return AppendByte(writer, value ? kESArchiveTagTrue : kESArchiveTagFalse);
+}
+
+static BOOL WriteBytes(ESArchiveWriter *writer, uint8_t tag, NSData *data)
+{
+	return AppendByte(writer, tag) && AppendVarint(writer, [data length]) && Append(writer, [data bytes], [data length]);
+}
+
+static BOOL WriteNumber(ESArchiveWriter *writer, NSNumber *number)
+{
+	// Decimal numbers would lose precision in a double
+	if ([number isKindOfClass:_decimalNumberClass])
+		return WriteBytes(writer, kESArchiveTagCoded, [NSKeyedArchiver archivedDataWithRootObject:number]);
+	CFNumberRef cfNumber = (__bridge CFNumberRef)number;
+	if (CFGetTypeID(cfNumber) == CFBooleanGetTypeID())
+		return WriteBool(writer, CFBooleanGetValue((CFBooleanRef)cfNumber));
+	if (CFNumberIsFloatType(cfNumber))
+	{
+		if (*[number objCType] == 'f')
+			return WriteFloat(writer, [number floatValue]);
+		return WriteDouble(writer, [number doubleValue]);
+	}
+	if (*[number objCType] == 'Q')
+		return WriteUnsignedInteger(writer, [number unsignedLongLongValue]);
+	return WriteInteger(writer, [number longLongValue]);
+}
+
+static BOOL WriteScalarProperty(ESArchiveWriter *writer, id object, const ESPropertyMappingStep *step)
+{
+	IMP getterIMP = step->getterIMP;
+	SEL getter = step->getter;
+	// Forwarded getters are rare enough to go through the boxing path
+	if (getterIMP == NULL)
+		return WriteNumber(writer, GetScalarPropertyValue(object, getter, NULL, step->storageType));
+	switch (step->storageType) {
+		case BoolType:
+			return WriteBool(writer, ((BOOL (*)(id, SEL))getterIMP)(object, getter));
+		case DoubleType:
+			return WriteDouble(writer, ((double (*)(id, SEL))getterIMP)(object, getter));
+		case FloatType:
+			return WriteFloat(writer, ((float (*)(id, SEL))getterIMP)(object, getter));
+		case IntType:
+			return WriteInteger(writer, ((int (*)(id, SEL))getterIMP)(object, getter));
+		case UnsignedCharType:
+			return WriteInteger(writer, ((unsigned char (*)(id, SEL))getterIMP)(object, getter));
+		case ShortType:
+			return WriteInteger(writer, ((short (*)(id, SEL))getterIMP)(object, getter));
+		case UnsignedShortType:
+			return WriteInteger(writer, ((unsigned short (*)(id, SEL))getterIMP)(object, getter));
+		case UnsignedIntType:
+			return WriteInteger(writer, ((unsigned int (*)(id, SEL))getterIMP)(object, getter));
+		case LongLongType:
+			return WriteInteger(writer, ((long long (*)(id, SEL))getterIMP)(object, getter));
+		case UnsignedLongLongType:
+			return WriteUnsignedInteger(writer, ((unsigned long long (*)(id, SEL))getterIMP)(object, getter));
+		default:
+			return Fail(writer, kESObjectArchiveErrorInvalidValue, "Unsupported property type");
+	}
+}
+
+static BOOL WriteValue(ESArchiveWriter *writer, id value);
+
+static BOOL Descend(ESArchiveWriter *writer)
+{
+	if (++writer->depth > MAXIMUM_DEPTH)
+		return Fail(writer, kESObjectArchiveErrorTooDeep, "Nested too deeply, the object graph may have a cycle");
+	return YES;
+}
+
+static BOOL WriteModelObject(ESArchiveWriter *writer, ESBaseModelObject *object)
+{
+	const void *writtenOffset = CFDictionaryGetValue(writer->objectOffsets, (__bridge const void *)object);
+	if (writtenOffset != NULL)
+	{
+		// Flagged as shared so readers know to keep it around for the references
+		size_t objectOffset = (size_t)writtenOffset;
+		writer->bytes[objectOffset] = kESArchiveTagSharedObject;
+		return AppendByte(writer, kESArchiveTagReference) && AppendUInt32(writer, (uint32_t)objectOffset);
+	}
+	// Registered before the properties are written, so cycles become references too
+	CFDictionarySetValue(writer->objectOffsets, (__bridge const void *)object, (const void *)(uintptr_t)writer->length);
+	if (!Descend(writer) || !AppendByte(writer, kESArchiveTagObject) || !AppendStringIndex(writer, NSStringFromClass([object class])))
+		return NO;
+	// Patched once the properties that have values are known
+	ssize_t countOffset = Extend(writer, 2);
+	if (countOffset < 0)
+		return NO;
+	ESObjectMappingPlan *plan = [ESObjectMappingPlan mappingPlanForObject:object];
+	const ESPropertyMappingStep *steps = plan.steps;
+	NSUInteger stepCount = plan.propertyCount;
+	uint16_t count = 0;
+	for (NSUInteger i = 0; i < stepCount; i++)
+	{
+		const ESPropertyMappingStep *step = &steps[i];
+		// Nothing to restore them with
+		if (step->readOnly || (step->storageType == UnsupportedType))
+			continue;
+		BOOL written;
+		@autoreleasepool {
+			if ((step->storageType == IDType) || (step->storageType == ObjectType))
+			{
+				id propertyValue;
+				if (step->getterIMP != NULL)
+					propertyValue = ((id (*)(id, SEL))step->getterIMP)(object, step->getter);
+				else
+					propertyValue = [object valueForKey:(__bridge NSString *)step->outputKey];
+				if (propertyValue == nil)
+					continue;
+				written = AppendStringIndex(writer, (__bridge NSString *)step->outputKey) && WriteValue(writer, propertyValue);
+			}
+			else
+			{
+				written = AppendStringIndex(writer, (__bridge NSString *)step->outputKey) && WriteScalarProperty(writer, object, step);
+			}
+		}
+		if (!written)
+			return NO;
+		count++;
+	}
+	OSWriteLittleInt16(writer->bytes, countOffset, count);
+	writer->depth--;
+	return YES;
+}
+
+static BOOL WriteArray(ESArchiveWriter *writer, NSArray *array)
+{
+	NSUInteger count = [array count];
+	if (!Descend(writer) || !AppendByte(writer, kESArchiveTagArray))
+		return NO;
+	ssize_t endOffset = Extend(writer, 4);
+	if ((endOffset < 0) || !AppendVarint(writer, count))
+		return NO;
+	// Member offsets let readers materialize any one member without reading the others
+	ssize_t tableOffset = Extend(writer, count * 4);
+	if (tableOffset < 0)
+		return NO;
+	size_t memberOffset = (size_t)tableOffset;
+	for (id member in array)
+	{
+		BOOL written;
+		@autoreleasepool {
+			OSWriteLittleInt32(writer->bytes, memberOffset, (uint32_t)writer->length);
+			written = WriteValue(writer, member);
+		}
+		if (!written)
+			return NO;
+		memberOffset += 4;
+	}
+	OSWriteLittleInt32(writer->bytes, endOffset, (uint32_t)writer->length);
+	writer->depth--;
+	return YES;
+}
+
+static BOOL WriteDictionary(ESArchiveWriter *writer, NSDictionary *dictionary)
+{
+	if (!Descend(writer) || !AppendByte(writer, kESArchiveTagDictionary) || !AppendVarint(writer, [dictionary count]))
+		return NO;
+	__block BOOL written = YES;
+	[dictionary enumerateKeysAndObjectsUsingBlock:^(id key, id member, BOOL *stop) {
+		if (![key isKindOfClass:_stringClass])
+			written = Fail(writer, kESObjectArchiveErrorInvalidValue, "Dictionary keys must be strings");
+		else
+			written = AppendStringIndex(writer, key) && WriteValue(writer, member);
+		*stop = !written;
+	}];
+	if (!written)
+		return NO;
+	writer->depth--;
+	return YES;
+}
+
+static BOOL WriteValue(ESArchiveWriter *writer, id value)
+{
+	if ((value == nil) || (value == [NSNull null]))
+		return AppendByte(writer, kESArchiveTagNull);
+	if ([value isKindOfClass:_stringClass])
+		return AppendByte(writer, kESArchiveTagString) && AppendStringIndex(writer, value);
+	if ([value isKindOfClass:_numberClass])
+		return WriteNumber(writer, value);
+	if ([value isKindOfClass:_baseModelObjectClass])
+		return WriteModelObject(writer, value);
+	if ([value isKindOfClass:_arrayClass])
+		return WriteArray(writer, value);
+	if ([value isKindOfClass:_dictionaryClass])
+		return WriteDictionary(writer, value);
+	if ([value isKindOfClass:_dateClass])
+		return AppendByte(writer, kESArchiveTagDate) && AppendDouble(writer, [value timeIntervalSinceReferenceDate]);
+	if ([value isKindOfClass:_URLClass])
+		return AppendByte(writer, kESArchiveTagURL) && AppendStringIndex(writer, [value absoluteString]);
+	if ([value isKindOfClass:_dataClass])
+		return WriteBytes(writer, kESArchiveTagData, value);
+	if ([value conformsToProtocol:@protocol(NSCoding)])
+		return WriteBytes(writer, kESArchiveTagCoded, [NSKeyedArchiver archivedDataWithRootObject:value]);
+	return Fail(writer, kESObjectArchiveErrorInvalidValue, "Value can't be archived");
+}
+
+static BOOL WriteStringTable(ESArchiveWriter *writer, uint32_t *stringTableOffset)
+{
+	CFIndex count = CFArrayGetCount(writer->strings);
+	uint32_t *offsets = (uint32_t *)malloc(sizeof(uint32_t) * (count + 1));
+	BOOL written = YES;
+	for (CFIndex i = 0; written && (i < count); i++)
+	{
+		offsets[i] = (uint32_t)writer->length;
+		NSString *string = (__bridge NSString *)CFArrayGetValueAtIndex(writer->strings, i);
+		const char *utf8 = [string UTF8String];
+		if (utf8 == NULL)
+		{
+			written = Fail(writer, kESObjectArchiveErrorInvalidValue, "String can't be represented as UTF-8");
+			break;
+		}
+		size_t length = strlen(utf8);
+		written = AppendVarint(writer, length) && Append(writer, utf8, length);
+	}
+	*stringTableOffset = (uint32_t)writer->length;
+	for (CFIndex i = 0; written && (i < count); i++)
+		written = AppendUInt32(writer, offsets[i]);
+	free(offsets);
+	return written;
+}
+
+#pragma mark - Reading
+
+typedef struct {
+	const uint8_t *bytes;
+	size_t length;
+	size_t stringTableOffset;
+	NSUInteger stringCount;
+	CFTypeRef *strings; // Materialized strings by index, NULL until first use
+	__unsafe_unretained NSData *data;
+	__unsafe_unretained id contents; // ESArchiveContents that owns the reader
+} ESArchiveReader;
+
+// The data and materialized strings, shared by an archive and its lazy arrays 
+// so the arrays can outlive it
+@interface ESArchiveContents : NSObject
+- (id)initWithData:(NSData *)data stringTableOffset:(size_t)stringTableOffset stringCount:(NSUInteger)stringCount;
+- (const ESArchiveReader *)reader;
+/**
+ * Materializes the kESArchiveTagSharedObject at offset the first time, and 
+ * returns the same instance for as long as it's alive after that
+ */
+- (id)sharedObjectAtOffset:(size_t)offset depth:(NSUInteger)depth;
+- (void)registerSharedObject:(id)object atOffset:(size_t)offset;
+@end
+
+static void Corrupt(const char *reason)
+{
+	[NSException raise:@"Corrupt Archive" format:@"%s", reason];
+}
+
+static inline void Require(const ESArchiveReader *reader, size_t offset, size_t length)
+{
+	if ((offset > reader->length) || (length > (reader->length - offset)))
+		Corrupt("Read past the end of the archive");
+}
+
+static inline uint8_t ReadByte(const ESArchiveReader *reader, size_t *offset)
+{
+	Require(reader, *offset, 1);
+	return reader->bytes[(*offset)++];
+}
+
+static uint64_t ReadVarint(const ESArchiveReader *reader, size_t *offset)
+{
+	uint64_t value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7)
+	{
+		uint8_t byte = ReadByte(reader, offset);
+		value |= ((uint64_t)(byte & 0x7F) << shift);
+		if ((byte & 0x80) == 0)
+			return value;
+	}
+	Corrupt("Varint too long");
+	return 0;
+}
+
+static inline uint16_t ReadUInt16(const ESArchiveReader *reader, size_t *offset)
+{
+	Require(reader, *offset, 2);
+	uint16_t value = OSReadLittleInt16(reader->bytes, *offset);
+	*offset += 2;
+	return value;
+}
+
+static inline uint32_t ReadUInt32(const ESArchiveReader *reader, size_t *offset)
+{
+	Require(reader, *offset, 4);
+	uint32_t value = OSReadLittleInt32(reader->bytes, *offset);
+	*offset += 4;
+	return value;
+}
+
+static double ReadDouble(const ESArchiveReader *reader, size_t *offset)
+{
+	Require(reader, *offset, 8);
+	uint64_t bits = OSReadLittleInt64(reader->bytes, *offset);
+	*offset += 8;
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static float ReadFloat(const ESArchiveReader *reader, size_t *offset)
+{
+	uint32_t bits = ReadUInt32(reader, offset);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static inline long long DecodeZigzag(uint64_t value)
+{
+	return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+// Strings are created the first time they're used and shared after that
+static NSString * ReadString(const ESArchiveReader *reader, size_t *offset)
+{
+	uint64_t index = ReadVarint(reader, offset);
+	if (index >= reader->stringCount)
+		Corrupt("String index out of range");
+	CFTypeRef string = reader->strings[index];
+	if (string == NULL)
+	{
+		size_t stringOffset = OSReadLittleInt32(reader->bytes, reader->stringTableOffset + (index * 4));
+		uint64_t length = ReadVarint(reader, &stringOffset);
+		Require(reader, stringOffset, (size_t)length);
+		CFStringRef newString = CFStringCreateWithBytes(NULL, reader->bytes + stringOffset, (CFIndex)length, kCFStringEncodingUTF8, false);
+		if (newString == NULL)
+			Corrupt("Invalid UTF-8 string");
+		if (OSAtomicCompareAndSwapPtrBarrier(NULL, (void *)newString, (void * volatile *)&reader->strings[index]))
+		{
+			string = newString;
+		}
+		else
+		{
+			CFRelease(newString);
+			string = reader->strings[index];
+		}
+	}
+	return (__bridge NSString *)string;
+}
+
+static NSData * ReadBytes(const ESArchiveReader *reader, size_t *offset)
+{
+	uint64_t length = ReadVarint(reader, offset);
+	Require(reader, *offset, (size_t)length);
+	NSData *data = [reader->data subdataWithRange:NSMakeRange(*offset, (NSUInteger)length)];
+	*offset += (size_t)length;
+	return data;
+}
+
+static void SkipValue(const ESArchiveReader *reader, size_t *offset, NSUInteger depth)
+{
+	if (depth > MAXIMUM_DEPTH)
+		Corrupt("Nested too deeply");
+	switch (ReadByte(reader, offset)) {
+		case kESArchiveTagNull:
+		case kESArchiveTagFalse:
+		case kESArchiveTagTrue:
+			break;
+		case kESArchiveTagInteger:
+		case kESArchiveTagUnsigned:
+		case kESArchiveTagString:
+		case kESArchiveTagURL:
+			ReadVarint(reader, offset);
+			break;
+		case kESArchiveTagDouble:
+		case kESArchiveTagDate:
+			Require(reader, *offset, 8);
+			*offset += 8;
+			break;
+		case kESArchiveTagFloat:
+			Require(reader, *offset, 4);
+			*offset += 4;
+			break;
+		case kESArchiveTagData:
+		case kESArchiveTagCoded:
+		{
+			uint64_t length = ReadVarint(reader, offset);
+			Require(reader, *offset, (size_t)length);
+			*offset += (size_t)length;
+			break;
+		}
+		case kESArchiveTagArray:
+		{
+			uint32_t endOffset = ReadUInt32(reader, offset);
+			if ((endOffset < *offset) || (endOffset > reader->length))
+				Corrupt("Invalid array length");
+			*offset = endOffset;
+			break;
+		}
+		case kESArchiveTagDictionary:
+		{
+			uint64_t count = ReadVarint(reader, offset);
+			for (uint64_t i = 0; i < count; i++)
+			{
+				ReadVarint(reader, offset);
+				SkipValue(reader, offset, depth + 1);
+			}
+			break;
+		}
+		case kESArchiveTagReference:
+			Require(reader, *offset, 4);
+			*offset += 4;
+			break;
+		case kESArchiveTagObject:
+		case kESArchiveTagSharedObject:
+		{
+			ReadVarint(reader, offset);
+			uint16_t count = ReadUInt16(reader, offset);
+			for (uint16_t i = 0; i < count; i++)
+			{
+				ReadVarint(reader, offset);
+				SkipValue(reader, offset, depth + 1);
+			}
+			break;
+		}
+		default:
+			Corrupt("Unknown value tag");
+			break;
+	}
+}
+
+// Reads a number straight into value without boxing it. Anything that isn't 
+// a number is skipped and NO is returned.
+static BOOL ReadScalarValue(const ESArchiveReader *reader, size_t *offset, ESScalarValue *value, NSUInteger depth)
+{
+	memset(value, 0, sizeof(ESScalarValue));
+	Require(reader, *offset, 1);
+	switch (reader->bytes[*offset]) {
+		case kESArchiveTagFalse:
+		case kESArchiveTagTrue:
+			value->isInteger = YES;
+			value->integerValue = (reader->bytes[(*offset)++] == kESArchiveTagTrue);
+			value->doubleValue = (double)value->integerValue;
+			return YES;
+		case kESArchiveTagInteger:
+			(*offset)++;
+			value->isInteger = YES;
+			value->integerValue = DecodeZigzag(ReadVarint(reader, offset));
+			value->doubleValue = (double)value->integerValue;
+			return YES;
+		case kESArchiveTagUnsigned:
+			(*offset)++;
+			value->isUnsigned = YES;
+			value->unsignedValue = ReadVarint(reader, offset);
+			value->doubleValue = (double)value->unsignedValue;
+			return YES;
+		case kESArchiveTagDouble:
+			(*offset)++;
+			value->doubleValue = ReadDouble(reader, offset);
+			return YES;
+		case kESArchiveTagFloat:
+			(*offset)++;
+			value->doubleValue = ReadFloat(reader, offset);
+			return YES;
+		default:
+			SkipValue(reader, offset, depth);
+			return NO;
+	}
+}
+
+static id ReadValue(const ESArchiveReader *reader, size_t *offset, NSUInteger depth);
+
+// sharedOffset is the offset of the tag of a kESArchiveTagSharedObject, 0 for any other object
+static id ReadModelObject(const ESArchiveReader *reader, size_t *offset, NSUInteger depth, size_t sharedOffset)
+{
+	NSString *className = ReadString(reader, offset);
+	uint16_t count = ReadUInt16(reader, offset);
+	Class objectClass = NSClassFromString(className);
+	// Gone since the archive was written
+	if ((objectClass == Nil) || ![objectClass isSubclassOfClass:_baseModelObjectClass])
+	{
+		for (uint16_t i = 0; i < count; i++)
+		{
+			ReadVarint(reader, offset);
+			SkipValue(reader, offset, depth + 1);
+		}
+		return nil;
+	}
+	id object = [[objectClass alloc] init];
+	// Before the properties, which may refer back to it
+	if (sharedOffset != 0)
+		[reader->contents registerSharedObject:object atOffset:sharedOffset];
+	ESObjectMappingPlan *plan = [ESObjectMappingPlan mappingPlanForObject:object];
+	const ESPropertyMappingStep *steps = plan.steps;
+	NSUInteger stepCount = plan.propertyCount;
+	// Properties are written in plan order, so the next step is almost always the one after the last match
+	NSUInteger nextStep = 0;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		NSString *name = ReadString(reader, offset);
+		const ESPropertyMappingStep *step = NULL;
+		for (NSUInteger j = 0; j < stepCount; j++)
+		{
+			NSUInteger index = (nextStep + j) % stepCount;
+			if (CFEqual(steps[index].outputKey, (__bridge CFStringRef)name))
+			{
+				step = &steps[index];
+				nextStep = index + 1;
+				break;
+			}
+		}
+		if ((step == NULL) || step->readOnly || (step->storageType == UnsupportedType))
+		{
+			SkipValue(reader, offset, depth + 1);
+			continue;
+		}
+		if ((step->storageType == IDType) || (step->storageType == ObjectType))
+		{
+			@autoreleasepool {
+				id value = ReadValue(reader, offset, depth + 1);
+				if ((value == [NSNull null]) && (step->storageType == ObjectType))
+					value = nil;
+				// Classes that changed type since the archive was written keep their default
+				if ((value != nil) && (step->storageType == ObjectType) && ![value isKindOfClass:step->propertyClass])
+					continue;
+				[plan setPropertyValue:value ofObject:object step:step];
+			}
+		}
+		else
+		{
+			ESScalarValue value;
+			if (ReadScalarValue(reader, offset, &value, depth + 1))
+				SetScalarStepValue(object, step, &value);
+		}
+	}
+	return object;
+}
+
+// Shared objects hold lazy arrays that hold the contents, so the contents only 
+// hold on to them weakly
+@interface ESArchivedObjectReference : NSObject
+@property (weak, nonatomic) id object;
+@end
+
+@implementation ESArchivedObjectReference
+@synthesize object=_object;
+@end
+
+@implementation ESArchiveContents
+{
+	NSData *_data;
+	ESArchiveReader _reader;
+	CFMutableDictionaryRef _sharedObjects; // Offset of the tag -> ESArchivedObjectReference
+}
+
+- (id)initWithData:(NSData *)data stringTableOffset:(size_t)stringTableOffset stringCount:(NSUInteger)stringCount
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_data = data;
+		_reader.bytes = (const uint8_t *)[data bytes];
+		_reader.length = [data length];
+		_reader.stringTableOffset = stringTableOffset;
+		_reader.stringCount = stringCount;
+		_reader.strings = (CFTypeRef *)calloc(MAX(stringCount, 1), sizeof(CFTypeRef));
+		_reader.data = _data;
+		_reader.contents = self;
+		_sharedObjects = CFDictionaryCreateMutable(NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	for (NSUInteger i = 0; i < _reader.stringCount; i++)
+	{
+		if (_reader.strings[i] != NULL)
+			CFRelease(_reader.strings[i]);
+	}
+	free(_reader.strings);
+	CFRelease(_sharedObjects);
+}
+
+- (const ESArchiveReader *)reader
+{
+	return &_reader;
+}
+
+- (id)sharedObjectAtOffset:(size_t)offset depth:(NSUInteger)depth
+{
+	// Recursive, materializing a shared object can run into other ones, or itself through a cycle
+	@synchronized(self)
+	{
+		ESArchivedObjectReference *reference = (__bridge ESArchivedObjectReference *)CFDictionaryGetValue(_sharedObjects, (const void *)offset);
+		id object = reference.object;
+		if (object != nil)
+			return object;
+		size_t objectOffset = offset + 1;
+		return ReadModelObject(&_reader, &objectOffset, depth, offset);
+	}
+}
+
+- (void)registerSharedObject:(id)object atOffset:(size_t)offset
+{
+	@synchronized(self)
+	{
+		ESArchivedObjectReference *reference = [ESArchivedObjectReference new];
+		reference.object = object;
+		CFDictionarySetValue(_sharedObjects, (const void *)offset, (__bridge const void *)reference);
+	}
+}
+
+@end
+
+// Materializes members the first time they're asked for. Any mutation turns 
+// it into a plain NSMutableArray of every member.
+@interface ESArchivedArray : NSMutableArray
+- (id)initWithContents:(ESArchiveContents *)contents tableOffset:(size_t)tableOffset count:(NSUInteger)count depth:(NSUInteger)depth;
+@end
+
+@implementation ESArchivedArray
+{
+	ESArchiveContents *_contents;
+	size_t _tableOffset;
+	NSUInteger _count;
+	NSUInteger _depth;
+	CFTypeRef *_members; // NULL until materialized
+	NSMutableArray *_mutableArray; // Once mutated
+}
+
+- (id)initWithContents:(ESArchiveContents *)contents tableOffset:(size_t)tableOffset count:(NSUInteger)count depth:(NSUInteger)depth
+{
+	self = [super init];
+	if (self != nil)
+	{
+		_contents = contents;
+		_tableOffset = tableOffset;
+		_count = count;
+		_depth = depth;
+		_members = (CFTypeRef *)calloc(MAX(count, 1), sizeof(CFTypeRef));
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if (_members != NULL)
+	{
+		for (NSUInteger i = 0; i < _count; i++)
+		{
+			if (_members[i] != NULL)
+				CFRelease(_members[i]);
+		}
+		free(_members);
+	}
+}
+
+- (NSUInteger)count
+{
+	if (_mutableArray != nil)
+		return [_mutableArray count];
+	return _count;
+}
+
+- (id)objectAtIndex:(NSUInteger)index
+{
+	if (_mutableArray != nil)
+		return [_mutableArray objectAtIndex:index];
+	if (index >= _count)
+		[NSException raise:NSRangeException format:@"Index %lu beyond bounds [0 .. %ld]", (unsigned long)index, (long)_count - 1];
+	CFTypeRef member = _members[index];
+	if (member == NULL)
+	{
+		const ESArchiveReader *reader = [_contents reader];
+		size_t offset = OSReadLittleInt32(reader->bytes, _tableOffset + (index * 4));
+		id value = ReadValue(reader, &offset, _depth);
+		// Members that can't be restored keep their place
+		if (value == nil)
+			value = [NSNull null];
+		CFTypeRef newMember = CFBridgingRetain(value);
+		if (OSAtomicCompareAndSwapPtrBarrier(NULL, (void *)newMember, (void * volatile *)&_members[index]))
+		{
+			member = newMember;
+		}
+		else
+		{
+			CFRelease(newMember);
+			member = _members[index];
+		}
+	}
+	return (__bridge id)member;
+}
+
+- (NSMutableArray *)mutableArray
+{
+	if (_mutableArray == nil)
+	{
+		NSMutableArray *mutableArray = [[NSMutableArray alloc] initWithCapacity:_count];
+		for (NSUInteger i = 0; i < _count; i++)
+			[mutableArray addObject:[self objectAtIndex:i]];
+		_mutableArray = mutableArray;
+	}
+	return _mutableArray;
+}
+
+- (void)insertObject:(id)anObject atIndex:(NSUInteger)index
+{
+	[[self mutableArray] insertObject:anObject atIndex:index];
+}
+
+- (void)removeObjectAtIndex:(NSUInteger)index
+{
+	[[self mutableArray] removeObjectAtIndex:index];
+}
+
+- (void)addObject:(id)anObject
+{
+	[[self mutableArray] addObject:anObject];
+}
+
+- (void)removeLastObject
+{
+	[[self mutableArray] removeLastObject];
+}
+
+- (void)replaceObjectAtIndex:(NSUInteger)index withObject:(id)anObject
+{
+	[[self mutableArray] replaceObjectAtIndex:index withObject:anObject];
+}
+
+@end
+
+static id ReadValue(const ESArchiveReader *reader, size_t *offset, NSUInteger depth)
+{
+	if (depth > MAXIMUM_DEPTH)
+		Corrupt("Nested too deeply");
+	switch (ReadByte(reader, offset)) {
+		case kESArchiveTagNull:
+			return [NSNull null];
+		case kESArchiveTagFalse:
+			return (__bridge NSNumber *)kCFBooleanFalse;
+		case kESArchiveTagTrue:
+			return (__bridge NSNumber *)kCFBooleanTrue;
+		case kESArchiveTagInteger:
+			return [NSNumber numberWithLongLong:DecodeZigzag(ReadVarint(reader, offset))];
+		case kESArchiveTagUnsigned:
+			return [NSNumber numberWithUnsignedLongLong:ReadVarint(reader, offset)];
+		case kESArchiveTagDouble:
+			return [NSNumber numberWithDouble:ReadDouble(reader, offset)];
+		case kESArchiveTagFloat:
+			return [NSNumber numberWithFloat:ReadFloat(reader, offset)];
+		case kESArchiveTagString:
+			return ReadString(reader, offset);
+		case kESArchiveTagData:
+			return ReadBytes(reader, offset);
+		case kESArchiveTagDate:
+			return [NSDate dateWithTimeIntervalSinceReferenceDate:ReadDouble(reader, offset)];
+		case kESArchiveTagURL:
+			return [NSURL URLWithString:ReadString(reader, offset)];
+		case kESArchiveTagArray:
+		{
+			uint32_t endOffset = ReadUInt32(reader, offset);
+			uint64_t count = ReadVarint(reader, offset);
+			if ((endOffset < *offset) || (endOffset > reader->length) || (count > ((endOffset - *offset) / 4)))
+				Corrupt("Invalid array length");
+			id array = [[ESArchivedArray alloc] initWithContents:reader->contents tableOffset:*offset count:(NSUInteger)count depth:depth + 1];
+			*offset = endOffset;
+			return array;
+		}
+		case kESArchiveTagDictionary:
+		{
+			uint64_t count = ReadVarint(reader, offset);
+			if (count > (reader->length - *offset))
+				Corrupt("Invalid dictionary length");
+			NSMutableDictionary *dictionary = [[NSMutableDictionary alloc] initWithCapacity:(NSUInteger)count];
+			for (uint64_t i = 0; i < count; i++)
+			{
+				NSString *key = ReadString(reader, offset);
+				id value = ReadValue(reader, offset, depth + 1);
+				if (value != nil)
+					[dictionary setObject:value forKey:key];
+			}
+			return dictionary;
+		}
+		case kESArchiveTagObject:
+			return ReadModelObject(reader, offset, depth + 1, 0);
+		case kESArchiveTagSharedObject:
+		{
+			// A lazy array member with a reference to this object may have materialized it already
+			size_t objectOffset = *offset - 1;
+			*offset = objectOffset;
+			SkipValue(reader, offset, depth);
+			return [reader->contents sharedObjectAtOffset:objectOffset depth:depth + 1];
+		}
+		case kESArchiveTagReference:
+		{
+			size_t referenceOffset = *offset - 1;
+			size_t objectOffset = ReadUInt32(reader, offset);
+			// References only point back, so they can't loop without an object in between
+			if ((objectOffset < HEADER_LENGTH) || (objectOffset >= referenceOffset) || (reader->bytes[objectOffset] != kESArchiveTagSharedObject))
+				Corrupt("Invalid object reference");
+			return [reader->contents sharedObjectAtOffset:objectOffset depth:depth + 1];
+		}
+		case kESArchiveTagCoded:
+		{
+			NSData *data = ReadBytes(reader, offset);
+			id value = nil;
+			@try {
+				value = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+			}
+			@catch (NSException *exception) {
+				Corrupt("Invalid keyed archive");
+			}
+			return value;
+		}
+		default:
+			Corrupt("Unknown value tag");
+			return nil;
+	}
+}
+
+#pragma mark - 
+
+static NSError * ArchiveError(NSInteger code, NSString *reason)
+{
+	NSDictionary *userInfo = [NSDictionary dictionaryWithObject:reason forKey:NSLocalizedDescriptionKey];
+	return [NSError errorWithDomain:kESObjectArchiveErrorDomain code:code userInfo:userInfo];
+}
+
+@implementation ESObjectArchive
+{
+	ESArchiveContents *_contents;
+	size_t _rootOffset;
+	BOOL _rootObjectLoaded;
+}
+@synthesize data=_data;
+@synthesize rootObject=_rootObject;
+
++ (void)initialize
+{
+	if (self == [ESObjectArchive class])
+	{
+		_stringClass = [NSString class];
+		_numberClass = [NSNumber class];
+		_decimalNumberClass = [NSDecimalNumber class];
+		_dateClass = [NSDate class];
+		_URLClass = [NSURL class];
+		_dataClass = [NSData class];
+		_dictionaryClass = [NSDictionary class];
+		_arrayClass = [NSArray class];
+		_baseModelObjectClass = [ESBaseModelObject class];
+	}
+}
+
++ (NSData *)archivedDataWithRootObject:(id)rootObject error:(NSError **)error
+{
+	ESArchiveWriter writer;
+	memset(&writer, 0, sizeof(ESArchiveWriter));
+	writer.capacity = 1024;
+	writer.bytes = (uint8_t *)malloc(writer.capacity);
+	writer.stringIndexes = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+	writer.strings = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	// Retained, but compared by pointer
+	CFDictionaryKeyCallBacks identityKeyCallBacks = kCFTypeDictionaryKeyCallBacks;
+	identityKeyCallBacks.equal = NULL;
+	identityKeyCallBacks.hash = NULL;
+	writer.objectOffsets = CFDictionaryCreateMutable(NULL, 0, &identityKeyCallBacks, NULL);
+	uint32_t stringTableOffset = 0;
+	BOOL success = (Extend(&writer, HEADER_LENGTH) == 0) && WriteValue(&writer, rootObject) && WriteStringTable(&writer, &stringTableOffset);
+	NSUInteger stringCount = (NSUInteger)CFArrayGetCount(writer.strings);
+	CFRelease(writer.stringIndexes);
+	CFRelease(writer.strings);
+	CFRelease(writer.objectOffsets);
+	if (!success)
+	{
+		free(writer.bytes);
+		if (error)
+			*error = ArchiveError(writer.errorCode, [NSString stringWithUTF8String:writer.errorReason]);
+		return nil;
+	}
+	memcpy(writer.bytes, _magic, sizeof(_magic));
+	writer.bytes[4] = ARCHIVE_VERSION;
+	memset(writer.bytes + 5, 0, 3);
+	OSWriteLittleInt32(writer.bytes, 8, HEADER_LENGTH);
+	OSWriteLittleInt32(writer.bytes, 12, stringTableOffset);
+	OSWriteLittleInt32(writer.bytes, 16, (uint32_t)stringCount);
+	return [NSData dataWithBytesNoCopy:writer.bytes length:writer.length freeWhenDone:YES];
+}
+
++ (id)newArchiveWithContentsOfURL:(NSURL *)url error:(NSError **)error
+{
+	NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:error];
+	if (data == nil)
+		return nil;
+	return [[self alloc] initWithData:data error:error];
+}
+
+- (id)initWithData:(NSData *)data error:(NSError **)error
+{
+	NSParameterAssert(data != nil);
+	self = [super init];
+	if (self != nil)
+	{
+		_data = data;
+		const uint8_t *bytes = (const uint8_t *)[data bytes];
+		size_t length = [data length];
+		if ((length < HEADER_LENGTH) || (memcmp(bytes, _magic, sizeof(_magic)) != 0))
+		{
+			if (error)
+				*error = ArchiveError(kESObjectArchiveErrorCorrupt, @"Not an object archive");
+			return nil;
+		}
+		if ((bytes[4] < MINIMUM_ARCHIVE_VERSION) || (bytes[4] > ARCHIVE_VERSION))
+		{
+			if (error)
+				*error = ArchiveError(kESObjectArchiveErrorUnsupportedVersion, [NSString stringWithFormat:@"Unsupported archive version %d", bytes[4]]);
+			return nil;
+		}
+		size_t rootOffset = OSReadLittleInt32(bytes, 8);
+		size_t stringTableOffset = OSReadLittleInt32(bytes, 12);
+		size_t stringCount = OSReadLittleInt32(bytes, 16);
+		if ((rootOffset < HEADER_LENGTH) || (rootOffset >= stringTableOffset) || (stringTableOffset > length) || (stringCount > ((length - stringTableOffset) / 4)))
+		{
+			if (error)
+				*error = ArchiveError(kESObjectArchiveErrorCorrupt, @"Invalid archive header");
+			return nil;
+		}
+		_rootOffset = rootOffset;
+		_contents = [[ESArchiveContents alloc] initWithData:data stringTableOffset:stringTableOffset stringCount:stringCount];
+	}
+	return self;
+}
+
+- (id)rootObject
+{
+	@synchronized(self)
+	{
+		if (!_rootObjectLoaded)
+		{
+			size_t offset = _rootOffset;
+			id rootObject = ReadValue([_contents reader], &offset, 0);
+			_rootObject = (rootObject == [NSNull null]) ? nil : rootObject;
+			_rootObjectLoaded = YES;
+		}
+		return _rootObject;
+	}
+}
+
+@end
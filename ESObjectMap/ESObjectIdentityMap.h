@@ -0,0 +1,79 @@
+//
+//  ESObjectIdentityMap.h
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Resolves nested objects that identify themselves with the same primary key 
+ * to one shared instance.
+ * 
+ * Classes opt in by setting primaryKeyInputKey on their object map. While an 
+ * identity map is current (inside performMapping:), ESObjectPropertyMap, 
+ * ESArrayPropertyMap, ObjectsFromArray() and ESObjectJSONDecoder look objects 
+ * of those classes up by the value at that key. The first dictionary for a key 
+ * creates the object, later ones update it in place with 
+ * UpdateObjectWithDictionary().
+ * 
+ * A session identity map keeps its objects alive until it's released, so every 
+ * reference in one payload comes back as the same instance. A weak identity map 
+ * can be kept for the lifetime of the app and shares objects with every mapping 
+ * it's used for, for as long as they're in use somewhere else.
+ * 
+ * Shared objects can't be updated from two threads at once, so arrays are mapped 
+ * serially while an identity map is current, and lookups are serialized.
+ */
+
+@interface ESObjectIdentityMap : NSObject
+
+/**
+ * Identity map that retains its objects, for one mapping session
+ */
++ (id)newIdentityMap;
+/**
+ * Identity map that holds its objects weakly
+ */
++ (id)newWeakIdentityMap;
+- (id)initWithWeakObjects:(BOOL)weakObjects;
+
+@property (nonatomic, readonly) BOOL weakObjects;
+
+/**
+ * @return The identity map of the innermost performMapping: on the calling thread, or nil
+ */
++ (ESObjectIdentityMap *)currentIdentityMap;
+/**
+ * Performs block synchronously with the receiver as the current identity map. Calls can be nested.
+ */
+- (void)performMapping:(dispatch_block_t)block;
+
+/**
+ * @return YES if objectClass has a primary key, otherwise objects of it are never shared
+ */
+- (BOOL)sharesObjectsOfClass:(Class)objectClass;
+/**
+ * @return The object of objectClass for dictionary's primary key updated with dictionary, or a new one created with initWithDictionary:
+ */
+- (id)objectOfClass:(Class)objectClass withDictionary:(NSDictionary *)dictionary;
+/**
+ * @return The object of objectClass registered for primaryKey, or nil
+ */
+- (id)objectOfClass:(Class)objectClass forPrimaryKey:(id)primaryKey;
+- (void)removeAllObjects;
+
+@end
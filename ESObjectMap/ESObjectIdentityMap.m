@@ -0,0 +1,198 @@
+//
+//  ESObjectIdentityMap.m
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import "ESObjectIdentityMap.h"
+#import "ESObjectProtocol.h"
+#import "ESObjectMapFunctions.h"
+#import <pthread.h>
+
+// Weak maps drop entries for deallocated objects when they've grown this much
+#define MINIMUM_PURGE_COUNT 64
+
+static pthread_key_t _currentIdentityMapKey;
+static Class _dictionaryClass;
+
+@interface ESIdentityMapWeakReference : NSObject
+@property (weak, nonatomic) id object;
+@end
+
+@implementation ESIdentityMapWeakReference
+@synthesize object=_object;
+@end
+
+@interface ESObjectIdentityMap ()
+- (NSMutableDictionary *)objectsForClass:(Class)objectClass;
+- (id)registeredObjectOfClass:(Class)objectClass forPrimaryKey:(id)primaryKey;
+- (void)registerObject:(id)object ofClass:(Class)objectClass forPrimaryKey:(id)primaryKey;
+@end
+
+@implementation ESObjectIdentityMap
+{
+	NSMutableDictionary *_objectsByClass; // Class -> primary key -> object (or weak reference)
+	NSUInteger _purgeCount;
+}
+@synthesize weakObjects=_weakObjects;
+
++ (void)initialize
+{
+	if (self == [ESObjectIdentityMap class])
+	{
+		pthread_key_create(&_currentIdentityMapKey, NULL);
+		_dictionaryClass = [NSDictionary class];
+	}
+}
+
++ (id)newIdentityMap
+{
+	return [[[self class] alloc] initWithWeakObjects:NO];
+}
+
++ (id)newWeakIdentityMap
+{
+	return [[[self class] alloc] initWithWeakObjects:YES];
+}
+
+- (id)init
+{
+	return [self initWithWeakObjects:NO];
+}
+
+- (id)initWithWeakObjects:(BOOL)weakObjects
+{
+	self = [super init];
+	if (self)
+	{
+		_weakObjects = weakObjects;
+		_objectsByClass = [NSMutableDictionary new];
+		_purgeCount = MINIMUM_PURGE_COUNT;
+	}
+	return self;
+}
+
+#pragma mark - Current identity map
+
++ (ESObjectIdentityMap *)currentIdentityMap
+{
+	return (__bridge ESObjectIdentityMap *)pthread_getspecific(_currentIdentityMapKey);
+}
+
+- (void)performMapping:(dispatch_block_t)block
+{
+	// The caller keeps the receiver alive for the duration of the block
+	void *previous = pthread_getspecific(_currentIdentityMapKey);
+	pthread_setspecific(_currentIdentityMapKey, (__bridge void *)self);
+	@try {
+		block();
+	}
+	@finally {
+		pthread_setspecific(_currentIdentityMapKey, previous);
+	}
+}
+
+#pragma mark - Objects
+
+- (BOOL)sharesObjectsOfClass:(Class)objectClass
+{
+	return ([[objectClass objectMap] primaryKeyInputKey] != nil);
+}
+
+- (NSMutableDictionary *)objectsForClass:(Class)objectClass
+{
+	NSMutableDictionary *objects = [_objectsByClass objectForKey:objectClass];
+	if (objects == nil)
+	{
+		objects = [NSMutableDictionary new];
+		[_objectsByClass setObject:objects forKey:(id<NSCopying>)objectClass];
+	}
+	return objects;
+}
+
+- (id)registeredObjectOfClass:(Class)objectClass forPrimaryKey:(id)primaryKey
+{
+	id object = [[_objectsByClass objectForKey:objectClass] objectForKey:primaryKey];
+	if (_weakObjects)
+		return [(ESIdentityMapWeakReference *)object object];
+	return object;
+}
+
+- (void)registerObject:(id)object ofClass:(Class)objectClass forPrimaryKey:(id)primaryKey
+{
+	NSMutableDictionary *objects = [self objectsForClass:objectClass];
+	if (!_weakObjects)
+	{
+		[objects setObject:object forKey:primaryKey];
+		return;
+	}
+	ESIdentityMapWeakReference *reference = [ESIdentityMapWeakReference new];
+	reference.object = object;
+	[objects setObject:reference forKey:primaryKey];
+	if ([objects count] >= _purgeCount)
+	{
+		NSSet *deallocatedKeys = [objects keysOfEntriesPassingTest:^BOOL(id key, id value, BOOL *stop) {
+			return ([(ESIdentityMapWeakReference *)value object] == nil);
+		}];
+		[objects removeObjectsForKeys:[deallocatedKeys allObjects]];
+		_purgeCount = MAX([objects count] * 2, MINIMUM_PURGE_COUNT);
+	}
+}
+
+- (id)objectOfClass:(Class)objectClass withDictionary:(NSDictionary *)dictionary
+{
+	NSString *primaryKeyInputKey = [[objectClass objectMap] primaryKeyInputKey];
+	id primaryKey = nil;
+	if ((primaryKeyInputKey != nil) && [dictionary isKindOfClass:_dictionaryClass])
+		primaryKey = [dictionary valueForKeyPath:primaryKeyInputKey];
+	if ((primaryKey == nil) || (primaryKey == [NSNull null]))
+		return [[objectClass alloc] initWithDictionary:dictionary];
+	// Held while the object is created or updated, nested lookups on this thread reenter it
+	@synchronized(self)
+	{
+		id object = [self registeredObjectOfClass:objectClass forPrimaryKey:primaryKey];
+		if (object != nil)
+		{
+			UpdateObjectWithDictionary(object, dictionary);
+			return object;
+		}
+		object = [[objectClass alloc] initWithDictionary:dictionary];
+		if (object != nil)
+			[self registerObject:object ofClass:objectClass forPrimaryKey:primaryKey];
+		return object;
+	}
+}
+
+- (id)objectOfClass:(Class)objectClass forPrimaryKey:(id)primaryKey
+{
+	if (primaryKey == nil)
+		return nil;
+	@synchronized(self)
+	{
+		return [self registeredObjectOfClass:objectClass forPrimaryKey:primaryKey];
+	}
+}
+
+- (void)removeAllObjects
+{
+	@synchronized(self)
+	{
+		[_objectsByClass removeAllObjects];
+		_purgeCount = MINIMUM_PURGE_COUNT;
+	}
+}
+
+@end
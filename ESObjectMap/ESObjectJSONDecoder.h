@@ -0,0 +1,54 @@
+//
+//  ESObjectJSONDecoder.h
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import <Foundation/Foundation.h>
+
+extern NSString *const kESObjectJSONDecoderErrorDomain;
+
+enum {
+	kESObjectJSONDecoderErrorUnexpectedCharacter	=	-1,
+	kESObjectJSONDecoderErrorUnexpectedEnd			=	-2,
+	kESObjectJSONDecoderErrorInvalidString			=	-3,
+	kESObjectJSONDecoderErrorTooDeep				=	-4
+};
+
+/**
+ * Decodes UTF-8 JSON text straight into model objects, without building the 
+ * NSDictionary for each of them that ConfigureObjectWithDictionary() needs.
+ * 
+ * Keys are matched against the ESObjectMappingPlan of the class being decoded:
+ * 
+ * - Keys no property maps from are skipped without creating any objects
+ * - Numbers and booleans for scalar properties without transform blocks are passed straight to the setter, without NSNumber boxing
+ * - ESObjectPropertyMap and ESArrayPropertyMap properties are decoded directly into their classes
+ * - Everything else (strings, key paths, transform blocks) is built as a Foundation value and applied exactly as ConfigureObjectWithDictionary() would
+ * 
+ * ESBaseModelObject subclasses are created with init rather than initWithDictionary:. 
+ * Subclasses that override initWithDictionary: or configureWithDictionary:, and other 
+ * classes, are built from a dictionary with initWithDictionary: as usual.
+ */
+
+@interface ESObjectJSONDecoder : NSObject
+
+/**
+ * @return An instance of objectClass, or an NSMutableArray of them if data is a top level array. nil with error set if data isn't valid JSON.
+ */
++ (id)objectOfClass:(Class)objectClass withJSONData:(NSData *)data error:(NSError **)error;
+
+@end
@@ -0,0 +1,758 @@
+//
+//  ESObjectJSONDecoder.m
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import "ESObjectJSONDecoder.h"
+#import "ESObjectMappingPlan.h"
+#import "ESObjectMapFunctions.h"
+#import "ESBaseModelObject.h"
+#import "ESObjectIdentityMap.h"
+#import <xlocale.h>
+
+NSString *const kESObjectJSONDecoderErrorDomain = @"ESObjectJSONDecoderErrorDomain";
+
+// Far deeper than any real document, shallow enough not to run out of stack
+#define MAXIMUM_DEPTH 512
+
+typedef struct {
+	const uint8_t *start;
+	const uint8_t *cursor;
+	const uint8_t *end;
+	NSUInteger depth;
+	NSInteger errorCode;
+	const char *errorReason;
+	__unsafe_unretained NSMutableData *scratch; // Unescaped strings, owned by the caller
+} ESJSONReader;
+
+static Class _baseModelObjectClass;
+static IMP _baseInitWithDictionaryIMP;
+static IMP _baseConfigureWithDictionaryIMP;
+
+#pragma mark - Tokens
+
+static BOOL Fail(ESJSONReader *reader, NSInteger code, const char *reason)
+{
+	// Keep the first error, it's the one nearest the problem
+	if (reader->errorCode == 0)
+	{
+		reader->errorCode = code;
+		reader->errorReason = reason;
+	}
+	return NO;
+}
+
+static BOOL FailUnexpected(ESJSONReader *reader, uint8_t c, const char *reason)
+{
+	if (c == 0)
+		return Fail(reader, kESObjectJSONDecoderErrorUnexpectedEnd, "Unexpected end of data");
+	return Fail(reader, kESObjectJSONDecoderErrorUnexpectedCharacter, reason);
+}
+
+// Skips whitespace and returns the next byte without consuming it, 0 at the end of the data
+static inline uint8_t Peek(ESJSONReader *reader)
+{
+	while (reader->cursor < reader->end)
+	{
+		uint8_t c = *reader->cursor;
+		if ((c != ' ') && (c != '\t') && (c != '\n') && (c != '\r'))
+			return c;
+		reader->cursor++;
+	}
+	return 0;
+}
+
+static inline BOOL IsDigit(uint8_t c)
+{
+	return ((c >= '0') && (c <= '9'));
+}
+
+static BOOL ReadLiteral(ESJSONReader *reader, const char *literal, size_t length)
+{
+	if ((size_t)(reader->end - reader->cursor) < length)
+		return Fail(reader, kESObjectJSONDecoderErrorUnexpectedEnd, "Unexpected end of data");
+	if (memcmp(reader->cursor, literal, length) != 0)
+		return Fail(reader, kESObjectJSONDecoderErrorUnexpectedCharacter, "Invalid literal");
+	reader->cursor += length;
+	return YES;
+}
+
+static BOOL ReadNumber(ESJSONReader *reader, ESScalarValue *number)
+{
+	const uint8_t *start = reader->cursor;
+	BOOL negative = NO, integer = YES;
+	if ((reader->cursor < reader->end) && (*reader->cursor == '-'))
+	{
+		negative = YES;
+		reader->cursor++;
+	}
+	if (reader->cursor >= reader->end)
+		return FailUnexpected(reader, 0, NULL);
+	if (*reader->cursor == '0')
+		reader->cursor++;
+	else if (IsDigit(*reader->cursor))
+		while ((reader->cursor < reader->end) && IsDigit(*reader->cursor))
+			reader->cursor++;
+	else
+		return FailUnexpected(reader, *reader->cursor, "Invalid number");
+	if ((reader->cursor < reader->end) && (*reader->cursor == '.'))
+	{
+		integer = NO;
+		reader->cursor++;
+		if ((reader->cursor >= reader->end) || !IsDigit(*reader->cursor))
+			return FailUnexpected(reader, (reader->cursor < reader->end) ? *reader->cursor : 0, "Invalid number");
+		while ((reader->cursor < reader->end) && IsDigit(*reader->cursor))
+			reader->cursor++;
+	}
+	if ((reader->cursor < reader->end) && ((*reader->cursor == 'e') || (*reader->cursor == 'E')))
+	{
+		integer = NO;
+		reader->cursor++;
+		if ((reader->cursor < reader->end) && ((*reader->cursor == '+') || (*reader->cursor == '-')))
+			reader->cursor++;
+		if ((reader->cursor >= reader->end) || !IsDigit(*reader->cursor))
+			return FailUnexpected(reader, (reader->cursor < reader->end) ? *reader->cursor : 0, "Invalid number");
+		while ((reader->cursor < reader->end) && IsDigit(*reader->cursor))
+			reader->cursor++;
+	}
+	// strto* need a terminated string
+	size_t length = (size_t)(reader->cursor - start);
+	char buffer[64];
+	char *text = (length < sizeof(buffer)) ? buffer : (char *)malloc(length + 1);
+	memcpy(text, start, length);
+	text[length] = '\0';
+	memset(number, 0, sizeof(ESScalarValue));
+	if (integer)
+	{
+		errno = 0;
+		long long integerValue = strtoll_l(text, NULL, 10, NULL);
+		if (errno == 0)
+		{
+			number->isInteger = YES;
+			number->integerValue = integerValue;
+			number->doubleValue = (double)integerValue;
+		}
+		else if (!negative)
+		{
+			errno = 0;
+			unsigned long long unsignedValue = strtoull_l(text, NULL, 10, NULL);
+			if (errno == 0)
+			{
+				number->isUnsigned = YES;
+				number->unsignedValue = unsignedValue;
+				number->doubleValue = (double)unsignedValue;
+			}
+		}
+	}
+	// The NULL locale is the C locale, so the decimal point is always '.'
+	if (!number->isInteger && !number->isUnsigned)
+		number->doubleValue = strtod_l(text, NULL, NULL);
+	if (text != buffer)
+		free(text);
+	return YES;
+}
+
+static BOOL ReadHex4(ESJSONReader *reader, uint32_t *value)
+{
+	if ((reader->end - reader->cursor) < 4)
+		return Fail(reader, kESObjectJSONDecoderErrorUnexpectedEnd, "Unexpected end of data");
+	uint32_t result = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		uint8_t c = reader->cursor[i];
+		result <<= 4;
+		if (IsDigit(c))
+			result |= (uint32_t)(c - '0');
+		else if ((c >= 'a') && (c <= 'f'))
+			result |= (uint32_t)(c - 'a' + 10);
+		else if ((c >= 'A') && (c <= 'F'))
+			result |= (uint32_t)(c - 'A' + 10);
+		else
+			return Fail(reader, kESObjectJSONDecoderErrorInvalidString, "Invalid \\u escape");
+	}
+	reader->cursor += 4;
+	*value = result;
+	return YES;
+}
+
+static void AppendUTF8(NSMutableData *data, uint32_t codePoint)
+{
+	uint8_t bytes[4];
+	NSUInteger length;
+	if (codePoint < 0x80)
+	{
+		bytes[0] = (uint8_t)codePoint;
+		length = 1;
+	}
+	else if (codePoint < 0x800)
+	{
+		bytes[0] = (uint8_t)(0xC0 | (codePoint >> 6));
+		bytes[1] = (uint8_t)(0x80 | (codePoint & 0x3F));
+		length = 2;
+	}
+	else if (codePoint < 0x10000)
+	{
+		bytes[0] = (uint8_t)(0xE0 | (codePoint >> 12));
+		bytes[1] = (uint8_t)(0x80 | ((codePoint >> 6) & 0x3F));
+		bytes[2] = (uint8_t)(0x80 | (codePoint & 0x3F));
+		length = 3;
+	}
+	else
+	{
+		bytes[0] = (uint8_t)(0xF0 | (codePoint >> 18));
+		bytes[1] = (uint8_t)(0x80 | ((codePoint >> 12) & 0x3F));
+		bytes[2] = (uint8_t)(0x80 | ((codePoint >> 6) & 0x3F));
+		bytes[3] = (uint8_t)(0x80 | (codePoint & 0x3F));
+		length = 4;
+	}
+	[data appendBytes:bytes length:length];
+}
+
+// Reads a string with the cursor on its opening quote. Strings without escapes 
+// are returned in place, others are unescaped into the reader's scratch buffer, 
+// which is only valid until the next string is read.
+static BOOL ReadStringBytes(ESJSONReader *reader, const uint8_t **bytes, size_t *length)
+{
+	reader->cursor++;
+	const uint8_t *start = reader->cursor;
+	while (reader->cursor < reader->end)
+	{
+		uint8_t c = *reader->cursor;
+		if (c == '"')
+		{
+			*bytes = start;
+			*length = (size_t)(reader->cursor - start);
+			reader->cursor++;
+			return YES;
+		}
+		if (c == '\\')
+			break;
+		if (c < 0x20)
+			return Fail(reader, kESObjectJSONDecoderErrorInvalidString, "Control character in string");
+		reader->cursor++;
+	}
+	NSMutableData *scratch = reader->scratch;
+	[scratch setLength:0];
+	[scratch appendBytes:start length:(NSUInteger)(reader->cursor - start)];
+	while (reader->cursor < reader->end)
+	{
+		uint8_t c = *reader->cursor;
+		if (c == '"')
+		{
+			reader->cursor++;
+			*bytes = (const uint8_t *)[scratch bytes];
+			*length = [scratch length];
+			return YES;
+		}
+		if (c < 0x20)
+			return Fail(reader, kESObjectJSONDecoderErrorInvalidString, "Control character in string");
+		if (c != '\\')
+		{
+			const uint8_t *run = reader->cursor;
+			while ((reader->cursor < reader->end) && (*reader->cursor != '"') && (*reader->cursor != '\\') && (*reader->cursor >= 0x20))
+				reader->cursor++;
+			[scratch appendBytes:run length:(NSUInteger)(reader->cursor - run)];
+			continue;
+		}
+		reader->cursor++;
+		if (reader->cursor >= reader->end)
+			break;
+		uint8_t unescaped;
+		switch (*reader->cursor++) {
+			case '"':
+				unescaped = '"';
+				break;
+			case '\\':
+				unescaped = '\\';
+				break;
+			case '/':
+				unescaped = '/';
+				break;
+			case 'b':
+				unescaped = '\b';
+				break;
+			case 'f':
+				unescaped = '\f';
+				break;
+			case 'n':
+				unescaped = '\n';
+				break;
+			case 'r':
+				unescaped = '\r';
+				break;
+			case 't':
+				unescaped = '\t';
+				break;
+			case 'u':
+			{
+				uint32_t codePoint;
+				if (!ReadHex4(reader, &codePoint))
+					return NO;
+				if ((codePoint >= 0xD800) && (codePoint <= 0xDBFF))
+				{
+					// Characters outside the BMP are escaped as a surrogate pair
+					uint32_t lowSurrogate;
+					if (((reader->end - reader->cursor) < 2) || (reader->cursor[0] != '\\') || (reader->cursor[1] != 'u'))
+						return Fail(reader, kESObjectJSONDecoderErrorInvalidString, "Unpaired surrogate");
+					reader->cursor += 2;
+					if (!ReadHex4(reader, &lowSurrogate))
+						return NO;
+					if ((lowSurrogate < 0xDC00) || (lowSurrogate > 0xDFFF))
+						return Fail(reader, kESObjectJSONDecoderErrorInvalidString, "Unpaired surrogate");
+					codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (lowSurrogate - 0xDC00);
+				}
+				else if ((codePoint >= 0xDC00) && (codePoint <= 0xDFFF))
+					return Fail(reader, kESObjectJSONDecoderErrorInvalidString, "Unpaired surrogate");
+				AppendUTF8(scratch, codePoint);
+				continue;
+			}
+			default:
+				return Fail(reader, kESObjectJSONDecoderErrorInvalidString, "Invalid escape");
+		}
+		[scratch appendBytes:&unescaped length:1];
+	}
+	return Fail(reader, kESObjectJSONDecoderErrorUnexpectedEnd, "Unexpected end of data");
+}
+
+static NSString * NewString(ESJSONReader *reader, const uint8_t *bytes, size_t length)
+{
+	NSString *string = [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+	if (string == nil)
+		Fail(reader, kESObjectJSONDecoderErrorInvalidString, "Invalid UTF-8");
+	return string;
+}
+
+#pragma mark - Containers
+
+static BOOL OpenContainer(ESJSONReader *reader)
+{
+	if (++reader->depth > MAXIMUM_DEPTH)
+		return Fail(reader, kESObjectJSONDecoderErrorTooDeep, "Nested too deeply");
+	reader->cursor++;
+	return YES;
+}
+
+// Call before each element of an open container, *done is set once the 
+// container has been closed
+static BOOL NextElement(ESJSONReader *reader, uint8_t close, NSUInteger index, BOOL *done)
+{
+	uint8_t c = Peek(reader);
+	*done = (c == close);
+	if (*done)
+	{
+		reader->cursor++;
+		reader->depth--;
+		return YES;
+	}
+	if (index > 0)
+	{
+		if (c != ',')
+			return FailUnexpected(reader, c, "Expected ',' or closing bracket");
+		reader->cursor++;
+		// No trailing commas
+		if (Peek(reader) == close)
+			return FailUnexpected(reader, close, "Unexpected closing bracket after ','");
+	}
+	return YES;
+}
+
+static BOOL ReadKey(ESJSONReader *reader, const uint8_t **bytes, size_t *length)
+{
+	uint8_t c = Peek(reader);
+	if (c != '"')
+		return FailUnexpected(reader, c, "Expected a string key");
+	if (!ReadStringBytes(reader, bytes, length))
+		return NO;
+	c = Peek(reader);
+	if (c != ':')
+		return FailUnexpected(reader, c, "Expected ':'");
+	reader->cursor++;
+	return YES;
+}
+
+static BOOL SkipValue(ESJSONReader *reader)
+{
+	uint8_t c = Peek(reader);
+	switch (c) {
+		case '"':
+		{
+			const uint8_t *bytes;
+			size_t length;
+			return ReadStringBytes(reader, &bytes, &length);
+		}
+		case '{':
+		case '[':
+		{
+			uint8_t close = (c == '{') ? '}' : ']';
+			if (!OpenContainer(reader))
+				return NO;
+			for (NSUInteger index = 0; ; index++)
+			{
+				BOOL done;
+				if (!NextElement(reader, close, index, &done))
+					return NO;
+				if (done)
+					return YES;
+				const uint8_t *bytes;
+				size_t length;
+				if ((close == '}') && !ReadKey(reader, &bytes, &length))
+					return NO;
+				if (!SkipValue(reader))
+					return NO;
+			}
+		}
+		case 't':
+			return ReadLiteral(reader, "true", 4);
+		case 'f':
+			return ReadLiteral(reader, "false", 5);
+		case 'n':
+			return ReadLiteral(reader, "null", 4);
+		default:
+		{
+			if ((c != '-') && !IsDigit(c))
+				return FailUnexpected(reader, c, "Expected a value");
+			ESScalarValue number;
+			return ReadNumber(reader, &number);
+		}
+	}
+}
+
+// Builds the same Foundation value NSJSONSerialization would (with mutable 
+// containers). Returns nil on failure.
+static id NewValue(ESJSONReader *reader)
+{
+	uint8_t c = Peek(reader);
+	switch (c) {
+		case '"':
+		{
+			const uint8_t *bytes;
+			size_t length;
+			if (!ReadStringBytes(reader, &bytes, &length))
+				return nil;
+			return NewString(reader, bytes, length);
+		}
+		case '{':
+		{
+			if (!OpenContainer(reader))
+				return nil;
+			NSMutableDictionary *dictionary = [NSMutableDictionary new];
+			for (NSUInteger index = 0; ; index++)
+			{
+				BOOL done;
+				if (!NextElement(reader, '}', index, &done))
+					return nil;
+				if (done)
+					return dictionary;
+				const uint8_t *bytes;
+				size_t length;
+				if (!ReadKey(reader, &bytes, &length))
+					return nil;
+				// Before the value, which can reuse the scratch buffer
+				NSString *key = NewString(reader, bytes, length);
+				if (key == nil)
+					return nil;
+				id value = NewValue(reader);
+				if (value == nil)
+					return nil;
+				[dictionary setObject:value forKey:key];
+			}
+		}
+		case '[':
+		{
+			if (!OpenContainer(reader))
+				return nil;
+			NSMutableArray *array = [NSMutableArray new];
+			for (NSUInteger index = 0; ; index++)
+			{
+				BOOL done;
+				if (!NextElement(reader, ']', index, &done))
+					return nil;
+				if (done)
+					return array;
+				id value = NewValue(reader);
+				if (value == nil)
+					return nil;
+				[array addObject:value];
+			}
+		}
+		case 't':
+			return ReadLiteral(reader, "true", 4) ? (__bridge NSNumber *)kCFBooleanTrue : nil;
+		case 'f':
+			return ReadLiteral(reader, "false", 5) ? (__bridge NSNumber *)kCFBooleanFalse : nil;
+		case 'n':
+			return ReadLiteral(reader, "null", 4) ? [NSNull null] : nil;
+		default:
+		{
+			if ((c != '-') && !IsDigit(c))
+			{
+				FailUnexpected(reader, c, "Expected a value");
+				return nil;
+			}
+			ESScalarValue number;
+			if (!ReadNumber(reader, &number))
+				return nil;
+			if (number.isInteger)
+				return [[NSNumber alloc] initWithLongLong:number.integerValue];
+			if (number.isUnsigned)
+				return [[NSNumber alloc] initWithUnsignedLongLong:number.unsignedValue];
+			return [[NSNumber alloc] initWithDouble:number.doubleValue];
+		}
+	}
+}
+
+#pragma mark - Properties
+
+// Reads a number, or a boolean or null as 1 or 0
+static BOOL ReadScalar(ESJSONReader *reader, uint8_t c, ESScalarValue *number)
+{
+	if ((c == '-') || IsDigit(c))
+		return ReadNumber(reader, number);
+	memset(number, 0, sizeof(ESScalarValue));
+	number->isInteger = YES;
+	if (c == 't')
+	{
+		number->integerValue = 1;
+		number->doubleValue = 1.0;
+		return ReadLiteral(reader, "true", 4);
+	}
+	return (c == 'f') ? ReadLiteral(reader, "false", 5) : ReadLiteral(reader, "null", 4);
+}
+
+static BOOL StepTransformsScalar(const ESPropertyMappingStep *step)
+{
+	ESPropertyMap *propertyMap = (__bridge ESPropertyMap *)step->propertyMap;
+	if (propertyMap == nil)
+		return NO;
+	switch (step->storageType) {
+		case IntType:
+			return [propertyMap respondsToSelector:@selector(intTransformBlock)] && (((ESIntPropertyMap *)propertyMap).intTransformBlock != nil);
+		case DoubleType:
+			return [propertyMap respondsToSelector:@selector(doubleTransformBlock)] && (((ESDoublePropertyMap *)propertyMap).doubleTransformBlock != nil);
+		case FloatType:
+			return [propertyMap respondsToSelector:@selector(floatTransformBlock)] && (((ESFloatPropertyMap *)propertyMap).floatTransformBlock != nil);
+		case BoolType:
+			return [propertyMap respondsToSelector:@selector(boolTransformBlock)] && (((ESBOOLPropertyMap *)propertyMap).boolTransformBlock != nil);
+		default:
+			// The wider integer and floating point types take any of the typed blocks
+			return ((propertyMap.transformBlock != nil) || 
+					([propertyMap respondsToSelector:@selector(intTransformBlock)] && (((ESIntPropertyMap *)propertyMap).intTransformBlock != nil)) || 
+					([propertyMap respondsToSelector:@selector(doubleTransformBlock)] && (((ESDoublePropertyMap *)propertyMap).doubleTransformBlock != nil)) || 
+					([propertyMap respondsToSelector:@selector(floatTransformBlock)] && (((ESFloatPropertyMap *)propertyMap).floatTransformBlock != nil)));
+	}
+}
+
+static id NewObjectOfClass(ESJSONReader *reader, Class objectClass);
+static NSMutableArray * NewArrayOfClass(ESJSONReader *reader, Class memberClass);
+
+static BOOL DecodeStepValue(ESJSONReader *reader, ESObjectMappingPlan *plan, id<ESObject> object, const ESPropertyMappingStep *step)
+{
+	uint8_t c = Peek(reader);
+	// Readonly properties raise in applyDictionaryValue:toObject:step:
+	if (!step->readOnly)
+	{
+		switch (step->storageType) {
+			case IDType:
+			case ObjectType:
+				if ((step->nestedClass != Nil) && (c == (step->mapsArray ? '[' : '{')))
+				{
+					id propertyValue = step->mapsArray ? NewArrayOfClass(reader, step->nestedClass) : NewObjectOfClass(reader, step->nestedClass);
+					if (reader->errorCode != 0)
+						return NO;
+					[plan setPropertyValue:propertyValue ofObject:object step:step];
+					return YES;
+				}
+				break;
+			case UnsupportedType:
+				return SkipValue(reader);
+			default:
+				if (((c == '-') || IsDigit(c) || (c == 't') || (c == 'f') || (c == 'n')) && !StepTransformsScalar(step))
+				{
+					ESScalarValue number;
+					if (!ReadScalar(reader, c, &number))
+						return NO;
+					SetScalarStepValue(object, step, &number);
+					return YES;
+				}
+				break;
+		}
+	}
+	id value = NewValue(reader);
+	if (value == nil)
+		return NO;
+	[plan applyDictionaryValue:value toObject:object step:step];
+	return YES;
+}
+
+#pragma mark - Objects
+
+// Classes that customize how they're built from a dictionary get a dictionary
+static BOOL CanDecodeDirectly(Class objectClass)
+{
+	return ([objectClass isSubclassOfClass:_baseModelObjectClass] && 
+			([objectClass instanceMethodForSelector:@selector(initWithDictionary:)] == _baseInitWithDictionaryIMP) && 
+			([objectClass instanceMethodForSelector:@selector(configureWithDictionary:)] == _baseConfigureWithDictionaryIMP));
+}
+
+// Returns nil on failure (reader->errorCode is set) and for JSON null
+static id NewObjectOfClass(ESJSONReader *reader, Class objectClass)
+{
+	uint8_t c = Peek(reader);
+	// Shared objects have to be looked up by a primary key that may come last, so they're built the usual way too
+	if ((c != '{') || !CanDecodeDirectly(objectClass) || [[ESObjectIdentityMap currentIdentityMap] sharesObjectsOfClass:objectClass])
+	{
+		// Not something that can be decoded directly, build it the usual way
+		id value = NewValue(reader);
+		if ((value == nil) || (value == [NSNull null]))
+			return nil;
+		return ObjectWithDictionary(objectClass, value);
+	}
+	id<ESObject> object = [[objectClass alloc] init];
+	ESObjectMappingPlan *plan = [ESObjectMappingPlan mappingPlanForObject:object];
+	const ESPropertyMappingStep *steps = plan.steps;
+	NSUInteger stepCount = plan.propertyCount;
+	if (!OpenContainer(reader))
+		return nil;
+	for (NSUInteger index = 0; ; index++)
+	{
+		BOOL done;
+		if (!NextElement(reader, '}', index, &done))
+			return nil;
+		if (done)
+			return object;
+		const uint8_t *keyBytes;
+		size_t keyLength;
+		if (!ReadKey(reader, &keyBytes, &keyLength))
+			return nil;
+		// Find the properties that read from this key
+		const ESPropertyMappingStep *match = NULL;
+		BOOL direct = YES;
+		for (NSUInteger i = 0; i < stepCount; i++)
+		{
+			const ESPropertyMappingStep *step = &steps[i];
+			if ((step->inputKeyLength != keyLength) || (memcmp(step->inputKeyBytes, keyBytes, keyLength) != 0))
+				continue;
+			if (match != NULL)
+				direct = NO;
+			else
+				match = step;
+			if (step->inputKeyComponentCount != 1)
+				direct = NO;
+		}
+		if (match == NULL)
+		{
+			if (!SkipValue(reader))
+				return nil;
+			continue;
+		}
+		BOOL decoded;
+		@autoreleasepool {
+			if (direct)
+				decoded = DecodeStepValue(reader, plan, object, match);
+			else
+			{
+				// Key paths and keys read by more than one property go through a dictionary. 
+				// keyBytes may be in the scratch buffer, so match against key after this.
+				NSString *key = NewString(reader, keyBytes, keyLength);
+				id value = (key != nil) ? NewValue(reader) : nil;
+				decoded = (value != nil);
+				if (decoded)
+				{
+					NSDictionary *dictionary = [[NSDictionary alloc] initWithObjectsAndKeys:value, key, nil];
+					for (NSUInteger i = 0; i < stepCount; i++)
+					{
+						const ESPropertyMappingStep *step = &steps[i];
+						if ((step->inputKeyLength != keyLength) || (memcmp(step->inputKeyBytes, [key UTF8String], keyLength) != 0))
+							continue;
+						id stepValue = [plan valueForStep:step inDictionary:dictionary];
+						if (stepValue != nil)
+							[plan applyDictionaryValue:stepValue toObject:object step:step];
+					}
+				}
+			}
+		}
+		if (!decoded)
+			return nil;
+	}
+}
+
+// Returns nil on failure (reader->errorCode is set)
+static NSMutableArray * NewArrayOfClass(ESJSONReader *reader, Class memberClass)
+{
+	if (!OpenContainer(reader))
+		return nil;
+	NSMutableArray *objects = [NSMutableArray new];
+	for (NSUInteger index = 0; ; index++)
+	{
+		BOOL done;
+		if (!NextElement(reader, ']', index, &done))
+			return nil;
+		if (done)
+			return objects;
+		id member;
+		@autoreleasepool {
+			member = NewObjectOfClass(reader, memberClass);
+		}
+		if (reader->errorCode != 0)
+			return nil;
+		if (member)
+			[objects addObject:member];
+	}
+}
+
+@implementation ESObjectJSONDecoder
+
++ (void)initialize
+{
+	if (self == [ESObjectJSONDecoder class])
+	{
+		_baseModelObjectClass = [ESBaseModelObject class];
+		_baseInitWithDictionaryIMP = [ESBaseModelObject instanceMethodForSelector:@selector(initWithDictionary:)];
+		_baseConfigureWithDictionaryIMP = [ESBaseModelObject instanceMethodForSelector:@selector(configureWithDictionary:)];
+	}
+}
+
++ (id)objectOfClass:(Class)objectClass withJSONData:(NSData *)data error:(NSError **)error
+{
+	NSParameterAssert(objectClass != Nil);
+	NSMutableData *scratch = [NSMutableData new];
+	ESJSONReader reader;
+	memset(&reader, 0, sizeof(ESJSONReader));
+	reader.start = (const uint8_t *)[data bytes];
+	reader.cursor = reader.start;
+	reader.end = reader.start + [data length];
+	reader.scratch = scratch;
+	id result;
+	if (Peek(&reader) == '[')
+		result = NewArrayOfClass(&reader, objectClass);
+	else
+		result = NewObjectOfClass(&reader, objectClass);
+	if ((reader.errorCode == 0) && (Peek(&reader) != 0))
+		Fail(&reader, kESObjectJSONDecoderErrorUnexpectedCharacter, "Unexpected data after the top level value");
+	if (reader.errorCode != 0)
+	{
+		if (error)
+		{
+			NSString *description = [NSString stringWithFormat:@"%s at offset %lu", reader.errorReason, (unsigned long)(reader.cursor - reader.start)];
+			NSDictionary *userInfo = [[NSDictionary alloc] initWithObjectsAndKeys:description, NSLocalizedDescriptionKey, nil];
+			*error = [NSError errorWithDomain:kESObjectJSONDecoderErrorDomain code:reader.errorCode userInfo:userInfo];
+		}
+		return nil;
+	}
+	return result;
+}
+
+@end
@@ -0,0 +1,61 @@
+//
+//  ESObjectJSONEncoder.h
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import <Foundation/Foundation.h>
+
+extern NSString *const kESObjectJSONEncoderErrorDomain;
+
+enum {
+	kESObjectJSONEncoderErrorInvalidValue	=	-1,
+	kESObjectJSONEncoderErrorTooDeep		=	-2,
+	kESObjectJSONEncoderErrorStream			=	-3
+};
+
+/**
+ * Writes model objects as UTF-8 JSON without building their dictionaryRepresentation first.
+ * 
+ * Properties are read through the ESObjectMappingPlan of each object's class and written 
+ * under the same keys, with the same inverse transform blocks, as GetDictionaryRepresentation(). 
+ * Scalars are formatted straight from their getters without NSNumber boxing, and 
+ * ESObjectPropertyMap and ESArrayPropertyMap values are written recursively instead of 
+ * through their default inverse blocks (a replaced inverse block is called as usual).
+ * 
+ * object can be a model object, or any NSJSONSerialization compatible value (NSArray, 
+ * NSDictionary, NSString, NSNumber, NSNull) that contains model objects. Objects that 
+ * override dictionaryRepresentation, or aren't ESBaseModelObjects, are written from 
+ * their dictionaryRepresentation.
+ */
+
+@interface ESObjectJSONEncoder : NSObject
+
+/**
+ * @return JSON for object, or nil with error set if it contains a value that can't be represented in JSON
+ */
++ (NSData *)JSONDataWithObject:(id)object error:(NSError **)error;
+
+/**
+ * Writes JSON for object to an open stream, in chunks, as it's encoded. Blocks until everything has been written.
+ * 
+ * If encoding fails part way through, part of the JSON will already have been written.
+ * 
+ * @return YES on success, NO with error set otherwise (the stream's error is under @"underlyingError")
+ */
++ (BOOL)writeObject:(id)object toStream:(NSOutputStream *)stream error:(NSError **)error;
+
+@end
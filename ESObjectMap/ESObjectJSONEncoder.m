@@ -0,0 +1,452 @@
+//
+//  ESObjectJSONEncoder.m
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import "ESObjectJSONEncoder.h"
+#import "ESObjectMappingPlan.h"
+#import "ESObjectMapFunctions.h"
+#import "ESBaseModelObject.h"
+#import <xlocale.h>
+
+NSString *const kESObjectJSONEncoderErrorDomain = @"ESObjectJSONEncoderErrorDomain";
+
+// Deep enough for any real graph, catches cycles before the stack runs out
+#define MAXIMUM_DEPTH 512
+// Bytes buffered before writing to a stream
+#define STREAM_CHUNK_SIZE (16 * 1024)
+
+typedef struct {
+	uint8_t *bytes;
+	size_t length;
+	size_t capacity;
+	__unsafe_unretained NSOutputStream *stream; // nil when everything is kept in bytes
+	NSUInteger depth;
+	NSInteger errorCode;
+	const char *errorReason;
+} ESJSONWriter;
+
+static Class _stringClass;
+static Class _numberClass;
+static Class _decimalNumberClass;
+static Class _dictionaryClass;
+static Class _arrayClass;
+static Class _baseModelObjectClass;
+static IMP _baseDictionaryRepresentationIMP;
+
+#pragma mark - Output
+
+static BOOL Fail(ESJSONWriter *writer, NSInteger code, const char *reason)
+{
+	if (writer->errorCode == 0)
+	{
+		writer->errorCode = code;
+		writer->errorReason = reason;
+	}
+	return NO;
+}
+
+static BOOL Flush(ESJSONWriter *writer)
+{
+	size_t written = 0;
+	while (written < writer->length)
+	{
+		NSInteger result = [writer->stream write:(writer->bytes + written) maxLength:(writer->length - written)];
+		if (result <= 0)
+			return Fail(writer, kESObjectJSONEncoderErrorStream, "Stream write failed");
+		written += (size_t)result;
+	}
+	writer->length = 0;
+	return YES;
+}
+
+static BOOL Append(ESJSONWriter *writer, const void *bytes, size_t length)
+{
+	if ((writer->length + length) > writer->capacity)
+	{
+		if ((writer->stream != nil) && !Flush(writer))
+			return NO;
+		while ((writer->length + length) > writer->capacity)
+			writer->capacity *= 2;
+		writer->bytes = (uint8_t *)realloc(writer->bytes, writer->capacity);
+	}
+	memcpy(writer->bytes + writer->length, bytes, length);
+	writer->length += length;
+	return YES;
+}
+
+static inline BOOL AppendByte(ESJSONWriter *writer, uint8_t byte)
+{
+	if (writer->length < writer->capacity)
+	{
+		writer->bytes[writer->length++] = byte;
+		return YES;
+	}
+	return Append(writer, &byte, 1);
+}
+
+#pragma mark - Values
+
+// Scanned by length rather than up to a terminator, strings can contain U+0000
+static BOOL WriteString(ESJSONWriter *writer, NSString *string)
+{
+	CFStringRef cfString = (__bridge CFStringRef)string;
+	CFIndex characterCount = CFStringGetLength(cfString);
+	// Only available when the string is stored as ASCII, one byte per character
+	const uint8_t *utf8 = (const uint8_t *)CFStringGetCStringPtr(cfString, kCFStringEncodingUTF8);
+	size_t length = (size_t)characterCount;
+	NSMutableData *converted = nil;
+	if (utf8 == NULL)
+	{
+		CFIndex byteCount = 0;
+		if (CFStringGetBytes(cfString, CFRangeMake(0, characterCount), kCFStringEncodingUTF8, 0, false, NULL, 0, &byteCount) != characterCount)
+			return Fail(writer, kESObjectJSONEncoderErrorInvalidValue, "String can't be represented as UTF-8");
+		converted = [[NSMutableData alloc] initWithLength:(NSUInteger)byteCount];
+		CFStringGetBytes(cfString, CFRangeMake(0, characterCount), kCFStringEncodingUTF8, 0, false, (UInt8 *)[converted mutableBytes], byteCount, NULL);
+		utf8 = (const uint8_t *)[converted bytes];
+		length = (size_t)byteCount;
+	}
+	if (!AppendByte(writer, '"'))
+		return NO;
+	const uint8_t *end = utf8 + length;
+	const uint8_t *run = utf8;
+	const uint8_t *cursor = run;
+	for (; cursor < end; cursor++)
+	{
+		uint8_t c = *cursor;
+		if ((c != '"') && (c != '\\') && (c >= 0x20))
+			continue;
+		if (!Append(writer, run, (size_t)(cursor - run)))
+			return NO;
+		run = cursor + 1;
+		char escape[8];
+		switch (c) {
+			case '"':
+				strcpy(escape, "\\\"");
+				break;
+			case '\\':
+				strcpy(escape, "\\\\");
+				break;
+			case '\n':
+				strcpy(escape, "\\n");
+				break;
+			case '\r':
+				strcpy(escape, "\\r");
+				break;
+			case '\t':
+				strcpy(escape, "\\t");
+				break;
+			case '\b':
+				strcpy(escape, "\\b");
+				break;
+			case '\f':
+				strcpy(escape, "\\f");
+				break;
+			default:
+				snprintf(escape, sizeof(escape), "\\u%04x", c);
+				break;
+		}
+		if (!Append(writer, escape, strlen(escape)))
+			return NO;
+	}
+	if (!Append(writer, run, (size_t)(cursor - run)))
+		return NO;
+	return AppendByte(writer, '"');
+}
+
+static BOOL WriteBool(ESJSONWriter *writer, BOOL value)
+{
+	return value ? Append(writer, "true", 4) : Append(writer, "false", 5);
+}
+
+static BOOL WriteInteger(ESJSONWriter *writer, long long value)
+{
+	char buffer[24];
+	int length = snprintf_l(buffer, sizeof(buffer), NULL, "%lld", value);
+	return Append(writer, buffer, (size_t)length);
+}
+
+static BOOL WriteUnsignedInteger(ESJSONWriter *writer, unsigned long long value)
+{
+	char buffer[24];
+	int length = snprintf_l(buffer, sizeof(buffer), NULL, "%llu", value);
+	return Append(writer, buffer, (size_t)length);
+}
+
+// Shortest of the two precisions that reads back as the same value. The NULL 
+// locale is the C locale, so the decimal point is always '.'
+static BOOL WriteDouble(ESJSONWriter *writer, double value)
+{
+	if (isnan(value) || isinf(value))
+		return Fail(writer, kESObjectJSONEncoderErrorInvalidValue, "NaN and infinity can't be represented in JSON");
+	char buffer[32];
+	int length = snprintf_l(buffer, sizeof(buffer), NULL, "%.15g", value);
+	if (strtod_l(buffer, NULL, NULL) != value)
+		length = snprintf_l(buffer, sizeof(buffer), NULL, "%.17g", value);
+	return Append(writer, buffer, (size_t)length);
+}
+
+static BOOL WriteFloat(ESJSONWriter *writer, float value)
+{
+	if (isnan(value) || isinf(value))
+		return Fail(writer, kESObjectJSONEncoderErrorInvalidValue, "NaN and infinity can't be represented in JSON");
+	char buffer[32];
+	int length = snprintf_l(buffer, sizeof(buffer), NULL, "%.7g", (double)value);
+	if (strtof_l(buffer, NULL, NULL) != value)
+		length = snprintf_l(buffer, sizeof(buffer), NULL, "%.9g", (double)value);
+	return Append(writer, buffer, (size_t)length);
+}
+
+static BOOL WriteNumber(ESJSONWriter *writer, NSNumber *number)
+{
+	if ([number isKindOfClass:_decimalNumberClass])
+	{
+		NSString *string = [number descriptionWithLocale:nil];
+		return Append(writer, [string UTF8String], [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding]);
+	}
+	CFNumberRef cfNumber = (__bridge CFNumberRef)number;
+	if (CFGetTypeID(cfNumber) == CFBooleanGetTypeID())
+		return WriteBool(writer, CFBooleanGetValue((CFBooleanRef)cfNumber));
+	if (CFNumberIsFloatType(cfNumber))
+		return WriteDouble(writer, [number doubleValue]);
+	if (*[number objCType] == 'Q')
+		return WriteUnsignedInteger(writer, [number unsignedLongLongValue]);
+	return WriteInteger(writer, [number longLongValue]);
+}
+
+static BOOL WriteScalarProperty(ESJSONWriter *writer, id object, const ESPropertyMappingStep *step)
+{
+	IMP getterIMP = step->getterIMP;
+	SEL getter = step->getter;
+	// Forwarded getters are rare enough to go through the boxing path
+	if (getterIMP == NULL)
+		return WriteNumber(writer, GetScalarPropertyValue(object, getter, NULL, step->storageType));
+	switch (step->storageType) {
+		case BoolType:
+			return WriteBool(writer, ((BOOL (*)(id, SEL))getterIMP)(object, getter));
+		case DoubleType:
+			return WriteDouble(writer, ((double (*)(id, SEL))getterIMP)(object, getter));
+		case FloatType:
+			return WriteFloat(writer, ((float (*)(id, SEL))getterIMP)(object, getter));
+		case IntType:
+			return WriteInteger(writer, ((int (*)(id, SEL))getterIMP)(object, getter));
+		case UnsignedCharType:
+			return WriteInteger(writer, ((unsigned char (*)(id, SEL))getterIMP)(object, getter));
+		case ShortType:
+			return WriteInteger(writer, ((short (*)(id, SEL))getterIMP)(object, getter));
+		case UnsignedShortType:
+			return WriteInteger(writer, ((unsigned short (*)(id, SEL))getterIMP)(object, getter));
+		case UnsignedIntType:
+			return WriteInteger(writer, ((unsigned int (*)(id, SEL))getterIMP)(object, getter));
+		case LongLongType:
+			return WriteInteger(writer, ((long long (*)(id, SEL))getterIMP)(object, getter));
+		case UnsignedLongLongType:
+			return WriteUnsignedInteger(writer, ((unsigned long long (*)(id, SEL))getterIMP)(object, getter));
+		default:
+			return YES;
+	}
+}
+
+static BOOL WriteValue(ESJSONWriter *writer, id value);
+
+static BOOL HasDefaultInverseTransformBlock(ESPropertyMap *propertyMap, const ESPropertyMappingStep *step)
+{
+	if (step->mapsArray)
+		return ((ESArrayPropertyMap *)propertyMap).hasDefaultInverseTransformBlock;
+	return ((ESObjectPropertyMap *)propertyMap).hasDefaultInverseTransformBlock;
+}
+
+static BOOL Descend(ESJSONWriter *writer)
+{
+	if (++writer->depth > MAXIMUM_DEPTH)
+		return Fail(writer, kESObjectJSONEncoderErrorTooDeep, "Nested too deeply, the object graph may have a cycle");
+	return YES;
+}
+
+static BOOL WriteModelObject(ESJSONWriter *writer, id<ESObject> object)
+{
+	if (!Descend(writer) || !AppendByte(writer, '{'))
+		return NO;
+	ESObjectMappingPlan *plan = [ESObjectMappingPlan mappingPlanForObject:object];
+	const ESPropertyMappingStep *steps = plan.steps;
+	NSUInteger stepCount = plan.propertyCount;
+	BOOL first = YES;
+	for (NSUInteger i = 0; i < stepCount; i++)
+	{
+		const ESPropertyMappingStep *step = &steps[i];
+		if (step->storageType == UnsupportedType)
+			continue;
+		BOOL written;
+		@autoreleasepool {
+			id value = nil;
+			if ((step->storageType == IDType) || (step->storageType == ObjectType))
+			{
+				id propertyValue;
+				if (step->getterIMP != NULL)
+					propertyValue = ((id (*)(id, SEL))step->getterIMP)(object, step->getter);
+				else
+					propertyValue = [object valueForKey:(__bridge NSString *)step->outputKey];
+				ESPropertyMap *propertyMap = (__bridge ESPropertyMap *)step->propertyMap;
+				// Nested model objects are written directly rather than through the dictionaries the default inverse blocks build, 
+				// a replaced block decides what's written like any other
+				if ((step->nestedClass != Nil) && HasDefaultInverseTransformBlock(propertyMap, step))
+					value = propertyValue;
+				else if (propertyMap.inverseTransformBlock)
+					value = propertyMap.inverseTransformBlock(object, propertyValue);
+				else
+					value = propertyValue;
+				// Same as GetDictionaryRepresentation(), nil values are left out
+				if (value == nil)
+					continue;
+			}
+			written = (first || AppendByte(writer, ',')) && WriteString(writer, (__bridge NSString *)step->inputKey) && AppendByte(writer, ':');
+			if (written)
+			{
+				if (value != nil)
+					written = WriteValue(writer, value);
+				else
+					written = WriteScalarProperty(writer, object, step);
+			}
+		}
+		if (!written)
+			return NO;
+		first = NO;
+	}
+	writer->depth--;
+	return AppendByte(writer, '}');
+}
+
+static BOOL WriteValue(ESJSONWriter *writer, id value)
+{
+	if ((value == nil) || (value == [NSNull null]))
+		return Append(writer, "null", 4);
+	if ([value isKindOfClass:_stringClass])
+		return WriteString(writer, value);
+	if ([value isKindOfClass:_numberClass])
+		return WriteNumber(writer, value);
+	if ([value isKindOfClass:_arrayClass])
+	{
+		if (!Descend(writer) || !AppendByte(writer, '['))
+			return NO;
+		BOOL first = YES;
+		for (id member in (NSArray *)value)
+		{
+			BOOL written;
+			@autoreleasepool {
+				written = (first || AppendByte(writer, ',')) && WriteValue(writer, member);
+			}
+			if (!written)
+				return NO;
+			first = NO;
+		}
+		writer->depth--;
+		return AppendByte(writer, ']');
+	}
+	if ([value isKindOfClass:_dictionaryClass])
+	{
+		if (!Descend(writer) || !AppendByte(writer, '{'))
+			return NO;
+		__block BOOL first = YES;
+		__block BOOL written = YES;
+		[(NSDictionary *)value enumerateKeysAndObjectsUsingBlock:^(id key, id member, BOOL *stop) {
+			if (![key isKindOfClass:_stringClass])
+				written = Fail(writer, kESObjectJSONEncoderErrorInvalidValue, "Dictionary keys must be strings");
+			else
+				written = (first || AppendByte(writer, ',')) && WriteString(writer, key) && AppendByte(writer, ':') && WriteValue(writer, member);
+			first = NO;
+			*stop = !written;
+		}];
+		if (!written)
+			return NO;
+		writer->depth--;
+		return AppendByte(writer, '}');
+	}
+	if ([value conformsToProtocol:@protocol(ESObject)])
+	{
+		// Classes with their own dictionaryRepresentation get to decide what's written
+		if ([value isKindOfClass:_baseModelObjectClass] && ([[value class] instanceMethodForSelector:@selector(dictionaryRepresentation)] == _baseDictionaryRepresentationIMP))
+			return WriteModelObject(writer, value);
+		return WriteValue(writer, [value dictionaryRepresentation]);
+	}
+	return Fail(writer, kESObjectJSONEncoderErrorInvalidValue, "Value can't be represented in JSON");
+}
+
+#pragma mark - 
+
+@interface ESObjectJSONEncoder ()
++ (BOOL)writeObject:(id)object withWriter:(ESJSONWriter *)writer error:(NSError **)error;
+@end
+
+@implementation ESObjectJSONEncoder
+
++ (void)initialize
+{
+	if (self == [ESObjectJSONEncoder class])
+	{
+		_stringClass = [NSString class];
+		_numberClass = [NSNumber class];
+		_decimalNumberClass = [NSDecimalNumber class];
+		_dictionaryClass = [NSDictionary class];
+		_arrayClass = [NSArray class];
+		_baseModelObjectClass = [ESBaseModelObject class];
+		_baseDictionaryRepresentationIMP = [ESBaseModelObject instanceMethodForSelector:@selector(dictionaryRepresentation)];
+	}
+}
+
++ (BOOL)writeObject:(id)object withWriter:(ESJSONWriter *)writer error:(NSError **)error
+{
+	BOOL success = WriteValue(writer, object);
+	if (success && (writer->stream != nil))
+		success = Flush(writer);
+	if (!success && error)
+	{
+		NSMutableDictionary *userInfo = [NSMutableDictionary dictionaryWithObject:[NSString stringWithUTF8String:writer->errorReason] forKey:NSLocalizedDescriptionKey];
+		if ((writer->errorCode == kESObjectJSONEncoderErrorStream) && ([writer->stream streamError] != nil))
+			[userInfo setObject:[writer->stream streamError] forKey:@"underlyingError"];
+		*error = [NSError errorWithDomain:kESObjectJSONEncoderErrorDomain code:writer->errorCode userInfo:userInfo];
+	}
+	return success;
+}
+
++ (NSData *)JSONDataWithObject:(id)object error:(NSError **)error
+{
+	ESJSONWriter writer;
+	memset(&writer, 0, sizeof(ESJSONWriter));
+	writer.capacity = 1024;
+	writer.bytes = (uint8_t *)malloc(writer.capacity);
+	if (![self writeObject:object withWriter:&writer error:error])
+	{
+		free(writer.bytes);
+		return nil;
+	}
+	return [NSData dataWithBytesNoCopy:writer.bytes length:writer.length freeWhenDone:YES];
+}
+
++ (BOOL)writeObject:(id)object toStream:(NSOutputStream *)stream error:(NSError **)error
+{
+	NSParameterAssert(stream != nil);
+	ESJSONWriter writer;
+	memset(&writer, 0, sizeof(ESJSONWriter));
+	writer.capacity = STREAM_CHUNK_SIZE;
+	writer.bytes = (uint8_t *)malloc(writer.capacity);
+	writer.stream = stream;
+	BOOL success = [self writeObject:object withWriter:&writer error:error];
+	free(writer.bytes);
+	return success;
+}
+
+@end
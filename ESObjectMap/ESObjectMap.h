@@ -31,6 +31,16 @@
 @interface ESObjectMap : NSObject
 
 @property (strong, nonatomic) Class mapClass;
+/**
+ * Incremented every time a property map is added, so that compiled mapping plans know to rebuild
+ */
+@property (nonatomic, readonly) int32_t version;
+/**
+ * Input key (or key path) whose value identifies an object of mapClass, so 
+ * ESObjectIdentityMap can share one instance between every dictionary with the 
+ * same value. nil, the default, means objects are never shared.
+ */
+@property (copy, nonatomic) NSString *primaryKeyInputKey;
 
 + (id)newObjectMapWithClass:(Class)class;
 - (id)initWithClass:(Class)class;
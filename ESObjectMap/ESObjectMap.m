@@ -19,13 +19,18 @@
 
 #import "ESObjectMap.h"
 #import "ESMutableDictionary.h"
+#import <libkern/OSAtomic.h>
 
 @interface ESObjectMap ()
 @property (strong, nonatomic, readonly) ESMutableDictionary* propertyMaps;
 @end
 
 @implementation ESObjectMap
+{
+	volatile int32_t _version;
+}
 @synthesize mapClass=_mapClass;
+@synthesize primaryKeyInputKey=_primaryKeyInputKey;
 @synthesize propertyMaps=_propertyMaps;
 
 + (id)newObjectMapWithClass:(Class)class
@@ -65,6 +70,12 @@
 	if (propertyMap.outputKey == nil)
 		return;
 	[self.propertyMaps setObject:propertyMap forKey:propertyMap.outputKey];
+	OSAtomicIncrement32Barrier(&_version);
+}
+
+- (int32_t)version
+{
+	return _version;
 }
 
 @end
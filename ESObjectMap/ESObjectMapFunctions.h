@@ -20,9 +20,41 @@
 #import <Foundation/Foundation.h>
 #import "ESObjectMap.h"
 #import "ESObjectProtocol.h"
+#import "ESDeclaredPropertyAttributes.h"
 
 void ConfigureObjectWithDictionary(id<ESObject> object, NSDictionary *dictionary);
+/**
+ * Like ConfigureObjectWithDictionary(), but only calls the setters of properties whose value would change, so unchanged properties don't post KVO notifications or dirty managed objects.
+ * 
+ * Objects are compared with isEqual:, nested ESObjectPropertyMap objects are updated in place when their class has a primaryKeyInputKey and the dictionary has the same primary key, otherwise they're replaced with new instances. The members of ESArrayPropertyMap arrays are matched the same way, matched members are updated in place and the array is only set if members were added, removed or reordered. Properties without a directly implemented getter are always set.
+ * 
+ * @return Names (output keys) of the properties that were set
+ */
+NSSet * UpdateObjectWithDictionary(id<ESObject> object, NSDictionary *dictionary);
 NSDictionary * GetDictionaryRepresentation(id<ESObject> object);
+/**
+ * Maps a dictionary to an instance of objectClass with initWithDictionary:, or through the current ESObjectIdentityMap if there is one
+ */
+id ObjectWithDictionary(Class objectClass, NSDictionary *dictionary);
+/**
+ * Maps an array of dictionaries to instances of objectClass with ObjectWithDictionary(), dropping members that come back nil.
+ * 
+ * Arrays are mapped serially unless objectClass is an ESBaseModelObject subclass whose +mapsArraysConcurrently returns YES, then large arrays are split into chunks that are mapped in parallel. Output order matches input order either way. Arrays are always mapped serially while an identity map is current.
+ * 
+ * @return Mutable array of mapped objects
+ */
+NSMutableArray * ObjectsFromArray(Class objectClass, NSArray *array);
 ESObjectMap * GetObjectMapForClass(Class objectClass);
+/**
+ * Boxes a scalar property through its getter. If getterIMP is NULL the getter is sent as a normal message.
+ */
+NSNumber * GetScalarPropertyValue(id object, SEL getter, IMP getterIMP, PropertyStorageType storageType);
+/**
+ * Sets a scalar property from value's NSNumber accessor for storageType (nil sets 0). If setterIMP is NULL the setter is sent as a normal message.
+ */
+void SetScalarPropertyValue(id object, SEL setter, IMP setterIMP, PropertyStorageType storageType, id value);
+/**
+ * Untyped accessors built on NSInvocation, much slower than the scalar functions above (see ESPropertyAccessBenchmark)
+ */
 void GetPrimitivePropertyValue(id object, SEL getter, void * value);
 void SetPrimitivePropertyValue(id object, SEL setter, void * value);
@@ -20,110 +20,26 @@
 #import "ESObjectMapFunctions.h"
 #import "ESMutableDictionary.h"
 #import <objc/runtime.h>
+#import <objc/message.h>
 #import "NSObject+PropertyDictionary.h"
+#import "ESObjectMappingPlan.h"
+#import "ESBaseModelObject.h"
+#import "ESObjectIdentityMap.h"
+
+// Members mapped per dispatch_apply iteration, big enough to amortize the 
+// iteration and its autorelease pool, small enough to balance across cores
+#define MAPPING_CHUNK_SIZE 32
+// Arrays shorter than this are mapped on the calling thread
+#define CONCURRENT_MAPPING_THRESHOLD 128
 
 void ConfigureObjectWithDictionary(id<ESObject> object, NSDictionary *dictionary)
 {
-	NSDictionary *propertyDictionary = [[object class] propertyDictionary];
-	ESObjectMap *objectMap = [[object class] objectMap];
-	for (ESDeclaredPropertyAttributes *attributes in [propertyDictionary allValues])
-	{
-		@autoreleasepool {
-			NSString *inputKey;
-			NSString *outputKey;
-			id dictionaryValue;
-			id propertyValue;
-			
-			outputKey = attributes.name;
-			if (outputKey == nil)
-				continue;
-			// Get the property map, if it exists
-			ESPropertyMap *propertyMap = [objectMap propertyMapForOutputKey:outputKey];
-			if (propertyMap == nil) // If there's no property map, then assume inputKey simply maps to outputKey
-				inputKey = outputKey;
-			else // If there is a property map, get the input key
-				inputKey = propertyMap.inputKey;
-			// Grab our value from the input dictionary
-			dictionaryValue = [dictionary valueForKeyPath:inputKey];
-			if (dictionaryValue == nil)
-				continue;
-			if (dictionaryValue == [NSNull null])
-				dictionaryValue = nil;
-			// At this point we have a value (or nil) to work with, so let's make sure we can actually set it
-			if (attributes.readOnly)
-				[NSException raise:@"Readonly Exception" format:@"Attempted to set a readonly property: %@", attributes];
-			switch (attributes.storageType) {
-				case IDType:
-					// If there's a transform block, execute it
-					if (dictionaryValue && propertyMap.transformBlock)
-						propertyValue = propertyMap.transformBlock(object, dictionaryValue);
-					else
-						propertyValue = dictionaryValue;
-					[object setValue:propertyValue forKey:outputKey];
-					break;
-				case ObjectType:
-					// If there's a transform block, execute it
-					if (dictionaryValue && propertyMap.transformBlock)
-						propertyValue = propertyMap.transformBlock(object, dictionaryValue);
-					else
-						propertyValue = dictionaryValue;
-					if (propertyValue)
-					{
-						Class class = NSClassFromString(attributes.classString);
-						if (![propertyValue isKindOfClass:class])
-							[NSException raise:@"Class Mismatch" format:@"Object: %@ is not kind of class: %@", propertyValue, NSStringFromClass(class)];
-					}
-					[object setValue:propertyValue forKey:outputKey];
-					break;
-				case IntType:
-				{
-					int intPropertyValue = 0;
-					// If there's a transform block, execute it
-					if (dictionaryValue && ((ESIntPropertyMap *)propertyMap).intTransformBlock)
-						intPropertyValue = ((ESIntPropertyMap *)propertyMap).intTransformBlock(dictionaryValue);
-					else if (dictionaryValue)
-						intPropertyValue = [dictionaryValue intValue];
-					SetPrimitivePropertyValue(object, attributes.setter, &intPropertyValue);
-					break;
-				}
-				case DoubleType:
-				{
-					double doublePropertyValue = 0.0;
-					// If there's a transform block, execute it
-					if (dictionaryValue && ((ESDoublePropertyMap *)propertyMap).doubleTransformBlock)
-						doublePropertyValue = ((ESDoublePropertyMap *)propertyMap).doubleTransformBlock(dictionaryValue);
-					else if (dictionaryValue)
-						doublePropertyValue = [dictionaryValue doubleValue];
-					SetPrimitivePropertyValue(object, attributes.setter, &doublePropertyValue);
-					break;
-				}
-				case FloatType:
-				{
-					float floatPropertyValue = 0.0f;
-					// If there's a transform block, execute it
-					if (dictionaryValue && ((ESFloatPropertyMap *)propertyMap).floatTransformBlock)
-						floatPropertyValue = ((ESFloatPropertyMap *)propertyMap).floatTransformBlock(dictionaryValue);
-					else if (dictionaryValue)
-						floatPropertyValue = [dictionaryValue floatValue];
-					SetPrimitivePropertyValue(object, attributes.setter, &floatPropertyValue);
-					break;
-				}
-				case BoolType:
-				{
-					BOOL boolPropertyValue = NO;
-					// If there's a transform block, execute it
-					if (dictionaryValue && ((ESBOOLPropertyMap *)propertyMap).boolTransformBlock)
-						boolPropertyValue = ((ESBOOLPropertyMap *)propertyMap).boolTransformBlock(dictionaryValue);
-					else if (dictionaryValue)
-						boolPropertyValue = [dictionaryValue boolValue];
-					SetPrimitivePropertyValue(object, attributes.setter, &boolPropertyValue);
-					break;
-				}
-				default:
-					break;
-			}
-		}
-	}
+	[[ESObjectMappingPlan mappingPlanForObject:object] configureObject:object withDictionary:dictionary];
+}
+
+NSSet * UpdateObjectWithDictionary(id<ESObject> object, NSDictionary *dictionary)
+{
+	return [[ESObjectMappingPlan mappingPlanForObject:object] updateObject:object withDictionary:dictionary];
 }
 
 NSDictionary * GetDictionaryRepresentation(id<ESObject> object)
@@ -157,35 +73,10 @@ NSDictionary * GetDictionaryRepresentation(id<ESObject> object)
 					else
 						dictionaryValue = propertyValue;
 					break;
-				case IntType:
-				{
-					int result;
-					GetPrimitivePropertyValue(object, attributes.getter, &result);
-					dictionaryValue = [NSNumber numberWithInt:result];
-					break;
-				}
-				case DoubleType:
-				{
-					double result;
-					GetPrimitivePropertyValue(object, attributes.getter, &result);
-					dictionaryValue = [NSNumber numberWithDouble:result];
-					break;
-				}
-				case FloatType:
-				{
-					float result;
-					GetPrimitivePropertyValue(object, attributes.getter, &result);
-					dictionaryValue = [NSNumber numberWithFloat:result];
-					break;
-				}
-				case BoolType:
-				{
-					BOOL result;
-					GetPrimitivePropertyValue(object, attributes.getter, &result);
-					dictionaryValue = [NSNumber numberWithBool:result];
+				case UnsupportedType:
 					break;
-				}
 				default:
+					dictionaryValue = GetScalarPropertyValue(object, attributes.getter, NULL, attributes.storageType);
 					break;
 			}
 			if (dictionaryValue)
@@ -195,6 +86,68 @@ NSDictionary * GetDictionaryRepresentation(id<ESObject> object)
 	return dictionaryRepresentation;
 }
 
+id ObjectWithDictionary(Class objectClass, NSDictionary *dictionary)
+{
+	ESObjectIdentityMap *identityMap = [ESObjectIdentityMap currentIdentityMap];
+	if (identityMap != nil)
+		return [identityMap objectOfClass:objectClass withDictionary:dictionary];
+	return [[objectClass alloc] initWithDictionary:dictionary];
+}
+
+NSMutableArray * ObjectsFromArray(Class objectClass, NSArray *array)
+{
+	NSUInteger count = [array count];
+	NSMutableArray *objects = [[NSMutableArray alloc] initWithCapacity:count];
+	if ((objectClass == nil) || (count == 0))
+		return objects;
+	// Concurrent mapping is opt in, initWithDictionary: may not be thread safe (NSManagedObjects aren't). 
+	// Shared objects would be updated from several chunks at once, and chunks 
+	// mapped on other threads wouldn't see the identity map anyway.
+	BOOL concurrent = ([objectClass respondsToSelector:@selector(mapsArraysConcurrently)] && [objectClass mapsArraysConcurrently]);
+	if (!concurrent || (count < CONCURRENT_MAPPING_THRESHOLD) || ([ESObjectIdentityMap currentIdentityMap] != nil))
+	{
+		for (NSDictionary *dictionary in array)
+		{
+			@autoreleasepool {
+				id member = ObjectWithDictionary(objectClass, dictionary);
+				if (member)
+					[objects addObject:member];
+			}
+		}
+		return objects;
+	}
+	// Each chunk writes its own range of members, so no locking is needed to keep order
+	CFTypeRef *members = (CFTypeRef *)calloc(count, sizeof(CFTypeRef));
+	__block NSException *exception = nil;
+	size_t chunkCount = (count + MAPPING_CHUNK_SIZE - 1) / MAPPING_CHUNK_SIZE;
+	dispatch_apply(chunkCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t chunk) {
+		NSUInteger start = chunk * MAPPING_CHUNK_SIZE;
+		NSUInteger end = MIN(start + MAPPING_CHUNK_SIZE, count);
+		@autoreleasepool {
+			@try {
+				for (NSUInteger i = start; i < end; i++)
+					members[i] = CFBridgingRetain([[objectClass alloc] initWithDictionary:[array objectAtIndex:i]]);
+			}
+			@catch (NSException *chunkException) {
+				// Rethrown on the calling thread, like a serial map would
+				@synchronized(array) {
+					if (exception == nil)
+						exception = chunkException;
+				}
+			}
+		}
+	});
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		if (members[i] != NULL)
+			[objects addObject:CFBridgingRelease(members[i])];
+	}
+	free(members);
+	if (exception)
+		[exception raise];
+	return objects;
+}
+
 static ESMutableDictionary *_objectMapCache;
 
 ESObjectMap * GetObjectMapForClass(Class objectClass)
@@ -213,6 +166,86 @@ ESObjectMap * GetObjectMapForClass(Class objectClass)
 	return objectMap;
 }
 
+static inline IMP MessageSendIMP(PropertyStorageType storageType)
+{
+#if defined(__i386__)
+	// Floating point return values come back on the x87 stack on i386
+	if ((storageType == DoubleType) || (storageType == FloatType))
+		return (IMP)objc_msgSend_fpret;
+#endif
+	return (IMP)objc_msgSend;
+}
+
+NSNumber * GetScalarPropertyValue(id object, SEL getter, IMP getterIMP, PropertyStorageType storageType)
+{
+	if (getterIMP == NULL)
+		getterIMP = MessageSendIMP(storageType);
+	switch (storageType) {
+		case BoolType:
+			return [NSNumber numberWithBool:((BOOL (*)(id, SEL))getterIMP)(object, getter)];
+		case DoubleType:
+			return [NSNumber numberWithDouble:((double (*)(id, SEL))getterIMP)(object, getter)];
+		case FloatType:
+			return [NSNumber numberWithFloat:((float (*)(id, SEL))getterIMP)(object, getter)];
+		case IntType:
+			return [NSNumber numberWithInt:((int (*)(id, SEL))getterIMP)(object, getter)];
+		case UnsignedCharType:
+			return [NSNumber numberWithUnsignedChar:((unsigned char (*)(id, SEL))getterIMP)(object, getter)];
+		case ShortType:
+			return [NSNumber numberWithShort:((short (*)(id, SEL))getterIMP)(object, getter)];
+		case UnsignedShortType:
+			return [NSNumber numberWithUnsignedShort:((unsigned short (*)(id, SEL))getterIMP)(object, getter)];
+		case UnsignedIntType:
+			return [NSNumber numberWithUnsignedInt:((unsigned int (*)(id, SEL))getterIMP)(object, getter)];
+		case LongLongType:
+			return [NSNumber numberWithLongLong:((long long (*)(id, SEL))getterIMP)(object, getter)];
+		case UnsignedLongLongType:
+			return [NSNumber numberWithUnsignedLongLong:((unsigned long long (*)(id, SEL))getterIMP)(object, getter)];
+		default:
+			return nil;
+	}
+}
+
+void SetScalarPropertyValue(id object, SEL setter, IMP setterIMP, PropertyStorageType storageType, id value)
+{
+	if (setterIMP == NULL)
+		setterIMP = (IMP)objc_msgSend;
+	switch (storageType) {
+		case BoolType:
+			((void (*)(id, SEL, BOOL))setterIMP)(object, setter, [value boolValue]);
+			break;
+		case DoubleType:
+			((void (*)(id, SEL, double))setterIMP)(object, setter, [value doubleValue]);
+			break;
+		case FloatType:
+			((void (*)(id, SEL, float))setterIMP)(object, setter, [value floatValue]);
+			break;
+		case IntType:
+			((void (*)(id, SEL, int))setterIMP)(object, setter, [value intValue]);
+			break;
+		case UnsignedCharType:
+			((void (*)(id, SEL, unsigned char))setterIMP)(object, setter, [value unsignedCharValue]);
+			break;
+		case ShortType:
+			((void (*)(id, SEL, short))setterIMP)(object, setter, [value shortValue]);
+			break;
+		case UnsignedShortType:
+			((void (*)(id, SEL, unsigned short))setterIMP)(object, setter, [value unsignedShortValue]);
+			break;
+		case UnsignedIntType:
+			((void (*)(id, SEL, unsigned int))setterIMP)(object, setter, [value unsignedIntValue]);
+			break;
+		case LongLongType:
+			((void (*)(id, SEL, long long))setterIMP)(object, setter, [value longLongValue]);
+			break;
+		case UnsignedLongLongType:
+			((void (*)(id, SEL, unsigned long long))setterIMP)(object, setter, [value unsignedLongLongValue]);
+			break;
+		default:
+			break;
+	}
+}
+
 void GetPrimitivePropertyValue(id object, SEL getter, void * value)
 {
 	NSInvocation *getInvocation = [NSInvocation invocationWithMethodSignature:[object methodSignatureForSelector:getter]];
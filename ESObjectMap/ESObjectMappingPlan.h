@@ -0,0 +1,111 @@
+//
+//  ESObjectMappingPlan.h
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import <Foundation/Foundation.h>
+#import "ESObjectProtocol.h"
+#import "ESDeclaredPropertyAttributes.h"
+
+// One property of a plan. Object references are CF types so steps can live in 
+// a plain C array, the plan owns one reference to each of them.
+typedef struct {
+	CFStringRef outputKey;
+	CFStringRef inputKey;
+	CFArrayRef inputKeyComponents; // NULL when the key path has to go through valueForKeyPath: (collection operators)
+	CFIndex inputKeyComponentCount;
+	const char *inputKeyBytes; // First component of inputKey as UTF-8, for matching keys without making strings
+	size_t inputKeyLength;
+	CFTypeRef propertyMap;
+	__unsafe_unretained Class propertyClass;
+	__unsafe_unretained Class nestedClass; // objectClass of an ESObjectPropertyMap or memberClass of an ESArrayPropertyMap
+	BOOL mapsArray; // nestedClass came from an ESArrayPropertyMap
+	PropertyStorageType storageType;
+	SEL setter;
+	IMP setterIMP; // objc_msgSend for scalar setters that aren't implemented directly or belong to a KVO observed instance, NULL for object ones (KVC)
+	SEL getter;
+	IMP getterIMP; // NULL when the getter isn't implemented directly
+	BOOL readOnly;
+} ESPropertyMappingStep;
+
+// A number read by a decoder, before it's narrowed to a property's storage type
+typedef struct {
+	BOOL isInteger;
+	BOOL isUnsigned; // Integer too large for long long
+	long long integerValue;
+	unsigned long long unsignedValue;
+	double doubleValue;
+} ESScalarValue;
+
+/**
+ * Sets a scalar property through step's setter, converting value the way the NSNumber accessors would
+ */
+void SetScalarStepValue(id object, const ESPropertyMappingStep *step, const ESScalarValue *value);
+
+/**
+ * Immutable, flattened form of a class's declared properties and object map.
+ * 
+ * A plan is compiled once per class and holds, for every property, 
+ * the input key path already split into components, the resolved property 
+ * class and the setter implementation for its storage type, so configuring an 
+ * object doesn't do any lock, string or runtime lookups per property.
+ * 
+ * Instances observed with KVO get a separate plan that sends setters as 
+ * messages, so KVO's overridden setters still post change notifications.
+ * 
+ * Plans are rebuilt automatically when a property map is added to the class's 
+ * object map.
+ */
+
+@interface ESObjectMappingPlan : NSObject
+
+/**
+ * @return The shared plan for [object class], compiled on first use
+ */
++ (ESObjectMappingPlan *)mappingPlanForObject:(id<ESObject>)object;
+
+@property (nonatomic, readonly) Class objectClass;
+@property (nonatomic, readonly) NSUInteger propertyCount;
+
+/**
+ * Same behavior as ConfigureObjectWithDictionary()
+ */
+- (void)configureObject:(id<ESObject>)object withDictionary:(NSDictionary *)dictionary;
+/**
+ * Same behavior as UpdateObjectWithDictionary()
+ */
+- (NSSet *)updateObject:(id<ESObject>)object withDictionary:(NSDictionary *)dictionary;
+
+/**
+ * propertyCount steps, valid for the lifetime of the plan. For decoders that 
+ * produce values some other way than from a dictionary.
+ */
+@property (nonatomic, readonly) const ESPropertyMappingStep *steps;
+/**
+ * @return The value at step's input key path in dictionary
+ */
+- (id)valueForStep:(const ESPropertyMappingStep *)step inDictionary:(NSDictionary *)dictionary;
+/**
+ * Applies a value exactly as configureObject:withDictionary: does once it has found it (NSNull, transform blocks, type checks)
+ */
+- (void)applyDictionaryValue:(id)dictionaryValue toObject:(id<ESObject>)object step:(const ESPropertyMappingStep *)step;
+/**
+ * Sets an already transformed value on an object typed property, checking its class
+ */
+- (void)setPropertyValue:(id)propertyValue ofObject:(id<ESObject>)object step:(const ESPropertyMappingStep *)step;
+
+@end
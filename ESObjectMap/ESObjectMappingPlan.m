@@ -0,0 +1,564 @@
+//
+//  ESObjectMappingPlan.m
+//	
+//  Created by Doug Russell
+//  Copyright (c) 2011 Doug Russell. All rights reserved.
+//  
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//  http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//  
+
+#import "ESObjectMappingPlan.h"
+#import "ESObjectMapFunctions.h"
+#import "NSObject+PropertyDictionary.h"
+#import "ESObjectIdentityMap.h"
+#import <objc/runtime.h>
+#import <objc/message.h>
+#import <libkern/OSAtomic.h>
+
+typedef void (*ESObjectSetterIMP)(id object, SEL setter, id value);
+typedef void (*ESIntSetterIMP)(id object, SEL setter, int value);
+typedef void (*ESDoubleSetterIMP)(id object, SEL setter, double value);
+typedef void (*ESFloatSetterIMP)(id object, SEL setter, float value);
+typedef void (*ESBOOLSetterIMP)(id object, SEL setter, BOOL value);
+
+static CFMutableDictionaryRef _planCache; // Class -> plan
+static CFMutableDictionaryRef _messagingPlanCache; // Class -> plan for instances with a KVO subclass
+static OSSpinLock _planCacheLock = OS_SPINLOCK_INIT;
+static Class _dictionaryClass;
+static Class _arrayClass;
+
+static CFArrayRef CreateInputKeyComponents(NSString *inputKey, CFIndex *count)
+{
+	*count = 0;
+	if ([inputKey rangeOfString:@"@"].location != NSNotFound)
+		return NULL;
+	NSArray *components = [inputKey componentsSeparatedByString:@"."];
+	*count = (CFIndex)[components count];
+	return (CFArrayRef)CFBridgingRetain(components);
+}
+
+static inline id ValueForMappingStep(NSDictionary *dictionary, const ESPropertyMappingStep *step)
+{
+	if (step->inputKeyComponents == NULL)
+		return [dictionary valueForKeyPath:(__bridge NSString *)step->inputKey];
+	// Same result as valueForKeyPath: without splitting the key path for every object
+	id value = dictionary;
+	for (CFIndex i = 0; (i < step->inputKeyComponentCount) && (value != nil); i++)
+	{
+		NSString *key = (__bridge NSString *)CFArrayGetValueAtIndex(step->inputKeyComponents, i);
+		if ([value isKindOfClass:_dictionaryClass])
+			value = [(NSDictionary *)value objectForKey:key];
+		else
+			value = [value valueForKey:key];
+	}
+	return value;
+}
+
+static void SetObjectPropertyValue(id<ESObject> object, const ESPropertyMappingStep *step, id propertyValue)
+{
+	if (propertyValue && (step->storageType == ObjectType) && ![propertyValue isKindOfClass:step->propertyClass])
+		[NSException raise:@"Class Mismatch" format:@"Object: %@ is not kind of class: %@", propertyValue, NSStringFromClass(step->propertyClass)];
+	if (step->setterIMP != NULL)
+		((ESObjectSetterIMP)step->setterIMP)(object, step->setter, propertyValue);
+	else
+		[object setValue:propertyValue forKey:(__bridge NSString *)step->outputKey];
+}
+
+// The storage types without a transform block of their own take the one of the 
+// typed property map for their family, nil if there is none
+static NSNumber * TypedTransformValue(ESPropertyMap *propertyMap, id dictionaryValue)
+{
+	if ([propertyMap isKindOfClass:[ESIntPropertyMap class]] && ((ESIntPropertyMap *)propertyMap).intTransformBlock)
+		return [NSNumber numberWithInt:((ESIntPropertyMap *)propertyMap).intTransformBlock(dictionaryValue)];
+	if ([propertyMap isKindOfClass:[ESDoublePropertyMap class]] && ((ESDoublePropertyMap *)propertyMap).doubleTransformBlock)
+		return [NSNumber numberWithDouble:((ESDoublePropertyMap *)propertyMap).doubleTransformBlock(dictionaryValue)];
+	if ([propertyMap isKindOfClass:[ESFloatPropertyMap class]] && ((ESFloatPropertyMap *)propertyMap).floatTransformBlock)
+		return [NSNumber numberWithFloat:((ESFloatPropertyMap *)propertyMap).floatTransformBlock(dictionaryValue)];
+	return nil;
+}
+
+// Value of the property primaryKeyInputKey maps to, nil if there isn't one
+static id PrimaryKeyOfObject(id<ESObject> object, NSString *primaryKeyInputKey)
+{
+	ESObjectMappingPlan *plan = [ESObjectMappingPlan mappingPlanForObject:object];
+	const ESPropertyMappingStep *steps = plan.steps;
+	for (NSUInteger i = 0; i < plan.propertyCount; i++)
+	{
+		const ESPropertyMappingStep *step = &steps[i];
+		if (![(__bridge NSString *)step->inputKey isEqualToString:primaryKeyInputKey])
+			continue;
+		if ((step->storageType == IDType) || (step->storageType == ObjectType))
+			return [object valueForKey:(__bridge NSString *)step->outputKey];
+		if (step->storageType == UnsupportedType)
+			return nil;
+		return GetScalarPropertyValue(object, step->getter, step->getterIMP, step->storageType);
+	}
+	return nil;
+}
+
+static id PrimaryKeyOfDictionary(NSDictionary *dictionary, NSString *primaryKeyInputKey)
+{
+	id primaryKey = [dictionary valueForKeyPath:primaryKeyInputKey];
+	return (primaryKey == [NSNull null]) ? nil : primaryKey;
+}
+
+// An existing model object only stands for the one a dictionary describes if 
+// its class has a primary key and both have the same value for it, anything 
+// else could update one object with another's values
+static BOOL ObjectMatchesDictionary(id<ESObject> object, NSDictionary *dictionary, NSString *primaryKeyInputKey)
+{
+	if (primaryKeyInputKey == nil)
+		return NO;
+	id primaryKey = PrimaryKeyOfDictionary(dictionary, primaryKeyInputKey);
+	return ((primaryKey != nil) && [primaryKey isEqual:PrimaryKeyOfObject(object, primaryKeyInputKey)]);
+}
+
+// Maps an array of dictionaries to members of memberClass, reusing the members 
+// of currentValue with the same primary key and updating them in place, new 
+// instances are made for the rest. *membersChanged is set if a reused member 
+// changed, *arrayChanged if the result doesn't hold exactly the members of 
+// currentValue in the same order. Returns nil without touching anything if 
+// memberClass has no primary key or the arrays hold anything else.
+static NSMutableArray * UpdateArrayByPrimaryKey(NSArray *currentValue, NSArray *dictionaryValue, Class memberClass, BOOL *membersChanged, BOOL *arrayChanged)
+{
+	NSString *primaryKeyInputKey = [[memberClass objectMap] primaryKeyInputKey];
+	if (primaryKeyInputKey == nil)
+		return nil;
+	NSMutableDictionary *membersByPrimaryKey = [[NSMutableDictionary alloc] initWithCapacity:[currentValue count]];
+	for (id member in currentValue)
+	{
+		if (![member isKindOfClass:memberClass])
+			return nil;
+		id primaryKey = PrimaryKeyOfObject(member, primaryKeyInputKey);
+		// Duplicates are left to be replaced
+		if ((primaryKey != nil) && ([membersByPrimaryKey objectForKey:primaryKey] == nil))
+			[membersByPrimaryKey setObject:member forKey:primaryKey];
+	}
+	for (id dictionary in dictionaryValue)
+	{
+		if (![dictionary isKindOfClass:_dictionaryClass])
+			return nil;
+	}
+	NSMutableArray *members = [[NSMutableArray alloc] initWithCapacity:[dictionaryValue count]];
+	BOOL changed = NO;
+	for (NSDictionary *dictionary in dictionaryValue)
+	{
+		@autoreleasepool {
+			id primaryKey = PrimaryKeyOfDictionary(dictionary, primaryKeyInputKey);
+			id member = (primaryKey != nil) ? [membersByPrimaryKey objectForKey:primaryKey] : nil;
+			if (member != nil)
+			{
+				// Each member is only reused once
+				[membersByPrimaryKey removeObjectForKey:primaryKey];
+				if ([[[ESObjectMappingPlan mappingPlanForObject:member] updateObject:member withDictionary:dictionary] count] > 0)
+					changed = YES;
+			}
+			else
+			{
+				member = ObjectWithDictionary(memberClass, dictionary);
+			}
+			if (member)
+				[members addObject:member];
+		}
+	}
+	*membersChanged = changed;
+	// Identity rather than isEqual:, a new instance equal to the one it replaces still has to be set
+	*arrayChanged = ([members count] != [currentValue count]);
+	for (NSUInteger i = 0; !*arrayChanged && (i < [members count]); i++)
+		*arrayChanged = ([members objectAtIndex:i] != [currentValue objectAtIndex:i]);
+	return members;
+}
+
+// Returns NO if onlyIfChanged is set and the property already had the value, 
+// in which case the setter isn't called. Properties without a directly 
+// implemented getter are always treated as changed.
+static BOOL ApplyDictionaryValue(Class objectClass, id<ESObject> object, const ESPropertyMappingStep *step, id dictionaryValue, BOOL onlyIfChanged)
+{
+	if (dictionaryValue == [NSNull null])
+		dictionaryValue = nil;
+	// At this point we have a value (or nil) to work with, so let's make sure we can actually set it
+	if (step->readOnly)
+		[NSException raise:@"Readonly Exception" format:@"Attempted to set a readonly property: %@", [[objectClass propertyDictionary] objectForKey:(__bridge NSString *)step->outputKey]];
+	BOOL compare = (onlyIfChanged && (step->getterIMP != NULL));
+	ESPropertyMap *propertyMap = (__bridge ESPropertyMap *)step->propertyMap;
+	switch (step->storageType) {
+		case IDType:
+		case ObjectType:
+		{
+			id currentValue = compare ? ((id (*)(id, SEL))step->getterIMP)(object, step->getter) : nil;
+			// Update nested model objects in place rather than replacing them with new ones that are never equal, 
+			// as long as the dictionary has the same primary key. 
+			// Shared objects are left to the identity map, the dictionary may identify a different one.
+			if (compare && (step->nestedClass != Nil) && ![[ESObjectIdentityMap currentIdentityMap] sharesObjectsOfClass:step->nestedClass])
+			{
+				if (!step->mapsArray && [currentValue isKindOfClass:step->nestedClass] && [dictionaryValue isKindOfClass:_dictionaryClass] && 
+					ObjectMatchesDictionary(currentValue, dictionaryValue, [[step->nestedClass objectMap] primaryKeyInputKey]))
+					return ([[[ESObjectMappingPlan mappingPlanForObject:currentValue] updateObject:currentValue withDictionary:dictionaryValue] count] > 0);
+				// Arrays are only replaced when members are added, removed or reordered
+				if (step->mapsArray && [currentValue isKindOfClass:_arrayClass] && [dictionaryValue isKindOfClass:_arrayClass])
+				{
+					BOOL membersChanged;
+					BOOL arrayChanged;
+					NSMutableArray *members = UpdateArrayByPrimaryKey(currentValue, dictionaryValue, step->nestedClass, &membersChanged, &arrayChanged);
+					if ((members != nil) && !arrayChanged)
+						return membersChanged;
+					if (members != nil)
+					{
+						SetObjectPropertyValue(object, step, members);
+						return YES;
+					}
+				}
+			}
+			id propertyValue;
+			// If there's a transform block, execute it
+			if (dictionaryValue && propertyMap.transformBlock)
+				propertyValue = propertyMap.transformBlock(object, dictionaryValue);
+			else
+				propertyValue = dictionaryValue;
+			if (compare && ((currentValue == propertyValue) || [currentValue isEqual:propertyValue]))
+				return NO;
+			SetObjectPropertyValue(object, step, propertyValue);
+			return YES;
+		}
+		case IntType:
+		{
+			int intPropertyValue = 0;
+			// If there's a transform block, execute it
+			if (dictionaryValue && ((ESIntPropertyMap *)propertyMap).intTransformBlock)
+				intPropertyValue = ((ESIntPropertyMap *)propertyMap).intTransformBlock(dictionaryValue);
+			else if (dictionaryValue)
+				intPropertyValue = [dictionaryValue intValue];
+			if (compare && (((int (*)(id, SEL))step->getterIMP)(object, step->getter) == intPropertyValue))
+				return NO;
+			((ESIntSetterIMP)step->setterIMP)(object, step->setter, intPropertyValue);
+			return YES;
+		}
+		case DoubleType:
+		{
+			double doublePropertyValue = 0.0;
+			// If there's a transform block, execute it
+			if (dictionaryValue && ((ESDoublePropertyMap *)propertyMap).doubleTransformBlock)
+				doublePropertyValue = ((ESDoublePropertyMap *)propertyMap).doubleTransformBlock(dictionaryValue);
+			else if (dictionaryValue)
+				doublePropertyValue = [dictionaryValue doubleValue];
+			if (compare && (((double (*)(id, SEL))step->getterIMP)(object, step->getter) == doublePropertyValue))
+				return NO;
+			((ESDoubleSetterIMP)step->setterIMP)(object, step->setter, doublePropertyValue);
+			return YES;
+		}
+		case FloatType:
+		{
+			float floatPropertyValue = 0.0f;
+			// If there's a transform block, execute it
+			if (dictionaryValue && ((ESFloatPropertyMap *)propertyMap).floatTransformBlock)
+				floatPropertyValue = ((ESFloatPropertyMap *)propertyMap).floatTransformBlock(dictionaryValue);
+			else if (dictionaryValue)
+				floatPropertyValue = [dictionaryValue floatValue];
+			if (compare && (((float (*)(id, SEL))step->getterIMP)(object, step->getter) == floatPropertyValue))
+				return NO;
+			((ESFloatSetterIMP)step->setterIMP)(object, step->setter, floatPropertyValue);
+			return YES;
+		}
+		case BoolType:
+		{
+			BOOL boolPropertyValue = NO;
+			// If there's a transform block, execute it
+			if (dictionaryValue && ((ESBOOLPropertyMap *)propertyMap).boolTransformBlock)
+				boolPropertyValue = ((ESBOOLPropertyMap *)propertyMap).boolTransformBlock(dictionaryValue);
+			else if (dictionaryValue)
+				boolPropertyValue = [dictionaryValue boolValue];
+			if (compare && ((((BOOL (*)(id, SEL))step->getterIMP)(object, step->getter) != NO) == (boolPropertyValue != NO)))
+				return NO;
+			((ESBOOLSetterIMP)step->setterIMP)(object, step->setter, boolPropertyValue);
+			return YES;
+		}
+		case UnsignedCharType:
+		case ShortType:
+		case UnsignedShortType:
+		case UnsignedIntType:
+		case LongLongType:
+		case UnsignedLongLongType:
+		{
+			// An ESIntPropertyMap, ESDoublePropertyMap or ESFloatPropertyMap block is narrowed like any 
+			// other number, a plain transform block returns an NSNumber
+			id scalarValue = nil;
+			if (dictionaryValue)
+				scalarValue = TypedTransformValue(propertyMap, dictionaryValue);
+			if (scalarValue == nil)
+			{
+				if (dictionaryValue && propertyMap.transformBlock)
+					scalarValue = propertyMap.transformBlock(object, dictionaryValue);
+				else
+					scalarValue = dictionaryValue;
+			}
+			if (compare)
+			{
+				// Compared at full width, a value that gets truncated by the setter just counts as changed
+				NSNumber *currentValue = GetScalarPropertyValue(object, step->getter, step->getterIMP, step->storageType);
+				BOOL unchanged;
+				if ((step->storageType == LongLongType) || (step->storageType == ShortType))
+					unchanged = ([currentValue longLongValue] == [scalarValue longLongValue]);
+				else
+					unchanged = ([currentValue unsignedLongLongValue] == [scalarValue unsignedLongLongValue]);
+				if (unchanged)
+					return NO;
+			}
+			SetScalarPropertyValue(object, step->setter, step->setterIMP, step->storageType, scalarValue);
+			return YES;
+		}
+		default:
+			return NO;
+	}
+}
+
+// Same conversions as the NSNumber accessors SetScalarPropertyValue() uses
+void SetScalarStepValue(id object, const ESPropertyMappingStep *step, const ESScalarValue *value)
+{
+	IMP setterIMP = step->setterIMP;
+	SEL setter = step->setter;
+	long long integerValue;
+	unsigned long long unsignedValue;
+	if (value->isInteger)
+	{
+		integerValue = value->integerValue;
+		unsignedValue = (unsigned long long)value->integerValue;
+	}
+	else if (value->isUnsigned)
+	{
+		integerValue = (long long)value->unsignedValue;
+		unsignedValue = value->unsignedValue;
+	}
+	else
+	{
+		integerValue = (long long)value->doubleValue;
+		unsignedValue = (unsigned long long)value->doubleValue;
+	}
+	switch (step->storageType) {
+		case BoolType:
+			((void (*)(id, SEL, BOOL))setterIMP)(object, setter, (value->isInteger || value->isUnsigned) ? (unsignedValue != 0) : (value->doubleValue != 0.0));
+			break;
+		case DoubleType:
+			((void (*)(id, SEL, double))setterIMP)(object, setter, value->doubleValue);
+			break;
+		case FloatType:
+			((void (*)(id, SEL, float))setterIMP)(object, setter, (float)value->doubleValue);
+			break;
+		case IntType:
+			((void (*)(id, SEL, int))setterIMP)(object, setter, (int)integerValue);
+			break;
+		case UnsignedCharType:
+			((void (*)(id, SEL, unsigned char))setterIMP)(object, setter, (unsigned char)integerValue);
+			break;
+		case ShortType:
+			((void (*)(id, SEL, short))setterIMP)(object, setter, (short)integerValue);
+			break;
+		case UnsignedShortType:
+			((void (*)(id, SEL, unsigned short))setterIMP)(object, setter, (unsigned short)integerValue);
+			break;
+		case UnsignedIntType:
+			((void (*)(id, SEL, unsigned int))setterIMP)(object, setter, (unsigned int)integerValue);
+			break;
+		case LongLongType:
+			((void (*)(id, SEL, long long))setterIMP)(object, setter, integerValue);
+			break;
+		case UnsignedLongLongType:
+			((void (*)(id, SEL, unsigned long long))setterIMP)(object, setter, unsignedValue);
+			break;
+		default:
+			break;
+	}
+}
+
+@interface ESObjectMappingPlan ()
+- (id)initWithObjectClass:(Class)objectClass cachesSetters:(BOOL)cachesSetters;
+@end
+
+@implementation ESObjectMappingPlan
+{
+	ESObjectMap *_objectMap;
+	int32_t _mapVersion;
+	ESPropertyMappingStep *_steps;
+}
+@synthesize objectClass=_objectClass;
+@synthesize propertyCount=_propertyCount;
+
++ (void)initialize
+{
+	if (self == [ESObjectMappingPlan class])
+	{
+		_planCache = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+		_messagingPlanCache = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+		_dictionaryClass = [NSDictionary class];
+		_arrayClass = [NSArray class];
+	}
+}
+
++ (ESObjectMappingPlan *)mappingPlanForObject:(id<ESObject>)object
+{
+	if (object == nil)
+		return nil;
+	Class objectClass = [object class];
+	// Observed instances are isa-swizzled to a KVO subclass that overrides the setters to send 
+	// change notifications, a setter IMP cached from objectClass would skip them. KVO subclasses 
+	// come and go with observers, so instead of compiling a plan per subclass those instances 
+	// get a plan that always sends setters as messages.
+	CFMutableDictionaryRef cache = (object_getClass(object) == objectClass) ? _planCache : _messagingPlanCache;
+	OSSpinLockLock(&_planCacheLock);
+	ESObjectMappingPlan *plan = (__bridge ESObjectMappingPlan *)CFDictionaryGetValue(cache, (__bridge const void *)objectClass);
+	OSSpinLockUnlock(&_planCacheLock);
+	if ((plan != nil) && (plan->_mapVersion == [plan->_objectMap version]))
+		return plan;
+	// Compiled outside of the lock, racing threads just compile the same plan twice
+	plan = [[ESObjectMappingPlan alloc] initWithObjectClass:objectClass cachesSetters:(cache == _planCache)];
+	OSSpinLockLock(&_planCacheLock);
+	CFDictionarySetValue(cache, (__bridge const void *)objectClass, (__bridge const void *)plan);
+	OSSpinLockUnlock(&_planCacheLock);
+	return plan;
+}
+
+- (id)initWithObjectClass:(Class)objectClass cachesSetters:(BOOL)cachesSetters
+{
+	self = [super init];
+	if (self)
+	{
+		_objectClass = objectClass;
+		_objectMap = [objectClass objectMap];
+		// Read before the property maps so a map that changes while compiling triggers another compile
+		_mapVersion = [_objectMap version];
+		NSDictionary *propertyDictionary = [objectClass propertyDictionary];
+		_steps = (ESPropertyMappingStep *)calloc(MAX([propertyDictionary count], 1), sizeof(ESPropertyMappingStep));
+		for (ESDeclaredPropertyAttributes *attributes in [propertyDictionary allValues])
+		{
+			NSString *outputKey = attributes.name;
+			if (outputKey == nil)
+				continue;
+			// Get the property map, if it exists
+			ESPropertyMap *propertyMap = [_objectMap propertyMapForOutputKey:outputKey];
+			// If there's no property map, then assume inputKey simply maps to outputKey
+			NSString *inputKey = (propertyMap == nil) ? outputKey : propertyMap.inputKey;
+			if (inputKey == nil)
+				continue;
+			ESPropertyMappingStep *step = &_steps[_propertyCount++];
+			step->outputKey = (CFStringRef)CFBridgingRetain(outputKey);
+			step->inputKey = (CFStringRef)CFBridgingRetain(inputKey);
+			step->inputKeyComponents = CreateInputKeyComponents(inputKey, &step->inputKeyComponentCount);
+			step->propertyMap = CFBridgingRetain(propertyMap);
+			NSRange dotRange = [inputKey rangeOfString:@"."];
+			const char *firstKey = [((dotRange.location == NSNotFound) ? inputKey : [inputKey substringToIndex:dotRange.location]) UTF8String];
+			step->inputKeyLength = strlen(firstKey);
+			step->inputKeyBytes = strdup(firstKey);
+			if ([propertyMap isKindOfClass:[ESObjectPropertyMap class]])
+				step->nestedClass = ((ESObjectPropertyMap *)propertyMap).objectClass;
+			else if ([propertyMap isKindOfClass:[ESArrayPropertyMap class]])
+			{
+				step->nestedClass = ((ESArrayPropertyMap *)propertyMap).memberClass;
+				step->mapsArray = YES;
+			}
+			if (attributes.storageType == ObjectType)
+				step->propertyClass = NSClassFromString(attributes.classString);
+			step->storageType = attributes.storageType;
+			step->readOnly = attributes.readOnly;
+			step->setter = attributes.setter;
+			// class_respondsToSelector gives dynamic properties (Core Data) a chance to resolve first
+			if (cachesSetters && (step->setter != NULL) && class_respondsToSelector(objectClass, step->setter))
+			{
+				IMP setterIMP = class_getMethodImplementation(objectClass, step->setter);
+				if (setterIMP != _objc_msgForward)
+					step->setterIMP = setterIMP;
+			}
+			step->getter = attributes.getter;
+			// KVO doesn't override getters, they're cached either way
+			if ((step->getter != NULL) && class_respondsToSelector(objectClass, step->getter))
+			{
+				IMP getterIMP = class_getMethodImplementation(objectClass, step->getter);
+				if (getterIMP != _objc_msgForward)
+					step->getterIMP = getterIMP;
+			}
+			// Scalar setters that aren't implemented directly are sent as normal messages, objects fall back to KVC
+			if ((step->setterIMP == NULL) && (step->setter != NULL) && (step->storageType != IDType) && (step->storageType != ObjectType))
+				step->setterIMP = (IMP)objc_msgSend;
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	for (NSUInteger i = 0; i < _propertyCount; i++)
+	{
+		ESPropertyMappingStep *step = &_steps[i];
+		CFRelease(step->outputKey);
+		CFRelease(step->inputKey);
+		free((void *)step->inputKeyBytes);
+		if (step->inputKeyComponents != NULL)
+			CFRelease(step->inputKeyComponents);
+		if (step->propertyMap != NULL)
+			CFRelease(step->propertyMap);
+	}
+	free(_steps);
+}
+
+- (const ESPropertyMappingStep *)steps
+{
+	return _steps;
+}
+
+- (void)configureObject:(id<ESObject>)object withDictionary:(NSDictionary *)dictionary
+{
+	for (NSUInteger i = 0; i < _propertyCount; i++)
+	{
+		@autoreleasepool {
+			const ESPropertyMappingStep *step = &_steps[i];
+			// Grab our value from the input dictionary
+			id dictionaryValue = ValueForMappingStep(dictionary, step);
+			if (dictionaryValue == nil)
+				continue;
+			ApplyDictionaryValue(_objectClass, object, step, dictionaryValue, NO);
+		}
+	}
+}
+
+- (NSSet *)updateObject:(id<ESObject>)object withDictionary:(NSDictionary *)dictionary
+{
+	NSMutableSet *changedKeys = [NSMutableSet new];
+	for (NSUInteger i = 0; i < _propertyCount; i++)
+	{
+		@autoreleasepool {
+			const ESPropertyMappingStep *step = &_steps[i];
+			// Grab our value from the input dictionary
+			id dictionaryValue = ValueForMappingStep(dictionary, step);
+			if (dictionaryValue == nil)
+				continue;
+			if (ApplyDictionaryValue(_objectClass, object, step, dictionaryValue, YES))
+				[changedKeys addObject:(__bridge NSString *)step->outputKey];
+		}
+	}
+	return changedKeys;
+}
+
+- (id)valueForStep:(const ESPropertyMappingStep *)step inDictionary:(NSDictionary *)dictionary
+{
+	return ValueForMappingStep(dictionary, step);
+}
+
+- (void)applyDictionaryValue:(id)dictionaryValue toObject:(id<ESObject>)object step:(const ESPropertyMappingStep *)step
+{
+	ApplyDictionaryValue(_objectClass, object, step, dictionaryValue, NO);
+}
+
+- (void)setPropertyValue:(id)propertyValue ofObject:(id<ESObject>)object step:(const ESPropertyMappingStep *)step
+{
+	SetObjectPropertyValue(object, step, propertyValue);
+}
+
+@end
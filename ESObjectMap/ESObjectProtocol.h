@@ -29,4 +29,11 @@
 - (id)valueForKey:(NSString *)key;
 - (void)setValue:(id)value forKey:(NSString *)key;
 
+@optional
+/**
+ * @return Names of the properties that changed
+ * @see UpdateObjectWithDictionary
+ */
+- (NSSet *)updateWithDictionary:(NSDictionary *)dictionary;
+
 @end
@@ -32,6 +32,11 @@
 	ConfigureObjectWithDictionary(self, dictionary);
 }
 
+- (NSSet *)updateWithDictionary:(NSDictionary *)dictionary
+{
+	return UpdateObjectWithDictionary(self, dictionary);
+}
+
 - (NSDictionary *)dictionaryRepresentation
 {
 	return GetDictionaryRepresentation(self);
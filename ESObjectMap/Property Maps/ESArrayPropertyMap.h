@@ -22,6 +22,11 @@
 @interface ESArrayPropertyMap : ESPropertyMap
 
 @property (strong, nonatomic) Class memberClass;
+/**
+ * NO once inverseTransformBlock has been replaced. ESObjectJSONEncoder writes 
+ * memberClass instances directly only while the default block is in place.
+ */
+@property (nonatomic, readonly) BOOL hasDefaultInverseTransformBlock;
 
 + (id)newPropertyMapWithInputKey:(NSString *)inputKey outputKey:(NSString *)outputKey memberClass:(Class)memberClass;
 - (id)initWithInputKey:(NSString *)inputKey outputKey:(NSString *)outputKey memberClass:(Class)memberClass;
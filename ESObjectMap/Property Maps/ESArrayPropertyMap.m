@@ -18,8 +18,12 @@
 //  
 
 #import "ESArrayPropertyMap.h"
+#import "ESObjectMapFunctions.h"
 
 @implementation ESArrayPropertyMap
+{
+	ESTransformBlock _defaultInverseTransformBlock;
+}
 @synthesize memberClass=_memberClass;
 
 + (id)newPropertyMapWithInputKey:(NSString *)inputKey outputKey:(NSString *)outputKey memberClass:(Class)memberClass
@@ -34,16 +38,8 @@
 	{
 		self.memberClass = memberClass;
 		self.transformBlock = ^id (id<ESObject> object, id inputValue) {
-			NSMutableArray *outArray = [NSMutableArray new];
-			for (NSDictionary *dictionary in (NSArray *)inputValue)
-			{
-				@autoreleasepool {
-					id member = [[memberClass alloc] initWithDictionary:dictionary];
-					if (member)
-						[outArray addObject:member];
-				}
-			}
-			return outArray;
+			// Maps concurrently once the array is long enough, if memberClass opts in
+			return ObjectsFromArray(memberClass, (NSArray *)inputValue);
 		};
 		self.inverseTransformBlock = ^id (id<ESObject> object, id inputValue) {
 			NSMutableArray *dictionaryArray = [NSMutableArray new];
@@ -55,8 +51,14 @@
 			}
 			return dictionaryArray;
 		};
+		_defaultInverseTransformBlock = self.inverseTransformBlock;
 	}
 	return self;
 }
 
+- (BOOL)hasDefaultInverseTransformBlock
+{
+	return (self.inverseTransformBlock == _defaultInverseTransformBlock);
+}
+
 @end
@@ -22,6 +22,11 @@
 @interface ESObjectPropertyMap : ESPropertyMap
 
 @property (strong, nonatomic) Class objectClass;
+/**
+ * NO once inverseTransformBlock has been replaced. ESObjectJSONEncoder writes 
+ * objectClass instances directly only while the default block is in place.
+ */
+@property (nonatomic, readonly) BOOL hasDefaultInverseTransformBlock;
 
 + (id)newPropertyMapWithInputKey:(NSString *)inputKey outputKey:(NSString *)outputKey objectClass:(Class)objectClass;
 - (id)initWithInputKey:(NSString *)inputKey outputKey:(NSString *)outputKey objectClass:(Class)objectClass;
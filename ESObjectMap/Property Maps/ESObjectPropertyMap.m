@@ -18,8 +18,12 @@
 //  
 
 #import "ESObjectPropertyMap.h"
+#import "ESObjectMapFunctions.h"
 
 @implementation ESObjectPropertyMap
+{
+	ESTransformBlock _defaultInverseTransformBlock;
+}
 @synthesize objectClass=_objectClass;
 
 + (id)newPropertyMapWithInputKey:(NSString *)inputKey outputKey:(NSString *)outputKey objectClass:(Class)objectClass
@@ -34,12 +38,19 @@
 	{
 		self.objectClass = objectClass;
 		self.transformBlock = ^id (id<ESObject> object, id inputValue) {
-			return [[objectClass alloc] initWithDictionary:inputValue];
+			// Shared with other references through the current identity map, if there is one
+			return ObjectWithDictionary(objectClass, inputValue);
 		};
 		self.inverseTransformBlock = ^id (id<ESObject> object, id inputValue) {
 			return [inputValue dictionaryRepresentation];
 		};
+		_defaultInverseTransformBlock = self.inverseTransformBlock;
 	}
 	return self;
 }
+
+- (BOOL)hasDefaultInverseTransformBlock
+{
+	return (self.inverseTransformBlock == _defaultInverseTransformBlock);
+}
 @end
@@ -32,10 +32,16 @@ typedef enum
 {
 	IDType,
 	ObjectType,
-	BoolType, // We assume that chars are BOOLs
+	BoolType, // We assume that chars are BOOLs, C++ bool/_Bool are stored the same way
 	DoubleType,
 	FloatType,
-	IntType,
+	IntType, // Also 32 bit long
+	UnsignedCharType,
+	ShortType,
+	UnsignedShortType,
+	UnsignedIntType, // Also 32 bit unsigned long
+	LongLongType, // Also long on 64 bit
+	UnsignedLongLongType, // Also unsigned long on 64 bit
 	UnsupportedType
 } PropertyStorageType;
 
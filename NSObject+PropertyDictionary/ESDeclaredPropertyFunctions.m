@@ -93,6 +93,7 @@ ESDeclaredPropertyAttributes * CreatePropertyAttributes(objc_property_t property
 						break;
 					}
 					case 'c':
+					case 'B':
 						storageType = BoolType;
 						break;
 					case 'd':
@@ -102,8 +103,28 @@ ESDeclaredPropertyAttributes * CreatePropertyAttributes(objc_property_t property
 						storageType = FloatType;
 						break;
 					case 'i':
+					case 'l': // long is always encoded as 32 bit, 64 bit longs are encoded as q
 						storageType = IntType;
 						break;
+					case 'C':
+						storageType = UnsignedCharType;
+						break;
+					case 's':
+						storageType = ShortType;
+						break;
+					case 'S':
+						storageType = UnsignedShortType;
+						break;
+					case 'I':
+					case 'L':
+						storageType = UnsignedIntType;
+						break;
+					case 'q':
+						storageType = LongLongType;
+						break;
+					case 'Q':
+						storageType = UnsignedLongLongType;
+						break;
 					default:
 						storageType = UnsupportedType;
 						break;